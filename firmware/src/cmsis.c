@@ -13,1126 +13,170 @@
  * for more details.
  * This program is distributed WITHOUT ANY WARRANTY.
  */
+#include <string.h>
 #include "pico/stdlib.h"
-#include "ios.h"
-#include "jtag.h"
+#include "pico/multicore.h"
+#include "dap.h"
+#include "dap_queue.h"
 #include "log.h"
 #include "cmsis.h"
-#include "swd.h"
 #include "usb.h"
 
 #ifdef USE_CMSIS
 #undef  DEBUG_CMSIS
 #undef  DEBUG_CMSIS_USB
 
-#define RX_SIZE 256
+/* Max packet size of the bulk endpoints */
+#define DAP_EP_SIZE      64
 
-static uint8_t  cmsis_mode;
-static uint16_t cmsis_clock;
 /* USB and communication buffers */
 static uint8_t ep_in_n;
 static uint8_t ep_out_n;
-static uint8_t rx_buffer[RX_SIZE];
-static uint8_t tx_buffer[256];
-
-static void dap_init(void);
+/* Queue of DAP packets between USB (core0) and DAP engine (core1) */
+static dap_queue dap_q;
+static uint q_rx_armed;
+static uint q_tx_busy;
+static uint q_drop;
+/* Parts of a long response (from DAP engine) */
+static u8   q_stream_buf[DAP_PACKET_SIZE];
+static u8  *q_stream_rsp; /* Response buffer of the slot in execution */
+static u8  *q_stream_ptr;
+static uint q_stream;     /* 0:free 1:ready (DAP engine) 2:sending (USB) */
+static uint q_stream_parts; /* Parts sent for the request in execution */
+
+static void dap_core1(void);
+static int  dap_stream(cmsis_pkt *pkt);
+static void dap_task(void);
+static void queue_flush(void);
+static void queue_rx_arm(uint8_t rhport);
+static void queue_tx_start(uint8_t rhport);
 
 /**
  * @brief Initialize the "cmsis" module
  *
  * This function initialize the cmsis module and configure IOs of the debug
- * port for SWD signals. For this module to work properly, this function must
- * be called before any other cmsis functions.
+ * port for SWD signals, then start the DAP engine on core1. For this module
+ * to work properly, this function must be called before any other cmsis
+ * functions, and from core0 (USB and UART interrupts stay on core0).
  */
 void cmsis_init(void)
 {
 	log_puts("CMSIS: Initialization\r\n");
-	cmsis_mode  = 0; // 0:Unused 1:SWD 2:JTAG
-	cmsis_clock = 0;
 	dap_init();
-}
-
-/* -------------------------------------------------------------------------- */
-/* --                             DAP commands                             -- */
-/* -------------------------------------------------------------------------- */
-
-static inline int dap_connect(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_delay(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_disconnect(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_host_status(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_info(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_info_cap(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_jtag_sequence(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_reset_target(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_swd_configure(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_swd_sequence(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_swj_clock(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_swj_pins(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_swj_sequence(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_transfer(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_transfer_configure(cmsis_pkt *req, cmsis_pkt *rsp);
-static inline int dap_write_abort(cmsis_pkt *req, cmsis_pkt *rsp);
-
-static int  dap_data_phase;
-static int  dap_idle_cycles;
-static int  dap_retry_wait;
-static int  dap_retry_match;
-static int  dap_ta_period;
-static char str_serial[]  = "12345678";
-static char str_version[] = "1.0";
-
-/**
- * @brief Initialize DAP submodule
- *
- * This function is used to initialize the DAP component of the CMSIS
- * module (mainly internal variables). For the DAP to work properly, this
- * function must be called before any use of DAP.
- */
-static void dap_init(void)
-{
-	dap_data_phase  = 0;
-	dap_idle_cycles = 0;
-	dap_retry_wait  = 16;
-	dap_retry_match = 0;
-	dap_ta_period   = 0;
-}
-
-/**
- * @brief Process an incoming CMSIS-DAP packet
- *
- * @param rx  Point to a buffer with received packet
- * @param len Number of bytes into received packet
- */
-void dap_recv(uint8_t *rx, uint16_t len)
-{
-	cmsis_pkt req, rsp;
-	int result = 1;
-	int i;
-
-	req.buffer = rx;
-	req.len    = len;
-	rsp.buffer = tx_buffer;
-	rsp.len    = 0;
-
-	rsp.buffer[0] = req.buffer[0];
-
-	switch(req.buffer[0])
-	{
-		/* == General Commands == */
-
-		/* DAP_Info */
-		case 0x00:
-			result = dap_info(&req, &rsp);
-			break;
-		/* DAP_HostStatus */
-		case 0x01:
-			result = dap_host_status(&req, &rsp);
-			break;
-		/* DAP_Connect */
-		case 0x02:
-			result = dap_connect(&req, &rsp);
-			break;
-		/* DAP_Disconnect */
-		case 0x03:
-			result = dap_disconnect(&req, &rsp);
-			break;
-		/* DAP_WriteABORT */
-		case 0x08:
-			result = dap_write_abort(&req, &rsp);
-			break;
-		/* DAP_Delay */
-		case 0x09:
-			result = dap_delay(&req, &rsp);
-			break;
-		/* DAP_ResetTarget */
-		case 0x0A:
-			result = dap_reset_target(&req, &rsp);
-			break;
-
-		/* == Common SWD/JTAG Commands == */
-
-		/* DAP_SWJ_Pins */
-		case 0x10:
-			result = dap_swj_pins(&req, &rsp);
-			break;
-		/* DAP_SWJ_Clock */
-		case 0x11:
-			result = dap_swj_clock(&req, &rsp);
-			break;
-		/* DAP_SWJ_Sequence */
-		case 0x12:
-			result = dap_swj_sequence(&req, &rsp);
-			break;
-
-		/* == SWD Commands == */
-
-		/* DAP_SWD_Configure */
-		case 0x13:
-			result = dap_swd_configure(&req, &rsp);
-			break;
-		/* DAP_SWD_Sequence */
-		case 0x1D:
-			result = dap_swd_sequence(&req, &rsp);
-			break;
-
-		/* == JTAG Commands */
-
-		/* DAP_JTAG_Sequence */
-		case 0x14:
-			result = dap_jtag_sequence(&req, &rsp);
-			break;
-		/* DAP_JTAG_Configure */
-		case 0x15:
-			log_puts("CMSIS: DAP_JTAG_Configure\r\n");
-			rsp.buffer[1] = 0xFF;
-			rsp.len = 2;
-			result = 0;
-			break;
-		/* DAP_JTAG_IDCODE */
-		case 0x16:
-			log_puts("CMSIS: DAP_JTAG_IDCODE\r\n");
-			rsp.buffer[1] = 0xFF;
-			rsp.len = 2;
-			result = 0;
-			break;
-
-		/* == SWO Commands == */
-
-		/* DAP_SWO_Transport */
-		case 0x17:
-		/* DAP_SWO_Mode */
-		case 0x18:
-		/* DAP_SWO_Baudrate */
-		case 0x19:
-		/* DAP_SWO_Control */
-		case 0x1A:
-		/* DAP_SWO_Status */
-		case 0x1B:
-		/* DAP_ExtendedStatus */
-		case 0x1E:
-		/* DAP_SWO_Data */
-		case 0x1C:
-			log_puts("CMSIS: SWO command ");
-			log_puthex(req.buffer[0], 8);
-			log_puts(" not supported yet.\r\n");
-			rsp.buffer[1] = 0xFF;
-			rsp.len = 2;
-			result = 0;
-			break;
-
-		/* == Unsorted Commands (SWD, JTAG, Transfer ...) == */
-
-		/* DAP_TransferConfigure */
-		case 0x04:
-			result = dap_transfer_configure(&req, &rsp);
-			break;
-		/* DAP_Transfer */
-		case 0x05:
-			result = dap_transfer(&req, &rsp);
-			break;
-		/* DAP_TransferBlock */
-		case 0x06:
-		/* DAP_TransferAbort */
-		case 0x07:
-			result = -1;
-			break;
-	}
-
-	if (result == 0)
-	{
-		if (rsp.len <= 0)
-		{
-			tx_buffer[0] = req.buffer[0]; // Copy command ID
-			tx_buffer[1] = 0xFF;          // DAP_ERROR
-			rsp.len = 2;
-		}
-		usbd_edpt_xfer(0, ep_in_n, tx_buffer, rsp.len);
-	}
-	else
-	{
-		log_puts("CMSIS: dap_recv() :\r\n");
-		for (i = 0; i < len; i++)
-		{
-			log_puthex(rx[i], 8);
-			log_puts(" ");
-		}
-		log_puts("\r\n");
-	}
-
-}
-
-/**
- * @brief Handle the DAP_Connect command
- *
- * This command is used to establish an electrical connection with the target.
- * Into argument, the protocol to use (SWD or JTAG) is also specified for a
- * correct pin configuration.
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_connect(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-
-	log_puts("CMSIS: Connect ");
-	log_puthex(req->buffer[1], 8);
-	log_puts("\r\n");
-#endif
-
-	/* If request port is SWD (or Default) */
-	if ((req->buffer[1] == 1) || (req->buffer[1] == 0))
-	{
-		if (swd_connect() == 0)
-			cmsis_mode = 1; // Success, now in SWD mode
-		else
-			cmsis_mode = 0; // Failed
-
-		swd_config.retry_count = dap_retry_wait;
-		rsp->buffer[1] = cmsis_mode;
-	}
-	/* If request port is JTAG */
-	else if (req->buffer[1] == 2)
-	{
-		if (jtag_connect() == 0)
-			cmsis_mode = 2; // Success, now in JTAG mode
-		else
-			cmsis_mode = 0; // Failed
-
-		rsp->buffer[1] = cmsis_mode;
-	}
-	/* For all other ports, Initialization Failed */
-	else
-		rsp->buffer[1] = 0x00;
-
-	rsp->buffer[0] = 0x02;
-	rsp->len = 2;
-
-	return(0);
-}
-
-/**
- * @brief Handle the DAP_Delay command
- *
- * This command is used to wait for a specific delay (in micro-seconds)
- *
- * TODO This command is not implemented yet
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_delay(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#else
-	(void)req;
-#endif
-	log_puts("CMSIS: Delay (not supported yet)\r\n");
-
-	rsp->buffer[1] = 0xFF; // ERROR
-	rsp->len = 2;
-	return(0);
-}
-
-/**
- * @brief Handle the DAP_Disconnect command
- *
- * This command is used to release the IOs of the debug port.
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_disconnect(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-
-	log_puts("CMSIS: Disconnect\r\n");
-#else
-	(void)req;
-#endif
-	if (cmsis_mode == 2)
-		jtag_disconnect();
-	else if (cmsis_mode == 1)
-		swd_disconnect();
-	else
-		ios_mode(PORT_MODE_HIZ);
-
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = 2;
-	return(0);
-}
-
-/**
- * @brief Handle the DAP_HostStatus command
- *
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_host_status(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-
-	log_puts("CMSIS: HostStatus\r\n");
-#else
-	(void)req;
-#endif
-
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = 2;
-
-	return(0);
-}
-
-/**
- * @brief Handle the DAP_Info command
- *
- * This commands are used by the host software to get informations about the
- * cmsis probe itself and about the target. There is a long list of available
- * informations so this function only decode the identifier of the request and
- * branch to other dedicated functions (below).
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_info(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-	char *str = 0;
-	int len;
-	int result = 0;
-
-	switch (req->buffer[1])
-	{
-		/* Vendor Name (string) */
-		case 0x01:
-			goto ret_str;
-		/* Product Name (string) */
-		case 0x02:
-			goto ret_str;
-		/* Serial Number (string) */
-		case 0x03:
-			str = str_serial;
-			goto ret_str;
-		/* CMSIS-DAP Protocol Version */
-		case 0x04:
-			str = str_version;
-			goto ret_str;
-		/* Target Device Vendor */
-		case 0x05:
-		/* Target Device Name */
-		case 0x06:
-		/* Target Board Vendor */
-		case 0x07:
-		/* Target Board Name */
-		case 0x08:
-		/* Product Firmware Version */
-		case 0x09:
-			goto ret_str;
-		/* Capabilities of the Debug Unit */
-		case 0xF0:
-			result = dap_info_cap(req, rsp);
-			break;
-		/* Test Domain Timer */
-		case 0xF1:
-			rsp->buffer[1] = 0x08;
-			/* Return 0 for the timer freq */
-			rsp->buffer[2] = 0x00;
-			rsp->buffer[3] = 0x00;
-			rsp->buffer[4] = 0x00;
-			rsp->buffer[5] = 0x00;
-			rsp->len = 6;
-			break;
-		/* UART Receive Buffer Size */
-		case 0xFB:
-		/* UART Transmit Buffer Size */
-		case 0xFC:
-		/* SWO Trace Buffer Size */
-		case 0xFD:
-			rsp->buffer[1] = 0x04; /* Len */
-			goto ret_word;
-		/* Packet Count */
-		case 0xFE:
-			rsp->buffer[1] = 1; // Response size
-			rsp->buffer[2] = 1; // Packet count = 1
-			rsp->len = 3;
-			break;
-		/* Packet Size */
-		case 0xFF:
-			rsp->buffer[1] = 2;    // Response size
-			rsp->buffer[2] = 0x40; // Packet size = 64
-			rsp->buffer[3] = 0x00;
-			rsp->len = 4;
-			break;
-
-		/* Unknown or unsupported command */
-		default:
-			result = -1;
-	}
-	return(result);
-
-/* Generic code to return a WORD */
-ret_word:
-	rsp->buffer[2] = 0x00;
-	rsp->buffer[3] = 0x00;
-	rsp->buffer[4] = 0x00;
-	rsp->buffer[5] = 0x00;
-	rsp->len = 6;
-	return(result);
-/* Generic code to return a string */
-ret_str:
-	if (str == 0)
-	{
-		rsp->buffer[1] = 0;
-		rsp->len = 2;
-		return(result);
-	}
-
-	len = strlen(str);
-	/* Insert header */
-	rsp->buffer[1] = len + 1;
-	/* Copy string into response packet */
-	strcpy((char *)(rsp->buffer + 2), str);
-	rsp->buffer[2+len] = 0; // Add a nul char to finish string
-	rsp->len = (2 + len + 1);
-	return(result);
-}
-
-/**
- * @brief Handle Dap_Info::Capabilities command
- *
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_info_cap(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-
-	log_puts("CMSIS: Get Capabilities\r\n");
-#else
-	(void)req;
-#endif
-	rsp->buffer[1] = 1;
-	rsp->buffer[2] = (1 << 0) | // SWD is supported
-	                 (1 << 1);  // JTAG is supported
-	rsp->len = 3;
-	return(0);
-}
-
-/**
- * @brief Handle DAP_JTAG_Sequence command
- *
- * This command generate sequences on TMS/TDI and capture TDO.
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_jtag_sequence(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-	uint seq_count;
-	uint tck_count;
-	u8  *p, *q;
-	uint tms, capture;
-	uint din, dmask;
-	int i, j, k, l;
-
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#endif
-	/* Extract number of sequences */
-	seq_count = req->buffer[1];
-
-#ifdef DEBUG_CMSIS_JTAG
-	log_puts("DAP_JTAG_Sequence: count="); log_putdec(seq_count);
-	log_puts("\r\n");
-#endif
-	dmask = 0x80;
-	p = (req->buffer + 2);
-	q = (rsp->buffer + 2);
-	for (i = 0; i < seq_count; i++)
-	{
-		/* Extract number of TCK clock cycle */
-		tck_count = (*p & 0x3F);
-		if (tck_count == 0)
-			tck_count = 64;
-		/* Extract TMS value */
-		tms = (*p & (1 << 6)) ?  1 : 0;
-		/* Is data capture enabled ? */
-		capture = (*p & (1 << 7)) ?  1 : 0;
-#ifdef DEBUG_CMSIS_JTAG
-		log_puts(" TCK="); log_putdec(tck_count);
-		log_puts(",TMS="); log_putdec(tms);
-		log_puts(",capture="); log_putdec(capture);
-		log_puts(" ");
-#endif
-		p++; // Move to next byte into request buffer
-		for (j = tck_count; j > 0; j -= l)
-		{
-			l = (j >= 8) ? 8 : j;
-			if (capture == 0)
-				jtag_rshift(*p++, l, tms);
-			else
-			{
-				din = jtag_rshift(*p++, l, tms);
-				// Insert received bits into response buffer
-				for (k = 0; k < l; k++)
-				{
-					if (din & (0x80 >> k))
-						*q |= dmask;
-					dmask = (dmask >> 1);
-					if (dmask == 0)
-					{
-						dmask = 0x80;
-						q++;
-						*q = 0;
-					}
-				}
-			}
-		}
-	}
-#ifdef DEBUG_CMSIS_JTAG
-	if (seq_count > 0)
-	{
-		log_puts("\r\nDAP_JTAG_Sequence response len=");
-		log_putdec(q - rsp->buffer);
-		log_puts("\r\n");
-	}
-#endif
-
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = (q - rsp->buffer);;
-
-	return(0);
-}
-
-/**
- * @brief Handle DAP_ResetTarget command
- *
- * This command request a target reset with device specific sequence.
- *
- * TODO This command is not implemented yet
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_reset_target(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#else
-	(void)req;
-#endif
-	log_puts("CMSIS: ResetTarget (not supported yet)\r\n");
 
-	/* Inform the host that this command is known but not implemented */
-	rsp->buffer[1] = 0x00; /* Command status OK */
-	rsp->buffer[2] = 0x00; /* Execute: 0 = not implemented */
-	rsp->len = 3;
+	dap_queue_init(&dap_q);
+	q_rx_armed = 0;
+	q_tx_busy  = 0;
+	q_drop     = 0;
+	q_stream   = 0;
 
-	return(0);
+	/* Start DAP engine */
+	multicore_launch_core1(dap_core1);
 }
 
 /**
- * @brief Handle DAP_SWD_Configure command
- *
- * This command is used to set configuration parameters specific to SWD
- * interface (like turnaround period or data phase).
+ * @brief Process periodic stuff of the cmsis module (USB side)
  *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
+ * This function must be called periodically (typically from main loop) to
+ * send the responses made by the DAP engine and re-arm the OUT endpoint
+ * when slots are released.
  */
-static inline int dap_swd_configure(cmsis_pkt *req, cmsis_pkt *rsp)
+void cmsis_task(void)
 {
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#endif
-	/* Extract new SWD configuration values */
-	dap_ta_period  = ((req->buffer[1] & 0x03) + 1);
-	dap_data_phase =  (req->buffer[1] & 4) ? 1 : 0;
-
-#ifdef DEBUG_CMSIS
-	log_puts("DAP: Configure SWD,");
-	log_puts(" TA_period="); log_putdec(dap_ta_period);
-	log_puts(" DataPhase="); log_putdec(dap_data_phase);
-	log_puts("\r\n");
-#endif
-
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = 2;
-	return(0);
+	queue_tx_start(0);
 }
 
-/**
- * @brief Handle DAP_SWD_Sequence command
- *
- * This command is used to generate special sequences in SWD mode on the pins
- * SWDCLK and/or SWDIO.
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_swd_sequence(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-	uint seq_count;
-	u8  *p, *q;
-	int tck_count;
-	int i, j, l;
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#endif
-	/* Extract number of sequences */
-	seq_count = req->buffer[1];
-
-#ifdef DEBUG_CMSIS_SEQ
-	log_puts("DAP_SWD_Sequence: count="); log_putdec(seq_count);
-#endif
-
-	p = (req->buffer + 2);
-	q = (rsp->buffer + 2);
-	for (i = 0; i < seq_count; i++)
-	{
-		/* Extract number of TCK clock cycle */
-		tck_count = (p[0] & 0x3F);
-		if (tck_count == 0)
-			tck_count = 64;
-
-		// If sequence direction is specified as input
-		if (p[0] & 0x80)
-		{
-#ifdef DEBUG_CMSIS_SEQ
-			log_puts(" IN("); log_putdec(tck_count); log_puts(")");
-#endif
-			// Force SWD-IO pin to input
-			swd_io_dir(IO_DIR_IN);
-			// Read the specified number of bits
-			for (j = tck_count; j > 0; j -= l)
-			{
-				l = (j >= 8) ? 8 : j;
-				*q++ = swd_rd(l);
-			}
-			p++;
-		}
-		// Sequence direction is specified as output
-		else
-		{
-#ifdef DEBUG_CMSIS_SEQ
-			log_puts(" OUT("); log_putdec(tck_count); log_puts(")");
-#endif
-			p++;
-			// Force SWD-IO pin to output
-			swd_io_dir(IO_DIR_OUT);
-			// Write the specified number of bits
-			for (j = tck_count; j > 0; j -= l)
-			{
-				l = (j >= 8) ? 8 : j;
-				swd_wr(*p++, l);
-			}
-		}
-	}
-#ifdef DEBUG_CMSIS_SEQ
-	log_puts("\r\n");
-#endif
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = (q - rsp->buffer);
-	swd_io_dir(IO_DIR_OUT);
-
-	return(0);
-}
-
-/**
- * @brief Handle DAP_SWJ_Clock command
- *
- * This command is used to set the clock frequency of the bus (common to SWD
- * and JTAG modes).
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_swj_clock(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#endif
-
-	cmsis_clock = (req->buffer[1] << 8) | req->buffer[2];
-
-#ifdef DEBUG_CMSIS
-	log_puts("CMSIS: Set clock ");
-	log_puthex(cmsis_clock, 16);
-	log_puts("\r\n");
-#endif
-
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = 2;
-	return(0);
-}
+/* -------------------------------------------------------------------------- */
+/* --                              DAP engine                              -- */
+/* -------------------------------------------------------------------------- */
 
 /**
- * @brief Handle DAP_SWJ_Pins command
- *
- * This command is used to monitor and control the IOs pins including
- * reset lines.
+ * @brief Entry point of the DAP engine (core1)
  *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
+ * Core1 is dedicated to the execution of DAP commands, no interrupt is
+ * enabled on this core so the timings of the bit engines are not disturbed.
  */
-static inline int dap_swj_pins(cmsis_pkt *req, cmsis_pkt *rsp)
+static void dap_core1(void)
 {
-	uint8_t output;
-	uint8_t select;
-	uint8_t wait;
-	uint8_t sig;
-
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-
-	log_puts("CMSIS: Set DAP_SWJ pins\r\n");
-#endif
-	output = req->buffer[1];
-	select = req->buffer[2];
-	wait   = req->buffer[3];
-
-	/* Bit0: TCK/SWD-CLK */
-	if (select & (1 << 0))
-	{
-		sig = (output & (1 << 0)) ? 1 : 0;
-		ios_pin_set(PORT_D2_PIN, sig);
-	}
-	/* Bit1: TMS/SWD-DAT */
-	if (select & (1 << 1))
-	{
-		sig = (output & (1 << 1)) ? 1 : 0;
-		ios_pin_set(PORT_D1_PIN, sig);
-	}
-	/* Bit3: TDO */
-	if (select & (1 << 3))
-	{
-		/* TDO signal available only in JTAG mode */
-		if (cmsis_mode == 2)
-		{
-			sig = (output & (1 << 3)) ? 1 : 0;
-			ios_pin_set(PORT_D3_PIN, sig);
-		}
-	}
-	/* Bit5: nTRST */
-	if (select & (1 << 5))
-	{
-		/* nTRST is not available */
-	}
-	/* Bit7: nReset */
-	if (select & (1 << 7))
-	{
-		/* Reset signal available only in SWD mode */
-		if (cmsis_mode == 1)
-		{
-			sig = (output & (1 << 7)) ? 1 : 0;
-			ios_pin_set(PORT_D3_PIN, sig);
-		}
-	}
-	/* TODO: Handle wait argument */
-	(void)wait;
-
-	/* Insert current IOs values into response */
-	rsp->buffer[1] = (ios_pin(PORT_D1_PIN) << 1) |
-	                 (ios_pin(PORT_D2_PIN) << 0);
-	if (cmsis_mode == 1)
-		rsp->buffer[1] |= (ios_pin(PORT_D3_PIN) << 7);
-	else if (cmsis_mode == 2)
-		rsp->buffer[1] |= (ios_pin(PORT_D3_PIN) << 3);
-
-	rsp->len = 2;
-	return(0);
+	while(1)
+		dap_task();
 }
 
 /**
- * @brief Handle DAP_SWJ_Sequence command
+ * @brief Send a part of a long response (DAP engine side)
  *
- * This command is used to send a sequence of bits without taking care about
- * input value or state of the target. This allow (for example) to send bit
- * pattern for SWD/JTAG reset or SWD->JTAG transition.
+ * The slot of the request in execution only has one response buffer, so the
+ * parts are sent alternately from this buffer and from q_stream_buf : while
+ * one part is sent by USB, the DAP engine fills the other one.
  *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
+ * @param pkt Pointer to the response (a full packet)
+ * @return integer Zero on success
  */
-static inline int dap_swj_sequence(cmsis_pkt *req, cmsis_pkt *rsp)
+static int dap_stream(cmsis_pkt *pkt)
 {
-	unsigned char *p, v;
-	int bit_count, bit_sent, bit_rem;
-	int len;
-
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#endif
-	/* Extract bit count from the first field of the request */
-	bit_count = (req->buffer[1] == 0) ? 256 : req->buffer[1];
-
-#ifdef DEBUG_CMSIS
-	log_puts("DAP: SWJ_Sequence");
-	log_puts(" bit_count="); log_putdec(bit_count);
-	log_puts("\r\n");
-#endif
-
-	p = (req->buffer + 2);
-
-	for (bit_sent = 0; bit_sent < bit_count ; )
-	{
-		/* Extract next byte */
-		v = *p;
-		bit_rem = (bit_count - bit_sent);
-		len = (bit_rem > 8) ? 8 : bit_rem;
-
-		/* Process according to port mode */
-		if (cmsis_mode == 1)
-			swd_wr(v, len);
-		else
-			jtag_tms_sequence(v, len);
-
-		/* Update counter of processed bits */
-		bit_sent += len;
-		p++;
-	}
-
-	/* Sequence complete ! prepare response */
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = 2;
-
+	/* Wait until the previous part has been sent */
+	while (DAP_QUEUE_LOAD(q_stream) != 0)
+		;
+	q_stream_ptr = pkt->buffer;
+	q_stream_parts++;
+	DAP_QUEUE_STORE(q_stream, 1);
+
+	pkt->buffer = (pkt->buffer == q_stream_buf) ? q_stream_rsp : q_stream_buf;
+	pkt->len    = 0;
 	return(0);
 }
 
 /**
- * @brief Handle DAP_Transfer command
- *
- * This command is used to read or write data to CoreSight registers. Each
- * access is for a 32bits value.
+ * @brief Execute the next DAP packet from the queue (if any)
  *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
  */
-static inline int dap_transfer(cmsis_pkt *req, cmsis_pkt *rsp)
+static void dap_task(void)
 {
-	int count, pos, pos_resp;
-	int request, ack;
-	unsigned long data;
-	int rd_posted = 0;
-	int wr_rd = 0;
-	int i;
-
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#endif
-
-	count = req->buffer[2];
-
-#ifdef DEBUG_CMSIS_TR
-	log_puts("CMSIS: DAP Transfer with ");
-	log_putdec(count);
-	log_puts(" requests\r\n");
-#endif
-	pos_resp = 3;
-	for (i = 0, pos = 2; i < count; i++)
-	{
-		wr_rd = 0;
-
-		request = req->buffer[++pos];
-
-		if (rd_posted)
-		{
-			/* In case of another read on AP, after a posted read */
-			if ( (request & (1 << 1)) && (request & (1 << 0)) )
-				ack = swd_transfer(request, &data);
-			else
-			{
-				ack = swd_transfer(0x0C | (1 << 1), &data);
-				rd_posted = 0;
-			}
-			if (ack != 1)
-				break;
-
-			rsp->buffer[pos_resp + 0] = ((data >>  0) & 0xFF);
-			rsp->buffer[pos_resp + 1] = ((data >>  8) & 0xFF);
-			rsp->buffer[pos_resp + 2] = ((data >> 16) & 0xFF);
-			rsp->buffer[pos_resp + 3] = ((data >> 24) & 0xFF);
-			pos_resp += 4;
-
-			if (rd_posted)
-				continue;
-		}
-		/* In case of a read on AP, insert an extra read cycle */
-		if ( (request & (1 << 1)) && (request & (1 << 0)) )
-		{
-			ack = swd_transfer(request, &data);
-			if (ack != 1)
-				break;
-			rd_posted = 1;
-		}
-		/* If RnW bit is set, read request */
-		else if (request & (1 << 1))
-		{
-			ack = swd_transfer(request, &data);
-			if (ack == 1)
-			{
-				rsp->buffer[pos_resp + 0] = ((data >>  0) & 0xFF);
-				rsp->buffer[pos_resp + 1] = ((data >>  8) & 0xFF);
-				rsp->buffer[pos_resp + 2] = ((data >> 16) & 0xFF);
-				rsp->buffer[pos_resp + 3] = ((data >> 24) & 0xFF);
-				pos_resp += 4;
-			}
-		}
-		/* RnW is clear, Write request */
-		else
-		{
-			/* Extract data to write from request */
-			data  = (req->buffer[pos+4] << 24);
-			data |= (req->buffer[pos+3] << 16);
-			data |= (req->buffer[pos+2] <<  8);
-			data |= (req->buffer[pos+1] <<  0);
-			pos += 4;
-
-			ack = swd_transfer(request, &data);
-			if (ack == 1)
-				wr_rd = 1;
-		}
-		if (ack != 1)
-			break;
-	}
-
-	if (ack == 1)
+	cmsis_pkt req, rsp;
+	int slot;
+
+	slot = dap_queue_exec_get(&dap_q);
+	/* If no packet is waiting, nothing to do */
+	if (slot < 0)
+		return;
+
+	/* DAP_QueueCommands packets are executed with the next packet, wait
+	 * until it is received (or until all slots are used) */
+	if ((dap_q.req[slot][0] == 0x7E) && (dap_queue_pending(&dap_q) == 1) &&
+	    ! dap_queue_full(&dap_q))
+		return;
+
+	req.buffer = dap_q.req[slot];
+	req.len    = dap_q.req_len[slot];
+	req.stream = 0;
+	rsp.buffer = dap_q.rsp[slot];
+	rsp.len    = 0;
+	rsp.stream = dap_stream;
+	q_stream_rsp = dap_q.rsp[slot];
+	q_stream_parts = 0;
+
+	/* A response that fill an integer number of USB packets needs a
+	 * short packet to terminate the transfer : add a padding byte. The
+	 * parts of a long response are full packets, the host reads them until
+	 * a short one : when the last part is full too, it is sent as a part
+	 * and the padding byte follows alone */
+	if (dap_recv(&req, &rsp) && ((rsp.len % DAP_EP_SIZE) == 0))
 	{
-		if (rd_posted)
+		if ((rsp.len == DAP_PACKET_SIZE) && q_stream_parts)
+			dap_stream(&rsp);
+		if (rsp.len < DAP_PACKET_SIZE)
 		{
-			ack = swd_transfer(0x0C | (1 << 1), &data);
-			if (ack == 1)
-			{
-				rsp->buffer[pos_resp + 0] = ((data >>  0) & 0xFF);
-				rsp->buffer[pos_resp + 1] = ((data >>  8) & 0xFF);
-				rsp->buffer[pos_resp + 2] = ((data >> 16) & 0xFF);
-				rsp->buffer[pos_resp + 3] = ((data >> 24) & 0xFF);
-
-				pos_resp += 4;
-			}
+			rsp.buffer[rsp.len] = 0x00;
+			rsp.len++;
 		}
-		else if (wr_rd)
-			ack = swd_transfer(0x0C | (1 << 1), 0);
 	}
-
-	/* Make response header */
-	rsp->buffer[1] = i;   /* Number of transfer */
-	rsp->buffer[2] = ack; /* Status of last transfer */
-	rsp->len = pos_resp;
-
-	return(0);
-}
-
-/**
- * @brief Handle DAP_TransferConfigure command
- *
- * This command is used to set some parameters that will be used for next
- * DAP_Transfer and DAP_TransferBlock commands.
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_transfer_configure(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#endif
-	/* Extract new Transfer configuration values */
-	dap_idle_cycles = req->buffer[1];
-	dap_retry_wait  = (req->buffer[3] << 8) | req->buffer[2];
-	dap_retry_match = (req->buffer[5] << 8) | req->buffer[4];
-
-	swd_config.retry_count = dap_retry_wait;
-
-#ifdef DEBUG_CMSIS
-	log_puts("DAP: Configure transfer:");
-	log_puts(" IdleCycles="); log_putdec(dap_idle_cycles);
-	log_puts(" RetryWait=");  log_putdec(dap_retry_wait);
-	log_puts(" RetryMatch="); log_putdec(dap_retry_match);
-	log_puts("\r\n");
-#endif
-
-	rsp->buffer[0] = 0x04;
-	rsp->buffer[1] = 0x00; // OK
-	rsp->len = 2;
-
-	return(0);
+	/* Last part of a long response is sent after the previous ones */
+	while (DAP_QUEUE_LOAD(q_stream) != 0)
+		;
+	if (rsp.buffer != dap_q.rsp[slot])
+		memcpy(dap_q.rsp[slot], rsp.buffer, rsp.len);
+	dap_queue_exec_put(&dap_q, rsp.len);
 }
-
-/**
- * @brief Handle DAP_WriteABORT command
- *
- * This command is used write an abort request into the ABORT register
- * of the target. This command should only be used when something really
- * wrong happens during a transfer that must be interrupted.
- *
- * TODO This command is not implemented yet
- *
- * @param rep Pointer to the request packet
- * @param rsp Pointer to a packet where response can be stored
- * @return integer On success zero is returned, -1 for error
- */
-static inline int dap_write_abort(cmsis_pkt *req, cmsis_pkt *rsp)
-{
-#ifdef DEBUG_CMSIS
-	/* Sanity check */
-	if ((req == 0) || (rsp == 0))
-		return(-1);
-#else
-	(void)req;
-#endif
-	log_puts("CMSIS: WriteABORT not supported yet\r\n");
-
-	rsp->buffer[1] = 0xFF; // ERROR
-	rsp->len = 2;
-	return(0);
-}
-
 /* -------------------------------------------------------------------------- */
 /* --                         TinyUSB class driver                         -- */
 /* -------------------------------------------------------------------------- */
@@ -1194,7 +238,8 @@ uint16_t cmsis_usb_open(uint8_t rhport, tusb_desc_interface_t const *itf_desc, u
 			goto err;
 		}
 		ep_out_n = ep_n;
-		usbd_edpt_xfer(rhport, ep_out_n, rx_buffer, RX_SIZE);
+		queue_flush();
+		queue_rx_arm(rhport);
 		drv_len += tu_desc_len(p_desc);
 	}
 	else
@@ -1245,6 +290,8 @@ void cmsis_usb_reset(uint8_t rhport)
 #ifdef DEBUG_CMSIS_USB
 	log_puts("cmsis_usb_reset()\r\n");
 #endif
+	/* Pending packets are lost */
+	queue_flush();
 }
 
 /**
@@ -1284,15 +331,26 @@ bool cmsis_usb_xfer(uint8_t rhport, uint8_t ep, xfer_result_t result, uint32_t x
 
 	if (ep == ep_out_n)
 	{
-		/* Call DAP to process received command */
-		dap_recv(rx_buffer, xferred_bytes);
+		q_rx_armed = 0;
+		/* Packet received, give it to the DAP engine */
+		if (xferred_bytes > 0)
+			dap_queue_rx_put(&dap_q, xferred_bytes);
 
-		/* Prepare endpoint for next transfer */
-		usbd_edpt_xfer(rhport, ep_out_n, rx_buffer, 256);
+		/* Prepare endpoint for next packet (if a buffer is free) */
+		queue_rx_arm(rhport);
 	}
 	else if (ep == ep_in_n)
 	{
-		/* Do nothing :) */
+		/* Part of a long response sent, buffer can be filled again */
+		if (q_stream == 2)
+			DAP_QUEUE_STORE(q_stream, 0);
+		/* Response sent, the slot is now free */
+		else
+			dap_queue_tx_put(&dap_q);
+		q_tx_busy = 0;
+
+		queue_tx_start(rhport);
+		queue_rx_arm(rhport);
 	}
 	else
 		/* Unknown endpoint ?! */
@@ -1300,5 +358,89 @@ bool cmsis_usb_xfer(uint8_t rhport, uint8_t ep, xfer_result_t result, uint32_t x
 
 	return(1);
 }
+
+/* -------------------------------------------------------------------------- */
+/* --                             Packet queue                             -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Drop the packets of a previous USB session
+ *
+ * Slots can not be released while the DAP engine is using them, so pending
+ * requests are still executed but their responses will not be sent.
+ */
+static void queue_flush(void)
+{
+	q_rx_armed = 0;
+	q_tx_busy  = 0;
+	q_drop     = dap_q.rx;
+	/* A part of long response was sending, drop it */
+	if (q_stream == 2)
+		DAP_QUEUE_STORE(q_stream, 0);
+}
+
+/**
+ * @brief Arm the OUT endpoint to receive the next packet
+ *
+ * The endpoint is only armed if a slot is free, otherwise this function will
+ * be called again when a response has been sent.
+ *
+ * @param rhport Index of the USB port
+ */
+static void queue_rx_arm(uint8_t rhport)
+{
+	int slot;
+
+	if ((ep_out_n == 0) || q_rx_armed)
+		return;
+	/* If all slots are used, wait */
+	slot = dap_queue_rx_get(&dap_q);
+	if (slot < 0)
+		return;
+
+	q_rx_armed = 1;
+	usbd_edpt_xfer(rhport, ep_out_n, dap_q.req[slot], DAP_PACKET_SIZE);
+}
+
+/**
+ * @brief Start the transfer of the next response (if any)
+ *
+ * @param rhport Index of the USB port
+ */
+static void queue_tx_start(uint8_t rhport)
+{
+	int slot;
+
+	while (q_tx_busy == 0)
+	{
+		slot = dap_queue_tx_get(&dap_q);
+		/* All responses sent, a long response may be in progress */
+		if ((slot < 0) && (DAP_QUEUE_LOAD(q_stream) == 1))
+		{
+			/* Drop it if the request was from a previous session */
+			if ((int)(dap_q.tx - q_drop) < 0)
+			{
+				DAP_QUEUE_STORE(q_stream, 0);
+				continue;
+			}
+			q_stream  = 2;
+			q_tx_busy = 1;
+			usbd_edpt_xfer(rhport, ep_in_n, q_stream_ptr, DAP_PACKET_SIZE);
+			break;
+		}
+		if (slot < 0)
+			break;
+		/* Some commands have no response (or a flushed one), just
+		 * release the slot */
+		if ((dap_q.rsp_len[slot] == 0) || ((int)(dap_q.tx - q_drop) < 0))
+		{
+			dap_queue_tx_put(&dap_q);
+			queue_rx_arm(rhport);
+			continue;
+		}
+		q_tx_busy = 1;
+		usbd_edpt_xfer(rhport, ep_in_n, dap_q.rsp[slot], dap_q.rsp_len[slot]);
+	}
+}
 #endif
 /* EOF */
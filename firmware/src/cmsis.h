@@ -17,6 +17,7 @@
 #define CMSIS_H
 #include "pico/stdlib.h"
 #include <device/usbd_pvt.h>
+#include "dap.h"
 
 /* Macro used to insert a CMSIS interface into a usb config descriptor */
 #define TUD_CMSIS_DESCRIPTOR(itf, str, ep_out, ep_in, ep_size) \
@@ -25,13 +26,8 @@
 	7, TUSB_DESC_ENDPOINT, ep_out, TUSB_XFER_BULK, U16_TO_U8S_LE(ep_size), 1, \
 	7, TUSB_DESC_ENDPOINT, ep_in,  TUSB_XFER_BULK, U16_TO_U8S_LE(ep_size), 1
 
-typedef struct s_cmsis_pkt
-{
-	uint8_t  *buffer;
-	uint16_t  len;
-} cmsis_pkt;
-
 void cmsis_init (void);
+void cmsis_task (void);
 
 /* TinyUSB class driver functions */
 void     cmsis_usb_init (void);
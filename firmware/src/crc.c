@@ -0,0 +1,139 @@
+/**
+ * @file  crc.c
+ * @brief Compute CRC32 of a data stream with the DMA sniffer
+ *
+ * A DMA channel copies the data to a dummy word, and the sniffer of the DMA
+ * computes the CRC on the fly. Transfers are started asynchronously, so the
+ * CRC of a buffer is computed while the caller fills the next one.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "crc.h"
+
+static int crc_dma = -1;
+static u32 crc_dummy;
+/* Bytes at the end of a buffer (not a multiple of 4) */
+static const u8 *crc_tail;
+static uint      crc_tail_len;
+
+static void crc_run(const void *data, uint count, enum dma_channel_transfer_size size);
+static void crc_wait(void);
+
+/**
+ * @brief Initialize the CRC module
+ *
+ * @return integer Zero on success, -1 if no DMA channel is available
+ */
+int crc_init(void)
+{
+	if (crc_dma < 0)
+		crc_dma = dma_claim_unused_channel(false);
+	if (crc_dma < 0)
+		return(-1);
+	crc_tail_len = 0;
+	return(0);
+}
+
+/**
+ * @brief Start a new CRC computation
+ *
+ * The sniffer uses the bit-reversed CRC32 (data is sent LSB first), the
+ * result is bit-reversed and inverted on read, like the IEEE 802.3 CRC.
+ *
+ * @return integer Zero on success, -1 if the module is not available
+ */
+int crc_start(void)
+{
+	if (crc_dma < 0)
+		return(-1);
+	crc_wait();
+	dma_sniffer_enable(crc_dma, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+	hw_set_bits(&dma_hw->sniff_ctrl, DMA_SNIFF_CTRL_OUT_REV_BITS |
+	                                 DMA_SNIFF_CTRL_OUT_INV_BITS);
+	dma_hw->sniff_data = 0xFFFFFFFF;
+	return(0);
+}
+
+/**
+ * @brief Add data to the current CRC
+ *
+ * This function returns before the end of the computation : the content of
+ * the buffer must not be modified until the next call to crc_update() or
+ * crc_result(). Words are used when possible (buffer aligned on 32 bits).
+ *
+ * @param data Pointer to the data
+ * @param len  Number of bytes
+ */
+void crc_update(const u8 *data, uint len)
+{
+	crc_wait();
+	if (len == 0)
+		return;
+	if ((uintptr_t)data & 3)
+	{
+		crc_run(data, len, DMA_SIZE_8);
+		return;
+	}
+	/* Bytes after the last word are sent when the words are done */
+	crc_tail     = data + (len & ~3);
+	crc_tail_len = (len & 3);
+	if (len >= 4)
+		crc_run(data, len >> 2, DMA_SIZE_32);
+}
+
+/**
+ * @brief Get the CRC of all data since crc_start()
+ *
+ * @return integer Value of the CRC32
+ */
+u32 crc_result(void)
+{
+	crc_wait();
+	return(dma_hw->sniff_data);
+}
+
+/**
+ * @brief Start a DMA transfer of data to the dummy word
+ *
+ * @param data  Pointer to the data
+ * @param count Number of transfers
+ * @param size  Size of each transfer
+ */
+static void crc_run(const void *data, uint count, enum dma_channel_transfer_size size)
+{
+	dma_channel_config cfg;
+
+	cfg = dma_channel_get_default_config(crc_dma);
+	channel_config_set_transfer_data_size(&cfg, size);
+	channel_config_set_read_increment (&cfg, true);
+	channel_config_set_write_increment(&cfg, false);
+	channel_config_set_sniff_enable(&cfg, true);
+	dma_channel_configure(crc_dma, &cfg, &crc_dummy, data, count, true);
+}
+
+/**
+ * @brief Wait for the end of the current transfer (and the pending bytes)
+ *
+ */
+static void crc_wait(void)
+{
+	dma_channel_wait_for_finish_blocking(crc_dma);
+	if (crc_tail_len)
+	{
+		crc_run(crc_tail, crc_tail_len, DMA_SIZE_8);
+		crc_tail_len = 0;
+		dma_channel_wait_for_finish_blocking(crc_dma);
+	}
+}
+/* EOF */
@@ -0,0 +1,26 @@
+/**
+ * @file  crc.h
+ * @brief Headers and definitions for the CRC32 module (DMA sniffer)
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef CRC_H
+#define CRC_H
+#include "types.h"
+
+/* CRC-32 of IEEE 802.3 (same as zlib crc32) */
+int  crc_init(void);
+int  crc_start(void);
+void crc_update(const u8 *data, uint len);
+u32  crc_result(void);
+
+#endif
@@ -0,0 +1,3729 @@
+/**
+ * @file  dap.c
+ * @brief This module contains the DAP engine (CMSIS-DAP commands)
+ *
+ * This module only decodes and executes DAP packets, the transport (USB) is
+ * managed by the cmsis module. It has no dependency on USB so it can also be
+ * compiled for a host computer (see test/dap-sim).
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "pico/stdlib.h"
+#include "crc.h"
+#include "dap.h"
+#include "ios.h"
+#include "jtag.h"
+#include "jtag_bscan.h"
+#include "jtag_dmi.h"
+#include "log.h"
+#include "svf.h"
+#include "swd.h"
+#include "swj_clock.h"
+
+#undef  DEBUG_CMSIS
+
+/* Bits of the DP CTRL/STAT register */
+#define DP_ORUNDETECT  (1 << 0)
+/* Bits of CTRL/STAT that can be written back (requests, mask, mode) */
+#define DP_CTRL_MASK   0x54000F0D
+/* Number of APs into the cache of CSW and TAR */
+#define DAP_CACHE_AP   4
+
+/* Debug registers of a Cortex-M core */
+#define CORE_DHCSR     0xE000EDF0
+#define CORE_DCRSR     0xE000EDF4
+#define CORE_DCRDR     0xE000EDF8
+#define CORE_DBGKEY    0xA05F0000
+#define CORE_S_REGRDY  (1 << 16)
+#define CORE_S_HALT    (1 << 17)
+
+/* Status of the flash algorithm runner */
+#define FLM_OK         0x00
+#define FLM_FAIL       0x01 /* A function returned an error (result is R0) */
+#define FLM_TIMEOUT    0x02 /* The core did not halt */
+#define FLM_SWD        0x03 /* A SWD transfer failed (result is ACK) */
+
+/* Cached registers of one MEM-AP */
+typedef struct dap_ap_cache_s
+{
+	u8   apsel;
+	u8   csw_ok;
+	u8   tar_ok;
+	u32  csw;
+	u32  tar;
+} dap_ap_cache;
+
+/* Flash algorithm (CMSIS-Pack FLM style) loaded into target RAM */
+typedef struct dap_flm_s
+{
+	u8   apsel;
+	u32  bkpt;     /* Return address of functions (breakpoint) */
+	u32  sb;       /* Static base (R9) */
+	u32  sp;       /* Stack pointer */
+	u32  program;  /* Entry of ProgramPage */
+	u32  buf[2];   /* Page buffers into target RAM */
+	u32  page;     /* Size of a page */
+	u32  timeout;  /* Max number of polls of DHCSR */
+	u32  addr;     /* Flash address of the page being loaded */
+	uint len;      /* Number of bytes loaded into current buffer */
+	uint cur;      /* Index of the buffer being loaded */
+	int  running;  /* A function is running on target */
+	int  status;   /* First error (kept until next setup) */
+	u32  result;
+} dap_flm;
+
+/* Progress into a DAP_Transfer command */
+typedef struct dap_xfer_state_s
+{
+	int i;         /* Index of the current transfer */
+	int pos;       /* Position into the request */
+	int pos_resp;  /* Position into the response */
+	int rd_posted; /* An AP read is pending (posted) */
+	int wr_rd;     /* Last write must be checked by reading RDBUFF */
+} dap_xfer_state;
+
+/* Context of a DAP_Transfer command */
+typedef struct dap_xfer_s
+{
+	dap_xfer_state st;
+	dap_xfer_state start;  /* State at the beginning of current transfer */
+	u32  select;           /* SELECT at the beginning of current transfer */
+	int  select_ok;
+	u8 *rsp;
+	/* Pipelined mode */
+	int  pipe;
+	int  fail;
+	dap_xfer_state resume; /* State to continue after an error */
+	struct
+	{
+		dap_xfer_state start;
+		u32 select;
+		u8  request;
+		u8 *dst;
+	} op[SWD_PIPE_DEPTH];
+	uint op_wr, op_rd;
+} dap_xfer;
+
+static uint8_t  dap_mode;
+static uint32_t dap_clock;
+
+static int  dap_command(cmsis_pkt *req, cmsis_pkt *rsp);
+
+static inline int dap_connect(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_delay(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_disconnect(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_execute_commands(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_host_status(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_info(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_info_cap(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_jtag_configure(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_jtag_idcode(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_jtag_sequence(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_reset_target(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_swd_configure(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_swd_sequence(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_swj_clock(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_swj_pins(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_swj_sequence(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_transfer(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_transfer_block(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_transfer_configure(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_bscan(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_chain(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_config(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_crc(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_diff(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_dmi(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_flash(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_memory(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_scatter(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_stats(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_vendor_svf(cmsis_pkt *req, cmsis_pkt *rsp);
+static inline int dap_write_abort(cmsis_pkt *req, cmsis_pkt *rsp);
+static void dap_cache_access(u8 request);
+static dap_ap_cache *dap_cache_ap(int create);
+static void dap_cache_error(int ack, u32 select, int select_ok);
+static void dap_cache_flush(void);
+static void dap_cache_read(u8 request, u32 data);
+static int  dap_cache_write(u8 request, u32 data);
+static int  dap_core_reg(u8 reg, u32 value, u32 *result);
+static int  dap_flm_call(u32 pc, u32 r0, u32 r1, u32 r2, u32 r3);
+static int  dap_flm_error(int status, u32 result);
+static int  dap_flm_load(u32 addr, const u8 *data, uint len);
+static int  dap_flm_start(void);
+static int  dap_flm_wait(void);
+static int  dap_mem_crc(u32 addr, uint len, uint size, uint *done, u32 *crc);
+static int  dap_mem_crc_out(cmsis_pkt *pkt);
+static int  dap_mem_flush(void);
+static int  dap_mem_out(cmsis_pkt *rsp, u32 data, uint len);
+static int  dap_mem_rd32(u32 addr, u32 *data);
+static int  dap_mem_read(cmsis_pkt *rsp, u32 addr, uint len, uint size, uint *done);
+static int  dap_mem_reg(u8 request, u32 data);
+static int  dap_mem_setup(u8 apsel, uint size);
+static int  dap_mem_wr32(u32 addr, u32 data);
+static int  dap_mem_write(u32 addr, const u8 *src, uint len, uint size, uint *done);
+static int  dap_port_transfer(u8 request, u32 *data);
+static void dap_xfer_get(dap_xfer *x);
+static int  dap_xfer_op (dap_xfer *x, u8 request, u32 data, u8 *dst);
+static int  dap_xfer_pipe(dap_xfer *x, cmsis_pkt *req);
+static int  dap_xfer_pipe_ok(cmsis_pkt *req);
+static int  dap_xfer_run(dap_xfer *x, cmsis_pkt *req);
+
+static int  dap_data_phase;
+static int  dap_idle_cycles;
+static int  dap_retry_wait;
+static int  dap_retry_match;
+static u32  dap_match_mask;
+static int  dap_orun;       /* Pipelined transfers with sticky overrun */
+static u32  dap_ctrl;       /* Last value of CTRL/STAT (writable bits) */
+static int  dap_ctrl_ok;    /* True when dap_ctrl is known */
+static int  dap_ctrl_dirty; /* CTRL/STAT must be restored */
+static u32  dap_select;     /* Last value written to SELECT */
+static int  dap_select_ok;  /* True when dap_select is known */
+static int  dap_cache;      /* Skip writes of SELECT, CSW, TAR with same value */
+static int  dap_cache_v5;   /* DP is ADIv5 (from DPIDR), CSW and TAR can be cached */
+static dap_ap_cache dap_ap[DAP_CACHE_AP];
+static uint dap_ap_next;
+static u32  dap_cache_hit;  /* Number of writes skipped */
+static u32  dap_cache_miss; /* Number of writes of cached registers sent */
+static u8  *dap_mem_post;   /* Destination of a pending posted read of DRW */
+static u32  dap_crc_buf[2][DAP_PACKET_SIZE / 4];
+static dap_flm dap_flash;
+static int  dap_ta_period;
+static u8   dap_scratch[DAP_PACKET_SIZE];
+static char str_serial[]  = "12345678";
+static char str_version[] = "1.0";
+
+/**
+ * @brief Initialize the DAP module
+ *
+ * This function is used to initialize the DAP engine (internal variables,
+ * SWJ clock and SWD module). For the DAP to work properly, this function
+ * must be called before any use of DAP.
+ */
+void dap_init(void)
+{
+	dap_mode  = 0; // 0:Unused 1:SWD 2:JTAG
+	dap_clock = SWJ_CLOCK_DEFAULT;
+	swj_clock_init();
+	swd_init();
+	jtag_init();
+	crc_init();
+
+	dap_data_phase  = 0;
+	dap_idle_cycles = 0;
+	dap_retry_wait  = 16;
+	dap_retry_match = 0;
+	dap_match_mask  = 0;
+	dap_orun        = 0;
+	dap_ctrl_ok     = 0;
+	dap_ctrl_dirty  = 0;
+	dap_select_ok   = 0;
+	dap_cache       = 1;
+	dap_cache_v5    = 0;
+	dap_cache_hit   = 0;
+	dap_cache_miss  = 0;
+	dap_ta_period   = 1;
+	dap_cache_flush();
+	memset(&dap_flash, 0, sizeof(dap_flm));
+	dap_flash.status = FLM_FAIL;
+}
+
+/**
+ * @brief Process an incoming CMSIS-DAP packet
+ *
+ * @param req Pointer to the received packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Length of the response to send (0 if no response)
+ */
+int dap_recv(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#if LOG_ON(LOG_WARN)
+	int i;
+#endif
+
+	if (dap_command(req, rsp) < 0)
+	{
+#if LOG_ON(LOG_WARN)
+		log_puts("CMSIS: dap_recv() :\r\n");
+		for (i = 0; i < req->len; i++)
+		{
+			log_puthex(req->buffer[i], 8);
+			log_puts(" ");
+		}
+		log_puts("\r\n");
+#endif
+		rsp->len = 0;
+	}
+	return(rsp->len);
+}
+
+/**
+ * @brief Execute one DAP command
+ *
+ * @param req Pointer to the request (first byte is the command ID)
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static int dap_command(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	int result = -1;
+
+	rsp->buffer[0] = req->buffer[0];
+	rsp->len = 0;
+
+	switch(req->buffer[0])
+	{
+		/* == General Commands == */
+
+		/* DAP_Info */
+		case 0x00:
+			result = dap_info(req, rsp);
+			break;
+		/* DAP_HostStatus */
+		case 0x01:
+			result = dap_host_status(req, rsp);
+			break;
+		/* DAP_Connect */
+		case 0x02:
+			result = dap_connect(req, rsp);
+			break;
+		/* DAP_Disconnect */
+		case 0x03:
+			result = dap_disconnect(req, rsp);
+			break;
+		/* DAP_WriteABORT */
+		case 0x08:
+			result = dap_write_abort(req, rsp);
+			break;
+		/* DAP_Delay */
+		case 0x09:
+			result = dap_delay(req, rsp);
+			break;
+		/* DAP_ResetTarget */
+		case 0x0A:
+			result = dap_reset_target(req, rsp);
+			break;
+
+		/* == Common SWD/JTAG Commands == */
+
+		/* DAP_SWJ_Pins */
+		case 0x10:
+			result = dap_swj_pins(req, rsp);
+			break;
+		/* DAP_SWJ_Clock */
+		case 0x11:
+			result = dap_swj_clock(req, rsp);
+			break;
+		/* DAP_SWJ_Sequence */
+		case 0x12:
+			result = dap_swj_sequence(req, rsp);
+			break;
+
+		/* == SWD Commands == */
+
+		/* DAP_SWD_Configure */
+		case 0x13:
+			result = dap_swd_configure(req, rsp);
+			break;
+		/* DAP_SWD_Sequence */
+		case 0x1D:
+			result = dap_swd_sequence(req, rsp);
+			break;
+
+		/* == JTAG Commands */
+
+		/* DAP_JTAG_Sequence */
+		case 0x14:
+			result = dap_jtag_sequence(req, rsp);
+			break;
+		/* DAP_JTAG_Configure */
+		case 0x15:
+			result = dap_jtag_configure(req, rsp);
+			break;
+		/* DAP_JTAG_IDCODE */
+		case 0x16:
+			result = dap_jtag_idcode(req, rsp);
+			break;
+
+		/* == SWO Commands == */
+
+		/* DAP_SWO_Status */
+		case 0x1B:
+			result = 1;
+			goto swo_err;
+		/* DAP_SWO_Transport */
+		case 0x17:
+		/* DAP_SWO_Mode */
+		case 0x18:
+		/* DAP_SWO_Control */
+		case 0x1A:
+		/* DAP_ExtendedStatus */
+		case 0x1E:
+			result = 2;
+			goto swo_err;
+		/* DAP_SWO_Data */
+		case 0x1C:
+			result = 3;
+			goto swo_err;
+		/* DAP_SWO_Baudrate */
+		case 0x19:
+			result = 5;
+swo_err:
+			LOG_INFO_PUTS("CMSIS: SWO command ");
+			LOG_INFO_PUTHEX(req->buffer[0], 8);
+			LOG_INFO_PUTS(" not supported yet.\r\n");
+			rsp->buffer[1] = 0xFF;
+			rsp->len = 2;
+			break;
+
+		/* == Unsorted Commands (SWD, JTAG, Transfer ...) == */
+
+		/* DAP_TransferConfigure */
+		case 0x04:
+			result = dap_transfer_configure(req, rsp);
+			break;
+		/* DAP_Transfer */
+		case 0x05:
+			result = dap_transfer(req, rsp);
+			break;
+		/* DAP_TransferBlock */
+		case 0x06:
+			result = dap_transfer_block(req, rsp);
+			break;
+		/* DAP_TransferAbort */
+		case 0x07:
+			result = -1;
+			break;
+
+		/* == Vendor commands == */
+
+		/* Cowprobe configuration */
+		case 0x80:
+			result = dap_vendor_config(req, rsp);
+			break;
+		/* Cowprobe statistics */
+		case 0x81:
+			result = dap_vendor_stats(req, rsp);
+			break;
+		/* Cowprobe memory access */
+		case 0x82:
+			result = dap_vendor_memory(req, rsp);
+			break;
+		/* Cowprobe scatter-gather read */
+		case 0x83:
+			result = dap_vendor_scatter(req, rsp);
+			break;
+		/* Cowprobe CRC32 of memory */
+		case 0x84:
+			result = dap_vendor_crc(req, rsp);
+			break;
+		/* Cowprobe CRC32 of sectors (differential programming) */
+		case 0x85:
+			result = dap_vendor_diff(req, rsp);
+			break;
+		/* Cowprobe flash algorithm runner */
+		case 0x86:
+			result = dap_vendor_flash(req, rsp);
+			break;
+		/* Cowprobe JTAG scan chain detection */
+		case 0x87:
+			result = dap_vendor_chain(req, rsp);
+			break;
+		/* Cowprobe SVF player */
+		case 0x88:
+			result = dap_vendor_svf(req, rsp);
+			break;
+		/* Cowprobe boundary scan */
+		case 0x89:
+			result = dap_vendor_bscan(req, rsp);
+			break;
+		/* Cowprobe RISC-V debug module access */
+		case 0x8A:
+			result = dap_vendor_dmi(req, rsp);
+			break;
+
+		/* == Command queue == */
+
+		/* DAP_QueueCommands */
+		case 0x7E:
+		/* DAP_ExecuteCommands */
+		case 0x7F:
+			result = dap_execute_commands(req, rsp);
+			break;
+	}
+
+	if ((result >= 0) && (rsp->len <= 0))
+	{
+		rsp->buffer[0] = req->buffer[0]; // Copy command ID
+		rsp->buffer[1] = 0xFF;           // DAP_ERROR
+		rsp->len = 2;
+	}
+	return(result);
+}
+
+/**
+ * @brief Handle the DAP_Connect command
+ *
+ * This command is used to establish an electrical connection with the target.
+ * Into argument, the protocol to use (SWD or JTAG) is also specified for a
+ * correct pin configuration.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_connect(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+
+	log_puts("CMSIS: Connect ");
+	log_puthex(req->buffer[1], 8);
+	log_puts("\r\n");
+#endif
+
+	/* If request port is SWD (or Default) */
+	if ((req->buffer[1] == 1) || (req->buffer[1] == 0))
+	{
+		if (swd_connect() == 0)
+			dap_mode = 1; // Success, now in SWD mode
+		else
+			dap_mode = 0; // Failed
+
+		swd_config.retry_count = dap_retry_wait;
+		/* DP registers are unknown for the new session */
+		dap_ctrl_ok    = 0;
+		dap_ctrl_dirty = 0;
+		dap_cache_v5   = 0;
+		dap_cache_flush();
+		swd_config.data_phase = dap_data_phase;
+		rsp->buffer[1] = dap_mode;
+	}
+	/* If request port is JTAG */
+	else if (req->buffer[1] == 2)
+	{
+		if (jtag_connect() == 0)
+			dap_mode = 2; // Success, now in JTAG mode
+		else
+			dap_mode = 0; // Failed
+
+		jtag_config.retry_count = dap_retry_wait;
+		/* DP registers are unknown for the new session */
+		dap_ctrl_ok    = 0;
+		dap_ctrl_dirty = 0;
+		dap_cache_v5   = 0;
+		dap_cache_flush();
+		rsp->buffer[1] = dap_mode;
+	}
+	/* For all other ports, Initialization Failed */
+	else
+		rsp->buffer[1] = 0x00;
+
+	rsp->buffer[0] = 0x02;
+	rsp->len = 2;
+
+	return(2);
+}
+
+/**
+ * @brief Handle the DAP_Delay command
+ *
+ * This command is used to wait for a specific delay (in micro-seconds)
+ *
+ * TODO This command is not implemented yet
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_delay(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#else
+	(void)req;
+#endif
+	LOG_INFO_PUTS("CMSIS: Delay (not supported yet)\r\n");
+
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	return(3);
+}
+
+/**
+ * @brief Handle the DAP_Disconnect command
+ *
+ * This command is used to release the IOs of the debug port.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_disconnect(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+
+	log_puts("CMSIS: Disconnect\r\n");
+#else
+	(void)req;
+#endif
+	if (dap_mode == 2)
+		jtag_disconnect();
+	else if (dap_mode == 1)
+		swd_disconnect();
+	else
+		ios_mode(PORT_MODE_HIZ);
+
+	dap_cache_v5 = 0;
+	dap_cache_flush();
+
+	rsp->buffer[1] = 0x00; // OK
+	rsp->len = 2;
+	return(1);
+}
+
+/**
+ * @brief Handle DAP_ExecuteCommands and DAP_QueueCommands commands
+ *
+ * These commands hold a list of DAP commands that are executed back to back.
+ * Responses of all commands are concatenated into one response packet, the
+ * host must take care that they fit into DAP_PACKET_SIZE. For queued packets,
+ * the difference is handled by the caller that waits for the next packet.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_execute_commands(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	cmsis_pkt sub_req, sub_rsp;
+	uint count, pos, pos_rsp;
+	uint i;
+	int  used;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	count   = req->buffer[1];
+	pos     = 2;
+	pos_rsp = 2;
+
+	for (i = 0; (i < count) && (pos < req->len); i++)
+	{
+		/* Nested command lists are not allowed */
+		if ((req->buffer[pos] == 0x7E) || (req->buffer[pos] == 0x7F))
+			break;
+
+		sub_req.buffer = (req->buffer + pos);
+		sub_req.len    = (req->len - pos);
+		sub_req.stream = 0;
+		sub_rsp.buffer = dap_scratch;
+		sub_rsp.len    = 0;
+		sub_rsp.stream = 0;
+		used = dap_command(&sub_req, &sub_rsp);
+		if (used < 0)
+			break;
+		pos += used;
+
+		/* Append the response (dropped if it does not fit) */
+		if ((pos_rsp + sub_rsp.len) > DAP_PACKET_SIZE)
+			break;
+		memcpy(rsp->buffer + pos_rsp, sub_rsp.buffer, sub_rsp.len);
+		pos_rsp += sub_rsp.len;
+	}
+#ifdef DEBUG_CMSIS
+	log_puts("CMSIS: Execute "); log_putdec(i);
+	log_puts(" commands\r\n");
+#endif
+	rsp->buffer[1] = i; /* Number of commands executed */
+	rsp->len = pos_rsp;
+	return(pos);
+}
+
+/**
+ * @brief Handle the DAP_HostStatus command
+ *
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_host_status(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+
+	log_puts("CMSIS: HostStatus\r\n");
+#else
+	(void)req;
+#endif
+
+	rsp->buffer[1] = 0x00; // OK
+	rsp->len = 2;
+
+	return(3);
+}
+
+/**
+ * @brief Handle the DAP_Info command
+ *
+ * This commands are used by the host software to get informations about the
+ * cmsis probe itself and about the target. There is a long list of available
+ * informations so this function only decode the identifier of the request and
+ * branch to other dedicated functions (below).
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_info(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	char *str = 0;
+	int len;
+	int result = 2;
+
+	switch (req->buffer[1])
+	{
+		/* Vendor Name (string) */
+		case 0x01:
+			goto ret_str;
+		/* Product Name (string) */
+		case 0x02:
+			goto ret_str;
+		/* Serial Number (string) */
+		case 0x03:
+			str = str_serial;
+			goto ret_str;
+		/* CMSIS-DAP Protocol Version */
+		case 0x04:
+			str = str_version;
+			goto ret_str;
+		/* Target Device Vendor */
+		case 0x05:
+		/* Target Device Name */
+		case 0x06:
+		/* Target Board Vendor */
+		case 0x07:
+		/* Target Board Name */
+		case 0x08:
+		/* Product Firmware Version */
+		case 0x09:
+			goto ret_str;
+		/* Capabilities of the Debug Unit */
+		case 0xF0:
+			result = dap_info_cap(req, rsp);
+			break;
+		/* Test Domain Timer */
+		case 0xF1:
+			rsp->buffer[1] = 0x08;
+			/* Return 0 for the timer freq */
+			rsp->buffer[2] = 0x00;
+			rsp->buffer[3] = 0x00;
+			rsp->buffer[4] = 0x00;
+			rsp->buffer[5] = 0x00;
+			rsp->len = 6;
+			break;
+		/* UART Receive Buffer Size */
+		case 0xFB:
+		/* UART Transmit Buffer Size */
+		case 0xFC:
+		/* SWO Trace Buffer Size */
+		case 0xFD:
+			rsp->buffer[1] = 0x04; /* Len */
+			goto ret_word;
+		/* Packet Count */
+		case 0xFE:
+			rsp->buffer[1] = 1; // Response size
+			rsp->buffer[2] = DAP_PACKET_COUNT;
+			rsp->len = 3;
+			break;
+		/* Packet Size */
+		case 0xFF:
+			rsp->buffer[1] = 2;    // Response size
+			rsp->buffer[2] = (DAP_PACKET_SIZE >> 0) & 0xFF;
+			rsp->buffer[3] = (DAP_PACKET_SIZE >> 8) & 0xFF;
+			rsp->len = 4;
+			break;
+
+		/* Unknown or unsupported command */
+		default:
+			result = -1;
+	}
+	return(result);
+
+/* Generic code to return a WORD */
+ret_word:
+	rsp->buffer[2] = 0x00;
+	rsp->buffer[3] = 0x00;
+	rsp->buffer[4] = 0x00;
+	rsp->buffer[5] = 0x00;
+	rsp->len = 6;
+	return(result);
+/* Generic code to return a string */
+ret_str:
+	if (str == 0)
+	{
+		rsp->buffer[1] = 0;
+		rsp->len = 2;
+		return(result);
+	}
+
+	len = strlen(str);
+	/* Insert header */
+	rsp->buffer[1] = len + 1;
+	/* Copy string into response packet */
+	strcpy((char *)(rsp->buffer + 2), str);
+	rsp->buffer[2+len] = 0; // Add a nul char to finish string
+	rsp->len = (2 + len + 1);
+	return(result);
+}
+
+/**
+ * @brief Handle Dap_Info::Capabilities command
+ *
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_info_cap(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+
+	log_puts("CMSIS: Get Capabilities\r\n");
+#else
+	(void)req;
+#endif
+	rsp->buffer[1] = 1;
+	rsp->buffer[2] = (1 << 0) | // SWD is supported
+	                 (1 << 1);  // JTAG is supported
+	rsp->len = 3;
+	return(2);
+}
+
+/**
+ * @brief Handle DAP_JTAG_Configure command
+ *
+ * This command set the number of devices into the scan chain and the length
+ * of the instruction register of each one. The DAP index of next transfers
+ * selects one of these devices.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_jtag_configure(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	uint count;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	count = req->buffer[1];
+	if (req->len < (2 + count))
+		return(-1);
+
+	if (jtag_configure(count, req->buffer + 2) == 0)
+		rsp->buffer[1] = 0x00; // OK
+	else
+		rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+
+	return(2 + count);
+}
+
+/**
+ * @brief Handle DAP_JTAG_IDCODE command
+ *
+ * This command reads the IDCODE of one device of the scan chain, with the
+ * IDCODE instruction (the TAPs are not reset). The value is read from the
+ * target once, then answered by the probe itself until disconnect (see
+ * jtag_idcode).
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_jtag_idcode(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u32 value = 0;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	if ((dap_mode == 2) && (jtag_idcode(req->buffer[1], &value) == 0))
+		rsp->buffer[1] = 0x00; // OK
+	else
+		rsp->buffer[1] = 0xFF; // ERROR
+	rsp->buffer[2] = (value >>  0) & 0xFF;
+	rsp->buffer[3] = (value >>  8) & 0xFF;
+	rsp->buffer[4] = (value >> 16) & 0xFF;
+	rsp->buffer[5] = (value >> 24) & 0xFF;
+	rsp->len = 6;
+
+	return(2);
+}
+
+/**
+ * @brief Handle DAP_JTAG_Sequence command
+ *
+ * This command generate sequences on TMS/TDI and capture TDO.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_jtag_sequence(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	uint seq_count;
+	uint tck_count;
+	u8  *p, *q;
+	uint tms, capture;
+	uint i;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	/* Extract number of sequences */
+	seq_count = req->buffer[1];
+
+#ifdef DEBUG_CMSIS_JTAG
+	log_puts("DAP_JTAG_Sequence: count="); log_putdec(seq_count);
+	log_puts("\r\n");
+#endif
+	/* Host expects the TAP into Run-Test/Idle after transfers */
+	jtag_idle();
+
+	p = (req->buffer + 2);
+	q = (rsp->buffer + 2);
+	for (i = 0; i < seq_count; i++)
+	{
+		/* Extract number of TCK clock cycle */
+		tck_count = (*p & 0x3F);
+		if (tck_count == 0)
+			tck_count = 64;
+		/* Extract TMS value */
+		tms = (*p & (1 << 6)) ?  1 : 0;
+		/* Is data capture enabled ? */
+		capture = (*p & (1 << 7)) ?  1 : 0;
+#ifdef DEBUG_CMSIS_JTAG
+		log_puts(" TCK="); log_putdec(tck_count);
+		log_puts(",TMS="); log_putdec(tms);
+		log_puts(",capture="); log_putdec(capture);
+		log_puts(" ");
+#endif
+		p++; // Move to next byte into request buffer
+		/* TDI and TDO are sent LSB first, captured bits of each sequence
+		 * start on a new byte of the response */
+		jtag_sequence(p, capture ? q : 0, tck_count, tms);
+		p += (tck_count + 7) / 8;
+		if (capture)
+			q += (tck_count + 7) / 8;
+	}
+	/* Wait for the captured bits (shifts may be queued) */
+	jtag_sync();
+#ifdef DEBUG_CMSIS_JTAG
+	if (seq_count > 0)
+	{
+		log_puts("\r\nDAP_JTAG_Sequence response len=");
+		log_putdec(q - rsp->buffer);
+		log_puts("\r\n");
+	}
+#endif
+
+	rsp->buffer[1] = 0x00; // OK
+	rsp->len = (q - rsp->buffer);
+
+	return(p - req->buffer);
+}
+
+/**
+ * @brief Handle DAP_ResetTarget command
+ *
+ * This command request a target reset with device specific sequence.
+ *
+ * TODO This command is not implemented yet
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_reset_target(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#else
+	(void)req;
+#endif
+	LOG_INFO_PUTS("CMSIS: ResetTarget (not supported yet)\r\n");
+
+	/* Inform the host that this command is known but not implemented */
+	rsp->buffer[1] = 0x00; /* Command status OK */
+	rsp->buffer[2] = 0x00; /* Execute: 0 = not implemented */
+	rsp->len = 3;
+
+	return(1);
+}
+
+/**
+ * @brief Handle DAP_SWD_Configure command
+ *
+ * This command is used to set configuration parameters specific to SWD
+ * interface (like turnaround period or data phase).
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_swd_configure(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	/* Extract new SWD configuration values */
+	dap_ta_period  = ((req->buffer[1] & 0x03) + 1);
+	dap_data_phase =  (req->buffer[1] & 4) ? 1 : 0;
+
+	swd_config.turnaround = dap_ta_period;
+	swd_config.data_phase = dap_data_phase;
+
+#ifdef DEBUG_CMSIS
+	log_puts("DAP: Configure SWD,");
+	log_puts(" TA_period="); log_putdec(dap_ta_period);
+	log_puts(" DataPhase="); log_putdec(dap_data_phase);
+	log_puts("\r\n");
+#endif
+
+	rsp->buffer[1] = 0x00; // OK
+	rsp->len = 2;
+	return(2);
+}
+
+/**
+ * @brief Handle DAP_SWD_Sequence command
+ *
+ * This command is used to generate special sequences in SWD mode on the pins
+ * SWDCLK and/or SWDIO.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_swd_sequence(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	uint seq_count;
+	u8  *p, *q;
+	int tck_count;
+	uint i;
+	int j, l;
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	/* Extract number of sequences */
+	seq_count = req->buffer[1];
+
+#ifdef DEBUG_CMSIS_SEQ
+	log_puts("DAP_SWD_Sequence: count="); log_putdec(seq_count);
+#endif
+
+	p = (req->buffer + 2);
+	q = (rsp->buffer + 2);
+	for (i = 0; i < seq_count; i++)
+	{
+		/* Extract number of TCK clock cycle */
+		tck_count = (p[0] & 0x3F);
+		if (tck_count == 0)
+			tck_count = 64;
+
+		// If sequence direction is specified as input
+		if (p[0] & 0x80)
+		{
+#ifdef DEBUG_CMSIS_SEQ
+			log_puts(" IN("); log_putdec(tck_count); log_puts(")");
+#endif
+			// Force SWD-IO pin to input
+			swd_io_dir(IO_DIR_IN);
+			// Read the specified number of bits
+			for (j = tck_count; j > 0; j -= l)
+			{
+				l = (j >= 8) ? 8 : j;
+				*q++ = swd_rd(l);
+			}
+			p++;
+		}
+		// Sequence direction is specified as output
+		else
+		{
+#ifdef DEBUG_CMSIS_SEQ
+			log_puts(" OUT("); log_putdec(tck_count); log_puts(")");
+#endif
+			p++;
+			// Force SWD-IO pin to output
+			swd_io_dir(IO_DIR_OUT);
+			// Write the specified number of bits
+			for (j = tck_count; j > 0; j -= l)
+			{
+				l = (j >= 8) ? 8 : j;
+				swd_wr(*p++, l);
+			}
+		}
+	}
+#ifdef DEBUG_CMSIS_SEQ
+	log_puts("\r\n");
+#endif
+	/* Any sequence can reset or desync the target */
+	dap_cache_flush();
+
+	rsp->buffer[1] = 0x00; // OK
+	rsp->len = (q - rsp->buffer);
+	swd_io_dir(IO_DIR_OUT);
+
+	return(p - req->buffer);
+}
+
+/**
+ * @brief Handle DAP_SWJ_Clock command
+ *
+ * This command is used to set the clock frequency of the bus (common to SWD
+ * and JTAG modes).
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_swj_clock(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+
+	rsp->len = 2;
+
+	/* Clock value is a 32 bits little-endian frequency (Hz) */
+	dap_clock = (req->buffer[4] << 24) | (req->buffer[3] << 16) |
+	              (req->buffer[2] <<  8) |  req->buffer[1];
+	if (dap_clock == 0)
+	{
+		rsp->buffer[1] = 0xFF; // Error
+		return(5);
+	}
+
+	/* Compute new timings, then apply them to running engines */
+	swj_clock_set(dap_clock);
+	swd_clock();
+	jtag_clock();
+
+#ifdef DEBUG_CMSIS
+	log_puts("CMSIS: Set clock ");
+	log_putdec(dap_clock);
+	log_puts(" Hz (pio=");
+	log_putdec(swj_clk.freq_pio);
+	log_puts(" gpio=");
+	log_putdec(swj_clk.freq_gpio);
+	log_puts(")\r\n");
+#endif
+
+	rsp->buffer[1] = 0x00; // OK
+	return(5);
+}
+
+/**
+ * @brief Handle DAP_SWJ_Pins command
+ *
+ * This command is used to monitor and control the IOs pins including
+ * reset lines.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_swj_pins(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	uint8_t output;
+	uint8_t select;
+	uint8_t wait;
+	uint8_t sig;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+
+	log_puts("CMSIS: Set DAP_SWJ pins\r\n");
+#endif
+	output = req->buffer[1];
+	select = req->buffer[2];
+	wait   = req->buffer[3];
+
+	/* Bit0: TCK/SWD-CLK */
+	if (select & (1 << 0))
+	{
+		sig = (output & (1 << 0)) ? 1 : 0;
+		ios_pin_set(PORT_D2_PIN, sig);
+	}
+	/* Bit1: TMS/SWD-DAT */
+	if (select & (1 << 1))
+	{
+		sig = (output & (1 << 1)) ? 1 : 0;
+		ios_pin_set(PORT_D1_PIN, sig);
+	}
+	/* Bit3: TDO */
+	if (select & (1 << 3))
+	{
+		/* TDO signal available only in JTAG mode */
+		if (dap_mode == 2)
+		{
+			sig = (output & (1 << 3)) ? 1 : 0;
+			ios_pin_set(PORT_D3_PIN, sig);
+		}
+	}
+	/* Bit5: nTRST */
+	if (select & (1 << 5))
+	{
+		/* nTRST is not available */
+	}
+	/* Bit7: nReset */
+	if (select & (1 << 7))
+	{
+		/* Reset signal available only in SWD mode */
+		if (dap_mode == 1)
+		{
+			sig = (output & (1 << 7)) ? 1 : 0;
+			ios_pin_set(PORT_D3_PIN, sig);
+		}
+	}
+	/* TODO: Handle wait argument */
+	(void)wait;
+
+	/* State of target is unknown when pins are driven by host */
+	if (select)
+		dap_cache_flush();
+
+	/* Insert current IOs values into response */
+	rsp->buffer[1] = (ios_pin(PORT_D1_PIN) << 1) |
+	                 (ios_pin(PORT_D2_PIN) << 0);
+	if (dap_mode == 1)
+		rsp->buffer[1] |= (ios_pin(PORT_D3_PIN) << 7);
+	else if (dap_mode == 2)
+		rsp->buffer[1] |= (ios_pin(PORT_D3_PIN) << 3);
+
+	rsp->len = 2;
+	return(7);
+}
+
+/**
+ * @brief Handle DAP_SWJ_Sequence command
+ *
+ * This command is used to send a sequence of bits without taking care about
+ * input value or state of the target. This allow (for example) to send bit
+ * pattern for SWD/JTAG reset or SWD->JTAG transition.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_swj_sequence(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	unsigned char *p, v;
+	int bit_count, bit_sent, bit_rem;
+	int len;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	/* Extract bit count from the first field of the request */
+	bit_count = (req->buffer[1] == 0) ? 256 : req->buffer[1];
+
+#ifdef DEBUG_CMSIS
+	log_puts("DAP: SWJ_Sequence");
+	log_puts(" bit_count="); log_putdec(bit_count);
+	log_puts("\r\n");
+#endif
+	/* Host expects the TAP into Run-Test/Idle after transfers */
+	if (dap_mode == 2)
+		jtag_idle();
+
+	p = (req->buffer + 2);
+
+	for (bit_sent = 0; bit_sent < bit_count ; )
+	{
+		/* Extract next byte */
+		v = *p;
+		bit_rem = (bit_count - bit_sent);
+		len = (bit_rem > 8) ? 8 : bit_rem;
+
+		/* Process according to port mode */
+		if (dap_mode == 1)
+			swd_wr(v, len);
+		else
+			jtag_tms_sequence(v, len);
+
+		/* Update counter of processed bits */
+		bit_sent += len;
+		p++;
+	}
+	/* Sequence can be a line reset, cached registers must be read again */
+	dap_cache_flush();
+
+	/* Sequence complete ! prepare response */
+	rsp->buffer[1] = 0x00; // OK
+	rsp->len = 2;
+
+	return(2 + ((bit_count + 7) / 8));
+}
+
+/**
+ * @brief Handle DAP_Transfer command
+ *
+ * This command is used to read or write data to CoreSight registers. Each
+ * access is for a 32bits value. A read with "Value Match" is repeated by the
+ * probe until (value & mask) equals the match value, up to the RetryMatch
+ * count of DAP_TransferConfigure ; a write with "Match Mask" only updates the
+ * mask. This allows to poll a status register with a single packet.
+ *
+ * When enabled (see dap_vendor_config), the transfers of a command are first
+ * pipelined with sticky overrun detection (see dap_xfer_pipe). Writes to
+ * SELECT, CSW and TAR that do not change their value are skipped (see
+ * dap_cache_write).
+ *
+ * A truncated request, or one with a response larger than a packet, is not
+ * executed : the response reports no transfer and the whole packet is used.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_transfer(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	dap_xfer x;
+	int count, pos, reads;
+	int request, ack;
+	u32 data;
+	int i;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+
+	/* Error response : no transfer done */
+	rsp->buffer[1] = 0;
+	rsp->buffer[2] = 0;
+	rsp->len = 3;
+	if (req->len < 3)
+		return(req->len);
+	count = req->buffer[2];
+
+	/* Check the whole request first : nothing is done if it is invalid */
+	for (i = 0, pos = 3, reads = 0; i < count; i++)
+	{
+		if (pos >= req->len)
+			return(req->len);
+		request = req->buffer[pos++];
+		/* Write value or match value */
+		if (((request & (1 << 1)) == 0) || (request & (1 << 4)))
+			pos += 4;
+		else
+			reads++;
+	}
+	if ((pos > req->len) || ((3 + (reads * 4)) > DAP_PACKET_SIZE))
+		return(req->len);
+
+#ifdef DEBUG_CMSIS_TR
+	log_puts("CMSIS: DAP Transfer with ");
+	log_putdec(count);
+	log_puts(" requests\r\n");
+#endif
+	memset(&x, 0, sizeof(dap_xfer));
+	x.st.pos      = 3;
+	x.st.pos_resp = 3;
+	x.rsp         = rsp->buffer;
+
+	/* CTRL/STAT not restored after last pipelined command, try again */
+	if (dap_ctrl_dirty)
+	{
+		data = dap_ctrl;
+		if (swd_transfer(0x04, &data) == 1)
+		{
+			swd_config.data_phase = dap_data_phase;
+			dap_ctrl_dirty = 0;
+		}
+	}
+
+	ack = 0;
+	/* With JTAG, the DAP index selects a device of the scan chain */
+	if ((dap_mode != 2) || (jtag_select(req->buffer[1]) == 0))
+	{
+		if (dap_xfer_pipe_ok(req))
+			ack = dap_xfer_pipe(&x, req);
+		/* Normal mode, or continue after an error in pipelined mode */
+		if (ack == 0)
+			ack = dap_xfer_run(&x, req);
+	}
+	/* Cached registers may have not been written as expected */
+	if ((ack & 0x07) != 1)
+		dap_cache_error(ack, x.select, x.select_ok);
+
+	/* Make response header */
+	rsp->buffer[1] = x.st.i; /* Number of transfer */
+	rsp->buffer[2] = ack;    /* Status of last transfer */
+	rsp->len = x.st.pos_resp;
+
+	/* Size of the request, including transfers not processed */
+	return(pos);
+}
+
+/**
+ * @brief Handle DAP_TransferBlock command
+ *
+ * This command is used to read or write a block of data to a single register
+ * (typically DRW of a MEM-AP with auto-increment). Reads on AP are posted :
+ * the value of each read is returned by the next one, and the last value is
+ * obtained by reading RDBUFF. The response can use more than one USB packet.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_transfer_block(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	uint count, done, max;
+	uint request, used;
+	u32 data;
+	u8  *p, *q;
+	int  ack = 1;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	if (req->len < 5)
+		return(-1);
+
+	count   = (req->buffer[3] << 8) | req->buffer[2];
+	request =  req->buffer[4];
+	/* Size of the request : header and data to write */
+	used = 5;
+	if ((request & (1 << 1)) == 0)
+		used += (count * 4);
+
+#ifdef DEBUG_CMSIS_TR
+	log_puts("CMSIS: DAP TransferBlock with ");
+	log_putdec(count);
+	log_puts(" requests\r\n");
+#endif
+	p = (req->buffer + 5);
+	q = (rsp->buffer + 4);
+	done = 0;
+
+	/* With JTAG, the DAP index selects a device of the scan chain */
+	if ((dap_mode == 2) && (jtag_select(req->buffer[1]) != 0))
+	{
+		count = 0;
+		ack   = 0;
+	}
+
+	/* If RnW bit is set, read request */
+	if (request & (1 << 1))
+	{
+		/* Limit count to the size of the response buffer */
+		max = (DAP_PACKET_SIZE - 4) / 4;
+		if (count > max)
+			count = max;
+
+		/* In case of a read on AP, insert an extra read cycle */
+		if ((request & (1 << 0)) && count)
+		{
+			dap_cache_access(request);
+			ack = dap_port_transfer(request, &data);
+		}
+
+		for ( ; (ack == 1) && (done < count); done++)
+		{
+			/* Last value of a posted read is in RDBUFF */
+			if ((request & (1 << 0)) && (done == (count - 1)))
+				ack = dap_port_transfer(0x0C | (1 << 1), &data);
+			else
+			{
+				dap_cache_access(request);
+				ack = dap_port_transfer(request, &data);
+			}
+			if (ack != 1)
+				break;
+
+			*q++ = ((data >>  0) & 0xFF);
+			*q++ = ((data >>  8) & 0xFF);
+			*q++ = ((data >> 16) & 0xFF);
+			*q++ = ((data >> 24) & 0xFF);
+		}
+	}
+	/* RnW is clear, Write request */
+	else
+	{
+		/* Limit count to the data available into request */
+		max = (req->len - 5) / 4;
+		if (count > max)
+			count = max;
+		/* Only writes to DRW are tracked by the cache */
+		if ((request & 0x0D) != 0x0D)
+			dap_cache_flush();
+
+		for ( ; done < count; done++)
+		{
+			data  = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+			p += 4;
+			dap_cache_access(request);
+			ack = dap_port_transfer(request, &data);
+			if (ack != 1)
+				break;
+		}
+		/* Read RDBUFF to get the status of the last write */
+		if ((ack == 1) && count)
+			ack = dap_port_transfer(0x0C | (1 << 1), 0);
+	}
+
+	if (ack != 1)
+		dap_cache_error(ack, dap_select, dap_select_ok);
+
+	/* Make response header */
+	rsp->buffer[1] = (done >> 0) & 0xFF; /* Number of transfer */
+	rsp->buffer[2] = (done >> 8) & 0xFF;
+	rsp->buffer[3] = ack;                /* Status of last transfer */
+	rsp->len = (q - rsp->buffer);
+
+	return(used);
+}
+
+/**
+ * @brief Handle DAP_TransferConfigure command
+ *
+ * This command is used to set some parameters that will be used for next
+ * DAP_Transfer and DAP_TransferBlock commands.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_transfer_configure(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	/* Extract new Transfer configuration values */
+	dap_idle_cycles = req->buffer[1];
+	dap_retry_wait  = (req->buffer[3] << 8) | req->buffer[2];
+	dap_retry_match = (req->buffer[5] << 8) | req->buffer[4];
+
+	swd_config.retry_count = dap_retry_wait;
+	swd_config.idle_cycles = dap_idle_cycles;
+	jtag_config.retry_count = dap_retry_wait;
+	jtag_config.idle_cycles = dap_idle_cycles;
+
+#ifdef DEBUG_CMSIS
+	log_puts("DAP: Configure transfer:");
+	log_puts(" IdleCycles="); log_putdec(dap_idle_cycles);
+	log_puts(" RetryWait=");  log_putdec(dap_retry_wait);
+	log_puts(" RetryMatch="); log_putdec(dap_retry_match);
+	log_puts("\r\n");
+#endif
+
+	rsp->buffer[0] = 0x04;
+	rsp->buffer[1] = 0x00; // OK
+	rsp->len = 2;
+
+	return(6);
+}
+
+/**
+ * @brief Handle the Cowprobe boundary scan vendor command (0x89)
+ *
+ * The host uploads a map of pins derived from the BSDL file of one device
+ * (see jtag_bscan.c), then pins are set and sampled by the probe : each
+ * request translates to DR scans without round trip to the host.
+ *
+ * Setup   : [0x89, 0x00, index, length(2), extest(4), sample(4)]
+ *   Device into the chain, length of its boundary-scan register, opcodes of
+ *   EXTEST and SAMPLE/PRELOAD. The map is cleared.
+ * Map     : [0x89, 0x01, first, count, count * {input(2), output(2),
+ *            control(2), disable}]
+ *   Cells of pins first to first + count - 1 (0xFFFF : no cell), disable is
+ *   the value of the control cell for high impedance.
+ * Set     : [0x89, 0x02, count, count * {pin, state}]
+ *   State is 0:low 1:high 2:high impedance. EXTEST is loaded by the first
+ *   Set (after a preload of the register). Two scans are done : levels are
+ *   captured before the update of the first one.
+ * Sample  : [0x89, 0x03, count(2)]
+ *   Sample the pins count times, back to back (continuous sampling).
+ * Release : [0x89, 0x04]
+ *   Reset the TAP, the device drives its pins again.
+ *
+ * Response : [0x89, status] for Setup, Map and Release, [0x89, status, pins]
+ * for Set and [0x89, status, count * pins] for Sample, where pins holds the
+ * level of each pin (one bit per pin, pin 0 into LSB of the first byte).
+ * Snapshots longer than one packet are streamed (see cmsis_pkt). Status is
+ * 0x00 on success, an invalid request or a port that is not in JTAG mode
+ * gets [0x89, 0xFF].
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_bscan(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u8  *p = req->buffer;
+	u8   pins[(JTAG_BSCAN_PINS + 7) / 8];
+	uint count, size, used, i;
+	int  result = 0;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if (req->len < 2)
+		return(req->len);
+
+	/* Length of the request, other commands can follow it */
+	switch (p[1])
+	{
+		case 0x00: used = 13; break;
+		case 0x01: used = (req->len < 4) ? 0 : (4 + (p[3] * 7)); break;
+		case 0x02: used = (req->len < 3) ? 0 : (3 + (p[2] * 2)); break;
+		case 0x03: used = 4; break;
+		case 0x04: used = 2; break;
+		default:   used = 0; break;
+	}
+	if ((used == 0) || (used > req->len))
+		return(req->len);
+	if (dap_mode != 2)
+		return(used);
+	size = (jtag_bscan_pins() + 7) / 8;
+
+	switch (p[1])
+	{
+		/* Setup */
+		case 0x00:
+			result = jtag_bscan_setup(p[2], (p[4] << 8) | p[3],
+				(p[8]  << 24) | (p[7]  << 16) | (p[6]  << 8) | p[5],
+				(p[12] << 24) | (p[11] << 16) | (p[10] << 8) | p[9]);
+			break;
+		/* Map */
+		case 0x01:
+			count = p[3];
+			for (i = 0, p += 4; (i < count) && (result == 0); i++, p += 7)
+				result = jtag_bscan_map(req->buffer[2] + i,
+				                        (p[1] << 8) | p[0], (p[3] << 8) | p[2],
+				                        (p[5] << 8) | p[4], p[6]);
+			break;
+		/* Set, then scan */
+		case 0x02:
+			count = p[2];
+			for (i = 0, p += 3; (i < count) && (result == 0); i++, p += 2)
+				result = jtag_bscan_set(p[0], p[1]);
+			if (result == 0)
+				result = jtag_bscan_scan(0);
+			if (result == 0)
+				result = jtag_bscan_scan(rsp->buffer + 2);
+			if (result == 0)
+				rsp->len = 2 + size;
+			break;
+		/* Sample */
+		case 0x03:
+			count = (p[3] << 8) | p[2];
+			/* Response must fit into one packet if it can not be streamed */
+			if ((size == 0) || (count == 0) ||
+			    ((rsp->stream == 0) && ((2 + (count * size)) > DAP_PACKET_SIZE)))
+				return(used);
+			if (jtag_bscan_scan(pins) != 0)
+				return(used);
+			rsp->buffer[1] = 0x00; // OK
+			for (i = 0; i < count; i++)
+			{
+				if ((i > 0) && (jtag_bscan_scan(pins) != 0))
+					break;
+				for (p = pins; p < (pins + size); p++)
+					dap_mem_out(rsp, *p, 1);
+			}
+			/* After an error, complete the response with zeros */
+			if (i < count)
+				dap_mem_out(rsp, 0, (count - i) * size);
+			return(used);
+		/* Release */
+		case 0x04:
+			jtag_bscan_release();
+			break;
+	}
+	if (result == 0)
+		rsp->buffer[1] = 0x00; // OK
+	return(used);
+}
+
+/**
+ * @brief Handle the Cowprobe JTAG scan chain detection vendor command (0x87)
+ *
+ * This command detects the number of devices, their IDCODE and the length
+ * of their IR in a single call (see jtag_detect). The result is kept until
+ * disconnect, so next calls (reattach of a debugger) do not use the port.
+ *
+ * Request  : [0x87, flags]
+ *   flags bit 0 : scan the chain again
+ * Response : [0x87, status, count, ir_len(count), idcode(4 x count)]
+ *
+ * Status is 0x00 when the chain has been configured (like with
+ * DAP_JTAG_Configure) or 0x01 when the IR lengths are not known (reported
+ * as zero, the chain must be configured by the host). When no device is
+ * found, or the port is not in JTAG mode, the response is [0x87, 0xFF].
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_chain(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	const jtag_chain *chain;
+	u8  *p;
+	uint i;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if (dap_mode != 2)
+		return(2);
+
+	chain = jtag_detect(req->buffer[1] & (1 << 0));
+	if (chain->count == 0)
+		return(2);
+
+	rsp->buffer[1] = chain->ir_ok ? 0x00 : 0x01;
+	rsp->buffer[2] = chain->count;
+	p = rsp->buffer + 3;
+	for (i = 0; i < chain->count; i++)
+		*p++ = chain->ir_ok ? chain->ir_len[i] : 0;
+	for (i = 0; i < chain->count; i++)
+	{
+		*p++ = (chain->idcode[i] >>  0) & 0xFF;
+		*p++ = (chain->idcode[i] >>  8) & 0xFF;
+		*p++ = (chain->idcode[i] >> 16) & 0xFF;
+		*p++ = (chain->idcode[i] >> 24) & 0xFF;
+	}
+	rsp->len = (p - rsp->buffer);
+	return(2);
+}
+
+/**
+ * @brief Handle the Cowprobe configuration vendor command (0x80)
+ *
+ * Request : [0x80, option, value] ; response : [0x80, status]. Options :
+ *  - 0x01 : Pipelined DAP_Transfer with sticky overrun (0:off 1:on)
+ *  - 0x02 : Cache of SELECT, CSW and TAR (0:off 1:on, default on)
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_config(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0x00; // OK
+
+	switch (req->buffer[1])
+	{
+		case 0x01:
+			dap_orun = req->buffer[2] ? 1 : 0;
+			break;
+		case 0x02:
+			dap_cache = req->buffer[2] ? 1 : 0;
+			/* Values written while disabled are not known */
+			dap_cache_flush();
+			break;
+		default:
+			rsp->buffer[1] = 0xFF; // ERROR
+			break;
+	}
+	rsp->len = 2;
+	return(3);
+}
+
+/**
+ * @brief Handle the Cowprobe CRC32 vendor command (0x84)
+ *
+ * This command reads a block of memory like the memory access command, but
+ * data is sent to the CRC module instead of the host : only the CRC32 (IEEE
+ * 802.3, like zlib) is returned. Used to verify a flashed image, or to skip
+ * the programming of unchanged sectors.
+ *
+ * Request  : [0x84, mode, apsel, address(4), length(4)]
+ *   mode bits [1:0] : size of accesses (0:byte 1:halfword 2:word)
+ * Response : [0x84, status, done(4), crc(4)]
+ *
+ * Status is the ACK of the last transfer, done is the number of bytes read
+ * and the CRC is computed on these bytes. An invalid request (or a probe
+ * without CRC module) gets [0x84, 0xFF].
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_crc(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u8  *p = req->buffer;
+	uint size, len, done;
+	u32  addr, crc;
+	int  ack;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	size = (p[1] & 0x03);
+	addr = (p[6]  << 24) | (p[5] << 16) | (p[4] << 8) | p[3];
+	len  = (p[10] << 24) | (p[9] << 16) | (p[8] << 8) | p[7];
+
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if (req->len < 11)
+		return(req->len);
+	if ((dap_mode != 1) || (size > 2) ||
+	    (addr & ((1 << size) - 1)) || (len & ((1 << size) - 1)))
+		return(11);
+	if (crc_start() < 0)
+		return(11);
+
+	done = 0;
+	crc  = 0;
+	ack = dap_mem_setup(p[2], size);
+	if (ack == 1)
+		ack = dap_mem_crc(addr, len, size, &done, &crc);
+	if (ack != 1)
+		dap_cache_flush();
+
+	rsp->buffer[1] = ack;
+	rsp->buffer[2] = (done >>  0) & 0xFF;
+	rsp->buffer[3] = (done >>  8) & 0xFF;
+	rsp->buffer[4] = (done >> 16) & 0xFF;
+	rsp->buffer[5] = (done >> 24) & 0xFF;
+	rsp->buffer[6] = (crc  >>  0) & 0xFF;
+	rsp->buffer[7] = (crc  >>  8) & 0xFF;
+	rsp->buffer[8] = (crc  >> 16) & 0xFF;
+	rsp->buffer[9] = (crc  >> 24) & 0xFF;
+	rsp->len = 10;
+	return(11);
+}
+
+/**
+ * @brief Handle the Cowprobe sector diff vendor command (0x85)
+ *
+ * For differential programming : the host sends the CRC32 of the sectors of
+ * its image, the probe computes the CRC of the same sectors into target and
+ * returns a bitmap of the sectors that differ (only these ones have to be
+ * erased and programmed).
+ *
+ * Request  : [0x85, mode, apsel, sector_size(4), count, count * {addr(4), crc(4)}]
+ *   mode bits [1:0] : size of accesses (0:byte 1:halfword 2:word)
+ * Response : [0x85, status, done, bitmap(4)]
+ *
+ * Bit n of bitmap is set when sector n differs. Status is the ACK of the
+ * last transfer, done is the number of sectors checked (before an error).
+ * Up to 31 sectors per request. An invalid request gets [0x85, 0xFF].
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_diff(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u8  *p = req->buffer;
+	uint size, len, count, done, n, i;
+	u32  addr, crc, diff;
+	int  ack;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if (req->len < 8)
+		return(req->len);
+	size  = (p[1] & 0x03);
+	len   = (p[6] << 24) | (p[5] << 16) | (p[4] << 8) | p[3];
+	count = p[7];
+	if ((req->len < (8 + count * 8)) || (count > 31))
+		return(req->len);
+	if ((dap_mode != 1) || (size > 2) || (len & ((1 << size) - 1)))
+		return(8 + count * 8);
+	for (i = 0, p += 8; i < count; i++, p += 8)
+	{
+		addr = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+		if (addr & ((1 << size) - 1))
+			return(8 + count * 8);
+	}
+
+	if (crc_start() < 0)
+		return(8 + count * 8);
+
+	diff = 0;
+	ack  = dap_mem_setup(req->buffer[2], size);
+	for (i = 0, p = req->buffer + 8; (ack == 1) && (i < count); i++, p += 8)
+	{
+		crc_start();
+		addr = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+		n = 0;
+		ack = dap_mem_crc(addr, len, size, &n, &crc);
+		if (ack != 1)
+			break;
+		if (crc != (u32)((p[7] << 24) | (p[6] << 16) | (p[5] << 8) | p[4]))
+			diff |= (1u << i);
+	}
+	done = i;
+	if (ack != 1)
+		dap_cache_flush();
+
+	rsp->buffer[1] = ack;
+	rsp->buffer[2] = done;
+	rsp->buffer[3] = (diff >>  0) & 0xFF;
+	rsp->buffer[4] = (diff >>  8) & 0xFF;
+	rsp->buffer[5] = (diff >> 16) & 0xFF;
+	rsp->buffer[6] = (diff >> 24) & 0xFF;
+	rsp->len = 7;
+	return(8 + count * 8);
+}
+
+/**
+ * @brief Handle the Cowprobe RISC-V debug module vendor command (0x8A)
+ *
+ * Operations on the Debug Module Interface of a RISC-V DTM are executed by
+ * the probe (see jtag_dmi.c) : DMI scans are pipelined and busy responses
+ * are retried locally, so one request replaces many round trips.
+ *
+ * Setup    : [0x8A, 0x00, index]
+ *   Find the DTM of the device index of the chain.
+ * Batch    : [0x8A, 0x01, count, count * {op, address(2), data(4)}]
+ *   Read (op 1) or write (op 2) DM registers, data is only present for a
+ *   write. Up to JTAG_DMI_QUEUE operations and 63 reads.
+ * Register : [0x8A, 0x02, write, regno(2), value(4)]
+ *   Read or write a register of the halted hart with an abstract command
+ *   (32 bits). Value is only used by a write.
+ * Read     : [0x8A, 0x03, address(4), count(2)]
+ *   Read count words of memory through the system bus.
+ * Write    : [0x8A, 0x04, address(4), count(2), data (count * 4 bytes)]
+ *   Write count words of memory through the system bus.
+ *
+ * Response to Setup    : [0x8A, status, dtmcs(4)]
+ * Response to Batch    : [0x8A, status, done, reads * data(4)]
+ * Response to Register : [0x8A, status, value(4)]
+ * Response to Read     : [0x8A, data (count * 4 bytes), status, done(2)]
+ * Response to Write    : [0x8A, status, done(2)]
+ *
+ * Status is DMI_OK or a DMI error (see jtag_dmi.h), done is the number of
+ * operations or words completed (data after an error is zero). When an
+ * abstract command fails, value is abstractcs.cmderr. A read response longer
+ * than one packet is streamed (see cmsis_pkt). An invalid request or a port
+ * that is not in JTAG mode gets [0x8A, 0xFF].
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_dmi(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u8  *p = req->buffer;
+	u32  data[JTAG_DMI_QUEUE];
+	u32  addr, value;
+	uint count, done, reads, n, i;
+	int  status;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if ((req->len < 2) || (dap_mode != 2))
+		return(req->len);
+
+	switch (p[1])
+	{
+		/* Setup */
+		case 0x00:
+			if (req->len < 3)
+				return(req->len);
+			value  = 0;
+			status = jtag_dmi_setup(p[2], &value);
+			rsp->buffer[1] = status;
+			rsp->buffer[2] = (value >>  0) & 0xFF;
+			rsp->buffer[3] = (value >>  8) & 0xFF;
+			rsp->buffer[4] = (value >> 16) & 0xFF;
+			rsp->buffer[5] = (value >> 24) & 0xFF;
+			rsp->len = 6;
+			return(3);
+		/* Batch of DMI operations */
+		case 0x01:
+			if (req->len < 3)
+				return(req->len);
+			count = p[2];
+			if (count > JTAG_DMI_QUEUE)
+				return(req->len);
+			/* Check the whole request first : nothing is done if it is invalid */
+			for (i = 0, n = 3, reads = 0; i < count; i++)
+			{
+				if (((n + 3) > req->len) || ((p[n] != 1) && (p[n] != 2)))
+					return(req->len);
+				if (p[n] == 1)
+					reads++;
+				n += (p[n] == 1) ? 3 : 7;
+			}
+			if ((n > req->len) || ((3 + (reads * 4)) > DAP_PACKET_SIZE))
+				return(req->len);
+
+			memset(data, 0, sizeof(data));
+			for (i = 0, n = 3, reads = 0; i < count; i++, n += 3)
+			{
+				addr = (p[n + 2] << 8) | p[n + 1];
+				if (p[n] == 1)
+				{
+					jtag_dmi_read(addr, &data[reads++]);
+					continue;
+				}
+				jtag_dmi_write(addr, (p[n + 6] << 24) | (p[n + 5] << 16) |
+				                     (p[n + 4] <<  8) |  p[n + 3]);
+				n += 4;
+			}
+			status = jtag_dmi_exec(&done);
+			rsp->buffer[1] = status;
+			rsp->buffer[2] = done;
+			rsp->len = 3;
+			for (i = 0; i < reads; i++)
+				dap_mem_out(rsp, data[i], 4);
+			return(n);
+		/* Abstract command : access to a register */
+		case 0x02:
+			if (req->len < 9)
+				return(req->len);
+			value  = (p[8] << 24) | (p[7] << 16) | (p[6] << 8) | p[5];
+			status = jtag_dmi_reg((p[4] << 8) | p[3], &value, p[2]);
+			rsp->buffer[1] = status;
+			rsp->buffer[2] = (value >>  0) & 0xFF;
+			rsp->buffer[3] = (value >>  8) & 0xFF;
+			rsp->buffer[4] = (value >> 16) & 0xFF;
+			rsp->buffer[5] = (value >> 24) & 0xFF;
+			rsp->len = 6;
+			return(9);
+		/* System bus read */
+		case 0x03:
+			if (req->len < 8)
+				return(req->len);
+			addr  = (p[5] << 24) | (p[4] << 16) | (p[3] << 8) | p[2];
+			count = (p[7] << 8) | p[6];
+			/* Response must fit into one packet if it can not be streamed */
+			if ((addr & 3) || (count == 0) ||
+			    ((rsp->stream == 0) && ((4 + (count * 4)) > DAP_PACKET_SIZE)))
+				return(8);
+			rsp->len = 1;
+			status = DMI_OK;
+			for (done = 0; (status == DMI_OK) && (done < count); done += n)
+			{
+				n = count - done;
+				if (n > JTAG_DMI_BLOCK)
+					n = JTAG_DMI_BLOCK;
+				status = jtag_dmi_mem_read(addr + (done * 4), data, n);
+				if (status != DMI_OK)
+					break;
+				for (i = 0; i < n; i++)
+					dap_mem_out(rsp, data[i], 4);
+			}
+			/* After an error, complete the response with zeros */
+			if (done < count)
+				dap_mem_out(rsp, 0, (count - done) * 4);
+			dap_mem_out(rsp, status, 1);
+			dap_mem_out(rsp, done, 2);
+			return(8);
+		/* System bus write, data must be into this request */
+		case 0x04:
+			if (req->len < 8)
+				return(req->len);
+			addr  = (p[5] << 24) | (p[4] << 16) | (p[3] << 8) | p[2];
+			count = (p[7] << 8) | p[6];
+			if ((8 + (count * 4)) > req->len)
+				return(req->len);
+			if ((addr & 3) || (count == 0))
+				return(8 + (count * 4));
+			status = DMI_OK;
+			for (done = 0, p += 8; (status == DMI_OK) && (done < count); done += n)
+			{
+				n = count - done;
+				if (n > JTAG_DMI_BLOCK)
+					n = JTAG_DMI_BLOCK;
+				for (i = 0; i < n; i++, p += 4)
+					data[i] = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+				status = jtag_dmi_mem_write(addr + (done * 4), data, n);
+				if (status != DMI_OK)
+					break;
+			}
+			rsp->buffer[1] = status;
+			rsp->buffer[2] = (done >> 0) & 0xFF;
+			rsp->buffer[3] = (done >> 8) & 0xFF;
+			rsp->len = 4;
+			return(8 + (count * 4));
+	}
+	return(req->len);
+}
+
+/**
+ * @brief Handle the Cowprobe flash algorithm vendor command (0x86)
+ *
+ * The host loads a flash algorithm (CMSIS-Pack FLM style) into target RAM
+ * with the memory access command, then the probe runs its functions : pages
+ * are loaded into two RAM buffers, ProgramPage runs on one buffer while the
+ * next page is loaded into the other one, completion is polled locally.
+ *
+ * Setup   : [0x86, 0x00, apsel, bkpt(4), sb(4), sp(4), program(4), buf0(4),
+ *            buf1(4), page(4), timeout(4)]
+ *   Halt the core. Functions return to bkpt (a breakpoint instruction), R9
+ *   is set to sb. Timeout is the max number of polls of DHCSR.
+ * Call    : [0x86, 0x01, pc(4), r0(4), r1(4), r2(4), r3(4)]
+ *   Program the pending page, then run the function at pc (Init, UnInit,
+ *   EraseSector ...) and wait for its end.
+ * Program : [0x86, 0x02, address(4), length(2), data(length)]
+ *   Add data to the page being loaded. ProgramPage is started when the page
+ *   is full, or when data is not contiguous (partial page).
+ * Flush   : [0x86, 0x03]
+ *   Program the pending page and wait for the end of all functions.
+ *
+ * Response : [0x86, status, result(4)] ; an invalid request gets
+ * [0x86, 0xFF]. Status is FLM_OK or the first error since setup, result is
+ * the value returned by the function (R0) or the ACK of the failed transfer.
+ * Address and length of data must be multiples of 4.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_flash(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u8  *p = req->buffer;
+	u32  v[8], dhcsr = 0;
+	uint i, n, used;
+	int  ack;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if ((req->len < 2) || (dap_mode != 1))
+		return(req->len);
+	/* Get the 32 bits arguments */
+	switch (p[1])
+	{
+		case 0x00: n = 8; p += 3; break;
+		case 0x01: n = 5; p += 2; break;
+		case 0x02: n = 1; p += 2; break;
+		case 0x03: n = 0; p += 2; break;
+		default:
+			return(req->len);
+	}
+	if (req->len < ((p - req->buffer) + (n * 4)))
+		return(req->len);
+	for (i = 0; i < n; i++, p += 4)
+		v[i] = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+	used = (p - req->buffer);
+	/* Data of pages follows its length */
+	if (req->buffer[1] == 0x02)
+	{
+		if (req->len < (used + 2))
+			return(req->len);
+		n = (p[1] << 8) | p[0];
+		used += 2 + n;
+		if (req->len < used)
+			return(req->len);
+		if ((v[0] & 3) || (n & 3))
+			return(used);
+	}
+
+	/* Select the MEM-AP of the core */
+	if ((req->buffer[1] != 0x00) && (dap_flash.status == FLM_OK))
+	{
+		ack = dap_mem_setup(dap_flash.apsel, 2);
+		if (ack != 1)
+			dap_flm_error(FLM_SWD, ack);
+	}
+
+	switch (req->buffer[1])
+	{
+		/* Setup : halt the core */
+		case 0x00:
+			if ((v[6] == 0) || (v[6] & 3) || (v[7] == 0))
+				return(used);
+			dap_flash.apsel   = req->buffer[2];
+			dap_flash.bkpt    = v[0];
+			dap_flash.sb      = v[1];
+			dap_flash.sp      = v[2];
+			dap_flash.program = v[3];
+			dap_flash.buf[0]  = v[4];
+			dap_flash.buf[1]  = v[5];
+			dap_flash.page    = v[6];
+			dap_flash.timeout = v[7];
+			dap_flash.len     = 0;
+			dap_flash.cur     = 0;
+			dap_flash.running = 0;
+			dap_flash.status  = FLM_OK;
+			dap_flash.result  = 0;
+			ack = dap_mem_setup(dap_flash.apsel, 2);
+			if (ack == 1)
+				ack = dap_mem_wr32(CORE_DHCSR, CORE_DBGKEY | (1 << 1) | (1 << 0));
+			for (i = 0; (ack == 1) && (i < dap_flash.timeout); i++)
+			{
+				ack = dap_mem_rd32(CORE_DHCSR, &dhcsr);
+				if ((ack == 1) && (dhcsr & CORE_S_HALT))
+					break;
+			}
+			if (ack != 1)
+				dap_flm_error(FLM_SWD, ack);
+			else if (i == dap_flash.timeout)
+				dap_flm_error(FLM_TIMEOUT, 0);
+			break;
+		/* Call a function */
+		case 0x01:
+			if ((dap_flm_start() == FLM_OK) && (dap_flm_wait() == FLM_OK) &&
+			    (dap_flm_call(v[0], v[1], v[2], v[3], v[4]) == FLM_OK))
+				dap_flm_wait();
+			break;
+		/* Load data of pages */
+		case 0x02:
+			dap_flm_load(v[0], req->buffer + 8, n);
+			break;
+		/* Flush */
+		case 0x03:
+			if (dap_flm_start() == FLM_OK)
+				dap_flm_wait();
+			break;
+	}
+
+	rsp->buffer[1] = dap_flash.status;
+	rsp->buffer[2] = (dap_flash.result >>  0) & 0xFF;
+	rsp->buffer[3] = (dap_flash.result >>  8) & 0xFF;
+	rsp->buffer[4] = (dap_flash.result >> 16) & 0xFF;
+	rsp->buffer[5] = (dap_flash.result >> 24) & 0xFF;
+	rsp->len = 6;
+	return(used);
+}
+
+/**
+ * @brief Handle the Cowprobe memory access vendor command (0x82)
+ *
+ * This command reads or writes a block of memory through a MEM-AP. The probe
+ * programs SELECT and CSW itself (protection bits of CSW are kept), and
+ * reloads TAR at each 1KB boundary (auto-increment may wrap there). After
+ * this command, a host that keeps its own copy of SELECT, CSW or TAR must
+ * consider them unknown and write them again before its next transfers.
+ *
+ * Request : [0x82, mode, apsel, address(4), length(4), data (write)]
+ *   mode bits [1:0] : size of accesses (0:byte 1:halfword 2:word)
+ *   mode bit  7     : write
+ * Response to a read  : [0x82, data (length bytes), status, done(4)]
+ * Response to a write : [0x82, status, done(4)]
+ *
+ * Status is the ACK of the last transfer, done is the number of bytes
+ * transferred (data after an error is zero). A read response longer than
+ * one packet is streamed (see cmsis_pkt), the data of a write must fit into
+ * the request. An invalid request gets [0x82, 0xFF] : only a truncated one
+ * uses the whole packet.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_memory(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u8  *p = req->buffer;
+	uint mode, size, len, done, used;
+	u32  addr;
+	int  ack;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if (req->len < 11)
+		return(req->len);
+	mode = p[1];
+	size = (mode & 0x03);
+	addr = (p[6]  << 24) | (p[5] << 16) | (p[4] << 8) | p[3];
+	len  = (p[10] << 24) | (p[9] << 16) | (p[8] << 8) | p[7];
+
+	/* Size of the request : header, and data of a write */
+	used = 11;
+	if (mode & (1 << 7))
+	{
+		/* Data of a write must be into this request */
+		if (len > (uint)(req->len - 11))
+			return(req->len);
+		used += len;
+	}
+	if ((dap_mode != 1) || (size > 2) ||
+	    (addr & ((1 << size) - 1)) || (len & ((1 << size) - 1)))
+		return(used);
+
+	done = 0;
+	/* Write */
+	if (mode & (1 << 7))
+	{
+		ack = dap_mem_setup(p[2], size);
+		if (ack == 1)
+			ack = dap_mem_write(addr, p + 11, len, size, &done);
+		if (ack != 1)
+			dap_cache_flush();
+
+		rsp->buffer[1] = ack;
+		rsp->buffer[2] = (done >>  0) & 0xFF;
+		rsp->buffer[3] = (done >>  8) & 0xFF;
+		rsp->buffer[4] = (done >> 16) & 0xFF;
+		rsp->buffer[5] = (done >> 24) & 0xFF;
+		rsp->len = 6;
+		return(used);
+	}
+
+	/* Read, response must fit into one packet if it can not be streamed */
+	if ((rsp->stream == 0) && ((len + 6) > DAP_PACKET_SIZE))
+		return(used);
+
+	rsp->len = 1;
+	ack = dap_mem_setup(p[2], size);
+	if (ack == 1)
+		ack = dap_mem_read(rsp, addr, len, size, &done);
+	if (ack != 1)
+		dap_cache_flush();
+	/* After an error, complete the response with zeros */
+	if (done < len)
+		dap_mem_out(rsp, 0, len - done);
+	dap_mem_out(rsp, ack, 1);
+	dap_mem_out(rsp, done, 4);
+	return(11);
+}
+
+/**
+ * @brief Handle the Cowprobe scatter-gather read vendor command (0x83)
+ *
+ * This command reads a list of unrelated addresses (watch windows, views of
+ * peripherals) with one request. SELECT, CSW and TAR are only written when
+ * their cached value differs, so consecutive addresses of the same AP cost
+ * one read. Reads of DRW are posted, RDBUFF is only read when a register
+ * must be written before the next read (or at the end).
+ *
+ * Request  : [0x83, count, count * {apsel, size, address(4)}]
+ * Response : [0x83, done, status, done * value(4)]
+ *
+ * Size is 0:byte 1:halfword 2:word, values are right aligned. Status is the
+ * ACK of the last transfer, done the number of values read before an error.
+ * An invalid request (bad size or alignment) gets [0x83, 0xFF].
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_scatter(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	u8  *p = req->buffer + 2;
+	u8  *q = rsp->buffer + 3;
+	uint count, size, done, i;
+	u32  addr, data;
+	int  ack = 1;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if (req->len < 2)
+		return(req->len);
+	count = req->buffer[1];
+	if ((req->len < (2 + count * 6)) || ((3 + count * 4) > DAP_PACKET_SIZE))
+		return(req->len);
+	if (dap_mode != 1)
+		return(2 + count * 6);
+	/* Check all entries before the first access */
+	for (i = 0; i < count; i++, p += 6)
+	{
+		size = p[1];
+		addr = (p[5] << 24) | (p[4] << 16) | (p[3] << 8) | p[2];
+		if ((size > 2) || (addr & ((1 << size) - 1)))
+			return(2 + count * 6);
+	}
+
+	p = req->buffer + 2;
+	for (i = 0; i < count; i++, p += 6)
+	{
+		size = p[1];
+		addr = (p[5] << 24) | (p[4] << 16) | (p[3] << 8) | p[2];
+		ack = dap_mem_setup(p[0], size);
+		if (ack == 1)
+			ack = dap_mem_reg(0x05, addr);
+		if (ack != 1)
+			break;
+		/* Read DRW, the result is the value of the previous posted read */
+		dap_cache_access(0x0F);
+		ack = dap_port_transfer(0x0F, &data);
+		if (ack != 1)
+			break;
+		if (dap_mem_post)
+		{
+			dap_mem_post[0] = ((data >>  0) & 0xFF);
+			dap_mem_post[1] = ((data >>  8) & 0xFF);
+			dap_mem_post[2] = ((data >> 16) & 0xFF);
+			dap_mem_post[3] = ((data >> 24) & 0xFF);
+		}
+		dap_mem_post = q;
+		q += 4;
+	}
+	/* Get the last value from RDBUFF */
+	if (ack == 1)
+		ack = dap_mem_flush();
+	/* A value still pending after an error is lost */
+	done = (q - (rsp->buffer + 3)) / 4;
+	if (dap_mem_post)
+	{
+		dap_mem_post = 0;
+		done--;
+	}
+	if (ack != 1)
+		dap_cache_flush();
+
+	/* Values use the byte lanes of their address */
+	p = req->buffer + 2;
+	q = rsp->buffer + 3;
+	for (i = 0; i < done; i++, p += 6, q += 4)
+	{
+		if (p[1] == 2)
+			continue;
+		data  = (q[3] << 24) | (q[2] << 16) | (q[1] << 8) | q[0];
+		data >>= ((p[2] & 3) * 8);
+		data &= (p[1] ? 0xFFFF : 0xFF);
+		q[0] = ((data >>  0) & 0xFF);
+		q[1] = ((data >>  8) & 0xFF);
+		q[2] = 0;
+		q[3] = 0;
+	}
+	rsp->buffer[1] = done;
+	rsp->buffer[2] = ack;
+	rsp->len = 3 + (done * 4);
+	return(2 + count * 6);
+}
+
+/**
+ * @brief Handle the Cowprobe statistics vendor command (0x81)
+ *
+ * Request : [0x81, flags] ; response : [0x81, status, hit(4), miss(4)]. The
+ * counters give the number of writes to SELECT, CSW and TAR skipped (hit)
+ * or sent to target (miss) by the cache. Set bit 0 of flags to clear them.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_stats(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0x00; // OK
+	rsp->buffer[2] = (dap_cache_hit  >>  0) & 0xFF;
+	rsp->buffer[3] = (dap_cache_hit  >>  8) & 0xFF;
+	rsp->buffer[4] = (dap_cache_hit  >> 16) & 0xFF;
+	rsp->buffer[5] = (dap_cache_hit  >> 24) & 0xFF;
+	rsp->buffer[6] = (dap_cache_miss >>  0) & 0xFF;
+	rsp->buffer[7] = (dap_cache_miss >>  8) & 0xFF;
+	rsp->buffer[8] = (dap_cache_miss >> 16) & 0xFF;
+	rsp->buffer[9] = (dap_cache_miss >> 24) & 0xFF;
+	rsp->len = 10;
+
+	if (req->buffer[1] & (1 << 0))
+	{
+		dap_cache_hit  = 0;
+		dap_cache_miss = 0;
+	}
+	return(2);
+}
+
+/**
+ * @brief Handle the Cowprobe SVF player vendor command (0x88)
+ *
+ * The host sends a SVF file as a stream of chunks (any size, statements can
+ * be split between packets). Statements are executed by the probe and TDO
+ * is compared locally (see svf.c), so the host does not wait for captured
+ * bits : a response only reports the progress of the player.
+ *
+ * Request  : [0x88, flags, length(2), data(length)]
+ *   flags bit 0 : first chunk of the file (reset the player)
+ *   flags bit 1 : last chunk of the file
+ * Response : [0x88, status, mismatch(4), line(4)]
+ *
+ * Status is SVF_OK, SVF_MISMATCH (scans with unexpected TDO, the player
+ * continues) or the error that stopped the player. Line is the line of the
+ * error, or of the first mismatch. When the port is not in JTAG mode, the
+ * response is [0x88, 0xFF].
+ *
+ * A FREQUENCY statement only applies to the file : the clock set by
+ * DAP_SWJ_Clock is restored after the last chunk, or when the player stops
+ * on an error.
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_vendor_svf(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+	const svf_result *res;
+	uint len;
+
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#endif
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	if (req->len < 4)
+		return(req->len);
+	len = (req->buffer[3] << 8) | req->buffer[2];
+	if ((4 + len) > req->len)
+		return(req->len);
+	if (dap_mode != 2)
+		return(4 + len);
+
+	if (req->buffer[1] & (1 << 0))
+		svf_start();
+	svf_feed(req->buffer + 4, len);
+	if (req->buffer[1] & (1 << 1))
+		svf_end();
+
+	res = svf_status();
+	if ((req->buffer[1] & (1 << 1)) || (res->status > SVF_MISMATCH))
+	{
+		swj_clock_set(dap_clock);
+		jtag_clock();
+	}
+	rsp->buffer[1] = res->status;
+	rsp->buffer[2] = (res->mismatch >>  0) & 0xFF;
+	rsp->buffer[3] = (res->mismatch >>  8) & 0xFF;
+	rsp->buffer[4] = (res->mismatch >> 16) & 0xFF;
+	rsp->buffer[5] = (res->mismatch >> 24) & 0xFF;
+	rsp->buffer[6] = (res->line >>  0) & 0xFF;
+	rsp->buffer[7] = (res->line >>  8) & 0xFF;
+	rsp->buffer[8] = (res->line >> 16) & 0xFF;
+	rsp->buffer[9] = (res->line >> 24) & 0xFF;
+	rsp->len = 10;
+	return(4 + len);
+}
+
+/**
+ * @brief Handle DAP_WriteABORT command
+ *
+ * This command is used write an abort request into the ABORT register
+ * of the target. This command should only be used when something really
+ * wrong happens during a transfer that must be interrupted.
+ *
+ * TODO This command is not implemented yet
+ *
+ * @param rep Pointer to the request packet
+ * @param rsp Pointer to a packet where response can be stored
+ * @return integer Number of request bytes used, -1 for error
+ */
+static inline int dap_write_abort(cmsis_pkt *req, cmsis_pkt *rsp)
+{
+#ifdef DEBUG_CMSIS
+	/* Sanity check */
+	if ((req == 0) || (rsp == 0))
+		return(-1);
+#else
+	(void)req;
+#endif
+	LOG_INFO_PUTS("CMSIS: WriteABORT not supported yet\r\n");
+
+	rsp->buffer[1] = 0xFF; // ERROR
+	rsp->len = 2;
+	return(6);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                  Cache of DP and AP registers                        -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Update the cache for an access to a MEM-AP data register (DRW)
+ *
+ * Each access to DRW may increment TAR, according to CSW. The new value of
+ * TAR is only computed for 32 bits accesses with single increment (other
+ * sizes may be unsupported by the MEM-AP) into the same 1KB block (wrap of
+ * TAR is implementation defined). Otherwise, TAR becomes unknown.
+ *
+ * @param request SWD request (APnDP, RnW, A[3:2])
+ */
+static void dap_cache_access(u8 request)
+{
+	dap_ap_cache *ap;
+	u32 tar;
+
+	/* Only DRW (AP bank 0, A=0x0C) is concerned */
+	if ((request & 0x0D) != 0x0D)
+		return;
+	/* Unknown AP and bank, any TAR may be modified */
+	if ( ! dap_select_ok)
+	{
+		memset(dap_ap, 0, sizeof(dap_ap));
+		return;
+	}
+	if (dap_select & 0xF0)
+		return;
+	ap = dap_cache_ap(0);
+	if ((ap == 0) || (ap->tar_ok == 0))
+		return;
+
+	/* Auto-increment disabled */
+	if (ap->csw_ok && ((ap->csw & 0x30) == 0))
+		return;
+	/* Single increment of 32 bits */
+	if (ap->csw_ok && ((ap->csw & 0x37) == 0x12))
+	{
+		tar = ap->tar + 4;
+		if (((tar ^ ap->tar) & ~0x3FF) == 0)
+		{
+			ap->tar = tar;
+			return;
+		}
+	}
+	ap->tar_ok = 0;
+}
+
+/**
+ * @brief Get the cache entry of the AP selected by SELECT
+ *
+ * @param create True to allocate a new entry if the AP is not found
+ * @return dap_ap_cache* Pointer to the entry (null if not found)
+ */
+static dap_ap_cache *dap_cache_ap(int create)
+{
+	dap_ap_cache *ap;
+	u8   apsel = ((dap_select >> 24) & 0xFF);
+	uint i;
+
+	for (i = 0; i < DAP_CACHE_AP; i++)
+	{
+		ap = &dap_ap[i];
+		if ((ap->csw_ok || ap->tar_ok) && (ap->apsel == apsel))
+			return(ap);
+	}
+	if ( ! create)
+		return(0);
+
+	/* Use a free entry, or replace one (round-robin) */
+	for (i = 0; i < DAP_CACHE_AP; i++)
+	{
+		if ((dap_ap[i].csw_ok == 0) && (dap_ap[i].tar_ok == 0))
+			break;
+	}
+	if (i == DAP_CACHE_AP)
+		i = (dap_ap_next++ % DAP_CACHE_AP);
+
+	ap = &dap_ap[i];
+	memset(ap, 0, sizeof(dap_ap_cache));
+	ap->apsel = apsel;
+	return(ap);
+}
+
+/**
+ * @brief Update the cache after a failed transfer
+ *
+ * A request that receives WAIT or FAULT is not executed by target, so
+ * SELECT keeps the value it had before the request. Without a valid ACK,
+ * the request may have been executed or not and SELECT becomes unknown.
+ * In both cases, state of the MEM-APs (TAR) is unknown.
+ *
+ * @param ack       ACK of the failed transfer
+ * @param select    Value of SELECT before the failed transfer
+ * @param select_ok True if this value is known
+ */
+static void dap_cache_error(int ack, u32 select, int select_ok)
+{
+	memset(dap_ap, 0, sizeof(dap_ap));
+
+	ack &= 0x07;
+	if ((ack == 2) || (ack == 4))
+	{
+		dap_select    = select;
+		dap_select_ok = select_ok;
+	}
+	else
+		dap_select_ok = 0;
+}
+
+/**
+ * @brief Invalidate all cached registers
+ *
+ * Must be called each time the target may have been reset, or when the
+ * probe can not know the effect of a command (line reset, sequences ...).
+ */
+static void dap_cache_flush(void)
+{
+	dap_select_ok = 0;
+	memset(dap_ap, 0, sizeof(dap_ap));
+}
+
+/**
+ * @brief Update the cache with the value of a register read from target
+ *
+ * Registers of MEM-AP are at a fixed position (bank 0) only for ADIv5, the
+ * version of the DP is taken from DPIDR (always read by host after a line
+ * reset).
+ *
+ * @param request SWD request (APnDP, RnW, A[3:2])
+ * @param data    Value read
+ */
+static void dap_cache_read(u8 request, u32 data)
+{
+	/* DPIDR (DP, A=0x00, bank 0) */
+	if (request != (1 << 1))
+		return;
+	if (dap_select_ok && (dap_select & 0x0F))
+		return;
+
+	/* ADIv5 for DP versions 0 to 2 */
+	dap_cache_v5 = (((data >> 12) & 0x0F) < 3);
+	if ( ! dap_cache_v5)
+		memset(dap_ap, 0, sizeof(dap_ap));
+}
+
+/**
+ * @brief Update the cache for a register write, test if it can be skipped
+ *
+ * SELECT is always tracked (used by pipelined mode). When the cache is
+ * enabled, a write to SELECT, CSW or TAR with the value that the register
+ * already holds can be skipped. Writes to ABORT and CTRL/STAT (that may
+ * cancel an AP transaction or power down the debug domain) invalidate the
+ * MEM-AP registers, a write to TARGETSEL invalidates everything.
+ *
+ * @param request SWD request (APnDP, RnW, A[3:2])
+ * @param data    Value to write
+ * @return integer True if the write can be skipped
+ */
+static int dap_cache_write(u8 request, u32 data)
+{
+	dap_ap_cache *ap;
+	int hit = 0;
+
+	/* DP registers */
+	if ((request & (1 << 0)) == 0)
+	{
+		switch (request & 0x0C)
+		{
+			/* ABORT, CTRL/STAT (or DLCR ...) */
+			case 0x00:
+			case 0x04:
+				memset(dap_ap, 0, sizeof(dap_ap));
+				return(0);
+			/* SELECT */
+			case 0x08:
+				hit = (dap_select_ok && (dap_select == data));
+				dap_select    = data;
+				dap_select_ok = 1;
+				break;
+			/* TARGETSEL */
+			case 0x0C:
+				dap_cache_v5 = 0;
+				dap_cache_flush();
+				return(0);
+		}
+	}
+	/* AP registers, AP and bank must be known */
+	else if ( ! dap_select_ok)
+	{
+		memset(dap_ap, 0, sizeof(dap_ap));
+		return(0);
+	}
+	/* CSW and TAR of a MEM-AP (bank 0, A=0x00 and A=0x04) */
+	else if (((dap_select & 0xF0) == 0) && ((request & 0x0C) <= 0x04) &&
+	         dap_cache && dap_cache_v5)
+	{
+		ap = dap_cache_ap(1);
+		if ((request & 0x0C) == 0x00)
+		{
+			hit = (ap->csw_ok && (ap->csw == data));
+			ap->csw    = data;
+			ap->csw_ok = 1;
+		}
+		else
+		{
+			hit = (ap->tar_ok && (ap->tar == data));
+			ap->tar    = data;
+			ap->tar_ok = 1;
+		}
+	}
+	else
+		return(0);
+
+	if ( ! dap_cache)
+		return(0);
+	if (hit)
+		dap_cache_hit++;
+	else
+		dap_cache_miss++;
+	return(hit);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                      Flash algorithm runner                          -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Write a register of the halted core
+ *
+ * @param reg    Index of the register (0-12, 13:SP 14:LR 15:PC 16:xPSR)
+ * @param value  Value to write
+ * @param result Pointer where the ACK of the last transfer is stored
+ * @return integer FLM_OK on success, or an error status
+ */
+static int dap_core_reg(u8 reg, u32 value, u32 *result)
+{
+	u32 dhcsr = 0;
+	uint i;
+	int ack;
+
+	ack = dap_mem_wr32(CORE_DCRDR, value);
+	if (ack == 1)
+		ack = dap_mem_wr32(CORE_DCRSR, (1 << 16) | reg);
+	for (i = 0; (ack == 1) && (i < dap_flash.timeout); i++)
+	{
+		ack = dap_mem_rd32(CORE_DHCSR, &dhcsr);
+		if (dhcsr & CORE_S_REGRDY)
+			break;
+	}
+	*result = ack;
+	if (ack != 1)
+		return(FLM_SWD);
+	return((dhcsr & CORE_S_REGRDY) ? FLM_OK : FLM_TIMEOUT);
+}
+
+/**
+ * @brief Start a function of the flash algorithm
+ *
+ * The core must be halted. The function returns to the breakpoint, so the
+ * core halts again at its end (see dap_flm_wait).
+ *
+ * @param pc Address of the function
+ * @param r0 First argument
+ * @param r1 Second argument
+ * @param r2 Third argument
+ * @param r3 Fourth argument
+ * @return integer FLM_OK on success, or an error status
+ */
+static int dap_flm_call(u32 pc, u32 r0, u32 r1, u32 r2, u32 r3)
+{
+	const u8 reg[] = { 0, 1, 2, 3, 9, 13, 14, 15, 16 };
+	u32 value[9];
+	u32 result = 0;
+	uint i;
+	int status = FLM_OK;
+	int ack;
+
+	value[0] = r0;
+	value[1] = r1;
+	value[2] = r2;
+	value[3] = r3;
+	value[4] = dap_flash.sb;
+	value[5] = dap_flash.sp;
+	value[6] = dap_flash.bkpt | 1; // Thumb
+	value[7] = pc & ~1;
+	value[8] = 0x01000000;         // xPSR : Thumb state
+	for (i = 0; (status == FLM_OK) && (i < sizeof(reg)); i++)
+		status = dap_core_reg(reg[i], value[i], &result);
+	if (status != FLM_OK)
+		return(dap_flm_error(status, result));
+
+	/* Resume the core (debug still enabled) */
+	ack = dap_mem_wr32(CORE_DHCSR, CORE_DBGKEY | (1 << 0));
+	if (ack != 1)
+		return(dap_flm_error(FLM_SWD, ack));
+	dap_flash.running = 1;
+	return(FLM_OK);
+}
+
+/**
+ * @brief Record an error of the flash algorithm runner
+ *
+ * Only the first error is kept, next commands are not executed until the
+ * next setup.
+ *
+ * @param status Error status
+ * @param result Value returned by the function, or ACK of the transfer
+ * @return integer Status of the runner
+ */
+static int dap_flm_error(int status, u32 result)
+{
+	if (status == FLM_SWD)
+		dap_cache_flush();
+	if (dap_flash.status == FLM_OK)
+	{
+		dap_flash.status = status;
+		dap_flash.result = result;
+	}
+	return(dap_flash.status);
+}
+
+/**
+ * @brief Load data into page buffers, start ProgramPage on full pages
+ *
+ * @param addr Flash address of the data
+ * @param data Pointer to the data
+ * @param len  Number of bytes
+ * @return integer Status of the runner
+ */
+static int dap_flm_load(u32 addr, const u8 *data, uint len)
+{
+	uint n, done;
+	int ack;
+
+	while ((dap_flash.status == FLM_OK) && len)
+	{
+		/* Not contiguous : program the partial page first */
+		if (dap_flash.len && (addr != (dap_flash.addr + dap_flash.len)))
+		{
+			if (dap_flm_start() != FLM_OK)
+				break;
+		}
+		if (dap_flash.len == 0)
+			dap_flash.addr = addr;
+
+		n = dap_flash.page - dap_flash.len;
+		if (n > len)
+			n = len;
+		/* Target memory is written while the other buffer is programmed */
+		done = 0;
+		ack = dap_mem_write(dap_flash.buf[dap_flash.cur] + dap_flash.len,
+		                    data, n, 2, &done);
+		if (ack != 1)
+			return(dap_flm_error(FLM_SWD, ack));
+		dap_flash.len += n;
+		addr += n;
+		data += n;
+		len  -= n;
+		if (dap_flash.len == dap_flash.page)
+			dap_flm_start();
+	}
+	return(dap_flash.status);
+}
+
+/**
+ * @brief Program the page of current buffer, then switch to other buffer
+ *
+ * The previous ProgramPage (other buffer) must be complete before a new one
+ * is started, but this one is not waited for.
+ *
+ * @return integer Status of the runner
+ */
+static int dap_flm_start(void)
+{
+	if ((dap_flash.status != FLM_OK) || (dap_flash.len == 0))
+		return(dap_flash.status);
+	if (dap_flm_wait() != FLM_OK)
+		return(dap_flash.status);
+	if (dap_flm_call(dap_flash.program, dap_flash.addr, dap_flash.len,
+	                 dap_flash.buf[dap_flash.cur], 0) != FLM_OK)
+		return(dap_flash.status);
+	dap_flash.cur ^= 1;
+	dap_flash.len  = 0;
+	return(FLM_OK);
+}
+
+/**
+ * @brief Wait for the end of the running function, and check its result
+ *
+ * @return integer Status of the runner
+ */
+static int dap_flm_wait(void)
+{
+	u32 dhcsr = 0;
+	u32 r0;
+	uint i;
+	int ack = 1;
+
+	if ((dap_flash.status != FLM_OK) || ! dap_flash.running)
+		return(dap_flash.status);
+
+	for (i = 0; i < dap_flash.timeout; i++)
+	{
+		ack = dap_mem_rd32(CORE_DHCSR, &dhcsr);
+		if ((ack != 1) || (dhcsr & CORE_S_HALT))
+			break;
+	}
+	if (ack != 1)
+		return(dap_flm_error(FLM_SWD, ack));
+	if ( ! (dhcsr & CORE_S_HALT))
+		return(dap_flm_error(FLM_TIMEOUT, 0));
+	dap_flash.running = 0;
+
+	/* Get the result from R0 */
+	ack = dap_mem_wr32(CORE_DCRSR, 0);
+	if (ack == 1)
+		ack = dap_mem_rd32(CORE_DHCSR, &dhcsr);
+	if (ack == 1)
+		ack = dap_mem_rd32(CORE_DCRDR, &r0);
+	if (ack != 1)
+		return(dap_flm_error(FLM_SWD, ack));
+	if ( ! (dhcsr & CORE_S_REGRDY))
+		return(dap_flm_error(FLM_TIMEOUT, 0));
+	if (r0 != 0)
+		return(dap_flm_error(FLM_FAIL, r0));
+	return(FLM_OK);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                     Memory access (MEM-AP)                           -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Compute the CRC32 of a block of memory (MEM-AP set by dap_mem_setup)
+ *
+ * Data read is streamed to the CRC module with two buffers, the CRC of one
+ * buffer is computed while the other one is filled. The CRC module must be
+ * started before (see crc_start).
+ *
+ * @param addr Address of the first byte
+ * @param len  Number of bytes to read
+ * @param size Size of accesses (0:byte 1:halfword 2:word)
+ * @param done Pointer to the number of bytes read (updated)
+ * @param crc  Pointer where the CRC of the bytes read is stored
+ * @return integer ACK of the last transfer
+ */
+static int dap_mem_crc(u32 addr, uint len, uint size, uint *done, u32 *crc)
+{
+	cmsis_pkt pkt;
+	int ack;
+
+	pkt.buffer = (u8 *)dap_crc_buf[0];
+	pkt.len    = 0;
+	pkt.stream = dap_mem_crc_out;
+	ack = dap_mem_read(&pkt, addr, len, size, done);
+	crc_update(pkt.buffer, pkt.len);
+	*crc = crc_result();
+	return(ack);
+}
+
+/**
+ * @brief Stream hook of dap_mem_crc, send a full buffer to the CRC
+ *
+ * @param pkt Pointer to the packet used as buffer by dap_mem_read
+ * @return integer Always zero (success)
+ */
+static int dap_mem_crc_out(cmsis_pkt *pkt)
+{
+	crc_update(pkt->buffer, pkt->len);
+	if (pkt->buffer == (u8 *)dap_crc_buf[0])
+		pkt->buffer = (u8 *)dap_crc_buf[1];
+	else
+		pkt->buffer = (u8 *)dap_crc_buf[0];
+	pkt->len = 0;
+	return(0);
+}
+
+/**
+ * @brief Get the value of a pending posted read of DRW from RDBUFF
+ *
+ * The scatter-gather read leaves the last read of DRW pending as long as the
+ * next access is also a read of DRW. Any other transfer must call this first.
+ *
+ * @return integer ACK of the transfer (1 when no read is pending)
+ */
+static int dap_mem_flush(void)
+{
+	u32 data;
+	int ack;
+
+	if (dap_mem_post == 0)
+		return(1);
+	ack = dap_port_transfer(0x0E, &data);
+	if (ack != 1)
+		return(ack);
+	dap_mem_post[0] = ((data >>  0) & 0xFF);
+	dap_mem_post[1] = ((data >>  8) & 0xFF);
+	dap_mem_post[2] = ((data >> 16) & 0xFF);
+	dap_mem_post[3] = ((data >> 24) & 0xFF);
+	dap_mem_post = 0;
+	return(1);
+}
+
+/**
+ * @brief Append bytes to a response, stream it when the buffer is full
+ *
+ * @param rsp  Pointer to the response
+ * @param data Value to append (little endian)
+ * @param len  Number of bytes to append (0 to 4 for a value, more to append
+ *             zeros)
+ * @return integer Zero on success, -1 for error
+ */
+static int dap_mem_out(cmsis_pkt *rsp, u32 data, uint len)
+{
+	for ( ; len; len--)
+	{
+		if (rsp->len == DAP_PACKET_SIZE)
+		{
+			if (rsp->stream(rsp) < 0)
+				return(-1);
+		}
+		rsp->buffer[rsp->len++] = (data & 0xFF);
+		data >>= 8;
+	}
+	return(0);
+}
+
+/**
+ * @brief Read one word with the MEM-AP selected by dap_mem_setup (word size)
+ *
+ * @param addr Address of the word
+ * @param data Pointer where the value is stored
+ * @return integer ACK of the last transfer
+ */
+static int dap_mem_rd32(u32 addr, u32 *data)
+{
+	int ack;
+
+	ack = dap_mem_reg(0x05, addr);
+	if (ack != 1)
+		return(ack);
+	dap_cache_access(0x0F);
+	ack = dap_port_transfer(0x0F, data);
+	if (ack == 1)
+		ack = dap_port_transfer(0x0E, data);
+	return(ack);
+}
+
+/**
+ * @brief Read a block of memory with the MEM-AP selected by dap_mem_setup
+ *
+ * Reads of DRW are posted : each read returns the value of the previous one,
+ * and the last value of each 1KB block is read from RDBUFF.
+ *
+ * @param rsp  Pointer to the response where data is appended
+ * @param addr Address of the first byte
+ * @param len  Number of bytes to read
+ * @param size Size of accesses (0:byte 1:halfword 2:word)
+ * @param done Pointer to the number of bytes read (updated)
+ * @return integer ACK of the last transfer
+ */
+static int dap_mem_read(cmsis_pkt *rsp, u32 addr, uint len, uint size, uint *done)
+{
+	uint count, i;
+	u32  data;
+	int  ack = 1;
+
+	while (*done < len)
+	{
+		/* Number of accesses until the end of 1KB block */
+		count = (0x400 - (addr & 0x3FF));
+		if (count > (len - *done))
+			count = (len - *done);
+		count >>= size;
+
+		ack = dap_mem_reg(0x05, addr);
+		if (ack != 1)
+			break;
+		/* First read only starts the access */
+		dap_cache_access(0x0F);
+		ack = dap_port_transfer(0x0F, &data);
+
+		for (i = 0; (ack == 1) && (i < count); i++)
+		{
+			/* Last value is into RDBUFF */
+			if (i == (count - 1))
+				ack = dap_port_transfer(0x0E, &data);
+			else
+			{
+				dap_cache_access(0x0F);
+				ack = dap_port_transfer(0x0F, &data);
+			}
+			if (ack != 1)
+				break;
+			/* Data uses the byte lanes of the address */
+			data >>= ((addr & 3) * 8);
+			if (dap_mem_out(rsp, data, 1 << size) < 0)
+				return(0);
+			addr  += (1 << size);
+			*done += (1 << size);
+		}
+		if (ack != 1)
+			break;
+	}
+	return(ack);
+}
+
+/**
+ * @brief Write an AP or DP register, unless the cache says it is useless
+ *
+ * @param request SWD request (APnDP, RnW, A[3:2])
+ * @param data    Value to write
+ * @return integer ACK of the transfer
+ */
+static int dap_mem_reg(u8 request, u32 data)
+{
+	int ack;
+
+	if (dap_cache_write(request, data))
+		return(1);
+	ack = dap_mem_flush();
+	if (ack == 1)
+		ack = dap_port_transfer(request, &data);
+	return(ack);
+}
+
+/**
+ * @brief Select a MEM-AP and set CSW for a memory access
+ *
+ * The current value of CSW is read (if not already known) to keep the bits
+ * that are specific to the MEM-AP (protection, DbgSwEnable ...), then the
+ * size of accesses and single auto-increment are set.
+ *
+ * @param apsel Index of the MEM-AP
+ * @param size  Size of accesses (0:byte 1:halfword 2:word)
+ * @return integer ACK of the last transfer
+ */
+static int dap_mem_setup(u8 apsel, uint size)
+{
+	dap_ap_cache *ap;
+	u32 csw;
+	int ack;
+
+	/* SELECT : AP bank 0 and DP bank 0 */
+	ack = dap_mem_reg(0x08, ((u32)apsel << 24));
+	if (ack != 1)
+		return(ack);
+
+	ap = dap_cache_ap(0);
+	if (ap && ap->csw_ok)
+		csw = ap->csw;
+	else
+	{
+		ack = dap_mem_flush();
+		if (ack == 1)
+			ack = dap_port_transfer(0x03, &csw);
+		if (ack == 1)
+			ack = dap_port_transfer(0x0E, &csw);
+		if (ack != 1)
+			return(ack);
+	}
+	csw = (csw & 0xFFFFF000) | (1 << 4) | size;
+	return( dap_mem_reg(0x01, csw) );
+}
+
+/**
+ * @brief Write one word with the MEM-AP selected by dap_mem_setup (word size)
+ *
+ * The write is posted, an error is reported by the next transfer.
+ *
+ * @param addr Address of the word
+ * @param data Value to write
+ * @return integer ACK of the last transfer
+ */
+static int dap_mem_wr32(u32 addr, u32 data)
+{
+	int ack;
+
+	ack = dap_mem_reg(0x05, addr);
+	if (ack != 1)
+		return(ack);
+	dap_cache_access(0x0D);
+	return( dap_port_transfer(0x0D, &data) );
+}
+
+/**
+ * @brief Write a block of memory with the MEM-AP selected by dap_mem_setup
+ *
+ * @param addr Address of the first byte
+ * @param src  Pointer to the data to write
+ * @param len  Number of bytes to write
+ * @param size Size of accesses (0:byte 1:halfword 2:word)
+ * @param done Pointer to the number of bytes written (updated)
+ * @return integer ACK of the last transfer
+ */
+static int dap_mem_write(u32 addr, const u8 *src, uint len, uint size, uint *done)
+{
+	uint count, i, j;
+	u32  data;
+	int  ack = 1;
+
+	while (*done < len)
+	{
+		/* Number of accesses until the end of 1KB block */
+		count = (0x400 - (addr & 0x3FF));
+		if (count > (len - *done))
+			count = (len - *done);
+		count >>= size;
+
+		ack = dap_mem_reg(0x05, addr);
+		if (ack != 1)
+			break;
+		for (i = 0; i < count; i++)
+		{
+			data = 0;
+			for (j = 0; j < (1u << size); j++)
+				data |= ((u32)src[*done + j] << (j * 8));
+			/* Data uses the byte lanes of the address */
+			data <<= ((addr & 3) * 8);
+			dap_cache_access(0x0D);
+			ack = dap_port_transfer(0x0D, &data);
+			if (ack != 1)
+				break;
+			addr  += (1 << size);
+			*done += (1 << size);
+		}
+		if (ack != 1)
+			break;
+	}
+	/* Read RDBUFF to get the status of the last write */
+	if ((ack == 1) && len)
+		ack = dap_port_transfer(0x0E, 0);
+	return(ack);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                       DAP_Transfer engine                            -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Process one DP or AP transfer on the port of current mode
+ *
+ * JTAG-DP transfers use the same request, ACK and posted reads than SWD,
+ * so the DAP engine does not depend on the port (except pipelined mode).
+ *
+ * @param request Transfer request (APnDP, RnW, A[3:2])
+ * @param data    Value to write, or pointer where read value is stored
+ * @return integer ACK of the transfer (1 for success)
+ */
+static int dap_port_transfer(u8 request, u32 *data)
+{
+	if (dap_mode == 2)
+		return( jtag_transfer(request, data) );
+	return( swd_transfer(request, data) );
+}
+
+/**
+ * @brief Get the result of the oldest pipelined transfer
+ *
+ * @param x Pointer to the context of the command
+ */
+static void dap_xfer_get(dap_xfer *x)
+{
+	uint n = (x->op_rd++ % SWD_PIPE_DEPTH);
+	u32  data;
+	int  ack;
+
+	ack = swd_pipe_get(&data);
+	/* After an error, results are ignored */
+	if (x->fail)
+		return;
+	if (ack != 1)
+	{
+		x->fail   = ack;
+		x->resume = x->op[n].start;
+		x->select = x->op[n].select;
+		return;
+	}
+	dap_cache_read(x->op[n].request, data);
+	if (x->op[n].dst)
+	{
+		x->op[n].dst[0] = ((data >>  0) & 0xFF);
+		x->op[n].dst[1] = ((data >>  8) & 0xFF);
+		x->op[n].dst[2] = ((data >> 16) & 0xFF);
+		x->op[n].dst[3] = ((data >> 24) & 0xFF);
+	}
+}
+
+/**
+ * @brief Execute (or queue, in pipelined mode) one SWD transfer
+ *
+ * @param x       Pointer to the context of the command
+ * @param request SWD request (APnDP, RnW, A[3:2])
+ * @param data    Value to write
+ * @param dst     Pointer into response where read value is stored (or null)
+ * @return integer ACK of the transfer (OK when queued without error)
+ */
+static int dap_xfer_op(dap_xfer *x, u8 request, u32 data, u8 *dst)
+{
+	uint n;
+	int  ack;
+
+	if (x->pipe)
+	{
+		/* Pipe full, wait for the result of the oldest transfer */
+		if ((x->op_wr - x->op_rd) == SWD_PIPE_DEPTH)
+			dap_xfer_get(x);
+		/* After an error, next transfers are ignored by target */
+		if (x->fail)
+			return(0);
+		n = (x->op_wr++ % SWD_PIPE_DEPTH);
+		x->op[n].start   = x->start;
+		x->op[n].select  = x->select;
+		x->op[n].request = request;
+		x->op[n].dst     = dst;
+		dap_cache_access(request);
+		swd_pipe_put(request, data);
+		return(1);
+	}
+
+	dap_cache_access(request);
+	ack = dap_port_transfer(request, &data);
+	if (ack == 1)
+		dap_cache_read(request, data);
+	if ((ack == 1) && dst)
+	{
+		dst[0] = ((data >>  0) & 0xFF);
+		dst[1] = ((data >>  8) & 0xFF);
+		dst[2] = ((data >> 16) & 0xFF);
+		dst[3] = ((data >> 24) & 0xFF);
+	}
+	return(ack);
+}
+
+/**
+ * @brief Execute a DAP_Transfer with pipelined SWD transfers
+ *
+ * Overrun detection (ORUNDETECT) is enabled on the target, then transfers
+ * are sent without waiting for their ACK : after a WAIT or a FAULT the
+ * target sets STICKYORUN and ignores the next ones. When an error is found,
+ * STICKYORUN is cleared and the command must continue from the failed
+ * transfer with normal (checked) transfers. CTRL/STAT is restored at the
+ * end of the command.
+ *
+ * @param x   Pointer to the context of the command
+ * @param req Pointer to the request packet
+ * @return integer ACK of the last transfer, 0 to continue in normal mode
+ */
+static int dap_xfer_pipe(dap_xfer *x, cmsis_pkt *req)
+{
+	u32 data;
+	int own, ack;
+
+	/* Get current value of CTRL/STAT (if not already known) */
+	if ( ! dap_ctrl_ok)
+	{
+		if (swd_transfer(0x04 | (1 << 1), &data) != 1)
+			return(0);
+		dap_ctrl    = (data & DP_CTRL_MASK);
+		dap_ctrl_ok = 1;
+	}
+	/* Enable overrun detection, if not already done by host */
+	own = ! (dap_ctrl & DP_ORUNDETECT);
+	if (own)
+	{
+		data = (dap_ctrl | DP_ORUNDETECT);
+		if (swd_transfer(0x04, &data) != 1)
+			return(0);
+		/* Target now expects a data phase after each WAIT or FAULT */
+		swd_config.data_phase = 1;
+	}
+
+	x->pipe = 1;
+	ack = dap_xfer_run(x, req);
+	/* Get the results of the last transfers */
+	while (x->op_rd != x->op_wr)
+		dap_xfer_get(x);
+	x->pipe = 0;
+
+	/* Transfers after the error have been ignored by target */
+	if (x->fail)
+		dap_cache_error(x->fail, x->select, 1);
+
+	if (own)
+	{
+		/* Clear STICKYORUN only (other errors are reported to host) */
+		if (x->fail)
+		{
+			data = (1 << 4);
+			swd_transfer(0x00, &data);
+		}
+		data = dap_ctrl;
+		if (swd_transfer(0x04, &data) == 1)
+			swd_config.data_phase = dap_data_phase;
+		else
+			dap_ctrl_dirty = 1;
+	}
+	if (x->fail)
+	{
+		x->st = x->resume;
+		return(0);
+	}
+	return(ack);
+}
+
+/**
+ * @brief Test if the transfers of a DAP_Transfer can be pipelined
+ *
+ * Value match, match mask and timestamps are not pipelined, nor accesses
+ * to DP registers used by the pipelined mode itself (ABORT, CTRL/STAT,
+ * SELECT with a DP bank other than 0) or TARGETSEL.
+ *
+ * @param req Pointer to the request packet
+ * @return integer True if the command can use pipelined mode
+ */
+static int dap_xfer_pipe_ok(cmsis_pkt *req)
+{
+	int count = req->buffer[2];
+	int pos, i;
+	u8  request;
+
+	if ( ! dap_orun || (dap_mode != 1) || (count < 2))
+		return(0);
+	/* PIO engine only supports a single cycle turnaround when pipelined,
+	 * and a limited number of idle cycles (see swd_pio_put) */
+	if ((swd_config.turnaround != 1) ||
+	    (swd_config.idle_cycles > SWD_PIPE_IDLE_MAX))
+		return(0);
+	/* CTRL/STAT is only accessible with DP bank 0 */
+	if ( ! dap_select_ok || (dap_select & 0x0F))
+		return(0);
+
+	for (i = 0, pos = 3; i < count; i++)
+	{
+		request = req->buffer[pos++];
+		if (request & 0xB0)
+			return(0);
+		/* DP access */
+		if ((request & (1 << 0)) == 0)
+		{
+			if ((request & 0x0C) == 0x04)
+				return(0);
+			if (((request & (1 << 1)) == 0) && ((request & 0x0C) != 0x08))
+				return(0);
+		}
+		/* Write to SELECT (DP bank must stay 0) */
+		if ((request & 0x0F) == 0x08)
+		{
+			if (req->buffer[pos] & 0x0F)
+				return(0);
+		}
+		if ((request & (1 << 1)) == 0)
+			pos += 4;
+	}
+	return(1);
+}
+
+/**
+ * @brief Execute the transfers of a DAP_Transfer command
+ *
+ * This function starts (or continues) at the position saved into the
+ * context, so it can be called again after an error in pipelined mode.
+ * The size of the request must have been checked (see dap_transfer).
+ *
+ * @param x   Pointer to the context of the command
+ * @param req Pointer to the request packet
+ * @return integer ACK of the last transfer
+ */
+static int dap_xfer_run(dap_xfer *x, cmsis_pkt *req)
+{
+	dap_xfer_state *st = &x->st;
+	int count = req->buffer[2];
+	int request, ack = 1;
+	u32 data, match;
+	int retry;
+	u8  *p;
+
+	for ( ; st->i < count; st->i++)
+	{
+		x->start     = *st;
+		x->select    = dap_select;
+		x->select_ok = dap_select_ok;
+		request = req->buffer[st->pos++];
+
+		/* A read gives the status of previous writes */
+		if (request & (1 << 1))
+			st->wr_rd = 0;
+
+		if (st->rd_posted)
+		{
+			/* In case of another read on AP (without match), after a posted read */
+			if ((request & 0x13) == 0x03)
+			{
+				ack = dap_xfer_op(x, request, 0, x->rsp + st->pos_resp);
+				if (ack != 1)
+					break;
+				st->pos_resp += 4;
+				continue;
+			}
+			/* Otherwise, get the value of the posted read from RDBUFF */
+			ack = dap_xfer_op(x, 0x0C | (1 << 1), 0, x->rsp + st->pos_resp);
+			if (ack != 1)
+				break;
+			st->pos_resp += 4;
+			st->rd_posted = 0;
+		}
+
+		p = (req->buffer + st->pos);
+		/* Read with value match, the value is not returned */
+		if ((request & (1 << 1)) && (request & (1 << 4)))
+		{
+			match = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+			st->pos += 4;
+
+			/* In case of a read on AP, insert an extra read cycle */
+			if (request & (1 << 0))
+			{
+				dap_cache_access(request);
+				ack = dap_port_transfer(request, &data);
+				if (ack != 1)
+					break;
+			}
+			retry = dap_retry_match;
+			do
+			{
+				dap_cache_access(request);
+				ack = dap_port_transfer(request, &data);
+				if (ack != 1)
+					break;
+			} while (((data & dap_match_mask) != match) && retry--);
+
+			/* Value still not matching, report a mismatch */
+			if ((ack == 1) && ((data & dap_match_mask) != match))
+				ack |= (1 << 4);
+		}
+		/* In case of a read on AP, insert an extra read cycle */
+		else if ( (request & (1 << 1)) && (request & (1 << 0)) )
+		{
+			ack = dap_xfer_op(x, request, 0, 0);
+			if (ack != 1)
+				break;
+			st->rd_posted = 1;
+		}
+		/* If RnW bit is set, read request */
+		else if (request & (1 << 1))
+		{
+			ack = dap_xfer_op(x, request, 0, x->rsp + st->pos_resp);
+			if (ack == 1)
+				st->pos_resp += 4;
+		}
+		/* RnW is clear, Write request */
+		else
+		{
+			/* Extract data to write from request */
+			data = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+			st->pos += 4;
+
+			/* Match Mask : update the mask used by value match reads */
+			if (request & (1 << 5))
+			{
+				dap_match_mask = data;
+				ack = 1;
+			}
+			else
+			{
+				/* Register already holds this value, skip the write */
+				if (dap_cache_write(request, data))
+				{
+					ack = 1;
+					continue;
+				}
+				ack = dap_xfer_op(x, request, data, 0);
+				if (ack != 1)
+					break;
+				st->wr_rd = 1;
+				/* CTRL/STAT written by host replaces the saved value */
+				if (((request & 0x0F) == 0x04) && ((dap_select & 0x0F) == 0))
+				{
+					dap_ctrl       = (data & DP_CTRL_MASK);
+					dap_ctrl_ok    = 1;
+					dap_ctrl_dirty = 0;
+					swd_config.data_phase = dap_data_phase;
+				}
+			}
+		}
+		if (ack != 1)
+			break;
+	}
+
+	if (ack == 1)
+	{
+		x->start     = *st;
+		x->select    = dap_select;
+		x->select_ok = dap_select_ok;
+		/* Get the value of the last posted read */
+		if (st->rd_posted)
+		{
+			ack = dap_xfer_op(x, 0x0C | (1 << 1), 0, x->rsp + st->pos_resp);
+			if (ack == 1)
+			{
+				st->pos_resp += 4;
+				st->rd_posted = 0;
+			}
+		}
+		/* Read RDBUFF to get the status of the last write */
+		else if (st->wr_rd)
+		{
+			ack = dap_xfer_op(x, 0x0C | (1 << 1), 0, 0);
+			if (ack == 1)
+				st->wr_rd = 0;
+		}
+	}
+	return(ack);
+}
+/* EOF */
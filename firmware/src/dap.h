@@ -0,0 +1,39 @@
+/**
+ * @file  dap.h
+ * @brief Headers and definitions for the DAP engine
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef DAP_H
+#define DAP_H
+#include "types.h"
+
+/* Size of DAP packets (can be larger than the USB endpoint size) */
+#define DAP_PACKET_SIZE 256
+/* Number of DAP packets that can be queued (advertised to the host) */
+#define DAP_PACKET_COUNT  4
+
+typedef struct s_cmsis_pkt
+{
+	u8  *buffer;
+	u16  len;
+	/* Send the buffer (DAP_PACKET_SIZE bytes) as the first part of a long
+	 * response, then give an empty buffer for next part. Null if the
+	 * transport does not support long responses. Over USB, a long response
+	 * is one transfer that ends with a short packet (see cmsis.c). */
+	int (*stream)(struct s_cmsis_pkt *pkt);
+} cmsis_pkt;
+
+void dap_init(void);
+int  dap_recv(cmsis_pkt *req, cmsis_pkt *rsp);
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * @file  dap_queue.h
+ * @brief Queue of DAP packets shared between USB and DAP engine
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef DAP_QUEUE_H
+#define DAP_QUEUE_H
+#include "dap.h"
+
+/*
+ * Packets are stored into a ring of DAP_PACKET_COUNT slots, each one with a
+ * request and a response buffer. The queue has a single producer (USB side,
+ * core0) and a single consumer (DAP engine, core1), no lock is used. Three
+ * free running counters define the owner of each slot :
+ *
+ *   [tx,   exec) : response ready, owned by USB side (sending)
+ *   [exec, rx  ) : request received, owned by DAP engine (executing)
+ *   [rx,   tx + DAP_PACKET_COUNT) : free, owned by USB side (receiving)
+ *
+ * "rx" and "tx" are only written by the USB side, "exec" only by the DAP
+ * engine. A counter is always written (release) after the content of the
+ * slot, and read (acquire) before the content of the slot.
+ */
+typedef struct dap_queue_s
+{
+	uint rx;    /* Number of requests received */
+	uint exec;  /* Number of requests executed */
+	uint tx;    /* Number of responses sent    */
+	u16  req_len[DAP_PACKET_COUNT];
+	u16  rsp_len[DAP_PACKET_COUNT];
+	u8   req[DAP_PACKET_COUNT][DAP_PACKET_SIZE];
+	u8   rsp[DAP_PACKET_COUNT][DAP_PACKET_SIZE];
+} dap_queue;
+
+#define DAP_QUEUE_LOAD(v)     __atomic_load_n(&(v), __ATOMIC_ACQUIRE)
+#define DAP_QUEUE_STORE(v, x) __atomic_store_n(&(v), (x), __ATOMIC_RELEASE)
+
+/**
+ * @brief Initialize an empty queue
+ *
+ * This function must be called before the DAP engine is started.
+ *
+ * @param q Pointer to the queue
+ */
+static inline void dap_queue_init(dap_queue *q)
+{
+	q->rx   = 0;
+	q->exec = 0;
+	q->tx   = 0;
+}
+
+/**
+ * @brief Get the slot where next request can be received (USB side)
+ *
+ * @param q Pointer to the queue
+ * @return integer Index of the slot, -1 if all slots are used
+ */
+static inline int dap_queue_rx_get(dap_queue *q)
+{
+	/* tx is owned by this side, no barrier needed */
+	if ((q->rx - q->tx) >= DAP_PACKET_COUNT)
+		return(-1);
+	return(q->rx % DAP_PACKET_COUNT);
+}
+
+/**
+ * @brief Give a received request to the DAP engine (USB side)
+ *
+ * @param q   Pointer to the queue
+ * @param len Length of the request into slot returned by dap_queue_rx_get
+ */
+static inline void dap_queue_rx_put(dap_queue *q, u16 len)
+{
+	q->req_len[q->rx % DAP_PACKET_COUNT] = len;
+	DAP_QUEUE_STORE(q->rx, q->rx + 1);
+}
+
+/**
+ * @brief Get the slot of the next request to execute (DAP engine side)
+ *
+ * @param q Pointer to the queue
+ * @return integer Index of the slot, -1 if no request is waiting
+ */
+static inline int dap_queue_exec_get(dap_queue *q)
+{
+	if (DAP_QUEUE_LOAD(q->rx) == q->exec)
+		return(-1);
+	return(q->exec % DAP_PACKET_COUNT);
+}
+
+/**
+ * @brief Number of requests waiting, including the current one (DAP engine)
+ *
+ * @param q Pointer to the queue
+ * @return integer Number of requests received and not executed
+ */
+static inline uint dap_queue_pending(dap_queue *q)
+{
+	return(DAP_QUEUE_LOAD(q->rx) - q->exec);
+}
+
+/**
+ * @brief Test if all slots are used (no more request can be received)
+ *
+ * @param q Pointer to the queue
+ * @return integer True if the queue is full
+ */
+static inline int dap_queue_full(dap_queue *q)
+{
+	return((DAP_QUEUE_LOAD(q->rx) - DAP_QUEUE_LOAD(q->tx)) >= DAP_PACKET_COUNT);
+}
+
+/**
+ * @brief Give a response back to the USB side (DAP engine side)
+ *
+ * @param q   Pointer to the queue
+ * @param len Length of the response (0 if the request has no response)
+ */
+static inline void dap_queue_exec_put(dap_queue *q, u16 len)
+{
+	q->rsp_len[q->exec % DAP_PACKET_COUNT] = len;
+	DAP_QUEUE_STORE(q->exec, q->exec + 1);
+}
+
+/**
+ * @brief Get the slot of the next response to send (USB side)
+ *
+ * @param q Pointer to the queue
+ * @return integer Index of the slot, -1 if no response is ready
+ */
+static inline int dap_queue_tx_get(dap_queue *q)
+{
+	if (DAP_QUEUE_LOAD(q->exec) == q->tx)
+		return(-1);
+	return(q->tx % DAP_PACKET_COUNT);
+}
+
+/**
+ * @brief Release the slot of a response sent (USB side)
+ *
+ * @param q Pointer to the queue
+ */
+static inline void dap_queue_tx_put(dap_queue *q)
+{
+	DAP_QUEUE_STORE(q->tx, q->tx + 1);
+}
+
+#endif
@@ -15,21 +15,156 @@
  */
 #include "ios.h"
 #include "jtag.h"
+#include "jtag_pio.h"
+#include "swj_clock.h"
 #include "types.h"
 
-static uint jtag_bit_delay;
+/* Next state of the TAP controller, for TMS=0 and TMS=1 */
+static const u8 jtag_next[JTAG_STATES][2] =
+{
+	/* RESET     */ { JTAG_IDLE,      JTAG_RESET    },
+	/* IDLE      */ { JTAG_IDLE,      JTAG_DRSELECT },
+	/* DRSELECT  */ { JTAG_DRCAPTURE, JTAG_IRSELECT },
+	/* DRCAPTURE */ { JTAG_DRSHIFT,   JTAG_DREXIT1  },
+	/* DRSHIFT   */ { JTAG_DRSHIFT,   JTAG_DREXIT1  },
+	/* DREXIT1   */ { JTAG_DRPAUSE,   JTAG_DRUPDATE },
+	/* DRPAUSE   */ { JTAG_DRPAUSE,   JTAG_DREXIT2  },
+	/* DREXIT2   */ { JTAG_DRSHIFT,   JTAG_DRUPDATE },
+	/* DRUPDATE  */ { JTAG_IDLE,      JTAG_DRSELECT },
+	/* IRSELECT  */ { JTAG_IRCAPTURE, JTAG_RESET    },
+	/* IRCAPTURE */ { JTAG_IRSHIFT,   JTAG_IREXIT1  },
+	/* IRSHIFT   */ { JTAG_IRSHIFT,   JTAG_IREXIT1  },
+	/* IREXIT1   */ { JTAG_IRPAUSE,   JTAG_IRUPDATE },
+	/* IRPAUSE   */ { JTAG_IRPAUSE,   JTAG_IREXIT2  },
+	/* IREXIT2   */ { JTAG_IRSHIFT,   JTAG_IRUPDATE },
+	/* IRUPDATE  */ { JTAG_IDLE,      JTAG_DRSELECT },
+};
+
+/*
+ * Shortest TMS paths between two states : [from][to] = (length << 8) | TMS
+ * bits (first bit into LSB). Generated with a breadth-first search on the
+ * jtag_next table, the longest path is 8 clocks.
+ */
+static const u16 jtag_path[JTAG_STATES][JTAG_STATES] =
+{
+	/* RESET     */ { 0x000, 0x100, 0x202, 0x302, 0x402, 0x40A, 0x50A, 0x62A,
+	                  0x51A, 0x306, 0x406, 0x506, 0x516, 0x616, 0x756, 0x636 },
+	/* IDLE      */ { 0x307, 0x000, 0x101, 0x201, 0x301, 0x305, 0x405, 0x515,
+	                  0x40D, 0x203, 0x303, 0x403, 0x40B, 0x50B, 0x62B, 0x51B },
+	/* DRSELECT  */ { 0x203, 0x303, 0x000, 0x100, 0x200, 0x202, 0x302, 0x40A,
+	                  0x306, 0x101, 0x201, 0x301, 0x305, 0x405, 0x515, 0x40D },
+	/* DRCAPTURE */ { 0x51F, 0x303, 0x307, 0x000, 0x100, 0x101, 0x201, 0x305,
+	                  0x203, 0x40F, 0x50F, 0x60F, 0x62F, 0x72F, 0x8AF, 0x76F },
+	/* DRSHIFT   */ { 0x51F, 0x303, 0x307, 0x407, 0x000, 0x101, 0x201, 0x305,
+	                  0x203, 0x40F, 0x50F, 0x60F, 0x62F, 0x72F, 0x8AF, 0x76F },
+	/* DREXIT1   */ { 0x40F, 0x201, 0x203, 0x303, 0x302, 0x000, 0x100, 0x202,
+	                  0x101, 0x307, 0x407, 0x507, 0x517, 0x617, 0x757, 0x637 },
+	/* DRPAUSE   */ { 0x51F, 0x303, 0x307, 0x407, 0x201, 0x305, 0x000, 0x101,
+	                  0x203, 0x40F, 0x50F, 0x60F, 0x62F, 0x72F, 0x8AF, 0x76F },
+	/* DREXIT2   */ { 0x40F, 0x201, 0x203, 0x303, 0x100, 0x202, 0x302, 0x000,
+	                  0x101, 0x307, 0x407, 0x507, 0x517, 0x617, 0x757, 0x637 },
+	/* DRUPDATE  */ { 0x307, 0x100, 0x101, 0x201, 0x301, 0x305, 0x405, 0x515,
+	                  0x000, 0x203, 0x303, 0x403, 0x40B, 0x50B, 0x62B, 0x51B },
+	/* IRSELECT  */ { 0x101, 0x201, 0x305, 0x405, 0x505, 0x515, 0x615, 0x755,
+	                  0x635, 0x000, 0x100, 0x200, 0x202, 0x302, 0x40A, 0x306 },
+	/* IRCAPTURE */ { 0x51F, 0x303, 0x307, 0x407, 0x507, 0x517, 0x617, 0x757,
+	                  0x637, 0x40F, 0x000, 0x100, 0x101, 0x201, 0x305, 0x203 },
+	/* IRSHIFT   */ { 0x51F, 0x303, 0x307, 0x407, 0x507, 0x517, 0x617, 0x757,
+	                  0x637, 0x40F, 0x50F, 0x000, 0x101, 0x201, 0x305, 0x203 },
+	/* IREXIT1   */ { 0x40F, 0x201, 0x203, 0x303, 0x403, 0x40B, 0x50B, 0x62B,
+	                  0x51B, 0x307, 0x407, 0x302, 0x000, 0x100, 0x202, 0x101 },
+	/* IRPAUSE   */ { 0x51F, 0x303, 0x307, 0x407, 0x507, 0x517, 0x617, 0x757,
+	                  0x637, 0x40F, 0x50F, 0x201, 0x305, 0x000, 0x101, 0x203 },
+	/* IREXIT2   */ { 0x40F, 0x201, 0x203, 0x303, 0x403, 0x40B, 0x50B, 0x62B,
+	                  0x51B, 0x307, 0x407, 0x100, 0x202, 0x302, 0x000, 0x101 },
+	/* IRUPDATE  */ { 0x307, 0x100, 0x101, 0x201, 0x301, 0x305, 0x405, 0x515,
+	                  0x40D, 0x203, 0x303, 0x403, 0x40B, 0x50B, 0x62B, 0x000 }
+};
+
+/* Instruction of the selected device not known */
+#define JTAG_IR_NONE 0xFFFFFFFF
+
+jtag_param jtag_config;
+
+static uint jtag_engine; /* Engine used by the current session */
+static uint jtag_state; /* Current state of the TAP (or JTAG_UNKNOWN) */
+static uint jtag_ones;  /* Consecutive clocks with TMS high (state unknown) */
+static uint jtag_count; /* Number of devices into the scan chain */
+static uint jtag_index; /* Device used for transfers */
+static u8   jtag_ir_len[JTAG_DEV_MAX];
+static u32  jtag_ir_cur; /* Instruction loaded into the selected device */
+static u32  jtag_ir_gen; /* Number of passes into Capture-IR or Reset */
+static jtag_chain jtag_found; /* Result of last detection (until disconnect) */
+static u32  jtag_id_known;    /* Mask of the devices with a known IDCODE */
+
+static int  jtag_acc(u32 ir, u8 req, u32 *data);
+static void jtag_bypass(uint len, uint last);
+static int  jtag_dr(u32 ir, u8 req, u32 *data);
+static void jtag_ir(u32 ir);
+static u32  jtag_scan(u32 value, uint len, uint last);
+static inline void jtag_track(uint tms, uint len);
+static int  jtag_walk(uint count);
+
+/**
+ * @brief Initialize the JTAG module
+ *
+ * This function set the default configuration : a single device into the
+ * scan chain, with a 4 bits IR (ARM JTAG-DP). The PIO engine is used by
+ * default, the GPIO engine can be selected by modifying jtag_config.engine
+ * before connect.
+ */
+void jtag_init(void)
+{
+	jtag_config.engine      = JTAG_ENGINE_PIO;
+	jtag_config.retry_count = 16;
+	jtag_config.idle_cycles = 0;
+
+	jtag_count     = 1;
+	jtag_index     = 0;
+	jtag_ir_len[0] = 4;
+	jtag_ir_cur    = JTAG_IR_NONE;
+	jtag_state     = JTAG_UNKNOWN;
+	jtag_ones      = 0;
+	jtag_found.count = 0;
+	jtag_id_known    = 0;
+	jtag_engine      = JTAG_ENGINE_GPIO;
+}
+
+/**
+ * @brief Apply a new JTAG clock frequency
+ *
+ * GPIO engine reads the delay from swj_clk on each bit, so only a running
+ * PIO state machine has to be updated.
+ */
+void jtag_clock(void)
+{
+	if (jtag_engine == JTAG_ENGINE_PIO)
+		jtag_pio_clock();
+}
 
 /**
  * @brief Activate the debug port in JTAG mode
  *
+ * The engine selected by jtag_config.engine is used for this session. When
+ * the PIO can not be used, the GPIO engine is used until disconnect : the
+ * PIO engine is tried again by the next connect.
+ *
  * @result integer Zero is returuned on success
  */
 int jtag_connect(void)
 {
-	/* Set default bit delay */
-	jtag_bit_delay = 80;
-
 	ios_mode(PORT_MODE_JTAG);
+
+	jtag_engine = jtag_config.engine;
+	if (jtag_engine == JTAG_ENGINE_PIO)
+	{
+		/* If PIO can not be used, fallback to GPIO */
+		if (jtag_pio_init() != 0)
+			jtag_engine = JTAG_ENGINE_GPIO;
+	}
+	jtag_state  = JTAG_UNKNOWN;
+	jtag_ones   = 0;
+	jtag_ir_cur = JTAG_IR_NONE;
 	return(0);
 }
 
@@ -40,35 +175,394 @@ int jtag_connect(void)
  */
 int jtag_disconnect(void)
 {
+	if (jtag_engine == JTAG_ENGINE_PIO)
+		jtag_pio_release();
+	jtag_engine = JTAG_ENGINE_GPIO;
+
 	ios_mode(PORT_MODE_HIZ);
+	jtag_state  = JTAG_UNKNOWN;
+	jtag_ones   = 0;
+	jtag_ir_cur = JTAG_IR_NONE;
+	/* Target may be changed, forget the scan chain */
+	jtag_found.count = 0;
+	jtag_id_known    = 0;
 	return(0);
 }
 
+/**
+ * @brief Set the description of the scan chain
+ *
+ * Devices are numbered from TDO : device 0 is the last one of the chain,
+ * its TDO pin is connected to the probe.
+ *
+ * @param count  Number of devices (1 to JTAG_DEV_MAX)
+ * @param ir_len Length of the instruction register of each device
+ * @return integer Zero on success, -1 for a bad configuration
+ */
+int jtag_configure(uint count, const u8 *ir_len)
+{
+	uint i;
+
+	if ((count == 0) || (count > JTAG_DEV_MAX))
+		return(-1);
+	for (i = 0; i < count; i++)
+		if (ir_len[i] == 0)
+			return(-1);
+
+	for (i = 0; i < count; i++)
+		jtag_ir_len[i] = ir_len[i];
+	jtag_count  = count;
+	jtag_index  = 0;
+	jtag_ir_cur = JTAG_IR_NONE;
+	return(0);
+}
+
+/**
+ * @brief Select the device of the scan chain used by next transfers
+ *
+ * @param index Position of the device into the chain (from TDO)
+ * @return integer Zero on success, -1 if there is no such device
+ */
+int jtag_select(uint index)
+{
+	if (index >= jtag_count)
+		return(-1);
+	/* Other devices must be set in BYPASS */
+	if (index != jtag_index)
+		jtag_ir_cur = JTAG_IR_NONE;
+	jtag_index = index;
+	return(0);
+}
+
+/**
+ * @brief Detect the devices of the scan chain
+ *
+ * The total length of the instruction registers is found first, by filling
+ * them with ones then counting the bits before the first zero comes out.
+ * With all devices in BYPASS, the number of devices is the length of the
+ * DR. IDCODEs are read after a TAP reset. The IR capture value of each
+ * device ends with 01 (IEEE 1149.1), this is used to split the total IR
+ * length : IR lengths are only known when these patterns are not ambiguous.
+ * When they are known, the chain is configured like DAP_JTAG_Configure.
+ *
+ * The result is kept until disconnect, a new scan is done only if forced.
+ *
+ * @param force True to scan the chain again
+ * @return jtag_chain Pointer to the description of the chain
+ */
+const jtag_chain *jtag_detect(uint force)
+{
+	u32  capture[JTAG_IR_TOTAL / 32];
+	u32  value;
+	uint start[JTAG_DEV_MAX];
+	uint len, count, bit, i, n;
+
+	if (jtag_found.count && ! force)
+		return(&jtag_found);
+	jtag_found.count = 0;
+	jtag_found.ir_ok = 0;
+	jtag_id_known    = 0;
+
+	/* Total length of IR (captured values are saved) */
+	jtag_goto(JTAG_IRSHIFT);
+	for (i = 0; i < (JTAG_IR_TOTAL / 32); i++)
+		capture[i] = jtag_scan(0xFFFFFFFF, 32, 0);
+	for (len = 0; len < JTAG_IR_TOTAL; len += 32)
+	{
+		value = jtag_scan(0, 32, 0);
+		if (value == 0xFFFFFFFF)
+			continue;
+		for ( ; value & 1; value >>= 1)
+			len++;
+		break;
+	}
+	/* Set all devices in BYPASS */
+	jtag_bypass(JTAG_IR_TOTAL, 1);
+
+	/* Number of devices : flush the BYPASS registers with zeros, then
+	 * count the bits before the first one comes out */
+	jtag_goto(JTAG_DRSHIFT);
+	jtag_scan(0, 32, 0);
+	value = jtag_scan(0xFFFFFFFF, 32, 1);
+	for (count = 0; (count < 32) && ((value & 1) == 0); count++)
+		value >>= 1;
+	jtag_goto(JTAG_IDLE);
+
+	/* No device (TDO stuck) or chain too long */
+	if ((len == 0) || (len >= JTAG_IR_TOTAL) ||
+	    (count == 0) || (count > JTAG_DEV_MAX))
+		return(&jtag_found);
+
+	if (jtag_walk(count) != 0)
+		return(&jtag_found);
+	jtag_found.count = count;
+
+	/* Start of each IR : bit 1 followed by bit 0 */
+	for (i = 0, n = 0; (i + 1) < len; i++)
+	{
+		bit = (capture[i / 32] >> (i % 32)) & 3;
+		if ((i % 32) == 31)
+			bit |= (capture[(i + 1) / 32] & 1) << 1;
+		if (bit != 1)
+			continue;
+		if (n < JTAG_DEV_MAX)
+			start[n] = i;
+		n++;
+	}
+	if (count == 1)
+		jtag_found.ir_len[0] = len;
+	else if ((n == count) && (start[0] == 0))
+	{
+		for (i = 0; i < count; i++)
+		{
+			n = ((i + 1) < count) ? start[i + 1] : len;
+			jtag_found.ir_len[i] = n - start[i];
+		}
+	}
+	else
+		return(&jtag_found);
+	jtag_found.ir_ok = 1;
+	jtag_configure(count, jtag_found.ir_len);
+
+	return(&jtag_found);
+}
+
+/**
+ * @brief Get the IDCODE of one device of the scan chain
+ *
+ * The IDCODE instruction is loaded into the device and its DR is scanned,
+ * other devices are set in BYPASS. The TAPs are not reset, so the state of
+ * the other devices is kept. Values (and the ones read by jtag_detect) are
+ * kept until disconnect.
+ *
+ * @param index Position of the device into the chain (from TDO)
+ * @param value Pointer where IDCODE is stored
+ * @return integer Zero on success, -1 if the device has no IDCODE
+ */
+int jtag_idcode(uint index, u32 *value)
+{
+	u8  zero[4] = { 0 }, cap[4];
+	u32 id;
+
+	if (index >= jtag_count)
+		return(-1);
+
+	if ((jtag_id_known & (1u << index)) == 0)
+	{
+		if (jtag_ir_scan(index, JTAG_IR_IDCODE) != 0)
+			return(-1);
+		jtag_dr_scan(index, zero, cap, 32);
+		jtag_goto(JTAG_IDLE);
+		id = (cap[3] << 24) | (cap[2] << 16) | (cap[1] << 8) | cap[0];
+		/* BYPASS captures a zero : the device has no such instruction */
+		if ((id & 1) == 0)
+			return(-1);
+		jtag_found.idcode[index] = id;
+		jtag_id_known |= (1u << index);
+	}
+	if (jtag_found.idcode[index] == 0)
+		return(-1);
+	*value = jtag_found.idcode[index];
+	return(0);
+}
+
+/**
+ * @brief Process one transfer with the JTAG-DP of the selected device
+ *
+ * The request and the result use the same format as swd_transfer(), and
+ * reads behave as with SWD : an AP read returns the result of the previous
+ * one (posted) which is obtained by reading RDBUFF. A DP read needs a second
+ * scan (RDBUFF) to capture its result. A write to DP register 0 uses the
+ * ABORT instruction. The IR scan is skipped when the instruction of the
+ * device is already the right one.
+ *
+ * @param req   Request (APnDP, RnW, A[3:2])
+ * @param value Value to write, or pointer where read value is stored
+ * @return integer Value of the ACK (1:OK 2:WAIT 7:no valid ACK)
+ */
+int jtag_transfer(u8 req, u32 *value)
+{
+	u32 data = 0;
+	int ack;
+
+	if ((req & (1 << 1)) == 0)
+		data = *value;
+
+	/* Write to ABORT, there is no ACK for this scan */
+	if ((req & 0x0F) == 0x00)
+	{
+		jtag_dr(JTAG_IR_ABORT, req, &data);
+		return(1);
+	}
+
+	ack = jtag_acc((req & 1) ? JTAG_IR_APACC : JTAG_IR_DPACC, req, &data);
+
+	/* DP read (other than RDBUFF), the result is captured by next scan */
+	if ((ack == 1) && ((req & 0x03) == 0x02) && ((req & 0x0C) != 0x0C))
+	{
+		data = 0;
+		ack = jtag_acc(JTAG_IR_DPACC, 0x0E, &data);
+	}
+
+	if ((ack == 1) && (req & (1 << 1)) && value)
+		*value = data;
+	return(ack);
+}
+
+/**
+ * @brief Load an instruction into one device of the scan chain
+ *
+ * Other devices are set in BYPASS. The TAP is left into Update-IR.
+ *
+ * @param index Position of the device into the chain (from TDO)
+ * @param ir    Instruction to load
+ * @return integer Zero on success, -1 if there is no such device
+ */
+int jtag_ir_scan(uint index, u32 ir)
+{
+	uint sel = jtag_index;
+
+	if (index >= jtag_count)
+		return(-1);
+	jtag_index = index;
+	jtag_ir(ir);
+	jtag_index = sel;
+	/* Device used for transfers is now in BYPASS */
+	if (index != sel)
+		jtag_ir_cur = JTAG_IR_NONE;
+	return(0);
+}
+
+/**
+ * @brief Scan the data register of one device of the scan chain
+ *
+ * Other devices must be in BYPASS (one bit each), see jtag_ir_scan(). The
+ * TAP is left into Update-DR.
+ *
+ * @param index Position of the device into the chain (from TDO)
+ * @param tdi   Bits to shift out (first one into LSB of first byte)
+ * @param tdo   Buffer where captured bits are stored (can be null)
+ * @param len   Length of the register (any length)
+ * @return integer Zero on success, -1 if there is no such device
+ */
+int jtag_dr_scan(uint index, const u8 *tdi, u8 *tdo, uint len)
+{
+	uint after;
+
+	if (index >= jtag_count)
+		return(-1);
+	after = (jtag_count - index - 1);
+
+	jtag_goto(JTAG_DRSHIFT);
+	jtag_bypass(index, (len + after) == 0);
+	jtag_scan_bits(tdi, tdo, len, (after == 0));
+	jtag_bypass(after, 1);
+	jtag_goto(JTAG_DRUPDATE);
+	return(0);
+}
+
+/**
+ * @brief Move the TAP controller to a state, with the minimum of clocks
+ *
+ * When the current state is not known, the TAP is reset first (5 clocks
+ * with TMS high).
+ *
+ * @param state Target state (JTAG_RESET to JTAG_IRUPDATE)
+ */
+void jtag_goto(uint state)
+{
+	u16 path;
+
+	if (state >= JTAG_STATES)
+		return;
+	if (jtag_state == JTAG_UNKNOWN)
+		jtag_tms_sequence(0x1F, 5);
+	path = jtag_path[jtag_state][state];
+	if (path)
+		jtag_tms_sequence(path & 0xFF, path >> 8);
+}
+
+/**
+ * @brief Move the TAP to Run-Test/Idle after a scan
+ *
+ * Scans end into Update-DR or Update-IR, so that the next one starts with
+ * the minimum of clocks. This function must be called before a sequence
+ * from the host, which expects the TAP into Run-Test/Idle.
+ */
+void jtag_idle(void)
+{
+	if ((jtag_state == JTAG_DRUPDATE) || (jtag_state == JTAG_IRUPDATE))
+		jtag_goto(JTAG_IDLE);
+}
+
+/**
+ * @brief Get the current state of the TAP controller
+ *
+ * @return integer State of the TAP (JTAG_RESET ...) or JTAG_UNKNOWN
+ */
+uint jtag_tap(void)
+{
+	return(jtag_state);
+}
+
+/**
+ * @brief Get the number of times the instructions may have been modified
+ *
+ * The counter is incremented when the TAP goes through Capture-IR or
+ * Test-Logic-Reset : a module that loads an instruction can check that it
+ * is still there.
+ *
+ * @return integer Value of the counter
+ */
+u32 jtag_ir_changes(void)
+{
+	return(jtag_ir_gen);
+}
+
 /**
  * @brief Execute one or multiple jtag transition
  *
+ * With the PIO engine, each run of identical TMS values is a single shift
+ * (TDI high) of up to 32 clocks. Transitions after the first 32 use a low
+ * TMS, so any length may be requested (idle cycles for example).
+ *
  * @brief seq List of TMS values (one bit per transition)
- * @brief len Number of transitions to execute (up to 32)
+ * @brief len Number of transitions to execute
  */
 void jtag_tms_sequence(u32 seq, uint len)
 {
-	unsigned int wait;
 	unsigned int i;
 
+	if (jtag_engine == JTAG_ENGINE_PIO)
+	{
+		while (len)
+		{
+			for (i = 1; (i < len) && (i < 32) &&
+			            (((seq >> i) & 1) == (seq & 1)); i++)
+				;
+			jtag_track(seq & 1, i);
+			jtag_pio_queue(0xFFFFFFFF, i, seq & 1, 0);
+			len -= i;
+			seq  = (i < 32) ? (seq >> i) : 0;
+		}
+		jtag_pio_flush();
+		return;
+	}
+
 	for (i = 0; i < len ; i++)
 	{
+		jtag_track(seq & 1, 1);
+
 		/* Set next bit to TMS */
 		if (seq & 1) ios_pin_set(PORT_D1_PIN, 1);
 		else         ios_pin_set(PORT_D1_PIN, 0);
 
 		/* Wait 1/2 clock period */
-		for (wait = 0; wait < jtag_bit_delay; wait++)
-			asm volatile("nop");
+		swj_delay(swj_clk.delay);
 		/* Rising edge to TCK */
 		ios_pin_set(PORT_D2_PIN, 1);
 		/* Wait 1/2 clock period */
-		for (wait = 0; wait < jtag_bit_delay; wait++)
-			asm volatile("nop");
+		swj_delay(swj_clk.delay);
 		/* Falling edge to TCK */
 		ios_pin_set(PORT_D2_PIN, 0);
 
@@ -83,14 +577,18 @@ void jtag_tms_sequence(u32 seq, uint len)
  * @param value Mask of the bits to shift out
  * @param len   Number of bits to shift (0 to 32)
  * @param tms   Value to set for TMS (same to all shifts)
- * @return uint Mask of bits readed for shift in
+ * @return uint Mask of bits readed for shift in (first one into LSB)
  */
 u32 jtag_shift(u32 value, uint len, uint tms)
 {
 	u32  result = 0;
-	uint wait;
 	uint i;
 
+	jtag_track(tms, len);
+
+	if (jtag_engine == JTAG_ENGINE_PIO)
+		return( jtag_pio_shift(value, len, tms) );
+
 	/* First, set TMS value */
 	ios_pin_set(PORT_D1_PIN, tms);
 
@@ -101,18 +599,15 @@ u32 jtag_shift(u32 value, uint len, uint tms)
 		value = (value >> 1);
 
 		/* Wait 1/2 clock period */
-		for (wait = 0; wait < jtag_bit_delay; wait++)
-			asm volatile("nop");
+		swj_delay(swj_clk.delay);
 
 		/* Get next input bit */
-		result = (result << 1);
-		result |= ios_pin(PORT_D0_PIN);
+		result |= ((u32)ios_pin(PORT_D0_PIN) << i);
 
 		/* Rising edge to TCK */
 		ios_pin_set(PORT_D2_PIN, 1);
 		/* Wait 1/2 clock period */
-		for (wait = 0; wait < jtag_bit_delay; wait++)
-			asm volatile("nop");
+		swj_delay(swj_clk.delay);
 		/* Falling edge to TCK */
 		ios_pin_set(PORT_D2_PIN, 0);
 	}
@@ -120,44 +615,289 @@ u32 jtag_shift(u32 value, uint len, uint tms)
 }
 
 /**
- * @brief Shift bits to/from the target (constant TMS)
+ * @brief Shift a sequence of bits stored into bytes (constant TMS)
  *
- * @param value Mask of the bits to shift out
- * @param len   Number of bits to shift (0 to 8)
- * @param tms   Value to set for TMS (same to all shifts)
- * @return uint Mask of bits readed for shift in
+ * Bits are sent and captured LSB first, 32 bits per shift. With the PIO
+ * engine the shifts are queued : the captured bits are stored into the TDO
+ * buffer by jtag_sync(), or by the next function that uses the port.
+ *
+ * @param tdi Bits to shift out (first one into LSB of first byte)
+ * @param tdo Buffer where captured bits are stored (can be null)
+ * @param len Number of bits (any length)
+ * @param tms Value to set for TMS
  */
-u8 jtag_rshift(u8 value, uint len, uint tms)
+void jtag_sequence(const u8 *tdi, u8 *tdo, uint len, uint tms)
 {
-	u32  result = 0;
-	uint wait;
+	u32  value;
+	uint n, i;
+
+	for ( ; len; len -= n)
+	{
+		n = (len > 32) ? 32 : len;
+		value = 0;
+		for (i = 0; i < n; i += 8)
+			value |= ((u32)*tdi++ << i);
+
+		if (jtag_engine == JTAG_ENGINE_PIO)
+		{
+			jtag_track(tms, n);
+			jtag_pio_queue(value, n, tms, tdo);
+			if (tdo)
+				tdo += (n + 7) / 8;
+			continue;
+		}
+
+		value = jtag_shift(value, n, tms);
+		if (tdo == 0)
+			continue;
+		for (i = 0; i < n; i += 8)
+		{
+			*tdo++ = (u8)value;
+			value >>= 8;
+		}
+	}
+}
+
+/**
+ * @brief Shift a part of a scan, and optionally leave the Shift state
+ *
+ * Same as jtag_sequence() with TMS low, but TMS is high for the last bit
+ * when "last" is set. Captured bits are available when the function
+ * returns.
+ *
+ * @param tdi  Bits to shift out (first one into LSB of first byte)
+ * @param tdo  Buffer where captured bits are stored (can be null)
+ * @param len  Number of bits (any length)
+ * @param last True to leave the Shift state with the last bit
+ */
+void jtag_scan_bits(const u8 *tdi, u8 *tdo, uint len, uint last)
+{
+	u8   bit, cap = 0;
 	uint i;
 
-	/* First, set TMS value */
-	ios_pin_set(PORT_D1_PIN, tms);
+	if (len == 0)
+		return;
+	if ( ! last)
+	{
+		jtag_sequence(tdi, tdo, len, 0);
+		jtag_sync();
+		return;
+	}
+	i = len - 1;
+	jtag_sequence(tdi, tdo, i, 0);
+	bit = (tdi[i / 8] >> (i % 8)) & 1;
+	jtag_sequence(&bit, &cap, 1, 1);
+	jtag_sync();
+	if (tdo)
+		tdo[i / 8] = (tdo[i / 8] & ((1 << (i % 8)) - 1)) | ((cap & 1) << (i % 8));
+}
 
-	for (i = 0; i < len; i++)
+/**
+ * @brief Wait for the end of queued sequences (see jtag_sequence)
+ *
+ */
+void jtag_sync(void)
+{
+	if (jtag_engine == JTAG_ENGINE_PIO)
+		jtag_pio_flush();
+}
+
+/**
+ * @brief Process one scan of the JTAG-DP, with retry on WAIT
+ *
+ * @param ir   Instruction to use (DPACC or APACC)
+ * @param req  Request (RnW, A[3:2])
+ * @param data Value to write, replaced by the captured value
+ * @return integer Value of the ACK (1:OK 2:WAIT 7:no valid ACK)
+ */
+static int jtag_acc(u32 ir, u8 req, u32 *data)
+{
+	u32  wdata = *data;
+	uint i;
+	int  ack = 2;
+
+	for (i = 0; (ack == 2) && (i < jtag_config.retry_count); i++)
 	{
-		/* Set next TDO bit */
-		ios_pin_set(PORT_D3_PIN, (value & 0x80) ? 1 : 0);
-		value = (value << 1);
+		/* On WAIT, the request has been ignored by the DP : send again */
+		*data = wdata;
+		ack = jtag_dr(ir, req, data);
+	}
+	return(ack);
+}
 
-		/* Wait 1/2 clock period */
-		for (wait = 0; wait < jtag_bit_delay; wait++)
-			asm volatile("nop");
+/**
+ * @brief Shift ones into the current Shift-DR or Shift-IR state
+ *
+ * @param len  Number of bits (any length)
+ * @param last True to leave the Shift state with the last bit
+ */
+static void jtag_bypass(uint len, uint last)
+{
+	for ( ; len > 32; len -= 32)
+		jtag_scan(0xFFFFFFFF, 32, 0);
+	jtag_scan(0xFFFFFFFF, len, last);
+}
 
-		/* Get next input bit */
-		result = (result >> 1);
-		result |= (ios_pin(PORT_D0_PIN) ? 0x80 : 0);
+/**
+ * @brief Process one DR scan of the JTAG-DP of the selected device
+ *
+ * The 35 bits of the DR are the request (RnW, A[3:2]) followed by the data.
+ * The captured value is the ACK of this request followed by the result of
+ * the previous one. Other devices of the chain are in BYPASS (one bit each).
+ *
+ * @param ir   Instruction to use (DPACC, APACC or ABORT)
+ * @param req  Request (RnW, A[3:2])
+ * @param data Value to write, replaced by the captured value
+ * @return integer Value of the ACK (1:OK 2:WAIT 7:no valid ACK)
+ */
+static int jtag_dr(u32 ir, u8 req, u32 *data)
+{
+	uint after = (jtag_count - jtag_index - 1);
+	u32  ack;
 
-		/* Rising edge to TCK */
-		ios_pin_set(PORT_D2_PIN, 1);
-		/* Wait 1/2 clock period */
-		for (wait = 0; wait < jtag_bit_delay; wait++)
-			asm volatile("nop");
-		/* Falling edge to TCK */
-		ios_pin_set(PORT_D2_PIN, 0);
+	if (ir != jtag_ir_cur)
+		jtag_ir(ir);
+
+	jtag_goto(JTAG_DRSHIFT);
+	jtag_bypass(jtag_index, 0);
+	ack   = jtag_scan((req >> 1) & 7, 3, 0);
+	*data = jtag_scan(*data, 32, (after == 0));
+	jtag_bypass(after, 1);
+	jtag_goto(JTAG_DRUPDATE);
+
+	if (jtag_config.idle_cycles)
+	{
+		jtag_goto(JTAG_IDLE);
+		jtag_tms_sequence(0, jtag_config.idle_cycles);
+	}
+
+	/* Convert JTAG-DP ACK (OK/FAULT:010 WAIT:001) to SWD values */
+	if (ack == 2)
+		return(1);
+	if (ack == 1)
+		return(2);
+	return(7);
+}
+
+/**
+ * @brief Load an instruction into the selected device
+ *
+ * All other devices of the chain are set in BYPASS (IR filled with ones).
+ * Devices between the selected one and TDO receive the first bits.
+ *
+ * @param ir Instruction to load
+ */
+static void jtag_ir(u32 ir)
+{
+	uint before = 0, after = 0;
+	uint len, i;
+
+	for (i = 0; i < jtag_count; i++)
+	{
+		if (i < jtag_index)
+			before += jtag_ir_len[i];
+		else if (i > jtag_index)
+			after += jtag_ir_len[i];
+	}
+	len = jtag_ir_len[jtag_index];
+
+	jtag_goto(JTAG_IRSHIFT);
+	jtag_bypass(before, 0);
+	if (len > 32)
+	{
+		jtag_scan(ir, 32, 0);
+		jtag_bypass(len - 32, (after == 0));
 	}
+	else
+		jtag_scan(ir, len, (after == 0));
+	jtag_bypass(after, 1);
+	jtag_goto(JTAG_IRUPDATE);
+
+	jtag_ir_cur = ir;
+}
+
+/**
+ * @brief Shift bits into the current Shift-DR or Shift-IR state
+ *
+ * @param value Bits to shift out (first one into LSB)
+ * @param len   Number of bits (0 to 32)
+ * @param last  True to leave the Shift state with the last bit (TMS high)
+ * @return integer Bits captured from TDO (first one into LSB)
+ */
+static u32 jtag_scan(u32 value, uint len, uint last)
+{
+	u32 result;
+
+	if ((len == 0) || ! last)
+		return( jtag_shift(value, len, 0) );
+
+	result  = jtag_shift(value, len - 1, 0);
+	result |= (jtag_shift(value >> (len - 1), 1, 1) << (len - 1));
 	return(result);
 }
+
+/**
+ * @brief Update the state of the TAP for a number of clocks (constant TMS)
+ *
+ * @param tms Value of TMS
+ * @param len Number of clocks
+ */
+static inline void jtag_track(uint tms, uint len)
+{
+	tms = tms ? 1 : 0;
+	if (jtag_state == JTAG_UNKNOWN)
+	{
+		/* Five clocks with TMS high reset the TAP from any state */
+		jtag_ones = tms ? (jtag_ones + len) : 0;
+		if (jtag_ones < 5)
+			return;
+		jtag_state  = JTAG_RESET;
+		jtag_ir_cur = JTAG_IR_NONE;
+		jtag_ir_gen++;
+		return;
+	}
+	for ( ; len; len--)
+	{
+		jtag_state = jtag_next[jtag_state][tms];
+		/* IR is modified (or reset to IDCODE) */
+		if ((jtag_state == JTAG_IRCAPTURE) || (jtag_state == JTAG_RESET))
+		{
+			jtag_ir_cur = JTAG_IR_NONE;
+			jtag_ir_gen++;
+		}
+	}
+}
+
+/**
+ * @brief Read the IDCODE registers of the first devices of the chain
+ *
+ * After a TAP reset, the DR of each device is IDCODE (32 bits, LSB high) or
+ * BYPASS (1 bit, low). Values are stored into jtag_found.
+ *
+ * @param count Number of devices to read
+ * @return integer Zero on success, -1 if there is no device
+ */
+static int jtag_walk(uint count)
+{
+	u32  value;
+	uint i;
+
+	jtag_goto(JTAG_RESET);
+	jtag_goto(JTAG_DRSHIFT);
+	for (i = 0; i < count; i++)
+	{
+		value = jtag_scan(0xFFFFFFFF, 1, 0);
+		if (value)
+			value |= (jtag_scan(0xFFFFFFFF, 31, 0) << 1);
+		/* Ones shifted in by the probe : end of the chain */
+		if (value == 0xFFFFFFFF)
+			break;
+		jtag_found.idcode[i] = value;
+	}
+	jtag_goto(JTAG_IDLE);
+	if (i < count)
+		return(-1);
+	jtag_id_known |= (1u << count) - 1;
+	return(0);
+}
 /* EOF */
@@ -17,17 +17,79 @@
 #define JTAG_H
 #include "types.h"
 
-typedef struct jtag_state_s
+/* States of the TAP controller (IEEE 1149.1) */
+#define JTAG_RESET      0
+#define JTAG_IDLE       1
+#define JTAG_DRSELECT   2
+#define JTAG_DRCAPTURE  3
+#define JTAG_DRSHIFT    4
+#define JTAG_DREXIT1    5
+#define JTAG_DRPAUSE    6
+#define JTAG_DREXIT2    7
+#define JTAG_DRUPDATE   8
+#define JTAG_IRSELECT   9
+#define JTAG_IRCAPTURE 10
+#define JTAG_IRSHIFT   11
+#define JTAG_IREXIT1   12
+#define JTAG_IRPAUSE   13
+#define JTAG_IREXIT2   14
+#define JTAG_IRUPDATE  15
+#define JTAG_STATES    16
+/* State not known (after connect, until 5 clocks with TMS high) */
+#define JTAG_UNKNOWN   0xFF
+
+/* Instructions of the ARM JTAG-DP */
+#define JTAG_IR_ABORT  0x08
+#define JTAG_IR_DPACC  0x0A
+#define JTAG_IR_APACC  0x0B
+#define JTAG_IR_IDCODE 0x0E
+#define JTAG_IR_BYPASS 0x0F
+
+/* Max number of devices into the scan chain */
+#define JTAG_DEV_MAX   8
+/* Max total length of the instruction registers (chain detection) */
+#define JTAG_IR_TOTAL  256
+
+#define JTAG_ENGINE_GPIO 0
+#define JTAG_ENGINE_PIO  1
+
+typedef struct jtag_param_s
 {
-	char name[16];
-	struct jtag_state_s *t0; // Next state when TMS=0
-	struct jtag_state_s *t1; // Next state when TMS=1
-} jtag_state;
+	uint engine;      /* GPIO (bit-banging) or PIO state machine */
+	uint retry_count;
+	uint idle_cycles; /* Idle cycles after each transfer */
+} jtag_param;
+
+/* Scan chain found by jtag_detect() */
+typedef struct jtag_chain_s
+{
+	uint count;                /* Number of devices (0 : not detected) */
+	uint ir_ok;                /* True when the IR lengths are known */
+	u8   ir_len[JTAG_DEV_MAX];
+	u32  idcode[JTAG_DEV_MAX]; /* Zero for a device without IDCODE */
+} jtag_chain;
+
+extern jtag_param jtag_config;
 
+void jtag_init(void);
+void jtag_clock(void);
 int  jtag_connect(void);
 int  jtag_disconnect(void);
+int  jtag_configure(uint count, const u8 *ir_len);
+int  jtag_select(uint index);
+const jtag_chain *jtag_detect(uint force);
+int  jtag_idcode(uint index, u32 *value);
+int  jtag_transfer(u8 req, u32 *value);
+int  jtag_ir_scan(uint index, u32 ir);
+int  jtag_dr_scan(uint index, const u8 *tdi, u8 *tdo, uint len);
+void jtag_goto(uint state);
+void jtag_idle(void);
+uint jtag_tap(void);
+u32  jtag_ir_changes(void);
 void jtag_tms_sequence(u32 seq, uint len);
 u32  jtag_shift(u32 value, uint len, uint tms);
-u8   jtag_rshift(u8 value, uint len, uint tms);
+void jtag_sequence(const u8 *tdi, u8 *tdo, uint len, uint tms);
+void jtag_scan_bits(const u8 *tdi, u8 *tdo, uint len, uint last);
+void jtag_sync(void);
 
 #endif
@@ -0,0 +1,290 @@
+/**
+ * @file  jtag_bscan.c
+ * @brief Boundary-scan engine (EXTEST and SAMPLE loops on the probe)
+ *
+ * The host describes one device of the scan chain : length of its
+ * boundary-scan register, EXTEST and SAMPLE/PRELOAD instructions, and a map
+ * of the pins to drive or sample (input, output and control cells, from the
+ * BSDL file). Then pins are set and sampled by their number, the probe
+ * builds the register and runs the scans.
+ *
+ * Pins are sampled with SAMPLE/PRELOAD until one is set. Before EXTEST is
+ * loaded, the register is captured and preloaded, so the cells that are not
+ * into the map keep their value and the pins do not glitch.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "jtag.h"
+#include "jtag_bscan.h"
+#include "types.h"
+
+typedef struct jtag_bscan_pin_s
+{
+	u16 input;    /* Cell captured for the level of the pin */
+	u16 output;   /* Cell that drives the pin */
+	u16 control;  /* Cell that enables the output (shared by some pins) */
+	u8  disable;  /* Value of the control cell for high impedance */
+	u8  state;    /* JTAG_BSCAN_LOW, JTAG_BSCAN_HIGH or JTAG_BSCAN_Z */
+} jtag_bscan_pin;
+
+static uint bscan_index;  /* Device into the scan chain */
+static uint bscan_len;    /* Length of the register (0 : not configured) */
+static u32  bscan_extest;
+static u32  bscan_sample;
+static uint bscan_count;  /* Number of pins (highest mapped pin + 1) */
+static uint bscan_drive;  /* A pin has been set, EXTEST must be used */
+static u32  bscan_ir;     /* Instruction loaded by this module */
+static uint bscan_ir_ok;  /* True when bscan_ir has been loaded */
+static u32  bscan_ir_gen; /* Value of jtag_ir_changes() after loading it */
+static u8   bscan_image[JTAG_BSCAN_BITS / 8]; /* Bits to shift (update) */
+static u8   bscan_cap  [JTAG_BSCAN_BITS / 8]; /* Last captured bits */
+static jtag_bscan_pin bscan_pin[JTAG_BSCAN_PINS];
+
+static inline uint bscan_bit(const u8 *buf, uint cell);
+static inline void bscan_bit_set(u8 *buf, uint cell, uint value);
+static int  bscan_load(u32 ir);
+static uint bscan_loaded(u32 ir);
+
+/**
+ * @brief Set the device, the register and the instructions to use
+ *
+ * The map of pins is cleared. The device must be into the chain described
+ * by DAP_JTAG_Configure (or found by jtag_detect).
+ *
+ * @param index  Position of the device into the chain (from TDO)
+ * @param len    Length of the boundary-scan register
+ * @param extest Opcode of EXTEST
+ * @param sample Opcode of SAMPLE/PRELOAD
+ * @return integer Zero on success, -1 for a bad configuration
+ */
+int jtag_bscan_setup(uint index, uint len, u32 extest, u32 sample)
+{
+	uint i;
+
+	bscan_len = 0;
+	if ((index >= JTAG_DEV_MAX) || (len == 0) || (len > JTAG_BSCAN_BITS))
+		return(-1);
+
+	bscan_index  = index;
+	bscan_len    = len;
+	bscan_extest = extest;
+	bscan_sample = sample;
+	bscan_count  = 0;
+	bscan_drive  = 0;
+	bscan_ir_ok  = 0;
+	for (i = 0; i < JTAG_BSCAN_PINS; i++)
+	{
+		bscan_pin[i].input   = JTAG_BSCAN_NONE;
+		bscan_pin[i].output  = JTAG_BSCAN_NONE;
+		bscan_pin[i].control = JTAG_BSCAN_NONE;
+		bscan_pin[i].state   = JTAG_BSCAN_Z;
+	}
+	memset(bscan_image, 0, sizeof(bscan_image));
+	memset(bscan_cap,   0, sizeof(bscan_cap));
+	return(0);
+}
+
+/**
+ * @brief Set the cells of one pin
+ *
+ * @param pin     Number of the pin (0 to JTAG_BSCAN_PINS - 1)
+ * @param input   Input cell (or JTAG_BSCAN_NONE)
+ * @param output  Output cell (or JTAG_BSCAN_NONE)
+ * @param control Control cell (or JTAG_BSCAN_NONE for an output always on)
+ * @param disable Value of the control cell that disables the output
+ * @return integer Zero on success, -1 for a bad pin or cell
+ */
+int jtag_bscan_map(uint pin, uint input, uint output, uint control, uint disable)
+{
+	if ((bscan_len == 0) || (pin >= JTAG_BSCAN_PINS))
+		return(-1);
+	if (((input   != JTAG_BSCAN_NONE) && (input   >= bscan_len)) ||
+	    ((output  != JTAG_BSCAN_NONE) && (output  >= bscan_len)) ||
+	    ((control != JTAG_BSCAN_NONE) && (control >= bscan_len)))
+		return(-1);
+
+	bscan_pin[pin].input   = input;
+	bscan_pin[pin].output  = output;
+	bscan_pin[pin].control = control;
+	bscan_pin[pin].disable = disable ? 1 : 0;
+	bscan_pin[pin].state   = JTAG_BSCAN_Z;
+	if (pin >= bscan_count)
+		bscan_count = pin + 1;
+	return(0);
+}
+
+/**
+ * @brief Set the state of one pin (applied by the next scan)
+ *
+ * @param pin   Number of the pin
+ * @param state JTAG_BSCAN_LOW, JTAG_BSCAN_HIGH or JTAG_BSCAN_Z
+ * @return integer Zero on success, -1 for a bad pin or a pin without output
+ */
+int jtag_bscan_set(uint pin, uint state)
+{
+	if ((pin >= bscan_count) || (state > JTAG_BSCAN_Z) ||
+	    (bscan_pin[pin].output == JTAG_BSCAN_NONE))
+		return(-1);
+	bscan_pin[pin].state = state;
+	bscan_drive = 1;
+	return(0);
+}
+
+/**
+ * @brief Scan the register : apply the state of pins, then sample them
+ *
+ * The instruction is only loaded when it is not the current one (or when
+ * the TAP went through Capture-IR or Reset since it has been loaded).
+ *
+ * @param pins Buffer where the level of pins is stored (one bit per pin,
+ *             pin 0 into LSB of first byte), can be null
+ * @return integer Zero on success, -1 if the engine is not configured or
+ *         the device is not into the chain
+ */
+int jtag_bscan_scan(u8 *pins)
+{
+	const jtag_bscan_pin *p;
+	uint extest, i;
+
+	if (bscan_len == 0)
+		return(-1);
+	extest = bscan_drive && bscan_loaded(bscan_extest);
+
+	if ( ! bscan_drive)
+	{
+		if (bscan_load(bscan_sample) != 0)
+			return(-1);
+	}
+	else if ( ! extest)
+	{
+		/* Capture the current values, before preloading them */
+		if (bscan_load(bscan_sample) != 0)
+			return(-1);
+		if (jtag_dr_scan(bscan_index, bscan_image, bscan_cap, bscan_len))
+			return(-1);
+		memcpy(bscan_image, bscan_cap, (bscan_len + 7) / 8);
+	}
+
+	/* A control cell can be shared by several pins : it is disabled only
+	 * if all of them are in high impedance */
+	for (i = 0, p = bscan_pin; i < bscan_count; i++, p++)
+		if ((p->output != JTAG_BSCAN_NONE) && (p->control != JTAG_BSCAN_NONE))
+			bscan_bit_set(bscan_image, p->control, p->disable);
+	for (i = 0, p = bscan_pin; i < bscan_count; i++, p++)
+	{
+		if ((p->output == JTAG_BSCAN_NONE) || (p->state == JTAG_BSCAN_Z))
+			continue;
+		bscan_bit_set(bscan_image, p->output, p->state);
+		if (p->control != JTAG_BSCAN_NONE)
+			bscan_bit_set(bscan_image, p->control, ! p->disable);
+	}
+
+	/* Preload, so pins do not glitch when EXTEST is loaded */
+	if (bscan_drive && ! extest)
+	{
+		if (jtag_dr_scan(bscan_index, bscan_image, 0, bscan_len))
+			return(-1);
+		if (bscan_load(bscan_extest) != 0)
+			return(-1);
+	}
+	if (jtag_dr_scan(bscan_index, bscan_image, bscan_cap, bscan_len))
+		return(-1);
+
+	if (pins == 0)
+		return(0);
+	memset(pins, 0, (bscan_count + 7) / 8);
+	for (i = 0, p = bscan_pin; i < bscan_count; i++, p++)
+		if ((p->input != JTAG_BSCAN_NONE) && bscan_bit(bscan_cap, p->input))
+			pins[i / 8] |= (1 << (i % 8));
+	return(0);
+}
+
+/**
+ * @brief Stop driving the pins
+ *
+ * The TAP is reset, which selects IDCODE (or BYPASS) : the pins are driven
+ * by the device again. States of the pins are set to high impedance.
+ */
+void jtag_bscan_release(void)
+{
+	uint i;
+
+	jtag_goto(JTAG_RESET);
+	bscan_drive = 0;
+	for (i = 0; i < bscan_count; i++)
+		bscan_pin[i].state = JTAG_BSCAN_Z;
+}
+
+/**
+ * @brief Get the number of pins into the map
+ *
+ * @return integer Number of pins (highest mapped pin + 1)
+ */
+uint jtag_bscan_pins(void)
+{
+	return(bscan_len ? bscan_count : 0);
+}
+
+/**
+ * @brief Get the value of one cell of a register
+ *
+ */
+static inline uint bscan_bit(const u8 *buf, uint cell)
+{
+	return((buf[cell / 8] >> (cell % 8)) & 1);
+}
+
+/**
+ * @brief Set the value of one cell of a register
+ *
+ */
+static inline void bscan_bit_set(u8 *buf, uint cell, uint value)
+{
+	if (value)
+		buf[cell / 8] |=  (1 << (cell % 8));
+	else
+		buf[cell / 8] &= ~(1 << (cell % 8));
+}
+
+/**
+ * @brief Load an instruction into the device, if needed
+ *
+ * @param ir Instruction to load
+ * @return integer Zero on success, -1 if the device is not into the chain
+ */
+static int bscan_load(u32 ir)
+{
+	if (bscan_loaded(ir))
+		return(0);
+	bscan_ir_ok = 0;
+	if (jtag_ir_scan(bscan_index, ir) != 0)
+		return(-1);
+	/* The IR scan itself goes through Capture-IR */
+	bscan_ir     = ir;
+	bscan_ir_ok  = 1;
+	bscan_ir_gen = jtag_ir_changes();
+	return(0);
+}
+
+/**
+ * @brief Test if an instruction is still loaded into the device
+ *
+ * @param ir Instruction
+ * @return integer True if ir has been loaded, and not modified since
+ */
+static uint bscan_loaded(u32 ir)
+{
+	return(bscan_ir_ok && (ir == bscan_ir) &&
+	       (jtag_ir_changes() == bscan_ir_gen));
+}
+/* EOF */
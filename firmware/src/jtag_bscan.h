@@ -0,0 +1,39 @@
+/**
+ * @file  jtag_bscan.h
+ * @brief Headers and definitions for the boundary-scan engine
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef JTAG_BSCAN_H
+#define JTAG_BSCAN_H
+#include "types.h"
+
+/* Max length of the boundary-scan register */
+#define JTAG_BSCAN_BITS  4096
+/* Max number of pins into the cell map */
+#define JTAG_BSCAN_PINS  256
+/* Cell not present (input only or output only pin) */
+#define JTAG_BSCAN_NONE  0xFFFF
+
+/* State of a pin */
+#define JTAG_BSCAN_LOW   0
+#define JTAG_BSCAN_HIGH  1
+#define JTAG_BSCAN_Z     2
+
+int  jtag_bscan_setup(uint index, uint len, u32 extest, u32 sample);
+int  jtag_bscan_map(uint pin, uint input, uint output, uint control, uint disable);
+int  jtag_bscan_set(uint pin, uint state);
+int  jtag_bscan_scan(u8 *pins);
+void jtag_bscan_release(void);
+uint jtag_bscan_pins(void);
+
+#endif
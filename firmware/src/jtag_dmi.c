@@ -0,0 +1,497 @@
+/**
+ * @file  jtag_dmi.c
+ * @brief Access to a RISC-V Debug Module through the JTAG DTM
+ *
+ * The Debug Module Interface (DMI) is a JTAG data register that holds an
+ * operation (op, data, address). The result of one operation is captured
+ * by the next scan, so a list of operations is pipelined : each scan sends
+ * an operation and gets the result of the previous one.
+ *
+ * When an operation is sent before the previous one has completed, the DTM
+ * captures "busy" and ignores it. The probe then clears the error
+ * (dtmcs.dmireset), adds Run-Test/Idle cycles between scans and sends again
+ * the operation that was not complete. This protocol is handled here, the
+ * host only gets the results.
+ *
+ * On top of that, abstract commands (access to the registers of a hart) and
+ * system bus accesses (memory, with sbdata auto-increment) are built as
+ * batches of DMI operations.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include "jtag.h"
+#include "jtag_dmi.h"
+#include "types.h"
+
+/* Operations of the DMI register */
+#define DMI_OP_NOP   0
+#define DMI_OP_READ  1
+#define DMI_OP_WRITE 2
+/* Status captured into the op field */
+#define DMI_OP_FAILED 2
+#define DMI_OP_BUSY   3
+
+#define DMI_NONE 0xFFFF
+/* Max length of the DMI register (abits is a 6 bits field) */
+#define DMI_BITS (63 + 34)
+
+typedef struct jtag_dmi_op_s
+{
+	u8   op;    /* DMI_OP_READ or DMI_OP_WRITE */
+	u32  addr;
+	u32  data;  /* Value to write */
+	u32 *dst;   /* Where the result of a read is stored */
+} jtag_dmi_op;
+
+static uint dmi_index;  /* Device into the scan chain */
+static uint dmi_abits;  /* Size of DMI addresses (0 : no DTM) */
+static uint dmi_idle;   /* Run-Test/Idle cycles after each scan */
+static uint dmi_ir_ok;  /* True when DMI instruction has been loaded */
+static u32  dmi_ir_gen; /* Value of jtag_ir_changes() after loading it */
+static uint dmi_count;  /* Number of queued operations */
+static uint dmi_lost;   /* Operations dropped because queue was full */
+static uint dmi_retried; /* Last jtag_dmi_exec() has sent operations again */
+static jtag_dmi_op dmi_queue[JTAG_DMI_QUEUE];
+
+static void dmi_bits_put(u8 *buf, uint pos, u32 value, uint len);
+static u32  dmi_bits_get(const u8 *buf, uint pos, uint len);
+static void dmi_queue_op(uint op, u32 addr, u32 data, u32 *dst);
+static void dmi_reset(void);
+static uint dmi_scan(uint op, u32 addr, u32 data, u32 *result);
+
+/**
+ * @brief Find the DTM of a device and read its configuration
+ *
+ * Only the version 0.13 of the DTM is supported.
+ *
+ * @param index Position of the device into the chain (from TDO)
+ * @param dtmcs Pointer where the value of dtmcs is stored (can be null)
+ * @return integer DMI_OK on success, DMI_NODTM if there is no such DTM
+ */
+int jtag_dmi_setup(uint index, u32 *dtmcs)
+{
+	u8  zero[4] = { 0 }, cap[4];
+	u32 value;
+
+	dmi_abits = 0;
+	dmi_count = 0;
+	dmi_lost  = 0;
+	if (jtag_ir_scan(index, DMI_IR_DTMCS) != 0)
+		return(DMI_NODTM);
+	if (jtag_dr_scan(index, zero, cap, 32) != 0)
+		return(DMI_NODTM);
+	value = (cap[3] << 24) | (cap[2] << 16) | (cap[1] << 8) | cap[0];
+	if (dtmcs)
+		*dtmcs = value;
+
+	/* version [3:0], abits [9:4], idle [14:12] */
+	if (((value & 0x0F) != 1) || (((value >> 4) & 0x3F) == 0))
+		return(DMI_NODTM);
+	dmi_index = index;
+	dmi_abits = (value >> 4) & 0x3F;
+	dmi_idle  = (value >> 12) & 0x07;
+	dmi_ir_ok = 0;
+	return(DMI_OK);
+}
+
+/**
+ * @brief Queue a read of a DM register (see jtag_dmi_exec)
+ *
+ * @param addr Address of the register
+ * @param data Pointer where the value is stored when the queue is executed
+ */
+void jtag_dmi_read(u32 addr, u32 *data)
+{
+	dmi_queue_op(DMI_OP_READ, addr, 0, data);
+}
+
+/**
+ * @brief Queue a write of a DM register (see jtag_dmi_exec)
+ *
+ * @param addr Address of the register
+ * @param data Value to write
+ */
+void jtag_dmi_write(u32 addr, u32 data)
+{
+	dmi_queue_op(DMI_OP_WRITE, addr, data, 0);
+}
+
+/**
+ * @brief Execute the queued operations, and empty the queue
+ *
+ * Operations are pipelined. When the DTM is busy, the operation that was
+ * not complete is sent again, with more Run-Test/Idle cycles after each
+ * scan (the new value is kept for next batches). Execution stops on the
+ * first failed operation.
+ *
+ * @param done Pointer where the number of complete operations is stored
+ *             (can be null)
+ * @return integer DMI_OK on success, DMI_FAILED, DMI_BUSY or DMI_NODTM
+ */
+int jtag_dmi_exec(uint *done)
+{
+	const jtag_dmi_op *op;
+	uint next = 0, prev = DMI_NONE, cur, count = 0, retry = 0, status;
+	int  result = DMI_OK;
+	u32  data;
+
+	if (dmi_abits == 0)
+		result = DMI_NODTM;
+	else if (dmi_lost)
+		result = DMI_FAILED;
+	dmi_retried = 0;
+
+	while (result == DMI_OK)
+	{
+		cur = (next < dmi_count) ? next : DMI_NONE;
+		if ((cur == DMI_NONE) && (prev == DMI_NONE))
+			break;
+		/* The last scan is a NOP, that gets the last result */
+		if (cur != DMI_NONE)
+		{
+			op = &dmi_queue[cur];
+			status = dmi_scan(op->op, op->addr, op->data, &data);
+		}
+		else
+			status = dmi_scan(DMI_OP_NOP, 0, 0, &data);
+
+		if (prev != DMI_NONE)
+		{
+			/* Previous operation not complete, this one is ignored */
+			if (status == DMI_OP_BUSY)
+			{
+				if (++retry > jtag_config.retry_count)
+				{
+					result = DMI_BUSY;
+					dmi_reset();
+					break;
+				}
+				dmi_reset();
+				dmi_retried = 1;
+				dmi_idle += (dmi_idle / 4) + 1;
+				if (dmi_idle > JTAG_DMI_IDLE_MAX)
+					dmi_idle = JTAG_DMI_IDLE_MAX;
+				next = prev;
+				prev = DMI_NONE;
+				continue;
+			}
+			if (status == DMI_OP_FAILED)
+			{
+				result = DMI_FAILED;
+				dmi_reset();
+				break;
+			}
+			if (dmi_queue[prev].dst)
+				*dmi_queue[prev].dst = data;
+			count++;
+			retry = 0;
+		}
+		prev = cur;
+		if (cur != DMI_NONE)
+			next++;
+	}
+	dmi_count = 0;
+	dmi_lost  = 0;
+	if (done)
+		*done = count;
+	return(result);
+}
+
+/**
+ * @brief Read or write a register of the halted hart (abstract command)
+ *
+ * The command, the test of abstractcs and the read of data0 are sent as
+ * one batch : abstractcs is only polled again when the command has not
+ * completed into this time. Only 32 bits accesses are done. When the DMI
+ * was busy, the command may have been sent twice and the second one gets
+ * cmderr "busy" : the error is cleared and the command is sent again.
+ *
+ * @param regno Number of the register (0x1000 + n for GPR xn)
+ * @param value Value to write, or pointer where the value is stored. Set to
+ *              abstractcs.cmderr when the command fails
+ * @param write True to write the register
+ * @return integer DMI_OK on success, DMI_CMDERR if the command failed, or an
+ *         error of jtag_dmi_exec()
+ */
+int jtag_dmi_reg(uint regno, u32 *value, uint write)
+{
+	u32  cmd, cs, data = 0;
+	uint i, n, retried;
+	int  result;
+
+	/* cmdtype 0 (access register), aarsize 2 (32 bits), transfer */
+	cmd = (2 << 20) | (1 << 17) | (regno & 0xFFFF);
+	if (write)
+		cmd |= (1 << 16);
+
+	for (n = 0; ; n++)
+	{
+		cs = 0;
+		if (write)
+			jtag_dmi_write(DM_DATA0, *value);
+		jtag_dmi_write(DM_COMMAND, cmd);
+		jtag_dmi_read(DM_ABSTRACTCS, &cs);
+		if ( ! write)
+			jtag_dmi_read(DM_DATA0, &data);
+		result  = jtag_dmi_exec(0);
+		retried = dmi_retried;
+
+		for (i = 0; (result == DMI_OK) && (cs & DM_ABS_BUSY); i++)
+		{
+			if (i == JTAG_DMI_POLLS)
+				return(DMI_TIMEOUT);
+			jtag_dmi_read(DM_ABSTRACTCS, &cs);
+			if ( ! write)
+				jtag_dmi_read(DM_DATA0, &data);
+			result = jtag_dmi_exec(0);
+		}
+		if (result != DMI_OK)
+			return(result);
+		if ((cs & DM_ABS_CMDERR) == 0)
+			break;
+
+		/* cmderr is cleared by writing ones */
+		jtag_dmi_write(DM_ABSTRACTCS, DM_ABS_CMDERR);
+		jtag_dmi_exec(0);
+		if ((((cs & DM_ABS_CMDERR) >> 8) != 1) || ! retried ||
+		    (n == jtag_config.retry_count))
+		{
+			*value = (cs & DM_ABS_CMDERR) >> 8;
+			return(DMI_CMDERR);
+		}
+	}
+	if ( ! write)
+		*value = data;
+	return(DMI_OK);
+}
+
+/**
+ * @brief Read a block of memory through the system bus (32 bits accesses)
+ *
+ * The first read is started by the write of sbaddress0, next ones by each
+ * read of sbdata0 (sbreadondata and sbautoincrement). The last read of
+ * sbdata0 does not start one more access. When the DMI was busy, a read of
+ * sbdata0 may have been sent twice (and a word skipped) : the whole block
+ * is read again.
+ *
+ * @param addr  Address of the first word (aligned)
+ * @param data  Buffer where words are stored
+ * @param count Number of words (up to JTAG_DMI_BLOCK)
+ * @return integer DMI_OK on success, DMI_SBERR for a bus error, or an error
+ *         of jtag_dmi_exec()
+ */
+int jtag_dmi_mem_read(u32 addr, u32 *data, uint count)
+{
+	u32  cs = 0, mode;
+	uint i, n;
+	int  result;
+
+	if ((count == 0) || (count > JTAG_DMI_BLOCK))
+		return(DMI_FAILED);
+
+	/* Errors are cleared by writing ones */
+	mode = DM_SB_ACCESS32 | DM_SB_READONADDR | DM_SB_AUTOINC |
+	       DM_SB_BUSYERROR | DM_SB_ERROR;
+	for (n = 0; ; n++)
+	{
+		jtag_dmi_write(DM_SBCS, mode | ((count > 1) ? DM_SB_READONDATA : 0));
+		jtag_dmi_write(DM_SBADDRESS0, addr);
+		for (i = 0; i < count; i++)
+		{
+			if ((count > 1) && (i == (count - 1)))
+				jtag_dmi_write(DM_SBCS, DM_SB_ACCESS32 | DM_SB_AUTOINC);
+			jtag_dmi_read(DM_SBDATA0, data + i);
+		}
+		jtag_dmi_read(DM_SBCS, &cs);
+		result = jtag_dmi_exec(0);
+		if ((result != DMI_OK) || ! dmi_retried)
+			break;
+		if (n == jtag_config.retry_count)
+			return(DMI_BUSY);
+	}
+	if (result != DMI_OK)
+		return(result);
+
+	if (cs & (DM_SB_BUSYERROR | DM_SB_ERROR))
+	{
+		jtag_dmi_write(DM_SBCS, DM_SB_BUSYERROR | DM_SB_ERROR);
+		jtag_dmi_exec(0);
+		return(DMI_SBERR);
+	}
+	return(DMI_OK);
+}
+
+/**
+ * @brief Write a block of memory through the system bus (32 bits accesses)
+ *
+ * Each write of sbdata0 starts one access, sbaddress0 is incremented by the
+ * DM (sbautoincrement). Like for reads, the whole block is written again
+ * when the DMI was busy.
+ *
+ * @param addr  Address of the first word (aligned)
+ * @param data  Words to write
+ * @param count Number of words (up to JTAG_DMI_BLOCK)
+ * @return integer DMI_OK on success, DMI_SBERR for a bus error, DMI_TIMEOUT
+ *         if the bus stays busy, or an error of jtag_dmi_exec()
+ */
+int jtag_dmi_mem_write(u32 addr, const u32 *data, uint count)
+{
+	u32  cs = 0;
+	uint i, n;
+	int  result;
+
+	if ((count == 0) || (count > JTAG_DMI_BLOCK))
+		return(DMI_FAILED);
+
+	for (n = 0; ; n++)
+	{
+		jtag_dmi_write(DM_SBCS, DM_SB_ACCESS32 | DM_SB_AUTOINC |
+		                        DM_SB_BUSYERROR | DM_SB_ERROR);
+		jtag_dmi_write(DM_SBADDRESS0, addr);
+		for (i = 0; i < count; i++)
+			jtag_dmi_write(DM_SBDATA0, data[i]);
+		jtag_dmi_read(DM_SBCS, &cs);
+		result = jtag_dmi_exec(0);
+		if ((result != DMI_OK) || ! dmi_retried)
+			break;
+		if (n == jtag_config.retry_count)
+			return(DMI_BUSY);
+	}
+
+	for (i = 0; (result == DMI_OK) && (cs & DM_SB_BUSY); i++)
+	{
+		if (i == JTAG_DMI_POLLS)
+			return(DMI_TIMEOUT);
+		jtag_dmi_read(DM_SBCS, &cs);
+		result = jtag_dmi_exec(0);
+	}
+	if (result != DMI_OK)
+		return(result);
+
+	if (cs & (DM_SB_BUSYERROR | DM_SB_ERROR))
+	{
+		jtag_dmi_write(DM_SBCS, DM_SB_BUSYERROR | DM_SB_ERROR);
+		jtag_dmi_exec(0);
+		return(DMI_SBERR);
+	}
+	return(DMI_OK);
+}
+
+/**
+ * @brief Insert bits into a register
+ *
+ */
+static void dmi_bits_put(u8 *buf, uint pos, u32 value, uint len)
+{
+	uint i;
+
+	for (i = 0; i < len; i++, pos++)
+	{
+		if ((value >> i) & 1)
+			buf[pos / 8] |=  (1 << (pos % 8));
+		else
+			buf[pos / 8] &= ~(1 << (pos % 8));
+	}
+}
+
+/**
+ * @brief Extract bits from a register
+ *
+ */
+static u32 dmi_bits_get(const u8 *buf, uint pos, uint len)
+{
+	u32  value = 0;
+	uint i;
+
+	for (i = 0; i < len; i++, pos++)
+		value |= (u32)((buf[pos / 8] >> (pos % 8)) & 1) << i;
+	return(value);
+}
+
+/**
+ * @brief Add an operation to the queue
+ *
+ */
+static void dmi_queue_op(uint op, u32 addr, u32 data, u32 *dst)
+{
+	jtag_dmi_op *p;
+
+	if (dmi_count == JTAG_DMI_QUEUE)
+	{
+		dmi_lost = 1;
+		return;
+	}
+	p = &dmi_queue[dmi_count++];
+	p->op   = op;
+	p->addr = addr;
+	p->data = data;
+	p->dst  = dst;
+}
+
+/**
+ * @brief Clear the sticky error of the DMI (dtmcs.dmireset)
+ *
+ * The DMI instruction is loaded again by the next scan.
+ */
+static void dmi_reset(void)
+{
+	u8 dtmcs[4] = { 0x00, 0x00, 0x01, 0x00 }; /* dmireset, bit 16 */
+
+	dmi_ir_ok = 0;
+	if (jtag_ir_scan(dmi_index, DMI_IR_DTMCS) != 0)
+		return;
+	jtag_dr_scan(dmi_index, dtmcs, 0, 32);
+}
+
+/**
+ * @brief Scan the DMI register once
+ *
+ * @param op     Operation to send (DMI_OP_NOP, DMI_OP_READ or DMI_OP_WRITE)
+ * @param addr   Address of the register
+ * @param data   Value to write
+ * @param result Pointer where the captured data is stored
+ * @return integer Captured op : status of the previous operation, or
+ *         DMI_OP_FAILED if the device is not into the chain
+ */
+static uint dmi_scan(uint op, u32 addr, u32 data, u32 *result)
+{
+	u8   tdi[(DMI_BITS + 7) / 8] = { 0 }, tdo[(DMI_BITS + 7) / 8];
+	uint len = dmi_abits + 34, n;
+
+	if ( ! dmi_ir_ok || (jtag_ir_changes() != dmi_ir_gen))
+	{
+		if (jtag_ir_scan(dmi_index, DMI_IR_DMI) != 0)
+			return(DMI_OP_FAILED);
+		dmi_ir_ok  = 1;
+		dmi_ir_gen = jtag_ir_changes();
+	}
+
+	/* op [1:0], data [33:2], address [abits + 33:34] */
+	dmi_bits_put(tdi, 0, op, 2);
+	dmi_bits_put(tdi, 2, data, 32);
+	dmi_bits_put(tdi, 34, addr, (dmi_abits > 32) ? 32 : dmi_abits);
+	if (jtag_dr_scan(dmi_index, tdi, tdo, len) != 0)
+		return(DMI_OP_FAILED);
+
+	/* Give time to the DM to process the operation */
+	if (dmi_idle)
+	{
+		jtag_goto(JTAG_IDLE);
+		for (n = dmi_idle; n > 32; n -= 32)
+			jtag_tms_sequence(0, 32);
+		jtag_tms_sequence(0, n);
+	}
+
+	*result = dmi_bits_get(tdo, 2, 32);
+	return(dmi_bits_get(tdo, 0, 2));
+}
+/* EOF */
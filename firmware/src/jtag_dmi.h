@@ -0,0 +1,72 @@
+/**
+ * @file  jtag_dmi.h
+ * @brief Headers and definitions for the RISC-V Debug Module Interface
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef JTAG_DMI_H
+#define JTAG_DMI_H
+#include "types.h"
+
+/* Instructions of the JTAG DTM (RISC-V Debug Specification 0.13) */
+#define DMI_IR_DTMCS  0x10
+#define DMI_IR_DMI    0x11
+
+/* Registers of the Debug Module */
+#define DM_DATA0        0x04
+#define DM_DMCONTROL    0x10
+#define DM_DMSTATUS     0x11
+#define DM_ABSTRACTCS   0x16
+#define DM_COMMAND      0x17
+#define DM_SBCS         0x38
+#define DM_SBADDRESS0   0x39
+#define DM_SBDATA0      0x3C
+
+/* Fields of abstractcs */
+#define DM_ABS_BUSY     (1 << 12)
+#define DM_ABS_CMDERR   (7 << 8)
+/* Fields of sbcs */
+#define DM_SB_BUSYERROR (1 << 22)
+#define DM_SB_BUSY      (1 << 21)
+#define DM_SB_READONADDR (1 << 20)
+#define DM_SB_ACCESS32  (2 << 17)
+#define DM_SB_AUTOINC   (1 << 16)
+#define DM_SB_READONDATA (1 << 15)
+#define DM_SB_ERROR     (7 << 12)
+
+/* Status of DMI operations */
+#define DMI_OK       0
+#define DMI_FAILED   1 /* Operation failed (op 2 of the DMI register) */
+#define DMI_BUSY     2 /* Still busy after all retries */
+#define DMI_TIMEOUT  3 /* Abstract command or system bus still busy */
+#define DMI_CMDERR   4 /* Abstract command error (see abstractcs.cmderr) */
+#define DMI_SBERR    5 /* System bus error (see sbcs.sberror) */
+#define DMI_NODTM    6 /* No DTM found by jtag_dmi_setup() */
+
+/* Max number of queued operations */
+#define JTAG_DMI_QUEUE 64
+/* Max number of words of one system bus block access */
+#define JTAG_DMI_BLOCK (JTAG_DMI_QUEUE - 4)
+/* Max number of polls of abstractcs.busy or sbcs.sbbusy */
+#define JTAG_DMI_POLLS 100
+/* Max number of Run-Test/Idle cycles between two DMI scans */
+#define JTAG_DMI_IDLE_MAX 1000
+
+int  jtag_dmi_setup(uint index, u32 *dtmcs);
+void jtag_dmi_read (u32 addr, u32 *data);
+void jtag_dmi_write(u32 addr, u32 data);
+int  jtag_dmi_exec(uint *done);
+int  jtag_dmi_reg(uint regno, u32 *value, uint write);
+int  jtag_dmi_mem_read (u32 addr, u32 *data, uint count);
+int  jtag_dmi_mem_write(u32 addr, const u32 *data, uint count);
+
+#endif
@@ -0,0 +1,337 @@
+/**
+ * @file  jtag_pio.c
+ * @brief Implement JTAG shifts using a PIO state machine
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "ios.h"
+#include "jtag_pio.h"
+#include "log.h"
+#include "swj_clock.h"
+
+#define PIN_TCK PORT_D2_PIN
+#define PIN_TDI PORT_D3_PIN
+#define PIN_TMS PORT_D1_PIN
+#define PIN_TDO PORT_D0_PIN
+
+/* Minimum number of queued shifts to use DMA instead of CPU */
+#define JTAG_PIO_DMA_MIN 4
+
+static const struct pio_program jtag_pio_prog =
+{
+	.instructions = jtag_pio_program,
+	.length       = JTAG_PIO_LENGTH,
+	.origin       = -1,
+};
+
+/* PIO0 may still hold the SWD program */
+static PIO  jtag_pio = pio1;
+static int  jtag_sm  = -1;
+static uint jtag_offset;
+static int  jtag_dma_tx = -1;
+static int  jtag_dma_rx = -1;
+/* Queued shifts : command and TDI words, then TDO words */
+static u32  jtag_cmd[JTAG_PIO_QUEUE * 2];
+static u32  jtag_res[JTAG_PIO_QUEUE];
+static struct
+{
+	u8 *tdo;
+	u8  len;
+} jtag_q[JTAG_PIO_QUEUE];
+static uint jtag_q_len;
+
+static inline u32  _div(void);
+static void _run_cpu(uint count);
+static void _run_dma(uint count);
+static inline void _wait_idle(void);
+
+/**
+ * @brief Load the JTAG program into PIO and take control of JTAG pins
+ *
+ * This function must be called after the IOs of the debug port have been
+ * configured in JTAG mode (see ios_mode). Two DMA channels are claimed to
+ * run long lists of shifts, the CPU is used when they are not available.
+ *
+ * @return integer Zero is returned on success, -1 if no PIO is available
+ */
+int jtag_pio_init(void)
+{
+	pio_sm_config c;
+	u32 div;
+
+	/* If the state machine is already running, nothing to do */
+	if (jtag_sm >= 0)
+		return(0);
+
+	if ( ! pio_can_add_program(jtag_pio, &jtag_pio_prog))
+	{
+		LOG_ERROR_PUTS("JTAG: No space for PIO program\r\n");
+		return(-1);
+	}
+	jtag_sm = pio_claim_unused_sm(jtag_pio, false);
+	if (jtag_sm < 0)
+	{
+		LOG_ERROR_PUTS("JTAG: No PIO state machine available\r\n");
+		return(-1);
+	}
+	jtag_offset = pio_add_program(jtag_pio, &jtag_pio_prog);
+
+	c = pio_get_default_sm_config();
+	sm_config_set_wrap(&c, jtag_offset + JTAG_PIO_WRAP_TARGET,
+	                       jtag_offset + JTAG_PIO_WRAP);
+	sm_config_set_sideset(&c, JTAG_PIO_SIDE_BITS, true, false);
+	sm_config_set_sideset_pins(&c, PIN_TCK);
+	sm_config_set_out_pins(&c, PIN_TDI, 1);
+	sm_config_set_set_pins(&c, PIN_TMS, 1);
+	sm_config_set_in_pins (&c, PIN_TDO);
+	/* Bits are sent and received LSB first, no auto push/pull */
+	sm_config_set_out_shift(&c, true, false, 32);
+	sm_config_set_in_shift (&c, true, false, 32);
+	div = _div();
+	sm_config_set_clkdiv_int_frac(&c, div >> 8, div & 0xFF);
+
+	/* Initial state : TCK and TMS low, TDI high */
+	pio_sm_set_pins_with_mask(jtag_pio, jtag_sm, (1u << PIN_TDI),
+	        (1u << PIN_TCK) | (1u << PIN_TDI) | (1u << PIN_TMS));
+	pio_sm_set_pindirs_with_mask(jtag_pio, jtag_sm,
+	        (1u << PIN_TCK) | (1u << PIN_TDI) | (1u << PIN_TMS),
+	        (1u << PIN_TCK) | (1u << PIN_TDI) | (1u << PIN_TMS));
+	pio_gpio_init(jtag_pio, PIN_TCK);
+	pio_gpio_init(jtag_pio, PIN_TDI);
+	pio_gpio_init(jtag_pio, PIN_TMS);
+
+	pio_sm_init(jtag_pio, jtag_sm, jtag_offset + JTAG_PIO_WRAP_TARGET, &c);
+	pio_sm_set_enabled(jtag_pio, jtag_sm, true);
+
+	if (jtag_dma_tx < 0)
+		jtag_dma_tx = dma_claim_unused_channel(false);
+	if (jtag_dma_rx < 0)
+		jtag_dma_rx = dma_claim_unused_channel(false);
+	jtag_q_len = 0;
+
+	return(0);
+}
+
+/**
+ * @brief Stop the PIO state machine and give JTAG pins back to SIO
+ *
+ */
+void jtag_pio_release(void)
+{
+	if (jtag_sm < 0)
+		return;
+
+	/* Process the pending shifts, then wait end of the last one */
+	jtag_pio_flush();
+	_wait_idle();
+
+	pio_sm_set_enabled(jtag_pio, jtag_sm, false);
+	pio_remove_program(jtag_pio, &jtag_pio_prog, jtag_offset);
+	pio_sm_unclaim(jtag_pio, jtag_sm);
+	jtag_sm = -1;
+
+	/* Restore pins as GPIO (SIO) */
+	gpio_set_function(PIN_TCK, GPIO_FUNC_SIO);
+	gpio_set_function(PIN_TDI, GPIO_FUNC_SIO);
+	gpio_set_function(PIN_TMS, GPIO_FUNC_SIO);
+}
+
+/**
+ * @brief Update the bit rate of a running state machine
+ *
+ * The divider is taken from the SWJ clock module (see swj_clock_set). When
+ * the state machine is not loaded, the new value is used by next init.
+ */
+void jtag_pio_clock(void)
+{
+	u32 div;
+
+	if (jtag_sm < 0)
+		return;
+
+	/* Wait end of the pending shifts before changing speed */
+	jtag_pio_flush();
+	_wait_idle();
+	div = _div();
+	pio_sm_set_clkdiv_int_frac(jtag_pio, jtag_sm, div >> 8, div & 0xFF);
+}
+
+/**
+ * @brief Queue a shift, executed by the next call to jtag_pio_flush()
+ *
+ * The captured bits are stored into the TDO buffer as little-endian bytes,
+ * (len + 7) / 8 bytes are written.
+ *
+ * @param tdi Bits to shift out (first one into LSB)
+ * @param len Number of bits (1 to 32)
+ * @param tms Value of TMS
+ * @param tdo Buffer where captured bits are stored (can be null)
+ */
+void jtag_pio_queue(u32 tdi, uint len, uint tms, u8 *tdo)
+{
+	if ((jtag_sm < 0) || (len == 0) || (len > 32))
+		return;
+
+	if (jtag_q_len == JTAG_PIO_QUEUE)
+		jtag_pio_flush();
+
+	jtag_cmd[(jtag_q_len * 2) + 0] = JTAG_PIO_CMD(jtag_offset, tms, len);
+	jtag_cmd[(jtag_q_len * 2) + 1] = tdi;
+	jtag_q[jtag_q_len].tdo = tdo;
+	jtag_q[jtag_q_len].len = len;
+	jtag_q_len++;
+}
+
+/**
+ * @brief Execute all queued shifts and store the captured bits
+ *
+ */
+void jtag_pio_flush(void)
+{
+	u32  value;
+	u8  *tdo;
+	uint i, n;
+
+	if (jtag_q_len == 0)
+		return;
+
+	if ((jtag_q_len >= JTAG_PIO_DMA_MIN) &&
+	    (jtag_dma_tx >= 0) && (jtag_dma_rx >= 0))
+		_run_dma(jtag_q_len);
+	else
+		_run_cpu(jtag_q_len);
+
+	for (i = 0; i < jtag_q_len; i++)
+	{
+		tdo = jtag_q[i].tdo;
+		if (tdo == 0)
+			continue;
+		/* Received bits are aligned on the MSB of the word */
+		value = jtag_res[i] >> (32 - jtag_q[i].len);
+		for (n = 0; n < jtag_q[i].len; n += 8)
+		{
+			*tdo++ = (u8)value;
+			value >>= 8;
+		}
+	}
+	jtag_q_len = 0;
+}
+
+/**
+ * @brief Shift bits to/from the target (constant TMS)
+ *
+ * @param tdi Bits to shift out (first one into LSB)
+ * @param len Number of bits (0 to 32)
+ * @param tms Value of TMS
+ * @return integer Bits captured from TDO (first one into LSB)
+ */
+u32 jtag_pio_shift(u32 tdi, uint len, uint tms)
+{
+	u32 data;
+
+	jtag_pio_flush();
+	if ((jtag_sm < 0) || (len == 0) || (len > 32))
+		return(0);
+
+	pio_sm_put_blocking(jtag_pio, jtag_sm, JTAG_PIO_CMD(jtag_offset, tms, len));
+	pio_sm_put_blocking(jtag_pio, jtag_sm, tdi);
+	data = pio_sm_get_blocking(jtag_pio, jtag_sm);
+	return(data >> (32 - len));
+}
+
+/**
+ * @brief Get the PIO clock divider for the current SWJ clock
+ *
+ * The divider of the SWJ clock module is computed for two PIO cycles per
+ * bit (SWD), the JTAG program uses JTAG_PIO_CYCLES.
+ *
+ * @return integer Clock divider (16.8 fixed point)
+ */
+static inline u32 _div(void)
+{
+	u32 div = (swj_clk.pio_div * 2) / JTAG_PIO_CYCLES;
+
+	if (div < SWJ_PIO_DIV_MIN)
+		div = SWJ_PIO_DIV_MIN;
+	return(div);
+}
+
+/**
+ * @brief Send queued shifts using the CPU
+ *
+ * Two shifts are kept into the TX fifo (two words each), so the state
+ * machine does not wait between them and the RX fifo never fills up.
+ *
+ * @param count Number of queued shifts
+ */
+static void _run_cpu(uint count)
+{
+	uint i;
+
+	for (i = 0; i < count; i++)
+	{
+		pio_sm_put_blocking(jtag_pio, jtag_sm, jtag_cmd[(i * 2) + 0]);
+		pio_sm_put_blocking(jtag_pio, jtag_sm, jtag_cmd[(i * 2) + 1]);
+		if (i > 0)
+			jtag_res[i - 1] = pio_sm_get_blocking(jtag_pio, jtag_sm);
+	}
+	jtag_res[count - 1] = pio_sm_get_blocking(jtag_pio, jtag_sm);
+}
+
+/**
+ * @brief Send queued shifts using two DMA channels
+ *
+ * One channel feeds the TX fifo with the command and TDI words, the other
+ * one drains the RX fifo. Both are paced by the DREQ of the state machine.
+ *
+ * @param count Number of queued shifts
+ */
+static void _run_dma(uint count)
+{
+	dma_channel_config cfg;
+
+	cfg = dma_channel_get_default_config(jtag_dma_rx);
+	channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+	channel_config_set_read_increment (&cfg, false);
+	channel_config_set_write_increment(&cfg, true);
+	channel_config_set_dreq(&cfg, pio_get_dreq(jtag_pio, jtag_sm, false));
+	dma_channel_configure(jtag_dma_rx, &cfg, jtag_res,
+	                      &jtag_pio->rxf[jtag_sm], count, true);
+
+	cfg = dma_channel_get_default_config(jtag_dma_tx);
+	channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+	channel_config_set_read_increment (&cfg, true);
+	channel_config_set_write_increment(&cfg, false);
+	channel_config_set_dreq(&cfg, pio_get_dreq(jtag_pio, jtag_sm, true));
+	dma_channel_configure(jtag_dma_tx, &cfg, &jtag_pio->txf[jtag_sm],
+	                      jtag_cmd, count * 2, true);
+
+	/* All words have been sent when the last TDO word is received */
+	dma_channel_wait_for_finish_blocking(jtag_dma_rx);
+}
+
+/**
+ * @brief Wait until all commands into TX fifo have been processed
+ *
+ */
+static inline void _wait_idle(void)
+{
+	while ( ! pio_sm_is_tx_fifo_empty(jtag_pio, jtag_sm))
+		;
+	/* Wait for the state machine to stall on the "start" pull */
+	while (pio_sm_get_pc(jtag_pio, jtag_sm) != (jtag_offset + JTAG_PIO_WRAP_TARGET))
+		;
+}
+/* EOF */
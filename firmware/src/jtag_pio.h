@@ -0,0 +1,86 @@
+/**
+ * @file  jtag_pio.h
+ * @brief Headers and definitions for the PIO based JTAG engine
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef JTAG_PIO_H
+#define JTAG_PIO_H
+#include "types.h"
+
+/*
+ * PIO program used to drive the JTAG port. Side-set controls TCK
+ * (PORT_D2_PIN), OUT pin is TDI (PORT_D3_PIN), SET pin is TMS (PORT_D1_PIN)
+ * and IN pin is TDO (PORT_D0_PIN). Each command pushed into the TX fifo
+ * holds the address of the routine to execute into its 5 lower bits (the
+ * value of TMS) and the number of bits minus one into the next 5 bits. The
+ * command is followed by a word with the TDI bits, and one word with the
+ * TDO bits (aligned on MSB) is pushed into the RX fifo. A bit is 4 cycles.
+ *
+ * .program jtag
+ * .side_set 1 opt
+ *
+ * tms1:     set pins, 1               ; TMS high ...
+ *           jmp bits
+ * .wrap_target
+ * start:    pull
+ *           out pc, 5
+ * tms0:     set pins, 0               ; ... or TMS low
+ * bits:     out x, 5
+ *           pull                      ; Get TDI bits
+ * loop:     out pins, 1      side 0 [1] ; TDI changes on falling edge
+ *           in pins, 1       side 1     ; TDO sampled on rising edge
+ *           jmp x-- loop     side 1
+ *           push             side 0     ; TCK low when idle
+ * .wrap
+ */
+static const u16 jtag_pio_program[] =
+{
+	0xe001, //  0: set    pins, 1
+	0x0005, //  1: jmp    5
+	0x80a0, //  2: pull   block
+	0x60a5, //  3: out    pc, 5
+	0xe000, //  4: set    pins, 0
+	0x6025, //  5: out    x, 5
+	0x80a0, //  6: pull   block
+	0x7101, //  7: out    pins, 1         side 0 [1]
+	0x5801, //  8: in     pins, 1         side 1
+	0x1847, //  9: jmp    x--, 7          side 1
+	0x9020, // 10: push   block           side 0
+};
+#define JTAG_PIO_LENGTH      (sizeof(jtag_pio_program) / sizeof(u16))
+#define JTAG_PIO_WRAP_TARGET  2
+#define JTAG_PIO_WRAP        10
+/* Side-set configuration : 1 bit + enable */
+#define JTAG_PIO_SIDE_BITS    2
+/* Number of PIO cycles for one TCK period */
+#define JTAG_PIO_CYCLES       4
+
+/* Entry points of the PIO program (relative to program offset) */
+#define JTAG_PIO_TMS1  0
+#define JTAG_PIO_TMS0  4
+
+/* Make a command word for the PIO program (len : 1 to 32 bits) */
+#define JTAG_PIO_CMD(offset, tms, len) \
+	(((offset) + ((tms) ? JTAG_PIO_TMS1 : JTAG_PIO_TMS0)) | (((len) - 1) << 5))
+
+/* Max number of shifts queued before the DMA transfer */
+#define JTAG_PIO_QUEUE 128
+
+void jtag_pio_clock(void);
+int  jtag_pio_init(void);
+void jtag_pio_release(void);
+void jtag_pio_queue(u32 tdi, uint len, uint tms, u8 *tdo);
+void jtag_pio_flush(void);
+u32  jtag_pio_shift(u32 tdi, uint len, uint tms);
+
+#endif
@@ -2,6 +2,12 @@
  * @file  log.c
  * @brief Handle log messages and debug interface
  *
+ * Messages are copied into a ring buffer (see log_ring.h) and sent by the
+ * UART interrupt : log functions never wait for the UART, they can be used
+ * by the DAP engine without slowing it. When the ring is full, messages are
+ * dropped and counted, a line with the number of lost messages is sent when
+ * there is space again.
+ *
  * @author Saint-Genest Gwenael <gwen@cowlab.fr>
  * @copyright Cowlab (c) 2022
  *
@@ -13,34 +19,55 @@
  * for more details.
  * This program is distributed WITHOUT ANY WARRANTY.
  */
+#include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "hardware/uart.h"
 #include "ios.h"
 #include "log.h"
+#include "log_ring.h"
 
 #define LOG_TX_PIN  EXT_08_PIN
 #define LOG_RX_PIN  EXT_07_PIN
 
+static log_ring     log_buf;
+static spin_lock_t *log_lock;
+static uint         log_lost_sent; /* Value of log_buf.lost already reported */
+
+static void log_drain(void);
+static char *log_fmt_dec(char *str, uint32_t v);
+static void log_irq(void);
+static void log_lost(void);
+
 /**
  * @brief Initialize the "log" module
  *
  * This function initialize the log module. Depends on compilation options,
  * log messages can be sent over physical UART (uart0) or virtual port (USB-CDC)
  * For this module to work properly, this function must be called before any
- * other log functions.
+ * other log functions, and before core1 is started.
  */
 void log_init(void)
 {
+	log_ring_init(&log_buf);
+	log_lost_sent = 0;
+	log_lock = spin_lock_init(spin_lock_claim_unused(true));
+
 	uart_init(uart0, 115200);
-    
+
 	gpio_set_function(LOG_TX_PIN, GPIO_FUNC_UART);
 	gpio_set_function(LOG_RX_PIN, GPIO_FUNC_UART);
 
 	/* Set default/initial UART configuration */
 	uart_set_hw_flow(uart0, false, false);
 	uart_set_format (uart0, 8, 1, UART_PARITY_NONE);
-	uart_set_fifo_enabled(uart0, false);
+	uart_set_fifo_enabled(uart0, true);
+
+	/* The TX interrupt is only enabled while the ring is not empty */
+	uart_set_irq_enables(uart0, false, false);
+	irq_set_exclusive_handler(UART0_IRQ, log_irq);
+	irq_set_enabled(UART0_IRQ, true);
 }
 
 /**
@@ -50,28 +77,9 @@ void log_init(void)
  */
 void log_putdec(uint32_t v)
 {
-	unsigned int decade = 1000000000;
-	char str[16], *d;
-	int i, count;
-
-	d = str;
-	count = 0;
+	char str[16];
 
-	for (i = 0; i < 9; i++)
-	{
-		if ((v > (int)(decade - 1)) || count)
-		{
-			*d =  (v / decade) + '0';
-			v -= ((v / decade) * decade);
-			d++;
-			count++;
-		}
-		decade = (decade / 10);
-	}
-	*d = v + '0';
-	count ++;
-
-	d[1] = 0;
+	log_fmt_dec(str, v);
 	log_puts(str);
 }
 
@@ -98,7 +106,7 @@ void log_puthex(const uint32_t c, const uint8_t len)
 	if (len > 16)
 		*p++ = hex[(c >> 16) & 0xF];
 	if (len > 12)
-		*p++ = hex[(c >> 22) & 0xF];
+		*p++ = hex[(c >> 12) & 0xF];
 	if (len >  8)
 		*p++ = hex[(c >>  8) & 0xF];
 	if (len > 4)
@@ -112,10 +120,109 @@ void log_puthex(const uint32_t c, const uint8_t len)
 /**
  * @brief Send a text-string to the debug console
  *
+ * The string is copied into the ring, then sent by the UART interrupt. This
+ * function can be called by both cores, it never waits for the UART.
+ *
  * @param s Pointer to the null terminated text string
  */
 void log_puts(char *s)
 {
-	uart_puts(uart0, s);
+	uint32_t save;
+
+	save = spin_lock_blocking(log_lock);
+	/* Report lost messages first, if they fit now */
+	log_lost();
+	log_ring_put(&log_buf, s, strlen(s));
+	log_drain();
+	spin_unlock(log_lock, save);
+}
+
+/**
+ * @brief Move bytes from the ring to the UART FIFO (lock held)
+ *
+ * The TX interrupt of the PL011 only fires when the FIFO level goes down,
+ * so the first bytes of a message are written here.
+ */
+static void log_drain(void)
+{
+	int c;
+
+	while (uart_is_writable(uart0))
+	{
+		c = log_ring_get(&log_buf);
+		if (c < 0)
+			break;
+		uart_get_hw(uart0)->dr = c;
+	}
+	uart_set_irq_enables(uart0, false, log_ring_count(&log_buf) != 0);
+}
+
+/**
+ * @brief Write the decimal representation of an integer
+ *
+ * @param str Buffer where the string is written (11 bytes at least)
+ * @param v   Value to convert
+ * @return pointer End of the string (null character)
+ */
+static char *log_fmt_dec(char *str, uint32_t v)
+{
+	unsigned int decade = 1000000000;
+	char *d;
+	int i, count;
+
+	d = str;
+	count = 0;
+
+	for (i = 0; i < 9; i++)
+	{
+		if ((v > (decade - 1)) || count)
+		{
+			*d =  (v / decade) + '0';
+			v -= ((v / decade) * decade);
+			d++;
+			count++;
+		}
+		decade = (decade / 10);
+	}
+	*d++ = v + '0';
+	*d = 0;
+	return(d);
+}
+
+/**
+ * @brief UART interrupt handler, send next bytes of the ring
+ *
+ * The line about lost messages is queued here too : after a storm, there
+ * may be no more call of log_puts() to report it.
+ */
+static void log_irq(void)
+{
+	uint32_t save;
+
+	save = spin_lock_blocking(log_lock);
+	log_lost();
+	log_drain();
+	spin_unlock(log_lock, save);
+}
+
+/**
+ * @brief Queue the number of lost messages, if it fits (lock held)
+ *
+ */
+static void log_lost(void)
+{
+	char msg[40];
+	uint len;
+
+	if (log_buf.lost == log_lost_sent)
+		return;
+	strcpy(msg, "\r\nLOG: ");
+	strcpy(log_fmt_dec(msg + strlen(msg), log_buf.lost - log_lost_sent),
+	       " messages lost\r\n");
+	len = strlen(msg);
+	if (len > (LOG_RING_SIZE - log_ring_count(&log_buf)))
+		return;
+	log_lost_sent = log_buf.lost;
+	log_ring_put(&log_buf, msg, len);
 }
 /* EOF */
@@ -16,6 +16,39 @@
 #ifndef LOG_H
 #define LOG_H
 
+/* Levels of messages */
+#define LOG_NONE  0
+#define LOG_ERROR 1
+#define LOG_WARN  2
+#define LOG_INFO  3
+#define LOG_DEBUG 4
+
+/* Messages above this level are not compiled. A module can set its own
+ * level (#undef LOG_LEVEL, then #define LOG_LEVEL after the includes) */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+/* True when messages of this level are compiled into the module, to use
+ * with "#if LOG_ON(LOG_WARN)" around blocks of log code */
+#define LOG_ON(level) ((level) <= LOG_LEVEL)
+
+/* Calls of log functions filtered by level. The test is constant, and uses
+ * the level of the module where the macro is expanded */
+#define LOG_PUTS(level, s) \
+	do { if (LOG_ON(level)) log_puts(s); } while (0)
+#define LOG_PUTHEX(level, v, len) \
+	do { if (LOG_ON(level)) log_puthex(v, len); } while (0)
+
+#define LOG_ERROR_PUTS(s)        LOG_PUTS(LOG_ERROR, s)
+#define LOG_ERROR_PUTHEX(v, len) LOG_PUTHEX(LOG_ERROR, v, len)
+#define LOG_WARN_PUTS(s)         LOG_PUTS(LOG_WARN, s)
+#define LOG_WARN_PUTHEX(v, len)  LOG_PUTHEX(LOG_WARN, v, len)
+#define LOG_INFO_PUTS(s)         LOG_PUTS(LOG_INFO, s)
+#define LOG_INFO_PUTHEX(v, len)  LOG_PUTHEX(LOG_INFO, v, len)
+#define LOG_DEBUG_PUTS(s)        LOG_PUTS(LOG_DEBUG, s)
+#define LOG_DEBUG_PUTHEX(v, len) LOG_PUTHEX(LOG_DEBUG, v, len)
+
 void log_init  (void);
 void log_putdec(const uint32_t v);
 void log_puthex(const uint32_t c, const uint8_t len);
@@ -0,0 +1,107 @@
+/**
+ * @file  log_ring.h
+ * @brief Ring buffer of log messages, drained by the UART interrupt
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef LOG_RING_H
+#define LOG_RING_H
+#include "types.h"
+
+/* Size of the ring (power of two) */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 2048
+#endif
+
+/*
+ * Messages are copied into the ring by log_puts(), and sent by the UART
+ * interrupt. Two free running counters give the content of the ring :
+ *
+ *   [tail, head) : bytes waiting to be sent
+ *   [head, tail + LOG_RING_SIZE) : free
+ *
+ * A message is never cut : when there is not enough free space, it is
+ * dropped and counted. Writers must not wait for the UART. The ring is used
+ * by both cores, the caller serializes accesses (see log.c).
+ */
+typedef struct log_ring_s
+{
+	uint head;    /* Number of bytes written */
+	uint tail;    /* Number of bytes sent */
+	uint lost;    /* Number of messages dropped (ring full) */
+	u8   data[LOG_RING_SIZE];
+} log_ring;
+
+/**
+ * @brief Initialize an empty ring
+ *
+ * @param r Pointer to the ring
+ */
+static inline void log_ring_init(log_ring *r)
+{
+	r->head = 0;
+	r->tail = 0;
+	r->lost = 0;
+}
+
+/**
+ * @brief Number of bytes waiting into the ring
+ *
+ * @param r Pointer to the ring
+ * @return integer Number of bytes
+ */
+static inline uint log_ring_count(const log_ring *r)
+{
+	return(r->head - r->tail);
+}
+
+/**
+ * @brief Copy a message into the ring
+ *
+ * @param r   Pointer to the ring
+ * @param s   Content of the message
+ * @param len Length of the message
+ * @return integer Zero on success, -1 if the message has been dropped
+ */
+static inline int log_ring_put(log_ring *r, const char *s, uint len)
+{
+	uint i;
+
+	if (len > (LOG_RING_SIZE - log_ring_count(r)))
+	{
+		r->lost++;
+		return(-1);
+	}
+	for (i = 0; i < len; i++)
+		r->data[(r->head + i) & (LOG_RING_SIZE - 1)] = s[i];
+	r->head += len;
+	return(0);
+}
+
+/**
+ * @brief Get the next byte to send
+ *
+ * @param r Pointer to the ring
+ * @return integer Value of the byte, -1 if the ring is empty
+ */
+static inline int log_ring_get(log_ring *r)
+{
+	u8 c;
+
+	if (r->head == r->tail)
+		return(-1);
+	c = r->data[r->tail & (LOG_RING_SIZE - 1)];
+	r->tail++;
+	return(c);
+}
+
+#endif
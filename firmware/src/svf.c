@@ -0,0 +1,680 @@
+/**
+ * @file  svf.c
+ * @brief Player of Serial Vector Format files (JTAG)
+ *
+ * The file is received as a stream of chunks of any size (see svf_feed).
+ * Each statement is stored until its terminating semicolon, then executed
+ * with the TAP tracker of the JTAG module. Captured bits are compared by
+ * the probe, only the number of mismatches and the line of the first one
+ * are reported to the host.
+ *
+ * Supported statements : SIR, SDR, HIR, HDR, TIR, TDR, ENDIR, ENDDR,
+ * RUNTEST, STATE, FREQUENCY and TRST (ignored, there is no TRST signal).
+ * TDO, MASK and SMASK of headers and trailers are ignored.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "pico/stdlib.h"
+#include "jtag.h"
+#include "svf.h"
+#include "swj_clock.h"
+#include "types.h"
+
+/* Vectors of a scan, TDI, MASK and SMASK are kept for the next one */
+typedef struct svf_scan_s
+{
+	uint len;
+	uint tdi_ok; /* TDI has been set since the last change of length */
+	u8   tdi  [SVF_MAX_BITS / 8];
+	u8   mask [SVF_MAX_BITS / 8];
+	u8   smask[SVF_MAX_BITS / 8];
+} svf_scan;
+
+/* Header or trailer (bits for the other devices of the chain) */
+typedef struct svf_pad_s
+{
+	uint len;
+	u8   tdi[SVF_PAD_BITS / 8];
+} svf_pad;
+
+/* Names of the states of the TAP, same order as JTAG_RESET ... */
+static const char *const svf_states[JTAG_STATES] =
+{
+	"RESET",    "IDLE",      "DRSELECT", "DRCAPTURE",
+	"DRSHIFT",  "DREXIT1",   "DRPAUSE",  "DREXIT2",
+	"DRUPDATE", "IRSELECT",  "IRCAPTURE", "IRSHIFT",
+	"IREXIT1",  "IRPAUSE",   "IREXIT2",  "IRUPDATE",
+};
+
+static svf_result svf_res;
+/* Statement being received */
+static char svf_line[SVF_LINE_MAX];
+static uint svf_pos;
+static uint svf_comment; /* Into a comment, until end of line */
+static uint svf_paren;   /* Into a vector, white spaces are removed */
+static u32  svf_lnum;    /* Current line of the file */
+static u32  svf_lstart;  /* Line where the statement starts */
+/* Parameters set by previous statements */
+static svf_scan svf_ir, svf_dr;
+static svf_pad  svf_hir, svf_hdr, svf_tir, svf_tdr;
+static uint svf_endir, svf_enddr;
+static uint svf_run_state, svf_run_end;
+/* Buffers of the current scan */
+static u8   svf_tdo[SVF_MAX_BITS / 8];
+static u8   svf_cap[SVF_MAX_BITS / 8];
+
+static int  svf_exec(char *p);
+static int  svf_hex(const char *tok, u8 *buf, uint len);
+static int  svf_number(const char *tok, int exp10, u32 *value);
+static int  svf_pad_cmd(char *p, svf_pad *pad);
+static int  svf_runtest(char *p);
+static void svf_run(uint ir, const svf_scan *s, uint check);
+static int  svf_scan_cmd(char *p, uint ir);
+static int  svf_stable(int state);
+static int  svf_state(const char *tok);
+static char *svf_token(char **p);
+
+/**
+ * @brief Reset the player before a new file
+ *
+ */
+void svf_start(void)
+{
+	memset(&svf_res, 0, sizeof(svf_result));
+	svf_pos     = 0;
+	svf_comment = 0;
+	svf_paren   = 0;
+	svf_lnum    = 1;
+	svf_lstart  = 1;
+	svf_ir.len  = 0;
+	svf_ir.tdi_ok = 0;
+	svf_dr.len  = 0;
+	svf_dr.tdi_ok = 0;
+	svf_hir.len = 0;
+	svf_hdr.len = 0;
+	svf_tir.len = 0;
+	svf_tdr.len = 0;
+	svf_endir   = JTAG_IDLE;
+	svf_enddr   = JTAG_IDLE;
+	svf_run_state = JTAG_IDLE;
+	svf_run_end   = JTAG_IDLE;
+}
+
+/**
+ * @brief Process a chunk of the file
+ *
+ * Comments and white spaces are removed, each complete statement is
+ * executed. After an error, next chunks are ignored until svf_start().
+ *
+ * @param data Pointer to the data of the file
+ * @param len  Number of bytes
+ * @return integer Status of the player (SVF_OK ...)
+ */
+int svf_feed(const u8 *data, uint len)
+{
+	char c;
+	int  result;
+
+	for ( ; len && (svf_res.status <= SVF_MISMATCH); len--)
+	{
+		c = (char)*data++;
+		if (c == '\n')
+		{
+			svf_lnum++;
+			svf_comment = 0;
+		}
+		if (svf_comment)
+			continue;
+
+		if ((c == '!') ||
+		    ((c == '/') && svf_pos && (svf_line[svf_pos - 1] == '/')))
+		{
+			if (c == '/')
+				svf_pos--;
+			svf_comment = 1;
+			continue;
+		}
+		if (c == ';')
+		{
+			svf_line[svf_pos] = 0;
+			svf_pos = 0;
+			result = svf_exec(svf_line);
+			if (result > SVF_MISMATCH)
+			{
+				svf_res.status = result;
+				svf_res.line   = svf_lstart;
+			}
+			continue;
+		}
+		/* A statement must fit into buffer (with room for separators) */
+		if (svf_pos >= (SVF_LINE_MAX - 3))
+		{
+			svf_res.status = SVF_TOO_LONG;
+			svf_res.line   = svf_lstart;
+			break;
+		}
+		if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'))
+		{
+			if (svf_pos && ! svf_paren && (svf_line[svf_pos - 1] != ' '))
+				svf_line[svf_pos++] = ' ';
+			continue;
+		}
+		if (svf_pos == 0)
+			svf_lstart = svf_lnum;
+		if ((c >= 'a') && (c <= 'z'))
+			c = (char)(c - 'a' + 'A');
+		/* Vectors are separate tokens, without white spaces */
+		if (c == '(')
+		{
+			if (svf_pos && (svf_line[svf_pos - 1] != ' '))
+				svf_line[svf_pos++] = ' ';
+			svf_paren = 1;
+		}
+		svf_line[svf_pos++] = c;
+		if (c == ')')
+		{
+			svf_line[svf_pos++] = ' ';
+			svf_paren = 0;
+		}
+	}
+	return(svf_res.status);
+}
+
+/**
+ * @brief End of the file
+ *
+ * @return integer Final status of the player (SVF_OK ...)
+ */
+int svf_end(void)
+{
+	uint i;
+
+	jtag_sync();
+	/* Something after the last semicolon (other than comments) */
+	for (i = 0; i < svf_pos; i++)
+	{
+		if ((svf_line[i] != ' ') && (svf_res.status <= SVF_MISMATCH))
+		{
+			svf_res.status = SVF_SYNTAX;
+			svf_res.line   = svf_lstart;
+			break;
+		}
+	}
+	svf_pos = 0;
+	return(svf_res.status);
+}
+
+/**
+ * @brief Get the result of the player
+ *
+ * @return svf_result* Pointer to the status, mismatches and line
+ */
+const svf_result *svf_status(void)
+{
+	return(&svf_res);
+}
+
+/**
+ * @brief Execute one statement
+ *
+ * @param p Statement (upper case, tokens separated by one space)
+ * @return integer SVF_OK, SVF_MISMATCH or an error
+ */
+static int svf_exec(char *p)
+{
+	const char *cmd;
+	char *tok;
+	u32   hz;
+	int   state;
+
+	cmd = svf_token(&p);
+	if (cmd == 0)
+		return(SVF_OK);
+
+	if (strcmp(cmd, "SIR") == 0)
+		return( svf_scan_cmd(p, 1) );
+	if (strcmp(cmd, "SDR") == 0)
+		return( svf_scan_cmd(p, 0) );
+	if (strcmp(cmd, "HIR") == 0)
+		return( svf_pad_cmd(p, &svf_hir) );
+	if (strcmp(cmd, "HDR") == 0)
+		return( svf_pad_cmd(p, &svf_hdr) );
+	if (strcmp(cmd, "TIR") == 0)
+		return( svf_pad_cmd(p, &svf_tir) );
+	if (strcmp(cmd, "TDR") == 0)
+		return( svf_pad_cmd(p, &svf_tdr) );
+	if (strcmp(cmd, "RUNTEST") == 0)
+		return( svf_runtest(p) );
+
+	if ((strcmp(cmd, "ENDIR") == 0) || (strcmp(cmd, "ENDDR") == 0))
+	{
+		state = svf_state(svf_token(&p));
+		if ( ! svf_stable(state) || svf_token(&p))
+			return(SVF_STATE);
+		if (cmd[3] == 'I')
+			svf_endir = state;
+		else
+			svf_enddr = state;
+		return(SVF_OK);
+	}
+	/* Path of states, the last one must be stable */
+	if (strcmp(cmd, "STATE") == 0)
+	{
+		for (state = -1; (tok = svf_token(&p)) != 0; )
+		{
+			state = svf_state(tok);
+			if (state < 0)
+				return(SVF_STATE);
+			jtag_goto(state);
+		}
+		return(svf_stable(state) ? SVF_OK : SVF_STATE);
+	}
+	if (strcmp(cmd, "FREQUENCY") == 0)
+	{
+		tok = svf_token(&p);
+		/* Without value : full speed, keep the clock of the debugger */
+		if (tok == 0)
+			return(SVF_OK);
+		if (svf_number(tok, 0, &hz) || (hz == 0) ||
+		    ((tok = svf_token(&p)) == 0) || strcmp(tok, "HZ"))
+			return(SVF_SYNTAX);
+		swj_clock_set(hz);
+		jtag_clock();
+		return(SVF_OK);
+	}
+	if (strcmp(cmd, "TRST") == 0)
+		return(SVF_OK);
+	if ((strcmp(cmd, "PIO") == 0) || (strcmp(cmd, "PIOMAP") == 0))
+		return(SVF_UNSUPPORTED);
+
+	return(SVF_SYNTAX);
+}
+
+/**
+ * @brief Load a vector (hex digits between parentheses, MSB first)
+ *
+ * The buffer is stored LSB first (first bit to shift into bit 0 of the
+ * first byte). Bits above the length are cleared.
+ *
+ * @param tok Token with the vector
+ * @param buf Buffer where the bits are stored
+ * @param len Number of bits of the scan
+ * @return integer Zero on success, -1 if the vector is invalid
+ */
+static int svf_hex(const char *tok, u8 *buf, uint len)
+{
+	const char *end;
+	uint bit, v;
+
+	if ((tok == 0) || (*tok != '('))
+		return(-1);
+	end = tok + strlen(tok) - 1;
+	if ((end <= (tok + 1)) || (*end != ')'))
+		return(-1);
+
+	memset(buf, 0, (len + 7) / 8);
+	for (bit = 0, end--; end > tok; end--, bit += 4)
+	{
+		if ((*end >= '0') && (*end <= '9'))
+			v = *end - '0';
+		else if ((*end >= 'A') && (*end <= 'F'))
+			v = *end - 'A' + 10;
+		else
+			return(-1);
+		/* Leading digits beyond the length are ignored */
+		if (bit < len)
+			buf[bit / 8] |= (v << (bit % 8));
+	}
+	if (len % 8)
+		buf[len / 8] &= (1 << (len % 8)) - 1;
+	return(0);
+}
+
+/**
+ * @brief Convert a number (integer or real) to an integer
+ *
+ * Numbers like "1000", "2.5" or "1.0E-3" are accepted, the value is
+ * multiplied by 10^exp10 and rounded up.
+ *
+ * @param tok   Token with the number
+ * @param exp10 Scale of the result (6 to get microseconds from seconds)
+ * @param value Pointer to a variable where the result is stored
+ * @return integer Zero on success, -1 if the token is not a valid number
+ */
+static int svf_number(const char *tok, int exp10, u32 *value)
+{
+	unsigned long long m = 0;
+	uint digits = 0, frac = 0;
+	int  e = 0, sign = 1;
+
+	if (tok == 0)
+		return(-1);
+	for ( ; *tok; tok++)
+	{
+		if ((*tok >= '0') && (*tok <= '9'))
+		{
+			/* Digits beyond the precision are ignored */
+			if (m < 100000000000000000ULL)
+			{
+				m = (m * 10) + (*tok - '0');
+				if (frac)
+					exp10--;
+			}
+			else if ( ! frac)
+				exp10++;
+			digits++;
+		}
+		else if ((*tok == '.') && ! frac)
+			frac = 1;
+		else
+			break;
+	}
+	if (digits == 0)
+		return(-1);
+	if (*tok == 'E')
+	{
+		tok++;
+		if ((*tok == '+') || (*tok == '-'))
+			sign = (*tok++ == '-') ? -1 : 1;
+		if ((*tok < '0') || (*tok > '9'))
+			return(-1);
+		for ( ; (*tok >= '0') && (*tok <= '9'); tok++)
+			if (e < 100)
+				e = (e * 10) + (*tok - '0');
+	}
+	if (*tok)
+		return(-1);
+
+	for (e = exp10 + (sign * e); (e > 0) && m; e--)
+	{
+		m *= 10;
+		if (m > 0xFFFFFFFFULL)
+			return(-1);
+	}
+	for ( ; (e < 0) && m; e++)
+		m = (m + 9) / 10;
+	if (m > 0xFFFFFFFFULL)
+		return(-1);
+	*value = (u32)m;
+	return(0);
+}
+
+/**
+ * @brief Handle HIR, HDR, TIR and TDR statements
+ *
+ * Without TDI, the bits of a new length are set to one (BYPASS).
+ *
+ * @param p   Arguments of the statement
+ * @param pad Header or trailer to update
+ * @return integer SVF_OK or an error
+ */
+static int svf_pad_cmd(char *p, svf_pad *pad)
+{
+	char *tok;
+	u32   len;
+
+	if (svf_number(svf_token(&p), 0, &len))
+		return(SVF_SYNTAX);
+	if (len > SVF_PAD_BITS)
+		return(SVF_TOO_LONG);
+	if (len != pad->len)
+	{
+		memset(pad->tdi, 0xFF, sizeof(pad->tdi));
+		pad->len = len;
+	}
+	while ((tok = svf_token(&p)) != 0)
+	{
+		if (strcmp(tok, "TDI") == 0)
+		{
+			if (svf_hex(svf_token(&p), pad->tdi, len))
+				return(SVF_SYNTAX);
+		}
+		else if ((strcmp(tok, "TDO") == 0) || (strcmp(tok, "MASK") == 0) ||
+		         (strcmp(tok, "SMASK") == 0))
+		{
+			if (svf_hex(svf_token(&p), svf_tdo, len))
+				return(SVF_SYNTAX);
+		}
+		else
+			return(SVF_SYNTAX);
+	}
+	return(SVF_OK);
+}
+
+/**
+ * @brief Handle the RUNTEST statement
+ *
+ * RUNTEST [run_state] [count TCK|SCK] [min_time SEC] [MAXIMUM max SEC]
+ * [ENDSTATE end_state]. There is no system clock : SCK are TCK. The
+ * minimum time is waited after the clocks, the maximum is ignored.
+ *
+ * @param p Arguments of the statement
+ * @return integer SVF_OK or an error
+ */
+static int svf_runtest(char *p)
+{
+	char *tok, *unit;
+	u32   count = 0, usec = 0, v;
+	uint  n, tms;
+	int   state;
+
+	tok = svf_token(&p);
+	state = svf_state(tok);
+	if (state >= 0)
+	{
+		if ( ! svf_stable(state))
+			return(SVF_STATE);
+		svf_run_state = state;
+		svf_run_end   = state;
+		tok = svf_token(&p);
+	}
+	for ( ; tok; tok = svf_token(&p))
+	{
+		if (strcmp(tok, "ENDSTATE") == 0)
+		{
+			state = svf_state(svf_token(&p));
+			if ( ! svf_stable(state))
+				return(SVF_STATE);
+			svf_run_end = state;
+			continue;
+		}
+		if (strcmp(tok, "MAXIMUM") == 0)
+		{
+			if (svf_number(svf_token(&p), 6, &v) ||
+			    ((unit = svf_token(&p)) == 0) || strcmp(unit, "SEC"))
+				return(SVF_SYNTAX);
+			continue;
+		}
+		unit = svf_token(&p);
+		if (unit == 0)
+			return(SVF_SYNTAX);
+		if ((strcmp(unit, "TCK") == 0) || (strcmp(unit, "SCK") == 0))
+		{
+			if (svf_number(tok, 0, &count))
+				return(SVF_SYNTAX);
+		}
+		else if (strcmp(unit, "SEC") == 0)
+		{
+			if (svf_number(tok, 6, &usec))
+				return(SVF_SYNTAX);
+		}
+		else
+			return(SVF_SYNTAX);
+	}
+
+	jtag_goto(svf_run_state);
+	tms = (svf_run_state == JTAG_RESET);
+	for ( ; count; count -= n)
+	{
+		n = (count > 32) ? 32 : count;
+		jtag_shift(0, n, tms);
+	}
+	if (usec)
+		busy_wait_us_32(usec);
+	jtag_goto(svf_run_end);
+	return(SVF_OK);
+}
+
+/**
+ * @brief Execute a scan (SIR or SDR) with header and trailer
+ *
+ * A scan starts from the current state : from Pause, Capture is skipped
+ * (like the path defined by the SVF specification). The last bit of the
+ * chain leaves the Shift state, then the TAP goes to ENDIR or ENDDR.
+ *
+ * @param ir    True for an instruction scan
+ * @param s     Vectors of the scan
+ * @param check True to compare captured bits with svf_tdo
+ */
+static void svf_run(uint ir, const svf_scan *s, uint check)
+{
+	const svf_pad *hdr = ir ? &svf_hir : &svf_hdr;
+	const svf_pad *tlr = ir ? &svf_tir : &svf_tdr;
+	uint i;
+
+	if (hdr->len + s->len + tlr->len)
+	{
+		jtag_goto(ir ? JTAG_IRSHIFT : JTAG_DRSHIFT);
+		jtag_scan_bits(hdr->tdi, 0, hdr->len, (s->len + tlr->len) == 0);
+		jtag_scan_bits(s->tdi, svf_cap, s->len, tlr->len == 0);
+		jtag_scan_bits(tlr->tdi, 0, tlr->len, 1);
+	}
+	jtag_goto(ir ? svf_endir : svf_enddr);
+	svf_res.scans++;
+
+	if ( ! check)
+		return;
+	for (i = 0; i < ((s->len + 7) / 8); i++)
+		if ((svf_cap[i] ^ svf_tdo[i]) & s->mask[i])
+			break;
+	if (i == ((s->len + 7) / 8))
+		return;
+	if (svf_res.mismatch++ == 0)
+	{
+		svf_res.status = SVF_MISMATCH;
+		svf_res.line   = svf_lstart;
+	}
+}
+
+/**
+ * @brief Handle SIR and SDR statements
+ *
+ * TDI, MASK and SMASK are kept for the next scan of the same length. TDO is
+ * only compared when set into the statement.
+ *
+ * @param p  Arguments of the statement
+ * @param ir True for SIR, false for SDR
+ * @return integer SVF_OK, SVF_MISMATCH or an error
+ */
+static int svf_scan_cmd(char *p, uint ir)
+{
+	svf_scan *s = ir ? &svf_ir : &svf_dr;
+	char *tok;
+	uint  check = 0;
+	u32   len;
+	int   result;
+
+	if (svf_number(svf_token(&p), 0, &len))
+		return(SVF_SYNTAX);
+	if (len > SVF_MAX_BITS)
+		return(SVF_TOO_LONG);
+	if (len != s->len)
+	{
+		s->len    = len;
+		s->tdi_ok = 0;
+		memset(s->mask,  0, sizeof(s->mask));
+		memset(s->mask,  0xFF, len / 8);
+		if (len % 8)
+			s->mask[len / 8] = (1 << (len % 8)) - 1;
+		memcpy(s->smask, s->mask, sizeof(s->smask));
+	}
+	while ((tok = svf_token(&p)) != 0)
+	{
+		if (strcmp(tok, "TDI") == 0)
+		{
+			result = svf_hex(svf_token(&p), s->tdi, len);
+			s->tdi_ok = 1;
+		}
+		else if (strcmp(tok, "TDO") == 0)
+		{
+			result = svf_hex(svf_token(&p), svf_tdo, len);
+			check = 1;
+		}
+		else if (strcmp(tok, "MASK") == 0)
+			result = svf_hex(svf_token(&p), s->mask, len);
+		else if (strcmp(tok, "SMASK") == 0)
+			result = svf_hex(svf_token(&p), s->smask, len);
+		else
+			result = -1;
+		if (result)
+			return(SVF_SYNTAX);
+	}
+	/* TDI must be set when the length is modified */
+	if (len && ! s->tdi_ok)
+		return(SVF_SYNTAX);
+
+	svf_run(ir, s, check);
+	return(SVF_OK);
+}
+
+/**
+ * @brief Test if a state can be used as end of a statement
+ *
+ * @param state State of the TAP (or -1)
+ * @return integer True for Test-Logic-Reset, Run-Test/Idle and Pause states
+ */
+static int svf_stable(int state)
+{
+	return((state == JTAG_RESET) || (state == JTAG_IDLE) ||
+	       (state == JTAG_DRPAUSE) || (state == JTAG_IRPAUSE));
+}
+
+/**
+ * @brief Get a state of the TAP from its name
+ *
+ * @param tok Name of the state (null is accepted)
+ * @return integer State (JTAG_RESET ...) or -1 if not found
+ */
+static int svf_state(const char *tok)
+{
+	int i;
+
+	if (tok == 0)
+		return(-1);
+	for (i = 0; i < JTAG_STATES; i++)
+		if (strcmp(tok, svf_states[i]) == 0)
+			return(i);
+	return(-1);
+}
+
+/**
+ * @brief Extract the next token of a statement
+ *
+ * @param p Pointer to the current position, updated
+ * @return char* Pointer to the token (null terminated), or null at the end
+ */
+static char *svf_token(char **p)
+{
+	char *tok = *p;
+
+	while (*tok == ' ')
+		tok++;
+	if (*tok == 0)
+		return(0);
+	for (*p = tok; **p && (**p != ' '); (*p)++)
+		;
+	if (**p)
+		*(*p)++ = 0;
+	return(tok);
+}
+/* EOF */
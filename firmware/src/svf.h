@@ -0,0 +1,48 @@
+/**
+ * @file  svf.h
+ * @brief Headers and definitions for the SVF player
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef SVF_H
+#define SVF_H
+#include "types.h"
+
+/* Max length of a scan (SIR, SDR) */
+#define SVF_MAX_BITS  4096
+/* Max length of headers and trailers (HIR, HDR, TIR, TDR) */
+#define SVF_PAD_BITS  256
+/* Max length of a statement (four vectors of SVF_MAX_BITS in hex) */
+#define SVF_LINE_MAX  (SVF_MAX_BITS + 128)
+
+/* Status of the player */
+#define SVF_OK           0
+#define SVF_MISMATCH     1 /* TDO does not match (player continues) */
+#define SVF_SYNTAX       2 /* Statement not understood */
+#define SVF_TOO_LONG     3 /* Statement or scan over the limits */
+#define SVF_STATE        4 /* Invalid or unstable state */
+#define SVF_UNSUPPORTED  5 /* PIO and PIOMAP */
+
+typedef struct svf_result_s
+{
+	uint status;   /* SVF_OK, SVF_MISMATCH or the error that stopped player */
+	u32  line;     /* Line of the error, or of the first mismatch */
+	u32  mismatch; /* Number of scans with unexpected TDO */
+	u32  scans;    /* Number of scans executed (SIR and SDR) */
+} svf_result;
+
+void svf_start(void);
+int  svf_feed(const u8 *data, uint len);
+int  svf_end(void);
+const svf_result *svf_status(void);
+
+#endif
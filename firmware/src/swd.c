@@ -19,26 +19,77 @@
 #include "ios.h"
 #include "log.h"
 #include "swd.h"
+#include "swd_pio.h"
+#include "swj_clock.h"
 
 #define DEBUG_SWD
-#define BIT_DELAY  80
 #define WAIT_DELAY 1000
 
 #define PIN_SWDIO PORT_D1_PIN
 #define PIN_SWCLK PORT_D2_PIN
 
 swd_param swd_config;
+static uint swd_engine; /* Engine used by the current session */
 
-static inline uint _parity(uint32_t value);
+static int _transfer(u8 req, u32 *value, uint data_phase);
+
+/* Results of pipelined transfers (GPIO engine) */
+static struct
+{
+	int ack;
+	u32 data;
+} swd_pipe[SWD_PIPE_DEPTH];
+static uint swd_pipe_wr, swd_pipe_rd;
+
+/**
+ * @brief Initialize the SWD module
+ *
+ * This function set the default configuration of the SWD module. The PIO
+ * engine is used by default, the GPIO engine (bit-banging) can be selected
+ * by modifying swd_config.engine before connect.
+ */
+void swd_init(void)
+{
+	swd_config.retry_count = 16;
+	swd_config.engine      = SWD_ENGINE_PIO;
+	swd_config.turnaround  = 1;
+	swd_config.data_phase  = 0;
+	swd_config.idle_cycles = 0;
+	swd_engine = SWD_ENGINE_GPIO;
+}
+
+/**
+ * @brief Apply a new SWD clock frequency
+ *
+ * GPIO engine reads the delay from swj_clk on each bit, so only a running
+ * PIO state machine has to be updated.
+ */
+void swd_clock(void)
+{
+	if (swd_engine == SWD_ENGINE_PIO)
+		swd_pio_clock();
+}
 
 /**
  * @brief Activate the debug port in SWD mode
  *
+ * The engine selected by swd_config.engine is used for this session. When
+ * the PIO can not be used, the GPIO engine is used until disconnect : the
+ * PIO engine is tried again by the next connect.
+ *
  * @result integer Zero is returuned on success
  */
 int swd_connect(void)
 {
 	ios_mode(PORT_MODE_SWD);
+
+	swd_engine = swd_config.engine;
+	if (swd_engine == SWD_ENGINE_PIO)
+	{
+		/* If PIO can not be used, fallback to GPIO */
+		if (swd_pio_init() != 0)
+			swd_engine = SWD_ENGINE_GPIO;
+	}
 	return(0);
 }
 
@@ -49,6 +100,10 @@ int swd_connect(void)
  */
 int swd_disconnect(void)
 {
+	if (swd_engine == SWD_ENGINE_PIO)
+		swd_pio_release();
+	swd_engine = SWD_ENGINE_GPIO;
+
 	ios_mode(PORT_MODE_HIZ);
 	return(0);
 }
@@ -58,13 +113,12 @@ int swd_disconnect(void)
  *
  * @param req Identifier of the SWD request
  * @param value Value to read or write during transaction
- * @return integer Value of the ACK bits (0 for success)
+ * @return integer Value of the ACK bits (1 for success)
  */
 int swd_transfer(uint8_t req, uint32_t *value)
 {
-	uint32_t data;
 	int ack = 0;
-	int i, wt;
+	uint i;
 
 #ifdef DEBUG_SWD
 	/* Sanity check */
@@ -77,12 +131,10 @@ int swd_transfer(uint8_t req, uint32_t *value)
 
 	for (i = 0; i < swd_config.retry_count; i++)
 	{
-		data  = ((req & 0x0F) << 1);
-		data |= (_parity(data) << 5);
-		data |= 0x81;
-		swd_wr(data, 8);
-		swd_turna(0);
-		ack = swd_rd(3);
+		if (swd_engine == SWD_ENGINE_PIO)
+			ack = swd_pio_transfer(req, value);
+		else
+			ack = _transfer(req, value, swd_config.data_phase);
 
 		/* If acknowledge is WAIT */
 		if (ack == 2)
@@ -91,59 +143,70 @@ int swd_transfer(uint8_t req, uint32_t *value)
 #ifdef DAP_DEBUG
 			log_puts("SWD: Transfer WAIT\r\n");
 #endif
-			/* Trn cycle to revert initial state */
-			swd_turna(1);
 			/* Wait some time before try again */
-			for (wt = 0; wt < BIT_DELAY; wt++)
-				asm volatile("nop");
+			swj_delay(swj_clk.delay);
 			continue;
 		}
-		/* If acknowledge is OK */
+		/* If acknowledge is OK, no retry needed */
 		else if (ack == 1)
-		{
-			/* If RnW bit is set, read request */
-			if (req & (1 << 1))
-			{
-				data = swd_rd(32);
-				/* Read parity bit */
-				if (swd_rd(1) != _parity(data))
-					log_puts("SWD: Parity error\r\n");
-				else if (value)
-					*value = data;
-
-				/* Trn cycle to revert initial state */
-				swd_turna(1);
-			}
-			/* Write request */
-			else
-			{
-				if (value)
-					data = *value;
-				else
-					data = 0;
-
-				swd_turna(1);
-				/* Write data to swd bus */
-				swd_wr(data, 32);
-				/* Send parity bit */
-				data = _parity(data);
-				swd_wr(data, 1);
-				swd_idle();
-			}
-			/* Request finished, no retry needed */
 			break;
-		}
 		else
 		{
-			log_puts("SWD: Transfer failed ! ACK=");
-			log_puthex(ack, 8);
-			log_puts("\r\n");
+			LOG_WARN_PUTS("SWD: Transfer failed ! ACK=");
+			LOG_WARN_PUTHEX(ack, 8);
+			LOG_WARN_PUTS("\r\n");
 			break;
 		}
 	}
 	return(ack);
 }
 
+/**
+ * @brief Queue one transfer with a fixed length (pipelined mode)
+ *
+ * The data phase is always generated, whatever the ACK, so the transfer does
+ * not depend on the target response : with overrun detection enabled on the
+ * target, a WAIT or FAULT only sets STICKYORUN and next transfers are
+ * ignored. The caller must get the result of each transfer (swd_pipe_get)
+ * with no more than SWD_PIPE_DEPTH transfers pending.
+ *
+ * @param req   Identifier of the SWD request
+ * @param value Value to write (ignored for a read)
+ */
+void swd_pipe_put(u8 req, u32 value)
+{
+	uint n;
+
+	if (swd_engine == SWD_ENGINE_PIO)
+	{
+		swd_pio_put(req, value);
+		return;
+	}
+	/* GPIO engine is synchronous, just save the result */
+	n = (swd_pipe_wr++ % SWD_PIPE_DEPTH);
+	swd_pipe[n].data = value;
+	swd_pipe[n].ack  = _transfer(req, &swd_pipe[n].data, 1);
+}
+
+/**
+ * @brief Get the result of the oldest pipelined transfer
+ *
+ * @param value Pointer where read value is stored (can be null)
+ * @return integer Value of the ACK bits (1 for success)
+ */
+int swd_pipe_get(u32 *value)
+{
+	uint n;
+
+	if (swd_engine == SWD_ENGINE_PIO)
+		return( swd_pio_get(value) );
+
+	n = (swd_pipe_rd++ % SWD_PIPE_DEPTH);
+	if ((swd_pipe[n].ack == 1) && value)
+		*value = swd_pipe[n].data;
+	return(swd_pipe[n].ack);
+}
+
 /**
  * @brief Set SWD signals to their IDLE state
  *
@@ -161,6 +224,10 @@ void swd_idle(void)
  */
 void swd_io_dir(int dir)
 {
+	/* With PIO, direction is managed by the state machine itself */
+	if (swd_engine == SWD_ENGINE_PIO)
+		return;
+
 	if (dir)
 		ios_pin_mode(PIN_SWDIO, IO_DIR_OUT);
 	else
@@ -176,24 +243,25 @@ void swd_io_dir(int dir)
 u32 swd_rd(uint len)
 {
 	u32  result = 0;
-	uint bit, wait;
+	uint bit;
 	uint i;
 
+	if (swd_engine == SWD_ENGINE_PIO)
+		return( swd_pio_rd(len) );
+
 	for (i = 0 ; i < len ; i++)
 	{
 		/* Falling edge to SWD-CLK */
 		ios_pin_set(PIN_SWCLK, 0);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
+		/* Wait 1/2 clock period */
+		swj_delay(swj_clk.delay);
 
 		bit = ios_pin(PIN_SWDIO);
 
 		/* Rising edge to SWD-CLK */
 		ios_pin_set(PIN_SWCLK, 1);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
+		/* Wait 1/2 clock period */
+		swj_delay(swj_clk.delay);
 
 		result |= (bit << i);
 	}
@@ -203,41 +271,33 @@ u32 swd_rd(uint len)
 /**
  * @brief Execute a bus turnaround to change SWD-IO direction
  *
+ * The turnaround lasts swd_config.turnaround clock cycles. When the probe
+ * takes the line back, SWD-IO is driven after the falling edge of the last
+ * cycle (the target has released it on the previous rising edge).
+ *
  * @param dir Direction to set (0=IN , 1=OUT)
  */
 void swd_turna(int dir)
 {
-	int wait;
+	uint n = swd_config.turnaround ? swd_config.turnaround : 1;
 
-	if (dir)
+	if (dir == 0)
+		ios_pin_mode(PIN_SWDIO, IO_DIR_IN);
+
+	for ( ; n ; n--)
 	{
 		/* Falling edge to SWD-CLK */
 		ios_pin_set(PIN_SWCLK, 0);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
+		/* Wait 1/2 clock period */
+		swj_delay(swj_clk.delay);
 
-		ios_pin_mode(PIN_SWDIO, IO_DIR_OUT);
+		if (dir && (n == 1))
+			ios_pin_mode(PIN_SWDIO, IO_DIR_OUT);
 
 		/* Rising edge to SWD-CLK */
 		ios_pin_set(PIN_SWCLK, 1);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
-	}
-	else
-	{
-		ios_pin_mode(PIN_SWDIO, IO_DIR_IN);
-		/* Falling edge to SWD-CLK */
-		ios_pin_set(PIN_SWCLK, 0);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
-		/* Rising edge to SWD-CLK */
-		ios_pin_set(PIN_SWCLK, 1);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
+		/* Wait 1/2 clock period */
+		swj_delay(swj_clk.delay);
 	}
 }
 
@@ -249,7 +309,11 @@ void swd_turna(int dir)
  */
 void swd_wr(uint32_t v, uint len)
 {
-	uint wait;
+	if (swd_engine == SWD_ENGINE_PIO)
+	{
+		swd_pio_wr(v, len);
+		return;
+	}
 
 	for ( ; len ; len--)
 	{
@@ -258,14 +322,12 @@ void swd_wr(uint32_t v, uint len)
 		else       ios_pin_set(PIN_SWDIO, 0);
 		/* Falling edge to SWD-CLK */
 		ios_pin_set(PIN_SWCLK, 0);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
+		/* Wait 1/2 clock period */
+		swj_delay(swj_clk.delay);
 		/* Rising edge to SWD-CLK */
 		ios_pin_set(PIN_SWCLK, 1);
-		/* Wait a bit TODO: improve delay */
-		for (wait = 0; wait < BIT_DELAY; wait++)
-			asm volatile("nop");
+		/* Wait 1/2 clock period */
+		swj_delay(swj_clk.delay);
 
 		/* Shift byte to select next bit */
 		v = (v >> 1);
@@ -273,18 +335,90 @@ void swd_wr(uint32_t v, uint len)
 }
 
 /**
- * @brief Compute a parity bit
+ * @brief Process one SWD transfer using GPIO (bit-banging)
  *
- * @param uint32_t Input value
- * @return integer Return 1 for an odd number of '1' into input value
+ * @param req Identifier of the SWD request
+ * @param value Value to read or write during transaction
+ * @param data_phase True to generate data phase on WAIT and FAULT
+ * @return integer Value of the ACK bits (1 for success)
  */
-static inline uint _parity(uint32_t value)
+static int _transfer(u8 req, u32 *value, uint data_phase)
 {
-	value ^= value >> 16;
-	value ^= value >> 8;
-	value ^= value >> 4;
-	value &= 0x0f;
+	u32 data;
+	int ack;
+
+	data  = ((req & 0x0F) << 1);
+	data |= (swd_parity(data) << 5);
+	data |= 0x81;
+	swd_wr(data, 8);
+	swd_turna(0);
+	ack = swd_rd(3);
+
+	/* If acknowledge is OK */
+	if (ack == 1)
+	{
+		/* If RnW bit is set, read request */
+		if (req & (1 << 1))
+		{
+			data = swd_rd(32);
+			/* Read parity bit */
+			if (swd_rd(1) != swd_parity(data))
+			{
+				LOG_WARN_PUTS("SWD: Parity error\r\n");
+			}
+			else if (value)
+				*value = data;
+
+			/* Trn cycle to revert initial state */
+			swd_turna(1);
+		}
+		/* Write request */
+		else
+		{
+			if (value)
+				data = *value;
+			else
+				data = 0;
 
-	return (0x6996 >> value) & 1;
+			swd_turna(1);
+			/* Write data to swd bus */
+			swd_wr(data, 32);
+			/* Send parity bit */
+			data = swd_parity(data);
+			swd_wr(data, 1);
+		}
+		/* Idle cycles (SWD-IO low) before next request */
+		if (swd_config.idle_cycles)
+			swd_wr(0, swd_config.idle_cycles);
+		swd_idle();
+	}
+	/* WAIT or FAULT */
+	else if ((ack == 2) || (ack == 4))
+	{
+		/* With overrun detection, the data phase is still expected */
+		if (data_phase && (req & (1 << 1)))
+		{
+			swd_rd(32);
+			swd_rd(1);
+		}
+		/* Trn cycle to revert initial state */
+		swd_turna(1);
+		if (data_phase && ((req & (1 << 1)) == 0))
+		{
+			swd_wr(0, 32);
+			swd_wr(0, 1);
+		}
+		swd_idle();
+	}
+	/* No response (protocol error) */
+	else
+	{
+		/* Back off the data phase, then take the line back */
+		swd_rd(32);
+		swd_rd(1);
+		swd_turna(1);
+		swd_idle();
+	}
+	return(ack);
 }
 /* EOF */
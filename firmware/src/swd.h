@@ -19,17 +19,33 @@
 #define SWD_H
 #include "types.h"
 
+#define SWD_ENGINE_GPIO 0
+#define SWD_ENGINE_PIO  1
+
+/* Max number of pending pipelined transfers */
+#define SWD_PIPE_DEPTH  2
+/* Max number of idle cycles after each pipelined transfer */
+#define SWD_PIPE_IDLE_MAX 32
+
 typedef struct swd_param_s
 {
 	uint retry_count;
+	uint engine;
+	uint turnaround;  /* Turnaround period (1 to 4 clock cycles) */
+	uint data_phase;  /* Data phase on WAIT and FAULT (sticky overrun) */
+	uint idle_cycles; /* Idle cycles after each transfer */
 } swd_param;
 
 extern swd_param swd_config;
 
+void swd_init(void);
+void swd_clock(void);
 int  swd_connect(void);
 int  swd_disconnect(void);
 
 int  swd_transfer(u8 req, u32 *value);
+int  swd_pipe_get(u32 *value);
+void swd_pipe_put(u8 req, u32 value);
 /* Low level SWD functions */
 void swd_idle(void);
 void swd_io_dir(int dir);
@@ -37,4 +53,20 @@ u32  swd_rd(uint len);
 void swd_turna(int dir);
 void swd_wr(u32 value, uint len);
 
+/**
+ * @brief Compute a parity bit
+ *
+ * @param value Input value
+ * @return integer Return 1 for an odd number of '1' into input value
+ */
+static inline uint swd_parity(u32 value)
+{
+	value ^= value >> 16;
+	value ^= value >> 8;
+	value ^= value >> 4;
+	value &= 0x0f;
+
+	return (0x6996 >> value) & 1;
+}
+
 #endif
@@ -0,0 +1,424 @@
+/**
+ * @file  swd_pio.c
+ * @brief Implement SWD protocol using a PIO state machine
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/pio.h"
+#include "ios.h"
+#include "log.h"
+#include "swd.h"
+#include "swd_pio.h"
+#include "swj_clock.h"
+
+#define PIN_SWCLK PORT_D2_PIN
+#define PIN_SWDIR PORT_D1_DIR
+#define PIN_SWDIO PORT_D1_PIN
+
+#if (PIN_SWDIR != (PIN_SWCLK + 1))
+#error "SWD PIO: SWCLK and SWDIO direction pins must be consecutive"
+#endif
+
+static const struct pio_program swd_pio_prog =
+{
+	.instructions = swd_pio_program,
+	.length       = SWD_PIO_LENGTH,
+	.origin       = -1,
+};
+
+static PIO  swd_pio = pio0;
+static int  swd_sm  = -1;
+static uint swd_offset;
+/* Requests of the pending pipelined transfers */
+static u8   swd_pipe_req[SWD_PIPE_DEPTH];
+static uint swd_pipe_wr, swd_pipe_rd;
+
+static inline void _idle(void);
+static inline void _put(uint entry, u32 arg);
+static inline int  _trn_out(void);
+static inline void _wait_idle(void);
+
+/**
+ * @brief Load the SWD program into PIO and take control of SWD pins
+ *
+ * This function must be called after the IOs of the debug port have been
+ * configured in SWD mode (see ios_mode) because the external buffers of
+ * SWD-CLK and SWD-IO are not managed by the PIO program.
+ *
+ * @return integer Zero is returned on success, -1 if no PIO is available
+ */
+int swd_pio_init(void)
+{
+	pio_sm_config c;
+
+	/* If the state machine is already running, nothing to do */
+	if (swd_sm >= 0)
+		return(0);
+
+	if ( ! pio_can_add_program(swd_pio, &swd_pio_prog))
+	{
+		LOG_ERROR_PUTS("SWD: No space for PIO program\r\n");
+		return(-1);
+	}
+	swd_sm = pio_claim_unused_sm(swd_pio, false);
+	if (swd_sm < 0)
+	{
+		LOG_ERROR_PUTS("SWD: No PIO state machine available\r\n");
+		return(-1);
+	}
+	swd_offset = pio_add_program(swd_pio, &swd_pio_prog);
+
+	c = pio_get_default_sm_config();
+	sm_config_set_wrap(&c, swd_offset + SWD_PIO_WRAP_TARGET,
+	                       swd_offset + SWD_PIO_WRAP);
+	sm_config_set_sideset(&c, SWD_PIO_SIDE_BITS, true, false);
+	sm_config_set_sideset_pins(&c, PIN_SWCLK);
+	sm_config_set_out_pins(&c, PIN_SWDIO, 1);
+	sm_config_set_set_pins(&c, PIN_SWDIO, 1);
+	sm_config_set_in_pins (&c, PIN_SWDIO);
+	/* Bits are sent and received LSB first, no auto push/pull */
+	sm_config_set_out_shift(&c, true, false, 32);
+	sm_config_set_in_shift (&c, true, false, 32);
+	/* Two PIO cycles per SWD bit */
+	sm_config_set_clkdiv_int_frac(&c, swj_clk.pio_div >> 8,
+	                                  swj_clk.pio_div & 0xFF);
+
+	/* Initial state : SWCLK high, buffer and SWDIO as output (high) */
+	pio_sm_set_pins_with_mask(swd_pio, swd_sm,
+	        (1u << PIN_SWCLK) | (1u << PIN_SWDIR) | (1u << PIN_SWDIO),
+	        (1u << PIN_SWCLK) | (1u << PIN_SWDIR) | (1u << PIN_SWDIO));
+	pio_sm_set_pindirs_with_mask(swd_pio, swd_sm,
+	        (1u << PIN_SWCLK) | (1u << PIN_SWDIR) | (1u << PIN_SWDIO),
+	        (1u << PIN_SWCLK) | (1u << PIN_SWDIR) | (1u << PIN_SWDIO));
+	pio_gpio_init(swd_pio, PIN_SWCLK);
+	pio_gpio_init(swd_pio, PIN_SWDIR);
+	pio_gpio_init(swd_pio, PIN_SWDIO);
+
+	pio_sm_init(swd_pio, swd_sm, swd_offset + SWD_PIO_WRAP_TARGET, &c);
+	pio_sm_set_enabled(swd_pio, swd_sm, true);
+
+	return(0);
+}
+
+/**
+ * @brief Stop the PIO state machine and give SWD pins back to SIO
+ *
+ */
+void swd_pio_release(void)
+{
+	if (swd_sm < 0)
+		return;
+
+	/* Wait end of the pending commands */
+	_wait_idle();
+
+	pio_sm_set_enabled(swd_pio, swd_sm, false);
+	pio_remove_program(swd_pio, &swd_pio_prog, swd_offset);
+	pio_sm_unclaim(swd_pio, swd_sm);
+	swd_sm = -1;
+
+	/* Restore pins as GPIO (SIO) */
+	gpio_set_function(PIN_SWCLK, GPIO_FUNC_SIO);
+	gpio_set_function(PIN_SWDIR, GPIO_FUNC_SIO);
+	gpio_set_function(PIN_SWDIO, GPIO_FUNC_SIO);
+}
+
+/**
+ * @brief Update the bit rate of a running state machine
+ *
+ * The divider is taken from the SWJ clock module (see swj_clock_set). When
+ * the state machine is not loaded, the new value is used by next init.
+ */
+void swd_pio_clock(void)
+{
+	if (swd_sm < 0)
+		return;
+
+	/* Wait end of the pending commands before changing speed */
+	_wait_idle();
+	pio_sm_set_clkdiv_int_frac(swd_pio, swd_sm, swj_clk.pio_div >> 8,
+	                                            swj_clk.pio_div & 0xFF);
+}
+
+/**
+ * @brief Read bits from SWD port
+ *
+ * @param len Number of bit(s) to read (1 to 32)
+ * @return integer Value of the readed bits
+ */
+u32 swd_pio_rd(uint len)
+{
+	u32 data;
+
+	if ((swd_sm < 0) || (len == 0) || (len > 32))
+		return(0);
+
+	_put(SWD_PIO_RD_BITS, len - 1);
+	data = pio_sm_get_blocking(swd_pio, swd_sm);
+	/* Received bits are aligned on the MSB of the word */
+	return(data >> (32 - len));
+}
+
+/**
+ * @brief Process one SWD transfer on the bus
+ *
+ * Request, turnaround, ACK, data and parity are generated by the PIO. After
+ * the ACK phase the state machine waits for the next command, so the data
+ * phase is only queued when the target has accepted the request. The "hdr"
+ * routine has a single cycle turnaround, longer turnaround periods use the
+ * generic read/write routines.
+ *
+ * @param req Identifier of the SWD request
+ * @param value Value to read or write during transaction
+ * @return integer Value of the ACK bits (1 for success)
+ */
+int swd_pio_transfer(u8 req, u32 *value)
+{
+	uint trn = swd_config.turnaround;
+	u32 data;
+	uint parity;
+	int ack, n;
+
+	if (swd_sm < 0)
+		return(0);
+
+	/* Request : Start, APnDP, RnW, A[2:3], Parity, Stop, Park */
+	data  = ((req & 0x0F) << 1);
+	data |= (swd_parity(data) << 5);
+	data |= 0x81;
+	if (trn <= 1)
+	{
+		_put(SWD_PIO_HDR, data);
+		/* ACK bits are aligned on the MSB of the received word */
+		ack = (pio_sm_get_blocking(swd_pio, swd_sm) >> 29);
+	}
+	else
+	{
+		swd_pio_wr(data, 8);
+		ack = (swd_pio_rd(trn + 3) >> trn);
+	}
+
+	/* If request not accepted, skip data phase and revert line direction */
+	if (ack != 1)
+	{
+		n = 0;
+		/* Data phase of a read (with overrun detection), or back off
+		 * the data phase after a protocol error */
+		if (((ack != 2) && (ack != 4)) ||
+		    (swd_config.data_phase && (req & (1 << 1))))
+		{
+			_put(SWD_PIO_RD_BITS, 31);
+			_put(SWD_PIO_RD_BITS,  0);
+			n = 2;
+		}
+		n += _trn_out();
+		for ( ; n; n--)
+			pio_sm_get_blocking(swd_pio, swd_sm);
+		/* Data phase of a write (with overrun detection) */
+		if (((ack == 2) || (ack == 4)) &&
+		    swd_config.data_phase && ((req & (1 << 1)) == 0))
+		{
+			swd_pio_wr(0, 32);
+			swd_pio_wr(0,  1);
+		}
+		return(ack);
+	}
+
+	/* If RnW bit is set, read request */
+	if (req & (1 << 1))
+	{
+		_put(SWD_PIO_RD_BITS, 31);
+		_put(SWD_PIO_RD_BITS,  0);
+		n = _trn_out();
+		data   = pio_sm_get_blocking(swd_pio, swd_sm);
+		parity = pio_sm_get_blocking(swd_pio, swd_sm) >> 31;
+		if (n)
+			pio_sm_get_blocking(swd_pio, swd_sm);
+		if (parity != swd_parity(data))
+		{
+			LOG_WARN_PUTS("SWD: Parity error\r\n");
+		}
+		else if (value)
+			*value = data;
+	}
+	/* Write request */
+	else
+	{
+		data = value ? *value : 0;
+		if (_trn_out())
+			pio_sm_get_blocking(swd_pio, swd_sm);
+		_put(SWD_PIO_WR_BITS, 31);
+		pio_sm_put_blocking(swd_pio, swd_sm, data);
+		_put(SWD_PIO_WR_BITS,  0);
+		pio_sm_put_blocking(swd_pio, swd_sm, swd_parity(data));
+	}
+	_idle();
+	return(ack);
+}
+
+/**
+ * @brief Queue a complete transfer, whatever the ACK (pipelined mode)
+ *
+ * All the phases (request, ACK, data and parity) are pushed into the TX fifo
+ * at once, so the state machine does not wait for the CPU between the ACK
+ * and the data phase, nor between two transfers. The results are read later
+ * by swd_pio_get(). With SWD_PIPE_DEPTH transfers pending, the RX fifo can
+ * be full during the last one : the state machine stalls on the push of the
+ * read data, and the CPU must still be able to write the end of the
+ * transfer into the TX fifo (parity, turnaround, and one idle command with
+ * its data). So only a single cycle turnaround and SWD_PIPE_IDLE_MAX
+ * idle cycles are supported, the caller must check it.
+ *
+ * @param req   Identifier of the SWD request
+ * @param value Value to write (ignored for a read)
+ */
+void swd_pio_put(u8 req, u32 value)
+{
+	u32 data;
+
+	if (swd_sm < 0)
+		return;
+
+	swd_pipe_req[swd_pipe_wr++ % SWD_PIPE_DEPTH] = req;
+
+	data  = ((req & 0x0F) << 1);
+	data |= (swd_parity(data) << 5);
+	data |= 0x81;
+	_put(SWD_PIO_HDR, data);
+	if (req & (1 << 1))
+	{
+		_put(SWD_PIO_RD_BITS, 31);
+		_put(SWD_PIO_RD_BITS,  0);
+		_put(SWD_PIO_TRN_OUT,  0);
+	}
+	else
+	{
+		_put(SWD_PIO_TRN_OUT,  0);
+		_put(SWD_PIO_WR_BITS, 31);
+		pio_sm_put_blocking(swd_pio, swd_sm, value);
+		_put(SWD_PIO_WR_BITS,  0);
+		pio_sm_put_blocking(swd_pio, swd_sm, swd_parity(value));
+	}
+	_idle();
+}
+
+/**
+ * @brief Get the result of the oldest transfer queued by swd_pio_put
+ *
+ * @param value Pointer where read value is stored (can be null)
+ * @return integer Value of the ACK bits (1 for success)
+ */
+int swd_pio_get(u32 *value)
+{
+	u32 data;
+	uint parity;
+	u8  req;
+	int ack;
+
+	if (swd_sm < 0)
+		return(0);
+
+	req = swd_pipe_req[swd_pipe_rd++ % SWD_PIPE_DEPTH];
+	ack = (pio_sm_get_blocking(swd_pio, swd_sm) >> 29);
+	if (req & (1 << 1))
+	{
+		data   = pio_sm_get_blocking(swd_pio, swd_sm);
+		parity = pio_sm_get_blocking(swd_pio, swd_sm) >> 31;
+		if (ack != 1)
+			return(ack);
+		if (parity != swd_parity(data))
+		{
+			LOG_WARN_PUTS("SWD: Parity error\r\n");
+		}
+		else if (value)
+			*value = data;
+	}
+	return(ack);
+}
+
+/**
+ * @brief Write bits to SWD port
+ *
+ * @param v   Value of the bits to write
+ * @param len Number of bit(s) to write (1 to 32)
+ */
+void swd_pio_wr(u32 value, uint len)
+{
+	if ((swd_sm < 0) || (len == 0) || (len > 32))
+		return;
+
+	_put(SWD_PIO_WR_BITS, len - 1);
+	pio_sm_put_blocking(swd_pio, swd_sm, value);
+}
+
+/**
+ * @brief Send idle cycles (SWDIO low) after a transfer
+ *
+ */
+static inline void _idle(void)
+{
+	uint n, len;
+
+	for (n = swd_config.idle_cycles; n; n -= len)
+	{
+		len = (n > 32) ? 32 : n;
+		swd_pio_wr(0, len);
+	}
+}
+
+/**
+ * @brief Push a command to the PIO state machine
+ *
+ * @param entry Offset of the PIO routine to execute
+ * @param arg   Argument of the routine (bit count or request)
+ */
+static inline void _put(uint entry, u32 arg)
+{
+	pio_sm_put_blocking(swd_pio, swd_sm, SWD_PIO_CMD(swd_offset, entry, arg));
+}
+
+/**
+ * @brief Queue a turnaround to drive SWDIO again
+ *
+ * The "trn_out" routine is a single cycle, extra cycles of a longer
+ * turnaround are queued first as a read (line released).
+ *
+ * @return integer Number of words that the extra cycles push into RX fifo
+ */
+static inline int _trn_out(void)
+{
+	int extra = 0;
+
+	if (swd_config.turnaround > 1)
+	{
+		_put(SWD_PIO_RD_BITS, swd_config.turnaround - 2);
+		extra = 1;
+	}
+	_put(SWD_PIO_TRN_OUT, 0);
+	return(extra);
+}
+
+/**
+ * @brief Wait until all queued commands have been processed
+ *
+ */
+static inline void _wait_idle(void)
+{
+	while ( ! pio_sm_is_tx_fifo_empty(swd_pio, swd_sm))
+		;
+	/* Wait for the state machine to stall on the "start" pull */
+	while (pio_sm_get_pc(swd_pio, swd_sm) != (swd_offset + SWD_PIO_WRAP_TARGET))
+		;
+}
+/* EOF */
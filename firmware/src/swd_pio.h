@@ -0,0 +1,105 @@
+/**
+ * @file  swd_pio.h
+ * @brief Headers and definitions for the PIO based SWD engine
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef SWD_PIO_H
+#define SWD_PIO_H
+#include "types.h"
+
+/*
+ * PIO program used to drive the SWD port. Side-set controls two consecutive
+ * pins : bit0 is SWCLK (PORT_D2_PIN) and bit1 is the direction of the SWDIO
+ * level shifter (PORT_D1_DIR, 1 = probe to target). OUT/SET/IN pins are
+ * mapped on SWDIO (PORT_D1_PIN). Each command pushed into the TX fifo holds
+ * the address of the routine to execute into its 5 lower bits.
+ *
+ * .program swd
+ * .side_set 2 opt
+ *
+ * wr_bits:  out x, 8         side 3 ; Buffer as output first ...
+ *           set pindirs, 1          ; ... then MCU pin
+ *           pull                    ; Get data word
+ * wr_loop:  out pins, 1      side 2 ; Data changes on falling edge
+ *           jmp x-- wr_loop  side 3 ; Target samples on rising edge
+ * .wrap_target
+ * start:    pull
+ *           out pc, 5
+ * rd_bits:  set pindirs, 0          ; Release MCU pin first ...
+ *           out x, 8         side 1 ; ... then buffer as input
+ *           jmp rd_loop
+ * trn_out:  nop              side 2 ; Turnaround, buffer as output first ...
+ *           set pindirs, 1   side 3 ; ... then MCU pin
+ *           jmp start
+ * hdr:      set pindirs, 1   side 3
+ *           set x, 7
+ * h_loop:   out pins, 1      side 2 ; Send the 8 bits of the request
+ *           jmp x-- h_loop   side 3
+ *           set pindirs, 0   side 2 ; Turnaround
+ *           set x, 2         side 1
+ * rd_loop:  in pins, 1       side 0 ; Data sampled on falling edge
+ *           jmp x-- rd_loop  side 1 ; Target shifts on rising edge
+ *           push
+ * .wrap
+ */
+static const u16 swd_pio_program[] =
+{
+	0x7c28, //  0: out    x, 8            side 3
+	0xe081, //  1: set    pindirs, 1
+	0x80a0, //  2: pull   block
+	0x7801, //  3: out    pins, 1         side 2
+	0x1c43, //  4: jmp    x--, 3          side 3
+	0x80a0, //  5: pull   block
+	0x60a5, //  6: out    pc, 5
+	0xe080, //  7: set    pindirs, 0
+	0x7428, //  8: out    x, 8            side 1
+	0x0013, //  9: jmp    19
+	0xb842, // 10: nop                    side 2
+	0xfc81, // 11: set    pindirs, 1      side 3
+	0x0005, // 12: jmp    5
+	0xfc81, // 13: set    pindirs, 1      side 3
+	0xe027, // 14: set    x, 7
+	0x7801, // 15: out    pins, 1         side 2
+	0x1c4f, // 16: jmp    x--, 15         side 3
+	0xf880, // 17: set    pindirs, 0      side 2
+	0xf422, // 18: set    x, 2            side 1
+	0x5001, // 19: in     pins, 1         side 0
+	0x1453, // 20: jmp    x--, 19         side 1
+	0x8020, // 21: push   block
+};
+#define SWD_PIO_LENGTH      (sizeof(swd_pio_program) / sizeof(u16))
+#define SWD_PIO_WRAP_TARGET  5
+#define SWD_PIO_WRAP        21
+/* Side-set configuration : 2 bits + enable */
+#define SWD_PIO_SIDE_BITS    3
+
+/* Entry points of the PIO program (relative to program offset) */
+#define SWD_PIO_WR_BITS  0
+#define SWD_PIO_RD_BITS  7
+#define SWD_PIO_TRN_OUT 10
+#define SWD_PIO_HDR     13
+
+/* Make a command word for the PIO program */
+#define SWD_PIO_CMD(offset, entry, arg) \
+	(((offset) + (entry)) | ((arg) << 5))
+
+void swd_pio_clock(void);
+int  swd_pio_init(void);
+void swd_pio_release(void);
+int  swd_pio_get(u32 *value);
+void swd_pio_put(u8 req, u32 value);
+u32  swd_pio_rd(uint len);
+int  swd_pio_transfer(u8 req, u32 *value);
+void swd_pio_wr(u32 value, uint len);
+
+#endif
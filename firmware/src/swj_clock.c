@@ -0,0 +1,90 @@
+/**
+ * @file  swj_clock.c
+ * @brief Compute timings of SWD and JTAG engines from the requested clock
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "log.h"
+#include "swj_clock.h"
+
+#undef DEBUG_CLOCK
+
+#define CALIB_LOOPS 1024
+
+swj_clock swj_clk;
+
+/**
+ * @brief Initialize the SWJ clock module
+ *
+ * This function measure the real cost of the delay loop used by GPIO engines
+ * (using SysTick as cycle counter) then set the default clock frequency. For
+ * engines to work properly, this function must be called before any SWD or
+ * JTAG transfer.
+ */
+void swj_clock_init(void)
+{
+	u32 t0, t1;
+
+	/* Use SysTick as a free running 24 bits cycle counter */
+	systick_hw->csr = 0;
+	systick_hw->rvr = 0x00FFFFFF;
+	systick_hw->cvr = 0;
+	systick_hw->csr = (1 << 2) | (1 << 0); // CLKSOURCE=cpu, ENABLE
+
+	t0 = systick_hw->cvr;
+	swj_delay(CALIB_LOOPS);
+	t1 = systick_hw->cvr;
+	systick_hw->csr = 0;
+
+	/* SysTick counts down, result in 8.8 fixed point */
+	swj_clk.loop = (((t0 - t1) & 0x00FFFFFF) << 8) / CALIB_LOOPS;
+	if (swj_clk.loop == 0)
+		swj_clk.loop = SWJ_GPIO_LOOP;
+
+#ifdef DEBUG_CLOCK
+	log_puts("SWJ: delay loop = ");
+	log_putdec(swj_clk.loop >> 8);
+	log_puts(" cycles\r\n");
+#endif
+	swj_clock_set(SWJ_CLOCK_DEFAULT);
+}
+
+/**
+ * @brief Set the frequency of SWD/JTAG clock
+ *
+ * This function compute settings of all engines (PIO divider, delay loops)
+ * for the requested frequency. The new settings are used by the next
+ * transfers, a PIO engine already running must be updated by its owner.
+ *
+ * @param freq Requested frequency (Hz)
+ * @return integer Frequency achieved by the PIO engines (Hz)
+ */
+u32 swj_clock_set(u32 freq)
+{
+	u32 sys = clock_get_hz(clk_sys);
+
+	swj_clk.freq      = freq;
+	swj_clk.freq_pio  = swj_clock_pio (sys, freq, &swj_clk.pio_div);
+	swj_clk.freq_gpio = swj_clock_gpio(sys, freq, swj_clk.loop, &swj_clk.delay);
+
+#ifdef DEBUG_CLOCK
+	log_puts("SWJ: clock ");   log_putdec(freq);
+	log_puts(" pio=");         log_putdec(swj_clk.freq_pio);
+	log_puts(" gpio=");        log_putdec(swj_clk.freq_gpio);
+	log_puts("\r\n");
+#endif
+	return(swj_clk.freq_pio);
+}
+/* EOF */
@@ -0,0 +1,124 @@
+/**
+ * @file  swj_clock.h
+ * @brief Headers and definitions for the SWD/JTAG clock module
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef SWJ_CLOCK_H
+#define SWJ_CLOCK_H
+#include "types.h"
+
+#define SWJ_CLOCK_DEFAULT 1000000
+/* Cycles used by GPIO engines for one half period, without delay loop */
+#define SWJ_GPIO_OVERHEAD 20
+/* Default cost of one delay loop (8.8 fixed point) before calibration */
+#define SWJ_GPIO_LOOP     (5 << 8)
+/* Limits of the PIO clock divider (16.8 fixed point) */
+#define SWJ_PIO_DIV_MIN   (1 << 8)
+#define SWJ_PIO_DIV_MAX   ((65536 << 8) - 1)
+
+typedef struct swj_clock_s
+{
+	u32  freq;      /* Requested frequency (Hz) */
+	u32  freq_pio;  /* Frequency achieved by PIO engines */
+	u32  freq_gpio; /* Frequency achieved by GPIO (bit-banging) engines */
+	u32  pio_div;   /* PIO clock divider (16.8 fixed point) */
+	uint delay;     /* Number of delay loops for each half period (GPIO) */
+	u32  loop;      /* Calibrated cost of one delay loop (8.8 fixed point) */
+} swj_clock;
+
+extern swj_clock swj_clk;
+
+void swj_clock_init(void);
+u32  swj_clock_set (u32 freq);
+
+/**
+ * @brief Wait a number of delay loops
+ *
+ * This delay loop is used by GPIO engines to generate half periods of the
+ * SWD/JTAG clock. The cost of one loop is measured by swj_clock_init().
+ *
+ * @param n Number of loops
+ */
+static inline void swj_delay(uint n)
+{
+	for ( ; n; n--)
+		asm volatile("nop");
+}
+
+/**
+ * @brief Compute PIO clock divider for a requested frequency
+ *
+ * PIO engines use two PIO cycles per bit. The divider is rounded up so the
+ * achieved frequency is never above the requested one (except when limited
+ * by the maximum divider value).
+ *
+ * @param sys  Frequency of the system clock (Hz)
+ * @param freq Requested bit rate (Hz)
+ * @param div  Pointer to a variable where divider (16.8) is stored
+ * @return integer Achieved bit rate (Hz)
+ */
+static inline u32 swj_clock_pio(u32 sys, u32 freq, u32 *div)
+{
+	unsigned long long d;
+
+	if (freq == 0)
+		freq = 1;
+	d = ((unsigned long long)sys << 8);
+	d = (d + (2ULL * freq) - 1) / (2ULL * freq);
+	if (d < SWJ_PIO_DIV_MIN)
+		d = SWJ_PIO_DIV_MIN;
+	if (d > SWJ_PIO_DIV_MAX)
+		d = SWJ_PIO_DIV_MAX;
+	if (div)
+		*div = (u32)d;
+
+	return( (u32)(((unsigned long long)sys << 8) / (2ULL * d)) );
+}
+
+/**
+ * @brief Compute delay loops of GPIO engines for a requested frequency
+ *
+ * Each half period costs SWJ_GPIO_OVERHEAD cycles plus "delay" loops. The
+ * number of loops is rounded up so the achieved frequency is never above
+ * the requested one. When the request is above the maximum speed of GPIO
+ * engines, delay is zero and the maximum speed is returned.
+ *
+ * @param sys   Frequency of the system clock (Hz)
+ * @param freq  Requested bit rate (Hz)
+ * @param loop  Cost of one delay loop in cycles (8.8 fixed point)
+ * @param delay Pointer to a variable where number of loops is stored
+ * @return integer Achieved bit rate (Hz)
+ */
+static inline u32 swj_clock_gpio(u32 sys, u32 freq, u32 loop, uint *delay)
+{
+	unsigned long long period, ovh, d;
+
+	if (freq == 0)
+		freq = 1;
+	if (loop == 0)
+		loop = SWJ_GPIO_LOOP;
+	/* Find smallest d where 2 * freq * (ovh + d * loop) >= sys (1/256 cycles) */
+	period = ((unsigned long long)sys << 8);
+	ovh    = (SWJ_GPIO_OVERHEAD << 8);
+	if (period <= (2ULL * freq * ovh))
+		d = 0;
+	else
+		d = (period - (2ULL * freq * ovh) + (2ULL * freq * loop) - 1) /
+		    (2ULL * freq * loop);
+	if (delay)
+		*delay = (uint)d;
+
+	return( (u32)(((unsigned long long)sys << 8) / (2ULL * (ovh + d * loop))) );
+}
+
+#endif
@@ -15,13 +15,16 @@
  */
 #ifndef TYPES_H
 #define TYPES_H
+#include <stdint.h>
 
+/* Fixed size types are based on stdint, so they keep their size when the
+ * code is compiled for a (64 bits) host computer */
 typedef unsigned int   uint;
-typedef unsigned long  u32;
-typedef unsigned short u16;
-typedef unsigned char  u8;
-typedef volatile unsigned long  vu32;
-typedef volatile unsigned short vu16;
-typedef volatile unsigned char  vu8;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t  u8;
+typedef volatile uint32_t vu32;
+typedef volatile uint16_t vu16;
+typedef volatile uint8_t  vu8;
 
 #endif
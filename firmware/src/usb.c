@@ -51,6 +51,10 @@ void usb_task(void)
 	/* Call TinyUSB stack to process events */
 	tud_task();
 	cdc_task();
+#ifdef USE_CMSIS
+	/* Execute received DAP packets */
+	cmsis_task();
+#endif
 }
 
 /* -------------------------------------------------------------------------- */
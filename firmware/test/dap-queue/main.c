@@ -0,0 +1,240 @@
+/**
+ * @file  main.c
+ * @brief Unit-test of the DAP packet queue shared between two cores
+ *
+ * Two threads use the queue (dap_queue.h) like the firmware does : one for
+ * the USB side (core0) that writes requests and reads responses, one for the
+ * DAP engine (core1) that executes requests. The content of each packet and
+ * the owner of each slot are checked by both sides.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "dap_queue.h"
+
+#define PACKETS 200000
+#define TIMEOUT 60
+
+#define OWNER_USB 0
+#define OWNER_DAP 1
+
+static dap_queue q;
+static int owner[DAP_PACKET_COUNT];
+static volatile int done_usb = 0;
+static volatile int done_dap = 0;
+static int err_usb = 0;
+static int err_dap = 0;
+
+/* Length of request and response for a packet sequence number */
+static u16 req_len(uint seq)
+{
+	return( 1 + ((seq * 37) % DAP_PACKET_SIZE) );
+}
+static u16 rsp_len(uint seq)
+{
+	/* Some requests have no response */
+	if ((seq % 7) == 3)
+		return(0);
+	return( 1 + ((seq * 11) % DAP_PACKET_SIZE) );
+}
+
+/**
+ * @brief Test if the packet is a DAP_QueueCommands (executed with the next)
+ *
+ * The last packet is never queued, otherwise it would wait forever.
+ */
+static int is_queued(uint seq)
+{
+	return( ((seq % 5) == 1) && (seq != (PACKETS - 1)) );
+}
+
+/**
+ * @brief Thread that emulates the USB side (core0)
+ *
+ */
+static void *thread_usb(void *arg)
+{
+	uint sent = 0, recv = 0;
+	uint i, seq, len;
+	u8 *p;
+	int slot, full;
+
+	(void)arg;
+
+	while (recv < PACKETS)
+	{
+		/* Write a new request if a slot is free */
+		slot = dap_queue_rx_get(&q);
+		full = (slot < 0) || (sent == PACKETS);
+		if (full)
+			sched_yield();
+		else
+		{
+			if (__atomic_load_n(&owner[slot], __ATOMIC_RELAXED) != OWNER_USB)
+				err_usb++;
+			p = q.req[slot];
+			len = req_len(sent);
+			for (i = 0; i < len; i++)
+				p[i] = (u8)(sent + i);
+			p[0] = is_queued(sent) ? 0x7E : 0x00;
+			dap_queue_rx_put(&q, len);
+			sent++;
+		}
+
+		/* Read the next response if available (not always, to let
+		 * responses accumulate into the queue) */
+		if ( ! full && (sent % 3))
+			continue;
+		slot = dap_queue_tx_get(&q);
+		if (slot >= 0)
+		{
+			if (__atomic_load_n(&owner[slot], __ATOMIC_RELAXED) != OWNER_USB)
+				err_usb++;
+			seq = recv;
+			len = q.rsp_len[slot];
+			if (len != rsp_len(seq))
+				err_usb++;
+			p = q.rsp[slot];
+			for (i = 0; i < len; i++)
+			{
+				if (p[i] != (u8)~(seq + i))
+				{
+					err_usb++;
+					break;
+				}
+			}
+			dap_queue_tx_put(&q);
+			recv++;
+		}
+	}
+	done_usb = 1;
+	return(0);
+}
+
+/**
+ * @brief Thread that emulates the DAP engine (core1)
+ *
+ */
+static void *thread_dap(void *arg)
+{
+	uint exec = 0;
+	uint i, len, first;
+	u8 *p;
+	int slot;
+
+	(void)arg;
+
+	while (exec < PACKETS)
+	{
+		slot = dap_queue_exec_get(&q);
+		if (slot < 0)
+		{
+			sched_yield();
+			continue;
+		}
+		/* Same rule as dap_task() for DAP_QueueCommands */
+		if ((q.req[slot][0] == 0x7E) && (dap_queue_pending(&q) == 1) &&
+		    ! dap_queue_full(&q))
+		{
+			sched_yield();
+			continue;
+		}
+
+		if (__atomic_exchange_n(&owner[slot], OWNER_DAP, __ATOMIC_ACQ_REL) != OWNER_USB)
+			err_dap++;
+
+		/* Check request */
+		p = q.req[slot];
+		len = q.req_len[slot];
+		if (len != req_len(exec))
+			err_dap++;
+		first = is_queued(exec) ? 0x7E : 0x00;
+		if (p[0] != first)
+			err_dap++;
+		for (i = 1; i < len; i++)
+		{
+			if (p[i] != (u8)(exec + i))
+			{
+				err_dap++;
+				break;
+			}
+		}
+		/* Make response */
+		len = rsp_len(exec);
+		for (i = 0; i < len; i++)
+			q.rsp[slot][i] = (u8)~(exec + i);
+
+		__atomic_store_n(&owner[slot], OWNER_USB, __ATOMIC_RELEASE);
+		dap_queue_exec_put(&q, len);
+		exec++;
+	}
+	done_dap = 1;
+	return(0);
+}
+
+/**
+ * @brief Entry point of the program
+ *
+ * @return integer Zero if all tests pass
+ */
+int main(void)
+{
+	pthread_t th_usb, th_dap;
+	struct timespec ts = { 0, 10000000 };
+	int t;
+
+	printf(" - Exchange %d packets between two threads (%d slots)\n",
+	       PACKETS, DAP_PACKET_COUNT);
+
+	dap_queue_init(&q);
+	pthread_create(&th_dap, 0, thread_dap, 0);
+	pthread_create(&th_usb, 0, thread_usb, 0);
+
+	/* Wait end of both threads (or timeout if the queue is locked) */
+	for (t = 0; t < (TIMEOUT * 100); t++)
+	{
+		if (done_usb && done_dap)
+			break;
+		nanosleep(&ts, 0);
+	}
+	if ( ! (done_usb && done_dap))
+	{
+		printf("    \x1b[1;91mFailed\x1b[0m timeout (queue locked ?)"
+		       " rx=%u exec=%u tx=%u\n", q.rx, q.exec, q.tx);
+		return(1);
+	}
+	pthread_join(th_usb, 0);
+	pthread_join(th_dap, 0);
+
+	if (err_usb)
+		printf("    \x1b[1;91mFailed\x1b[0m %d errors on USB side\n", err_usb);
+	if (err_dap)
+		printf("    \x1b[1;91mFailed\x1b[0m %d errors on DAP side\n", err_dap);
+	if ((q.rx != PACKETS) || (q.exec != PACKETS) || (q.tx != PACKETS))
+	{
+		printf("    \x1b[1;91mFailed\x1b[0m bad counters\n");
+		err_usb++;
+	}
+
+	printf("\n Test complete ");
+	if ((err_usb + err_dap) == 0)
+		printf("\x1b[1;92m0 error\x1b[0m\n");
+	else
+		printf("\x1b[1;91m%d errors\x1b[0m\n", err_usb + err_dap);
+
+	return((err_usb + err_dap) ? 1 : 0);
+}
+/* EOF */
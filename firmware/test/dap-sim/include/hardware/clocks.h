@@ -0,0 +1,27 @@
+/**
+ * @file  clocks.h
+ * @brief Host replacement of the pico-sdk "hardware/clocks.h" header
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef HARDWARE_CLOCKS_H
+#define HARDWARE_CLOCKS_H
+#include <stdint.h>
+
+enum clock_index
+{
+	clk_sys = 5,
+};
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * @file  systick.h
+ * @brief Host replacement of the pico-sdk "hardware/structs/systick.h" header
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef HARDWARE_STRUCTS_SYSTICK_H
+#define HARDWARE_STRUCTS_SYSTICK_H
+#include <stdint.h>
+
+typedef struct
+{
+	volatile uint32_t csr;
+	volatile uint32_t rvr;
+	volatile uint32_t cvr;
+	volatile uint32_t calib;
+} systick_hw_t;
+
+/* SysTick is a simple variable, it never counts */
+extern systick_hw_t sim_systick;
+#define systick_hw (&sim_systick)
+
+#endif
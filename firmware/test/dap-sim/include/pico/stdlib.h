@@ -0,0 +1,29 @@
+/**
+ * @file  stdlib.h
+ * @brief Host replacement of the pico-sdk "pico/stdlib.h" header
+ *
+ * Only the types and functions used by the DAP engine are declared here,
+ * any SDK function used by a module compiled for host must be simulated.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef PICO_STDLIB_H
+#define PICO_STDLIB_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "types.h"
+
+void busy_wait_us_32(uint32_t delay_us);
+
+#endif
@@ -0,0 +1,2458 @@
+/**
+ * @file  main.c
+ * @brief Regression tests and benchmark of the DAP engine on host
+ *
+ * The DAP engine of the firmware (dap.c, swd.c, jtag.c) is compiled for host
+ * with simulated IOs connected to a bit-level model of a SWD target. DAP
+ * packets are given to dap_recv() like the USB side of the firmware does,
+ * and responses are checked against the content of the target model.
+ *
+ * With "-s <path>" the simulated probe is served on a local socket, so host
+ * tools (ut-cmsis bench) can be run without hardware. With "-f <file>" a SVF
+ * file is played by the probe against the simulated TAP (one JTAG-DP).
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "dap.h"
+#include "ios.h"
+#include "jtag.h"
+#include "jtag_dmi.h"
+#include "sim.h"
+#include "swd.h"
+#include "swj_clock.h"
+
+#define BENCH_LOOPS 2000
+
+/* DAP_Transfer request bits */
+#define DP      0x00
+#define AP      0x01
+#define RD      0x02
+#define WR      0x00
+#define A(x)    ((x) & 0x0C)
+#define MATCH   0x10
+#define MASK    0x20
+
+static u8  rsp[DAP_PACKET_SIZE];
+static int rsp_len;
+/* Parts of a long response (before the last one, into rsp) */
+static u8  stream[80 * 1024];
+static int stream_len;
+static int stream_sock = -1;
+static int err = 0;
+static unsigned long contention = 0;
+/* DAP index used by transfers (device of the JTAG scan chain) */
+static u8  xfer_index = 0;
+
+static void check(int cond, const char *msg)
+{
+	if (cond)
+		return;
+	printf("    \x1b[1;91mFailed\x1b[0m %s\n", msg);
+	err++;
+}
+
+static u32 get32(const u8 *p)
+{
+	return((u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24));
+}
+
+static u8 *put32(u8 *p, u32 v)
+{
+	*p++ = (v >>  0) & 0xFF;
+	*p++ = (v >>  8) & 0xFF;
+	*p++ = (v >> 16) & 0xFF;
+	*p++ = (v >> 24) & 0xFF;
+	return(p);
+}
+
+/**
+ * @brief Receive a part of a long response from the DAP engine
+ *
+ * @param pkt Pointer to the response (a full packet)
+ * @return integer Zero on success, -1 for error
+ */
+static int sim_stream(cmsis_pkt *pkt)
+{
+	if (stream_sock >= 0)
+		send(stream_sock, pkt->buffer, pkt->len, 0);
+	else if ((stream_len + pkt->len) <= (int)sizeof(stream))
+	{
+		memcpy(stream + stream_len, pkt->buffer, pkt->len);
+		stream_len += pkt->len;
+	}
+	else
+		return(-1);
+	pkt->len = 0;
+	return(0);
+}
+
+/**
+ * @brief Execute one DAP packet
+ *
+ * @param data Content of the request
+ * @param len  Length of the request
+ * @return integer Length of the response
+ */
+static int dap(const u8 *data, uint len)
+{
+	u8 buffer[DAP_PACKET_SIZE];
+	cmsis_pkt req, res;
+
+	memset(buffer, 0, sizeof(buffer));
+	memcpy(buffer, data, len);
+	req.buffer = buffer;
+	req.len    = len;
+	req.stream = 0;
+	res.buffer = rsp;
+	res.len    = 0;
+	res.stream = sim_stream;
+	stream_len = 0;
+	rsp_len = dap_recv(&req, &res);
+	return(rsp_len);
+}
+
+/**
+ * @brief Execute a command, then DAP_Info, with DAP_ExecuteCommands
+ *
+ * A command that does not report the exact length of its request makes the
+ * next command of the list lost.
+ *
+ * @param data Content of the command
+ * @param len  Length of the command
+ * @return integer Length of the response of the command, -1 if the next
+ *         command has not been executed
+ */
+static int dap_exec(const u8 *data, uint len)
+{
+	u8 pkt[DAP_PACKET_SIZE];
+
+	pkt[0] = 0x7F;
+	pkt[1] = 2;
+	memcpy(pkt + 2, data, len);
+	/* DAP_Info : packet count */
+	pkt[2 + len] = 0x00;
+	pkt[3 + len] = 0xFE;
+	dap(pkt, len + 4);
+	if ((rsp_len < 5) || (rsp[1] != 2) || (rsp[rsp_len - 3] != 0x00) ||
+	    (rsp[rsp_len - 2] != 1) || (rsp[rsp_len - 1] != DAP_PACKET_COUNT))
+		return(-1);
+	return(rsp_len - 5);
+}
+
+/**
+ * @brief Execute a single DAP_Transfer
+ *
+ * @param request Transfer request (APnDP, RnW, A[3:2])
+ * @param value   Value to write, or pointer where read value is stored
+ * @return integer ACK of the transfer
+ */
+static int transfer(u8 request, u32 *value)
+{
+	u8 pkt[8] = { 0x05, xfer_index, 0x01, request };
+	uint len = 4;
+
+	if ((request & RD) == 0)
+	{
+		put32(pkt + 4, *value);
+		len += 4;
+	}
+	dap(pkt, len);
+	if ((rsp[2] == 1) && (request & RD) && value)
+		*value = get32(rsp + 3);
+	return(rsp[2]);
+}
+
+static int wr(u8 request, u32 value)
+{
+	return(transfer(request, &value));
+}
+
+/**
+ * @brief Send a SWD line reset followed by the JTAG-to-SWD sequence
+ *
+ */
+static void line_reset(void)
+{
+	const u8 ones[]  = { 0x12, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	const u8 j2s[]   = { 0x12, 16, 0x9E, 0xE7 };
+	const u8 idle[]  = { 0x12,  8, 0x00 };
+
+	dap(ones, sizeof(ones));
+	dap(j2s,  sizeof(j2s));
+	dap(ones, sizeof(ones));
+	dap(idle, sizeof(idle));
+}
+
+/**
+ * @brief Read or write a block of words with DAP_TransferBlock
+ *
+ * @param request Transfer request (APnDP, RnW, A[3:2])
+ * @param data    Buffer of words (read or written)
+ * @param count   Number of words
+ * @return integer ACK of the last transfer
+ */
+static int block(u8 request, u32 *data, uint count)
+{
+	u8 pkt[DAP_PACKET_SIZE];
+	u8 *p = pkt + 5;
+	uint i;
+
+	pkt[0] = 0x06;
+	pkt[1] = xfer_index;
+	pkt[2] = (count >> 0) & 0xFF;
+	pkt[3] = (count >> 8) & 0xFF;
+	pkt[4] = request;
+	if ((request & RD) == 0)
+		for (i = 0; i < count; i++)
+			p = put32(p, data[i]);
+	dap(pkt, p - pkt);
+
+	if (request & RD)
+		for (i = 0; (i < count) && ((4 + (i * 4)) < (uint)rsp_len); i++)
+			data[i] = get32(rsp + 4 + (i * 4));
+	return(rsp[3]);
+}
+
+/**
+ * @brief Connect to the target and power-up the debug domain
+ *
+ */
+static void swd_setup(void)
+{
+	const u8 conn[] = { 0x02, 0x01 };
+	const u8 conf[] = { 0x04, 0x00, 16, 0x00, 0x00, 0x00 };
+	u32 v = 0;
+
+	dap(conn, sizeof(conn));
+	check((rsp_len == 2) && (rsp[1] == 1), "DAP_Connect SWD");
+	dap(conf, sizeof(conf));
+	check((rsp_len == 2) && (rsp[1] == 0), "DAP_TransferConfigure");
+
+	line_reset();
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read failed");
+	check(v == SIM_DPIDR, "bad DPIDR value");
+	wr(DP | WR | A(0x0), 0x1E);
+	wr(DP | WR | A(0x4), 0x50000000);
+	check(transfer(DP | RD | A(0x4), &v) == 1, "CTRL/STAT read failed");
+	check((v & 0xF0000000) == 0xF0000000, "debug power-up not acknowledged");
+}
+
+static void test_info(void)
+{
+	const u8 info_size[]  = { 0x00, 0xFF };
+	const u8 info_count[] = { 0x00, 0xFE };
+
+	printf(" - DAP_Info\n");
+	dap(info_size, sizeof(info_size));
+	check((rsp[1] == 2) && ((rsp[2] | (rsp[3] << 8)) == DAP_PACKET_SIZE),
+	      "bad packet size");
+	dap(info_count, sizeof(info_count));
+	check((rsp[1] == 1) && (rsp[2] == DAP_PACKET_COUNT), "bad packet count");
+}
+
+static void test_connect(void)
+{
+	u32 v = 0;
+
+	printf(" - Line reset and connection\n");
+	swd_setup();
+	check(sim_tgt.resets == 2, "line reset not detected");
+	/* PIO failed at first connect : GPIO for this session only */
+	check(sim_st.swd_pio_init == 1, "PIO engine not tried on connect");
+	swd_setup();
+	check(sim_st.swd_pio_init == 2, "PIO engine not tried again on connect");
+
+	/* After a line reset, target only answer to DPIDR read. Without
+	 * response (protocol error), the host must send a new line reset */
+	line_reset();
+	check(transfer(DP | RD | A(0x4), &v) == 7, "target locked must not respond");
+	line_reset();
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read after lock failed");
+	check(transfer(DP | RD | A(0x4), &v) == 1, "CTRL/STAT read after unlock");
+}
+
+static void test_ap(void)
+{
+	u8  pkt[80], *p;
+	u32 v = 0;
+	unsigned long n;
+
+	printf(" - AP registers (posted reads)\n");
+	wr(DP | WR | A(0x8), 0x000000F0);
+	check(transfer(AP | RD | A(0xC), &v) == 1, "IDR read failed");
+	check(v == SIM_AP_IDR, "bad IDR value");
+	wr(DP | WR | A(0x8), 0x00000000);
+
+	/* Mix of DP and AP reads into one DAP_Transfer */
+	p = pkt;
+	*p++ = 0x05; *p++ = 0x00; *p++ = 4;
+	*p++ = AP | WR | A(0x4); p = put32(p, 0x20000010);
+	*p++ = AP | RD | A(0x4);
+	*p++ = AP | RD | A(0x0);
+	*p++ = DP | RD | A(0x0);
+	dap(pkt, p - pkt);
+	check((rsp[1] == 4) && (rsp[2] == 1), "multiple transfers failed");
+	check(rsp_len == (3 + 12), "bad response length for 3 reads");
+	check(get32(rsp + 3) == 0x20000010, "TAR read back");
+	check((get32(rsp + 7) & 0x3F) == 0x02, "CSW read back");
+	check(get32(rsp + 11) == SIM_DPIDR, "DPIDR after AP reads");
+
+	/* Truncated request : nothing is done */
+	n = sim_st.clocks;
+	p = pkt;
+	*p++ = 0x05; *p++ = 0x00; *p++ = 2;
+	*p++ = AP | WR | A(0x4); p = put32(p, 0x20000100);
+	*p++ = AP | WR | A(0x4);
+	dap(pkt, (p - pkt) + 2);
+	check((rsp_len == 3) && (rsp[1] == 0) && (rsp[2] == 0) && (sim_st.clocks == n),
+	      "truncated transfer must fail");
+	pkt[2] = 3;
+	dap(pkt, p - pkt);
+	check((rsp_len == 3) && (rsp[1] == 0) && (sim_st.clocks == n),
+	      "missing transfer must fail");
+	/* Response larger than a packet */
+	memset(pkt + 3, DP | RD | A(0x0), 64);
+	pkt[2] = 64;
+	dap(pkt, 3 + 64);
+	check((rsp_len == 3) && (rsp[1] == 0) && (sim_st.clocks == n),
+	      "too many reads must fail");
+	check((transfer(AP | RD | A(0x4), &v) == 1) && (v == 0x20000010),
+	      "TAR modified by an invalid request");
+}
+
+static void test_memory(void)
+{
+	/* Largest blocks that fit into one packet */
+	const uint wr_max = (DAP_PACKET_SIZE - 5) / 4;
+	const uint rd_max = (DAP_PACKET_SIZE - 4) / 4;
+	u32 out[64], in[100], v;
+	uint i;
+
+	printf(" - Memory access with TransferBlock\n");
+	for (i = 0; i < 64; i++)
+		out[i] = 0x11111111 * (i & 0xF) + (i << 24);
+
+	wr(AP | WR | A(0x0), 0x23000012);
+	wr(AP | WR | A(0x4), 0x20000100);
+	check(block(AP | WR | A(0xC), out, wr_max) == 1, "block write failed");
+	check((rsp[1] | (rsp[2] << 8)) == wr_max, "block write count");
+	check(memcmp(sim_tgt.ram + 0x100, out, wr_max * 4) == 0, "RAM content");
+
+	memcpy(sim_tgt.ram + 0x100, out, sizeof(out));
+	memset(in, 0, sizeof(in));
+	wr(AP | WR | A(0x4), 0x20000100);
+	check(block(AP | RD | A(0xC), in, rd_max) == 1, "block read failed");
+	check((rsp[1] | (rsp[2] << 8)) == rd_max, "block read count");
+	check(memcmp(in, out, rd_max * 4) == 0, "block read content");
+
+	/* Read count is limited by the size of the response */
+	wr(AP | WR | A(0x4), 0x20000100);
+	check(block(AP | RD | A(0xC), in, 100) == 1, "long block read failed");
+	check((rsp[1] | (rsp[2] << 8)) == rd_max, "long block read count");
+	check(sim_tgt.tar == (0x20000100 + (rd_max * 4)), "long block read TAR");
+
+	/* Byte access uses byte lanes */
+	wr(AP | WR | A(0x0), 0x23000000);
+	wr(AP | WR | A(0x4), 0x20000101);
+	wr(AP | WR | A(0xC), 0x0000AB00);
+	check((sim_tgt.ram[0x100] == (out[0] & 0xFF)) && (sim_tgt.ram[0x101] == 0xAB),
+	      "byte write");
+
+	/* Auto-increment wraps on 1KB boundaries */
+	wr(AP | WR | A(0x0), 0x23000012);
+	wr(AP | WR | A(0x4), 0x200003FC);
+	wr(AP | WR | A(0xC), 0xCAFE0001);
+	wr(AP | WR | A(0xC), 0xCAFE0002);
+	memcpy(&v, sim_tgt.ram, 4);
+	check(v == 0xCAFE0002, "TAR must wrap on 1KB boundary");
+}
+
+static void test_wait(void)
+{
+	u32 v = 0;
+
+	printf(" - WAIT responses\n");
+	sim_tgt.ack_wait = 0;
+	sim_tgt.wait = 5;
+	check(transfer(AP | RD | A(0x4), &v) == 1, "transfer with 5 WAIT failed");
+	check(sim_tgt.ack_wait == 5, "WAIT not received");
+
+	/* More WAIT than retry count (16) */
+	sim_tgt.wait = 100;
+	check(transfer(AP | RD | A(0x4), &v) == 2, "WAIT must be reported");
+	sim_tgt.wait = 0;
+	check(transfer(AP | RD | A(0x4), &v) == 1, "no recovery after WAIT");
+}
+
+static void test_fault(void)
+{
+	u32 data[16];
+	u32 v = 0;
+
+	printf(" - FAULT responses\n");
+	/* Read from an unmapped address : bus error */
+	wr(AP | WR | A(0x4), 0x10000000);
+	check(transfer(AP | RD | A(0xC), &v) == 4, "bus error not reported");
+	check(transfer(DP | RD | A(0x4), &v) == 1, "CTRL/STAT read with sticky");
+	check(v & SIM_STICKYERR, "STICKYERR not set");
+	check(transfer(AP | RD | A(0x0), &v) == 4, "AP access allowed with sticky");
+	wr(DP | WR | A(0x0), 0x04);
+	check(transfer(AP | RD | A(0x0), &v) == 1, "no recovery after ABORT");
+
+	/* Bus error in the middle of a block */
+	wr(AP | WR | A(0x4), 0x20000000);
+	sim_tgt.fault_at = 6;
+	check(block(AP | RD | A(0xC), data, 16) == 4, "block fault not reported");
+	check((rsp[1] | (rsp[2] << 8)) < 16, "block count after fault");
+	wr(DP | WR | A(0x0), 0x04);
+	check(transfer(DP | RD | A(0x0), &v) == 1, "no recovery after block fault");
+}
+
+static void test_match(void)
+{
+	const u8 conf[] = { 0x04, 0x00, 16, 0x00, 100, 0x00 };
+	u8  pkt[32], *p;
+	uint n;
+
+	printf(" - Value match and match mask\n");
+	dap(conf, sizeof(conf));
+	memset(sim_tgt.ram, 0, 4);
+	wr(AP | WR | A(0x0), 0x23000002);
+	wr(AP | WR | A(0x4), 0x20000000);
+
+	/* Poll a busy flag : the probe spins until bit 0 is clear */
+	sim_tgt.busy = 20;
+	n = sim_tgt.mem_access;
+	p = pkt;
+	*p++ = 0x05; *p++ = 0x00; *p++ = 3;
+	*p++ = DP | WR | MASK;  p = put32(p, 0x00000001);
+	*p++ = AP | RD | MATCH | A(0xC); p = put32(p, 0x00000000);
+	*p++ = DP | RD | A(0x0);
+	dap(pkt, p - pkt);
+	check((rsp[1] == 3) && (rsp[2] == 1), "match read failed");
+	check(rsp_len == (3 + 4), "match value must not be returned");
+	check(get32(rsp + 3) == SIM_DPIDR, "read after match");
+	check(sim_tgt.busy == 0, "busy flag not polled");
+	check((sim_tgt.mem_access - n) <= 22, "too many reads for match");
+
+	/* Value never matches : mismatch after RetryMatch reads */
+	sim_tgt.busy = 1000;
+	n = sim_tgt.mem_access;
+	p = pkt;
+	*p++ = 0x05; *p++ = 0x00; *p++ = 2;
+	*p++ = AP | RD | MATCH | A(0xC); p = put32(p, 0x00000000);
+	*p++ = DP | RD | A(0x0);
+	dap(pkt, p - pkt);
+	check((rsp[1] == 0) && (rsp[2] == 0x11), "mismatch not reported");
+	check((sim_tgt.mem_access - n) == (1 + 1 + 100), "RetryMatch count");
+	sim_tgt.busy = 0;
+
+	/* DP register match, mask is kept between commands */
+	wr(DP | WR | MASK, 0xF0000000);
+	p = pkt;
+	*p++ = 0x05; *p++ = 0x00; *p++ = 1;
+	*p++ = DP | RD | MATCH | A(0x4); p = put32(p, 0xF0000000);
+	dap(pkt, p - pkt);
+	check((rsp[1] == 1) && (rsp[2] == 1), "CTRL/STAT match failed");
+	dap(conf, sizeof(conf));
+}
+
+static void test_swd_config(void)
+{
+	const u8 conf_idle[] = { 0x04, 8, 16, 0x00, 0x00, 0x00 };
+	const u8 conf[]      = { 0x04, 0, 16, 0x00, 0x00, 0x00 };
+	const u8 swd_trn2[]  = { 0x13, 0x01 };
+	const u8 swd_dp[]    = { 0x13, 0x05 };
+	const u8 swd_def[]   = { 0x13, 0x00 };
+	u32 data[8], v = 0;
+	unsigned long clocks, cont;
+	uint n;
+
+	printf(" - Idle cycles, turnaround and data phase\n");
+	/* Idle cycles are added after each transfer */
+	dap(conf_idle, sizeof(conf_idle));
+	clocks = sim_st.clocks;
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read with idle cycles");
+	check((sim_st.clocks - clocks) == (46 + 8), "bad number of idle cycles");
+	dap(conf, sizeof(conf));
+
+	/* Turnaround of 2 cycles (DLCR), configured on both sides. The check
+	 * of the DLCR write (RDBUFF read) already uses the new turnaround, so
+	 * the host re-synchronizes with a line reset (contention during the
+	 * mismatch is expected) */
+	wr(DP | WR | A(0x8), 0x00000001);
+	cont = sim_st.contention;
+	wr(DP | WR | A(0x4), 0x00000100);
+	dap(swd_trn2, sizeof(swd_trn2));
+	line_reset();
+	sim_st.contention = cont;
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read after DLCR write");
+	n = sim_tgt.proto_err;
+	check(transfer(DP | RD | A(0x4), &v) == 1, "DLCR read with turnaround 2");
+	check(v == 0x00000100, "bad DLCR value");
+	wr(DP | WR | A(0x8), 0x00000000);
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read with turnaround 2");
+	check(v == SIM_DPIDR, "bad DPIDR with turnaround 2");
+	wr(AP | WR | A(0x0), 0x23000012);
+	wr(AP | WR | A(0x4), 0x20000200);
+	for (v = 0; v < 8; v++)
+		data[v] = 0x5A000000 | v;
+	check(block(AP | WR | A(0xC), data, 8) == 1, "block write with turnaround 2");
+	check(memcmp(sim_tgt.ram + 0x200, data, 32) == 0, "RAM with turnaround 2");
+
+	/* Data phase after WAIT, with overrun detection enabled */
+	wr(DP | WR | A(0x4), 0x50000001);
+	dap(swd_dp, sizeof(swd_dp));
+	/* WAIT sets STICKYORUN, so the retry is a FAULT */
+	sim_tgt.wait = 1;
+	check(transfer(AP | RD | A(0x4), &v) == 4, "overrun on read not reported");
+	check(transfer(DP | RD | A(0x4), &v) == 1, "CTRL/STAT read after overrun");
+	check(v & SIM_STICKYORUN, "STICKYORUN not set");
+	wr(DP | WR | A(0x0), 0x10);
+	sim_tgt.wait = 1;
+	check(wr(AP | WR | A(0x4), 0x20000200) == 4, "overrun on write not reported");
+	wr(DP | WR | A(0x0), 0x10);
+	check(transfer(DP | RD | A(0x0), &v) == 1, "no recovery after data phase");
+	check(sim_tgt.proto_err == n, "protocol error with turnaround/data phase");
+
+	/* Back to default configuration */
+	wr(DP | WR | A(0x4), 0x50000000);
+	wr(DP | WR | A(0x8), 0x00000001);
+	cont = sim_st.contention;
+	wr(DP | WR | A(0x4), 0x00000000);
+	dap(swd_def, sizeof(swd_def));
+	line_reset();
+	sim_st.contention = cont;
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read after DLCR reset");
+	wr(DP | WR | A(0x8), 0x00000000);
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read after restore");
+}
+
+/**
+ * @brief Run a packet in normal and pipelined modes, and compare results
+ *
+ * @param name   Name of the error injected
+ * @param pkt    Request to test
+ * @param len    Length of the request
+ * @param inject Error to inject (0:none 1:WAIT 2:bus fault)
+ */
+static void pipe_compare(const char *name, const u8 *pkt, uint len, int inject)
+{
+	const u8 mode[2][3] = { { 0x80, 0x01, 0x00 }, { 0x80, 0x01, 0x01 } };
+	u8  ref[DAP_PACKET_SIZE], ram[0x400];
+	int ref_len = 0;
+	uint requests[2], faults[2];
+	u32 v = 0;
+	int m;
+
+	for (m = 0; m < 2; m++)
+	{
+		dap(mode[m], sizeof(mode[m]));
+		check((rsp_len == 2) && (rsp[1] == 0), "vendor config");
+		memset(sim_tgt.ram, 0, 0x400);
+		if (inject == 1)
+		{
+			sim_tgt.wait    = 3;
+			sim_tgt.wait_at = 12;
+		}
+		else if (inject == 2)
+			sim_tgt.fault_at = 30;
+
+		requests[m] = sim_tgt.requests;
+		faults[m]   = sim_tgt.ack_fault;
+		dap(pkt, len);
+		requests[m] = sim_tgt.requests - requests[m];
+		faults[m]   = sim_tgt.ack_fault - faults[m];
+		sim_tgt.wait     = 0;
+		sim_tgt.wait_at  = 0;
+		sim_tgt.fault_at = 0;
+
+		if (m == 0)
+		{
+			memcpy(ref, rsp, rsp_len);
+			memcpy(ram, sim_tgt.ram, sizeof(ram));
+			ref_len = rsp_len;
+		}
+		else
+		{
+			check((rsp_len == ref_len) && (memcmp(rsp, ref, rsp_len) == 0), name);
+			check(memcmp(ram, sim_tgt.ram, sizeof(ram)) == 0, name);
+		}
+		/* Clear errors, then check that ORUNDETECT has been restored */
+		wr(DP | WR | A(0x0), 0x1E);
+		check(transfer(DP | RD | A(0x4), &v) == 1, "CTRL/STAT read after pipe");
+		check((v & (SIM_ORUNDETECT | SIM_STICKY)) == 0, "CTRL/STAT not restored");
+	}
+	/* Pipelined mode has been used, and target ignored requests after error */
+	check(requests[1] > requests[0], "pipelined mode not used");
+	if (inject)
+		check(faults[1] > faults[0], "no overrun in pipelined mode");
+}
+
+static void test_pipe(void)
+{
+	const u8 orun_off[] = { 0x80, 0x01, 0x00 };
+	const u8 orun_mode[2][3] = { { 0x80, 0x01, 0x00 }, { 0x80, 0x01, 0x01 } };
+	const u8 idle_long[] = { 0x04, SWD_PIPE_IDLE_MAX + 1, 16, 0x00, 0x00, 0x00 };
+	const u8 idle_none[] = { 0x04, 0x00, 16, 0x00, 0x00, 0x00 };
+	u8  pkt[DAP_PACKET_SIZE], *p;
+	uint requests[2];
+	uint i;
+
+	printf(" - Pipelined transfers (sticky overrun)\n");
+	/* SELECT must be known to use pipelined mode */
+	wr(DP | WR | A(0x8), 0x00000000);
+	wr(AP | WR | A(0x0), 0x23000012);
+
+	/* Writes, then posted reads of the same words */
+	p = pkt;
+	*p++ = 0x05; *p++ = 0x00; *p++ = 2 + 20 + 1 + 20 + 1;
+	*p++ = AP | WR | A(0x4); p = put32(p, 0x20000000);
+	for (i = 0; i < 20; i++)
+	{
+		*p++ = AP | WR | A(0xC);
+		p = put32(p, 0xA5000000 | (i * 0x010101));
+	}
+	*p++ = DP | RD | A(0x0);
+	*p++ = AP | WR | A(0x4); p = put32(p, 0x20000000);
+	for (i = 0; i < 20; i++)
+		*p++ = AP | RD | A(0xC);
+	*p++ = DP | RD | A(0x0);
+
+	pipe_compare("pipelined transfers",            pkt, p - pkt, 0);
+	pipe_compare("pipelined transfers with WAIT",  pkt, p - pkt, 1);
+	pipe_compare("pipelined transfers with FAULT", pkt, p - pkt, 2);
+
+	/* PIO engine can not pipeline more than SWD_PIPE_IDLE_MAX idle cycles */
+	dap(idle_long, sizeof(idle_long));
+	for (i = 0; i < 2; i++)
+	{
+		dap(orun_mode[i], sizeof(orun_mode[i]));
+		requests[i] = sim_tgt.requests;
+		dap(pkt, p - pkt);
+		requests[i] = sim_tgt.requests - requests[i];
+		check((rsp[1] == pkt[2]) && (rsp[2] == 1), "transfers with idle cycles");
+	}
+	check(requests[0] == requests[1], "pipelined mode used with long idle");
+	dap(idle_none, sizeof(idle_none));
+
+	dap(orun_off, sizeof(orun_off));
+}
+
+/**
+ * @brief Get (and clear) the counters of the register cache
+ *
+ * @param hit  Pointer where number of skipped writes is stored
+ * @param miss Pointer where number of writes sent is stored
+ */
+static void cache_stats(u32 *hit, u32 *miss)
+{
+	const u8 stats[] = { 0x81, 0x01 };
+
+	dap(stats, sizeof(stats));
+	check((rsp_len == 10) && (rsp[1] == 0), "vendor statistics");
+	*hit  = get32(rsp + 2);
+	*miss = get32(rsp + 6);
+}
+
+/**
+ * @brief Write two words with SELECT, CSW and TAR set before (like hosts do)
+ *
+ * @param addr Address of the first word
+ * @param csw  Value of CSW
+ * @return integer Number of SWD requests received by target
+ */
+static uint cache_write(u32 addr, u32 csw)
+{
+	u8 pkt[64], *p = pkt;
+	uint requests = sim_tgt.requests;
+
+	*p++ = 0x05; *p++ = 0x00; *p++ = 5;
+	*p++ = DP | WR | A(0x8); p = put32(p, 0x00000000);
+	*p++ = AP | WR | A(0x0); p = put32(p, csw);
+	*p++ = AP | WR | A(0x4); p = put32(p, addr);
+	*p++ = AP | WR | A(0xC); p = put32(p, addr ^ 0x55555555);
+	*p++ = AP | WR | A(0xC); p = put32(p, addr ^ 0xAAAAAAAA);
+	dap(pkt, p - pkt);
+	check((rsp[1] == 5) && (rsp[2] == 1), "cached write failed");
+	return(sim_tgt.requests - requests);
+}
+
+static void test_cache(void)
+{
+	const u8 cache_off[] = { 0x80, 0x02, 0x00 };
+	const u8 cache_on[]  = { 0x80, 0x02, 0x01 };
+	u32 hit, miss, v = 0;
+	u32 data[8];
+	uint n;
+
+	printf(" - Cache of SELECT, CSW and TAR\n");
+	line_reset();
+	transfer(DP | RD | A(0x0), &v);
+	cache_stats(&hit, &miss);
+
+	/* SELECT and CSW are skipped, TAR follows auto-increment */
+	check(cache_write(0x20000200, 0x23000012) == 6, "first write");
+	n = cache_write(0x20000208, 0x23000012);
+	check(n == 3, "SELECT, CSW and TAR writes not skipped");
+	memcpy(&v, sim_tgt.ram + 0x20C, 4);
+	check(v == (0x20000208 ^ 0xAAAAAAAA), "RAM content with cache");
+	cache_stats(&hit, &miss);
+	check((hit == 3) && (miss == 3), "cache counters");
+
+	/* A new value of TAR is written */
+	check(cache_write(0x20000300, 0x23000012) == 4, "TAR must be written");
+	/* TAR is unknown after the end of a 1KB block */
+	cache_write(0x200003F8, 0x23000012);
+	check(cache_write(0x20000400, 0x23000012) == 4, "TAR after 1KB block");
+	check(sim_tgt.tar == 0x20000408, "bad TAR after 1KB block");
+	/* TAR is unknown after byte accesses */
+	cache_write(0x20000200, 0x23000010);
+	check(cache_write(0x20000208, 0x23000012) == 5, "TAR after byte access");
+	memcpy(&v, sim_tgt.ram + 0x208, 4);
+	check(v == (0x20000208 ^ 0x55555555), "RAM content after byte access");
+
+	/* Block read of DRW updates TAR */
+	cache_write(0x20000000, 0x23000012);
+	wr(AP | WR | A(0x4), 0x20000000);
+	check(block(AP | RD | A(0xC), data, 8) == 1, "block read");
+	cache_stats(&hit, &miss);
+	wr(AP | WR | A(0x4), 0x20000020);
+	wr(AP | WR | A(0x4), 0x20000000);
+	cache_stats(&hit, &miss);
+	check((hit == 1) && (miss == 1), "TAR after block read");
+	check(transfer(AP | RD | A(0x4), &v) == 1, "TAR read");
+	check(v == 0x20000000, "TAR must be written");
+
+	/* After an error, CSW and TAR are unknown but SELECT is kept */
+	wr(AP | WR | A(0x4), 0x10000000);
+	check(transfer(AP | RD | A(0xC), &v) == 4, "bus error not reported");
+	wr(DP | WR | A(0x0), 0x1E);
+	cache_stats(&hit, &miss);
+	cache_write(0x20000010, 0x23000012);
+	cache_stats(&hit, &miss);
+	check((hit == 1) && (miss == 2), "cache after error");
+
+	/* A write that receives WAIT is not executed */
+	cache_write(0x20000040, 0x23000012);
+	sim_tgt.wait = 100;
+	check(wr(AP | WR | A(0x4), 0x20000080) == 2, "WAIT not reported");
+	sim_tgt.wait = 0;
+	check(cache_write(0x20000080, 0x23000012) == 5, "TAR after WAIT");
+	check(sim_tgt.tar == 0x20000088, "bad TAR after WAIT");
+
+	/* Line reset invalidates the cache */
+	line_reset();
+	transfer(DP | RD | A(0x0), &v);
+	check(cache_write(0x20000018, 0x23000012) == 6, "cache after line reset");
+
+	/* When cache is disabled, all writes are sent */
+	dap(cache_off, sizeof(cache_off));
+	check(cache_write(0x20000020, 0x23000012) == 6, "cache disabled");
+	dap(cache_on, sizeof(cache_on));
+	check(cache_write(0x20000028, 0x23000012) == 6, "cache enabled again");
+	check(cache_write(0x20000030, 0x23000012) == 3, "cache not used");
+	cache_stats(&hit, &miss);
+}
+
+/**
+ * @brief Execute a memory access vendor command (0x82) on AP 0
+ *
+ * @param mode Size of accesses, and bit 7 for a write
+ * @param addr Address of the first byte
+ * @param len  Number of bytes
+ * @param data Data to write (ignored for a read)
+ * @return integer Length of the complete response (into stream)
+ */
+static int mem_cmd(u8 mode, u32 addr, uint len, const u8 *data)
+{
+	u8 pkt[DAP_PACKET_SIZE], *p = pkt;
+
+	*p++ = 0x82;
+	*p++ = mode;
+	*p++ = 0x00;
+	p = put32(p, addr);
+	p = put32(p, len);
+	if (mode & 0x80)
+	{
+		memcpy(p, data, len);
+		p += len;
+	}
+	dap(pkt, p - pkt);
+	/* Complete response : streamed parts, then the last one */
+	memcpy(stream + stream_len, rsp, rsp_len);
+	return(stream_len + rsp_len);
+}
+
+static void test_mem_cmd(void)
+{
+	u8  out[244], pkt[32];
+	uint requests, i;
+	int len;
+
+	printf(" - Memory access vendor command\n");
+	for (i = 0; i < SIM_RAM_SIZE; i++)
+		sim_tgt.ram[i] = (i * 7) ^ (i >> 8);
+	wr(AP | WR | A(0x0), 0x23000002);
+
+	/* Whole RAM into one command (streamed response) */
+	requests = sim_tgt.requests;
+	len = mem_cmd(0x02, SIM_RAM_BASE, SIM_RAM_SIZE, 0);
+	requests = sim_tgt.requests - requests;
+	check(len == (1 + SIM_RAM_SIZE + 5), "bad length of long response");
+	check(stream_len > 0, "long response not streamed");
+	check((stream[0] == 0x82) && (memcmp(stream + 1, sim_tgt.ram, SIM_RAM_SIZE) == 0),
+	      "long read content");
+	check((stream[len - 5] == 1) && (get32(stream + len - 4) == SIM_RAM_SIZE),
+	      "long read status");
+	/* TAR loaded once per 1KB, one posted read more per 1KB */
+	check(requests <= ((SIM_RAM_SIZE / 4) + (3 * (SIM_RAM_SIZE / 1024)) + 4),
+	      "too many requests for long read");
+	check((sim_tgt.csw & 0xFFFFF000) == 0x23000000, "CSW protection bits");
+
+	/* Byte and halfword reads, crossing 1KB boundaries */
+	len = mem_cmd(0x00, SIM_RAM_BASE + 0x3F3, 0x412, 0);
+	check((len == (1 + 0x412 + 5)) && (memcmp(stream + 1, sim_tgt.ram + 0x3F3, 0x412) == 0),
+	      "byte read");
+	len = mem_cmd(0x01, SIM_RAM_BASE + 0x7FA, 12, 0);
+	check((len == (1 + 12 + 5)) && (memcmp(stream + 1, sim_tgt.ram + 0x7FA, 12) == 0),
+	      "halfword read");
+	check(stream_len == 0, "short response must not be streamed");
+
+	/* Writes */
+	for (i = 0; i < sizeof(out); i++)
+		out[i] = 0xC0 + i;
+	len = mem_cmd(0x82, SIM_RAM_BASE + 0x3C0, sizeof(out), out);
+	check((len == 6) && (rsp[1] == 1) && (get32(rsp + 2) == sizeof(out)), "word write");
+	check(memcmp(sim_tgt.ram + 0x3C0, out, sizeof(out)) == 0, "word write content");
+	mem_cmd(0x80, SIM_RAM_BASE + 0x801, 7, out + 1);
+	check((rsp[1] == 1) && (memcmp(sim_tgt.ram + 0x801, out + 1, 7) == 0), "byte write");
+	mem_cmd(0x81, SIM_RAM_BASE + 0x3FE, 6, out);
+	check((rsp[1] == 1) && (memcmp(sim_tgt.ram + 0x3FE, out, 6) == 0), "halfword write");
+
+	/* Bus error at the end of RAM, remaining data is zero */
+	len = mem_cmd(0x02, SIM_RAM_BASE + SIM_RAM_SIZE - 0x100, 0x200, 0);
+	check(len == (1 + 0x200 + 5), "bad length after error");
+	check((stream[len - 5] == 4) && (get32(stream + len - 4) < 0x200), "bus error");
+	check(stream[0x1FF] == 0, "data after error");
+	wr(DP | WR | A(0x0), 0x1E);
+
+	/* Invalid requests */
+	mem_cmd(0x02, SIM_RAM_BASE + 2, 8, 0);
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "unaligned read must fail");
+	mem_cmd(0x82, SIM_RAM_BASE, 4, out);
+	check(rsp[1] == 1, "write after error");
+
+	/* Into a command list : header, and data of a write, are used */
+	pkt[0] = 0x82; pkt[1] = 0x02; pkt[2] = 0x00;
+	put32(pkt + 3, SIM_RAM_BASE + 2);
+	put32(pkt + 7, 8);
+	check((dap_exec(pkt, 11) == 2) && (rsp[3] == 0xFF), "unaligned read into a list");
+	pkt[1] = 0x83;
+	check((dap_exec(pkt, 11 + 8) == 2) && (rsp[3] == 0xFF), "bad size into a list");
+	pkt[1] = 0x82;
+	check((dap_exec(pkt, 11 + 8) == 2) && (rsp[3] == 0xFF), "unaligned write into a list");
+	put32(pkt + 3, SIM_RAM_BASE + 0x10);
+	memcpy(pkt + 11, out, 8);
+	check((dap_exec(pkt, 11 + 8) == 6) && (rsp[3] == 1) &&
+	      (memcmp(sim_tgt.ram + 0x10, out, 8) == 0), "write into a list");
+}
+
+/**
+ * @brief Execute a CRC32 vendor command (0x84) on AP 0
+ *
+ * @param size Size of accesses (0:byte 1:halfword 2:word)
+ * @param addr Address of the first byte
+ * @param len  Number of bytes
+ * @return integer Value of the CRC32
+ */
+static u32 crc_cmd(u8 size, u32 addr, uint len)
+{
+	u8 pkt[11], *p = pkt;
+
+	*p++ = 0x84;
+	*p++ = size;
+	*p++ = 0x00;
+	p = put32(p, addr);
+	p = put32(p, len);
+	dap(pkt, p - pkt);
+	return(get32(rsp + 6));
+}
+
+/**
+ * @brief Reference CRC32 (IEEE 802.3, table less)
+ *
+ * @param data Pointer to the data
+ * @param len  Number of bytes
+ * @return integer Value of the CRC32
+ */
+static u32 crc_ref(const u8 *data, uint len)
+{
+	u32 crc = 0xFFFFFFFF;
+	int i;
+
+	while (len--)
+	{
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+	}
+	return(~crc);
+}
+
+static void test_crc(void)
+{
+	u32 crc, requests;
+	uint i;
+
+	printf(" - CRC32 vendor command\n");
+	for (i = 0; i < SIM_RAM_SIZE; i++)
+		sim_tgt.ram[i] = (i * 11) ^ (i >> 9);
+
+	/* Check value of the standard */
+	memcpy(sim_tgt.ram + 0x101, "123456789", 9);
+	crc = crc_cmd(0, SIM_RAM_BASE + 0x101, 9);
+	check((rsp_len == 10) && (rsp[1] == 1) && (get32(rsp + 2) == 9), "CRC status");
+	check(crc == 0xCBF43926, "CRC of check string");
+
+	/* Whole RAM, into one response */
+	requests = sim_tgt.requests;
+	crc = crc_cmd(2, SIM_RAM_BASE, SIM_RAM_SIZE);
+	requests = sim_tgt.requests - requests;
+	check((rsp_len == 10) && (stream_len == 0), "CRC response must not be streamed");
+	check(crc == crc_ref(sim_tgt.ram, SIM_RAM_SIZE), "CRC of RAM");
+	check(requests <= ((SIM_RAM_SIZE / 4) + (3 * (SIM_RAM_SIZE / 1024)) + 4),
+	      "too many requests for CRC");
+	crc = crc_cmd(1, SIM_RAM_BASE + 0x3FE, 0x106);
+	check(crc == crc_ref(sim_tgt.ram + 0x3FE, 0x106), "CRC of halfwords");
+
+	/* Bus error, CRC of the data read before */
+	crc = crc_cmd(2, SIM_RAM_BASE + SIM_RAM_SIZE - 0x200, 0x400);
+	check((rsp[1] == 4) && (get32(rsp + 2) == 0x200), "CRC bus error");
+	check(crc == crc_ref(sim_tgt.ram + SIM_RAM_SIZE - 0x200, get32(rsp + 2)),
+	      "CRC before error");
+	wr(DP | WR | A(0x0), 0x1E);
+
+	/* Invalid request */
+	crc_cmd(2, SIM_RAM_BASE + 2, 8);
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "unaligned CRC must fail");
+}
+
+/**
+ * @brief Execute a sector diff vendor command (0x85) on AP 0
+ *
+ * @param addr  Pointer to the list of sector addresses
+ * @param crc   Pointer to the list of expected CRC
+ * @param count Number of sectors
+ * @param len   Size of a sector
+ * @return integer Bitmap of the sectors that differ
+ */
+static u32 diff_cmd(const u32 *addr, const u32 *crc, uint count, uint len)
+{
+	u8 pkt[DAP_PACKET_SIZE], *p = pkt;
+	uint i;
+
+	*p++ = 0x85;
+	*p++ = 0x02;
+	*p++ = 0x00;
+	p = put32(p, len);
+	*p++ = count;
+	for (i = 0; i < count; i++)
+	{
+		p = put32(p, addr[i]);
+		p = put32(p, crc[i]);
+	}
+	dap(pkt, p - pkt);
+	return(get32(rsp + 3));
+}
+
+static void test_diff(void)
+{
+	u32 addr[31], crc[31];
+	u32 diff;
+	uint i;
+
+	printf(" - Sector diff vendor command\n");
+	for (i = 0; i < SIM_RAM_SIZE; i++)
+		sim_tgt.ram[i] = (i * 5) ^ (i >> 10);
+	for (i = 0; i < 31; i++)
+	{
+		addr[i] = SIM_RAM_BASE + (i * 0x800);
+		crc[i]  = crc_ref(sim_tgt.ram + (i * 0x800), 0x800);
+	}
+
+	/* Same content, then two sectors changed */
+	diff = diff_cmd(addr, crc, 31, 0x800);
+	check((rsp_len == 7) && (rsp[1] == 1) && (rsp[2] == 31), "diff status");
+	check(diff == 0, "no sector must differ");
+	sim_tgt.ram[0x801] ^= 0x40;
+	sim_tgt.ram[(30 * 0x800) + 0x7FF] ^= 0x01;
+	diff = diff_cmd(addr, crc, 31, 0x800);
+	check(diff == ((1u << 1) | (1u << 30)), "bad bitmap of sectors");
+
+	/* Bus error on third sector */
+	addr[2] = SIM_RAM_BASE + SIM_RAM_SIZE;
+	diff = diff_cmd(addr, crc, 4, 0x800);
+	check((rsp[1] == 4) && (rsp[2] == 2) && (diff == (1u << 1)), "diff bus error");
+	wr(DP | WR | A(0x0), 0x1E);
+
+	/* Invalid request */
+	diff_cmd(addr, crc, 2, 0x802);
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "unaligned sector must fail");
+}
+
+/**
+ * @brief Execute a flash algorithm vendor command (0x86)
+ *
+ * @param op   Operation (0:setup 1:call 2:program 3:flush)
+ * @param arg  Pointer to the 32 bits arguments
+ * @param narg Number of arguments
+ * @param data Pointer to data (program), or 0
+ * @param len  Length of data
+ * @return integer Status of the runner (0xFF for an invalid request)
+ */
+static int flash_cmd(u8 op, const u32 *arg, uint narg, const u8 *data, uint len)
+{
+	u8 pkt[DAP_PACKET_SIZE], *p = pkt;
+	uint i;
+
+	*p++ = 0x86;
+	*p++ = op;
+	if (op == 0x00)
+		*p++ = 0x00; // AP 0
+	for (i = 0; i < narg; i++)
+		p = put32(p, arg[i]);
+	if (data)
+	{
+		*p++ = (len >> 0) & 0xFF;
+		*p++ = (len >> 8) & 0xFF;
+		memcpy(p, data, len);
+		p += len;
+	}
+	dap(pkt, p - pkt);
+	if ((rsp_len != 6) || (rsp[0] != 0x86))
+		return(0xFF);
+	return(rsp[1]);
+}
+
+/**
+ * @brief Load a fake flash algorithm and setup the runner
+ *
+ * @param page    Size of a page
+ * @param timeout Max number of polls of DHCSR
+ * @return integer Status of the setup
+ */
+static int flash_setup(u32 page, u32 timeout)
+{
+	const u32 setup[] = { SIM_RAM_BASE, SIM_RAM_BASE + 0x100, SIM_RAM_BASE + 0x1000,
+	                      SIM_RAM_BASE + 0x10, SIM_RAM_BASE + 0x2000,
+	                      SIM_RAM_BASE + 0x3000, page, timeout };
+	u8 algo[20];
+
+	/* Breakpoint, then Init, UnInit, EraseSector and ProgramPage */
+	put32(algo +  0, 0xBE00BE00);
+	put32(algo +  4, SIM_OP(SIM_OP_INIT));
+	put32(algo +  8, SIM_OP(SIM_OP_UNINIT));
+	put32(algo + 12, SIM_OP(SIM_OP_ERASE));
+	put32(algo + 16, SIM_OP(SIM_OP_PROGRAM));
+	mem_cmd(0x82, SIM_RAM_BASE, sizeof(algo), algo);
+	return( flash_cmd(0x00, setup, 8, 0, 0) );
+}
+
+static void test_flash(void)
+{
+	u32 init[]  = { SIM_RAM_BASE + 0x04, 0, 12000000, 1, 0 };
+	u32 erase[] = { SIM_RAM_BASE + 0x0C, 0, 0, 0, 0 };
+	u32 bad[]   = { SIM_RAM_BASE + 0x20, 0, 0, 0, 0 };
+	const u32 setup[] = { SIM_RAM_BASE, SIM_RAM_BASE + 0x100, SIM_RAM_BASE + 0x1000,
+	                      SIM_RAM_BASE + 0x10, SIM_RAM_BASE + 0x2000,
+	                      SIM_RAM_BASE + 0x3000, 1024, 1000 };
+	static u8 image[0x4000];
+	u8   pkt[64];
+	uint i, pos, n, runs, writes;
+	u32 addr;
+
+	printf(" - Flash algorithm runner\n");
+	for (i = 0; i < sizeof(image); i++)
+		image[i] = (i * 29) ^ (i >> 7);
+	memset(sim_tgt.flash, 0x00, SIM_FLASH_SIZE);
+
+	/* Commands are rejected before setup */
+	check(flash_cmd(0x01, init, 5, 0, 0) != 0, "call before setup");
+	check(flash_setup(1024, 1000) == 0, "flash setup");
+	check(sim_tgt.dhcsr & (1 << 1), "core not halted by setup");
+	check(flash_cmd(0x01, init, 5, 0, 0) == 0, "call Init");
+	for (i = 0; i < sizeof(image); i += SIM_FLASH_SECTOR)
+	{
+		erase[1] = i;
+		check(flash_cmd(0x01, erase, 5, 0, 0) == 0, "call EraseSector");
+	}
+	check(sim_tgt.flash[0] == 0xFF, "flash not erased");
+
+	/* Chunks not aligned on pages, pages are double buffered */
+	runs   = sim_tgt.core_runs;
+	writes = sim_tgt.run_writes;
+	for (pos = 0; pos < sizeof(image); pos += n)
+	{
+		n = sizeof(image) - pos;
+		if (n > 200)
+			n = 200;
+		addr = SIM_FLASH_BASE + pos;
+		check(flash_cmd(0x02, &addr, 1, image + pos, n) == 0, "program data");
+	}
+	check(flash_cmd(0x03, 0, 0, 0, 0) == 0, "flush");
+	check(memcmp(sim_tgt.flash, image, sizeof(image)) == 0, "flash content");
+	check((sim_tgt.core_runs - runs) == (sizeof(image) / 1024), "number of ProgramPage");
+	check(sim_tgt.run_writes > writes, "buffers not loaded while core runs");
+
+	/* Partial page on a jump of address */
+	erase[1] = 0x8000;
+	flash_cmd(0x01, erase, 5, 0, 0);
+	addr = 0x8000;
+	flash_cmd(0x02, &addr, 1, image, 64);
+	addr = 0x8400;
+	flash_cmd(0x02, &addr, 1, image + 64, 64);
+	check(flash_cmd(0x03, 0, 0, 0, 0) == 0, "flush partial pages");
+	check((memcmp(sim_tgt.flash + 0x8000, image, 64) == 0) &&
+	      (memcmp(sim_tgt.flash + 0x8400, image + 64, 64) == 0) &&
+	      (sim_tgt.flash[0x8040] == 0xFF), "partial pages");
+
+	/* Errors : function failed, not an instruction, timeout */
+	addr = SIM_FLASH_SIZE;
+	flash_cmd(0x02, &addr, 1, image, 200);
+	check(flash_cmd(0x03, 0, 0, 0, 0) == 1, "ProgramPage error");
+	check(get32(rsp + 2) == 1, "result of ProgramPage");
+	check(flash_cmd(0x01, init, 5, 0, 0) == 1, "error must be kept");
+	flash_setup(1024, 1000);
+	check(flash_cmd(0x01, bad, 5, 0, 0) == 1, "fault not reported");
+	flash_setup(1024, 10);
+	sim_tgt.run_delay = 100;
+	check(flash_cmd(0x01, init, 5, 0, 0) == 2, "timeout not reported");
+	sim_tgt.run_delay = 3;
+	check(flash_setup(1024, 1000) == 0, "setup after timeout");
+	addr = 1;
+	check(flash_cmd(0x02, &addr, 1, image, 4) == 0xFF, "unaligned data");
+
+	/* Each operation uses the exact length of its request */
+	pkt[0] = 0x86;
+	pkt[1] = 0x03;
+	check(dap_exec(pkt, 2) == 6, "flush into a command list");
+	pkt[1] = 0x02;
+	put32(pkt + 2, SIM_FLASH_BASE + 0x9000);
+	pkt[6] = 8;
+	pkt[7] = 0;
+	memcpy(pkt + 8, image, 8);
+	check(dap_exec(pkt, 16) == 6, "program into a command list");
+	pkt[1] = 0x01;
+	erase[1] = 0x9000;
+	for (i = 0; i < 5; i++)
+		put32(pkt + 2 + (i * 4), erase[i]);
+	check(dap_exec(pkt, 22) == 6, "call into a command list");
+	check(sim_tgt.flash[0x9000] == 0xFF, "erase into a command list");
+	pkt[1] = 0x00;
+	pkt[2] = 0x00;
+	for (i = 0; i < 8; i++)
+		put32(pkt + 3 + (i * 4), setup[i]);
+	check(dap_exec(pkt, 35) == 6, "setup into a command list");
+	/* Invalid page size or timeout : only the request is used */
+	put32(pkt + 3 + (6 * 4), 1022);
+	check((dap_exec(pkt, 35) == 2) && (rsp[3] == 0xFF), "bad page size into a list");
+	put32(pkt + 3 + (6 * 4), 1024);
+	put32(pkt + 3 + (7 * 4), 0);
+	check((dap_exec(pkt, 35) == 2) && (rsp[3] == 0xFF), "bad timeout into a list");
+	pkt[1] = 0x02;
+	put32(pkt + 2, SIM_FLASH_BASE + 0x9002);
+	pkt[6] = 8;
+	pkt[7] = 0;
+	check((dap_exec(pkt, 16) == 2) && (rsp[3] == 0xFF), "unaligned data into a list");
+}
+
+/**
+ * @brief Execute a scatter-gather read vendor command (0x83) on AP 0
+ *
+ * @param addr  Pointer to the list of addresses
+ * @param size  Pointer to the list of sizes (0:byte 1:halfword 2:word)
+ * @param count Number of entries
+ * @return integer Number of SWD requests received by target
+ */
+static uint scatter(const u32 *addr, const u8 *size, uint count)
+{
+	u8 pkt[DAP_PACKET_SIZE], *p = pkt;
+	uint requests = sim_tgt.requests;
+	uint i;
+
+	*p++ = 0x83;
+	*p++ = count;
+	for (i = 0; i < count; i++)
+	{
+		*p++ = 0x00;
+		*p++ = size[i];
+		p = put32(p, addr[i]);
+	}
+	dap(pkt, p - pkt);
+	return(sim_tgt.requests - requests);
+}
+
+static void test_scatter(void)
+{
+	const u32 addr[] = { 0x20000010, 0x20000014, 0x20000100, 0x20000103,
+	                     0x20000202, 0x20000300, 0x20000304 };
+	const u8  size[] = { 2, 2, 2, 0, 1, 2, 2 };
+	const u32 bad_addr[] = { 0x20000020, 0x10000000, 0x20000040 };
+	const u8  bad_size[] = { 2, 2, 2 };
+	const u8  bad_len[]  = { 0x83, 0x02, 0x00, 0x02, 0x00, 0x00, 0x00, 0x20 };
+	uint n, i;
+	u32 v;
+
+	printf(" - Scatter-gather read vendor command\n");
+	for (i = 0; i < SIM_RAM_SIZE; i++)
+		sim_tgt.ram[i] = (i * 13) ^ (i >> 8);
+
+	/* RDBUFF only read when TAR or CSW must be written */
+	n = scatter(addr, size, 7);
+	check((rsp_len == (3 + 7 * 4)) && (rsp[1] == 7) && (rsp[2] == 1), "scatter status");
+	for (i = 0; i < 7; i++)
+	{
+		memcpy(&v, sim_tgt.ram + (addr[i] - SIM_RAM_BASE), 4);
+		if (size[i] == 0) v &= 0xFF;
+		if (size[i] == 1) v &= 0xFFFF;
+		check(get32(rsp + 3 + (i * 4)) == v, "scatter value");
+	}
+	check(n <= 21, "too many requests for scatter read");
+	/* Same list again, SELECT and first CSW are cached */
+	check(scatter(addr, size, 7) <= n, "scatter read not cached");
+
+	/* Bus error, values read before are returned */
+	scatter(bad_addr, bad_size, 3);
+	check((rsp[1] == 1) && (rsp[2] == 4) && (rsp_len == 7), "scatter bus error");
+	memcpy(&v, sim_tgt.ram + 0x20, 4);
+	check(get32(rsp + 3) == v, "scatter value before error");
+	wr(DP | WR | A(0x0), 0x1E);
+
+	/* Invalid requests */
+	scatter(addr + 3, size + 4, 1);
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "unaligned scatter must fail");
+	dap(bad_len, sizeof(bad_len));
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "truncated scatter must fail");
+	scatter(addr, size, 2);
+	check((rsp[1] == 2) && (rsp[2] == 1), "scatter after error");
+}
+
+/**
+ * @brief Measure the cost of one DAP packet
+ *
+ * @return double Time used by the host for one packet (ns)
+ */
+static double bench(const char *name, const u8 *pkt, uint len)
+{
+	struct timespec t0, t1;
+	sim_stats st;
+	double ns;
+	int i;
+
+	contention += sim_st.contention;
+	memset(&sim_st, 0, sizeof(sim_st));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < BENCH_LOOPS; i++)
+		dap(pkt, len);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	st = sim_st;
+	ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / BENCH_LOOPS;
+
+	printf("   %-24s %7lu %8lu %8lu %6lu %9.0f\n", name,
+	       st.clocks / BENCH_LOOPS, st.toggles / BENCH_LOOPS,
+	       (st.pin_set + st.pin_get) / BENCH_LOOPS, st.dir / BENCH_LOOPS, ns);
+	return(ns);
+}
+
+/**
+ * @brief Check the tracking of the TAP state and the shortest TMS paths
+ *
+ */
+static void test_jtag_tap(void)
+{
+	const u8 conn[]  = { 0x02, 0x02 };
+	const u8 disc[]  = { 0x03 };
+	const u8 tms4[]  = { 0x12, 4, 0x0F };
+	const u8 tms1[]  = { 0x12, 1, 0x01 };
+	/* DAP_JTAG_Sequence : 1 clock TMS high, then 3 clocks TMS low */
+	const u8 seq[]   = { 0x14, 0x02, 0x41, 0x00, 0x03, 0x00 };
+	u8   dist[JTAG_STATES][JTAG_STATES];
+	uint clocks, a, b, n, bad;
+	int  s, changed;
+
+	printf(" - JTAG TAP state and shortest paths\n");
+	dap(conn, sizeof(conn));
+	check((rsp_len == 2) && (rsp[1] == 2), "DAP_Connect JTAG");
+	check(jtag_tap() == JTAG_UNKNOWN, "TAP state must be unknown after connect");
+
+	/* From an unknown state, the TAP is reset first */
+	sim_jtag.state = JTAG_DRPAUSE;
+	jtag_goto(JTAG_IDLE);
+	check((sim_jtag.state == JTAG_IDLE) && (jtag_tap() == JTAG_IDLE),
+	      "goto from unknown state");
+
+	/* Reference distances, from the TAP model */
+	memset(dist, 0xFF, sizeof(dist));
+	for (a = 0; a < JTAG_STATES; a++)
+	{
+		dist[a][a] = 0;
+		for (n = 0, changed = 1; changed; n++)
+		{
+			changed = 0;
+			for (b = 0; b < JTAG_STATES; b++)
+			{
+				if (dist[a][b] != n)
+					continue;
+				s = sim_jtag_next(b, 0);
+				if (dist[a][s] == 0xFF) { dist[a][s] = n + 1; changed = 1; }
+				s = sim_jtag_next(b, 1);
+				if (dist[a][s] == 0xFF) { dist[a][s] = n + 1; changed = 1; }
+			}
+		}
+	}
+
+	/* Each move between two states uses the minimum of clocks */
+	for (a = 0, bad = 0; a < JTAG_STATES; a++)
+	{
+		for (b = 0; b < JTAG_STATES; b++)
+		{
+			jtag_goto(a);
+			clocks = sim_jtag.clocks;
+			jtag_goto(b);
+			if ((sim_jtag.state != (int)b) || (jtag_tap() != b) ||
+			    ((sim_jtag.clocks - clocks) != dist[a][b]))
+			{
+				if (bad++ == 0)
+					printf("    from %u to %u : state %d, %u clocks (expect %u)\n",
+					       a, b, sim_jtag.state, sim_jtag.clocks - clocks, dist[a][b]);
+			}
+		}
+	}
+	check(bad == 0, "bad TMS path between two states");
+
+	/* Sequences sent by the host are tracked */
+	jtag_goto(JTAG_IDLE);
+	dap(seq, sizeof(seq));
+	check((rsp_len == 2) && (rsp[1] == 0), "DAP_JTAG_Sequence");
+	check((sim_jtag.state == JTAG_DRSHIFT) && (jtag_tap() == JTAG_DRSHIFT),
+	      "TAP state after DAP_JTAG_Sequence");
+	dap(tms1, sizeof(tms1));
+	check(jtag_tap() == JTAG_DREXIT1, "TAP state after SWJ_Sequence");
+
+	/* After a reconnect, 5 clocks with TMS high are needed (even split
+	 * into many sequences) before the state is known */
+	dap(disc, sizeof(disc));
+	dap(conn, sizeof(conn));
+	dap(tms4, sizeof(tms4));
+	check(jtag_tap() == JTAG_UNKNOWN, "TAP state known before 5 TMS high");
+	dap(tms1, sizeof(tms1));
+	check((jtag_tap() == JTAG_RESET) && (sim_jtag.state == JTAG_RESET),
+	      "TAP state after 5 TMS high");
+	dap(disc, sizeof(disc));
+}
+
+/**
+ * @brief Check bit order and capture of DAP_JTAG_Sequence
+ *
+ */
+static void test_jtag_seq(void)
+{
+	const u8 conn[]  = { 0x02, 0x02 };
+	const u8 disc[]  = { 0x03 };
+	/* Reset, Run-Test/Idle, then Shift-DR with IDCODE selected */
+	const u8 shift[] = { 0x14, 0x04, 0x46, 0xFF, 0x01, 0x00,
+	                     0x41, 0x00, 0x02, 0x00 };
+	/* Then 8 bits without capture and 32 bits with capture */
+	const u8 skip[]  = { 0x14, 0x02, 0x08, 0xFF, 0xA0, 0x00, 0x00, 0x00, 0x00 };
+	const u8 exit1[] = { 0x14, 0x01, 0x41, 0x00 };
+	const u32 pattern = 0xA5C3F00F;
+	u8  pkt[16], *p;
+	uint clocks;
+
+	printf(" - JTAG sequences (bit order and capture)\n");
+	dap(conn, sizeof(conn));
+	dap(shift, sizeof(shift));
+	check((rsp_len == 2) && (rsp[1] == 0), "DAP_JTAG_Sequence");
+	check(sim_jtag.state == JTAG_DRSHIFT, "TAP not into Shift-DR");
+
+	/* IDCODE split in two captures of 5 and 27 bits, each one starts on a
+	 * new byte. A pattern is shifted in at the same time. */
+	p = pkt;
+	*p++ = 0x14; *p++ = 0x02;
+	*p++ = 0x80 | 5;  *p++ = pattern & 0x1F;
+	*p++ = 0x80 | 27; p = put32(p, pattern >> 5);
+	clocks = sim_jtag.clocks;
+	dap(pkt, p - pkt);
+	check((rsp_len == 7) && (rsp[1] == 0), "response length of 2 captures");
+	check(rsp[2] == (SIM_JTAG_IDCODE & 0x1F), "first capture");
+	check(get32(rsp + 3) == (SIM_JTAG_IDCODE >> 5), "second capture");
+	check((sim_jtag.clocks - clocks) == 32, "bad number of clocks");
+
+	/* 64 bits into a single sequence : the pattern comes back first */
+	p = pkt;
+	*p++ = 0x14; *p++ = 0x01;
+	*p++ = 0x80;
+	p = put32(p, 0);
+	p = put32(p, 0);
+	dap(pkt, p - pkt);
+	check((rsp_len == 10) && (get32(rsp + 2) == pattern) &&
+	      (get32(rsp + 6) == 0), "64 bits sequence");
+
+	/* Bits of a sequence without capture are not into the response */
+	dap(skip, sizeof(skip));
+	check((rsp_len == 6) && (get32(rsp + 2) == 0xFF000000),
+	      "sequence without capture");
+
+	dap(exit1, sizeof(exit1));
+	check((sim_jtag.state == JTAG_DREXIT1) && (jtag_tap() == JTAG_DREXIT1),
+	      "TAP state after sequences");
+	dap(disc, sizeof(disc));
+}
+
+/**
+ * @brief Check DAP_Transfer and DAP_TransferBlock with a JTAG-DP
+ *
+ */
+static void test_jtag_dp(void)
+{
+	const u8  conn[]  = { 0x02, 0x02 };
+	const u8  disc[]  = { 0x03 };
+	const u8  conf1[] = { 0x15, 1, 4 };
+	const u8  conf3[] = { 0x15, 3, 5, 4, 3 };
+	const u8  idle[]  = { 0x14, 0x01, 0x01, 0x00 };
+	const u8  reset[] = { 0x12, 5, 0x1F };
+	const u8  ir_len[3] = { 5, 4, 3 };
+	const u32 idcode[3] = { 0x0362D093, SIM_JTAG_IDCODE, 0 };
+	u8  pkt[32], *p;
+	u32 out[8], in[8], v = 0;
+	uint ir, waits, i;
+
+	printf(" - JTAG-DP transfers\n");
+	dap(conn, sizeof(conn));
+	check((rsp_len == 2) && (rsp[1] == 2), "DAP_Connect JTAG");
+	dap(conf1, sizeof(conf1));
+	check((rsp_len == 2) && (rsp[1] == 0), "DAP_JTAG_Configure");
+
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read failed");
+	check(v == SIM_DPIDR, "bad DPIDR value");
+	wr(DP | WR | A(0x8), 0);
+	wr(DP | WR | A(0x4), 0x50000000);
+	check(transfer(DP | RD | A(0x4), &v) == 1, "CTRL/STAT read failed");
+	check((v & 0xF0000000) == 0xF0000000, "debug power-up not acknowledged");
+
+	/* AP accesses of one command only load APACC, then DPACC for RDBUFF */
+	memcpy(sim_tgt.ram + 0x200, "\x11\x22\x33\x44\x55\x66\x77\x88", 8);
+	p = pkt;
+	*p++ = 0x05; *p++ = 0x00; *p++ = 4;
+	*p++ = AP | WR | A(0x0); p = put32(p, 0x23000012);
+	*p++ = AP | WR | A(0x4); p = put32(p, SIM_RAM_BASE + 0x200);
+	*p++ = AP | RD | A(0xC);
+	*p++ = AP | RD | A(0xC);
+	ir = sim_jtag.ir_scans;
+	dap(pkt, p - pkt);
+	check((rsp[1] == 4) && (rsp[2] == 1), "AP transfers failed");
+	check((get32(rsp + 3) == 0x44332211) && (get32(rsp + 7) == 0x88776655),
+	      "AP read values");
+	check((sim_jtag.ir_scans - ir) == 2, "IR scan not skipped");
+	check(jtag_tap() == JTAG_DRUPDATE, "TAP must stay into Update-DR");
+
+	/* Host sequences start from Run-Test/Idle */
+	dap(idle, sizeof(idle));
+	check(sim_jtag.state == JTAG_IDLE, "TAP not moved to Run-Test/Idle");
+
+	for (i = 0; i < 8; i++)
+		out[i] = 0x01020304 * (i + 1);
+	wr(AP | WR | A(0x4), SIM_RAM_BASE + 0x200);
+	check(block(AP | WR | A(0xC), out, 8) == 1, "block write failed");
+	check(memcmp(sim_tgt.ram + 0x200, out, sizeof(out)) == 0, "RAM content");
+	wr(AP | WR | A(0x4), SIM_RAM_BASE + 0x200);
+	ir = sim_jtag.ir_scans;
+	memset(in, 0, sizeof(in));
+	check(block(AP | RD | A(0xC), in, 8) == 1, "block read failed");
+	check(memcmp(in, out, sizeof(out)) == 0, "block read content");
+	check((sim_jtag.ir_scans - ir) == 2, "IR scan not skipped by block read");
+
+	/* WAIT : the scan is sent again */
+	waits = sim_tgt.ack_wait;
+	sim_tgt.wait = 3;
+	wr(AP | WR | A(0x4), SIM_RAM_BASE + 0x204);
+	check((transfer(AP | RD | A(0xC), &v) == 1) && (v == out[1]),
+	      "read after WAIT");
+	check((sim_tgt.ack_wait - waits) == 3, "WAIT not received");
+	sim_tgt.wait = 0;
+
+	/* Scan chain with 3 devices, the JTAG-DP is the second one */
+	sim_jtag_chain(&sim_jtag, 3, ir_len, idcode, 1);
+	dap(reset, sizeof(reset));
+	dap(conf3, sizeof(conf3));
+	check((rsp_len == 2) && (rsp[1] == 0), "DAP_JTAG_Configure 3 devices");
+	xfer_index = 1;
+	v = 0;
+	check(transfer(DP | RD | A(0x0), &v) == 1, "DPIDR read with index 1");
+	check(v == SIM_DPIDR, "bad DPIDR value with index 1");
+	check((sim_jtag.dev[0].ir == 0x1F) && (sim_jtag.dev[2].ir == 0x07),
+	      "other devices must be in BYPASS");
+	wr(AP | WR | A(0x4), SIM_RAM_BASE + 0x208);
+	check((transfer(AP | RD | A(0xC), &v) == 1) && (v == out[2]),
+	      "AP read with index 1");
+	xfer_index = 0;
+	check(transfer(DP | RD | A(0x0), &v) != 1, "device 0 is not a JTAG-DP");
+	xfer_index = 3;
+	transfer(DP | RD | A(0x0), &v);
+	check((rsp[1] == 0) && (rsp[2] == 0), "DAP index out of the chain");
+	xfer_index = 0;
+
+	sim_jtag_reset(&sim_jtag);
+	dap(conf1, sizeof(conf1));
+	dap(disc, sizeof(disc));
+	/* Next tests use SWD */
+	swd_setup();
+}
+
+/**
+ * @brief Check the idle cycles of JTAG-DP transfers with the PIO engine
+ *
+ * One PIO shift holds up to 32 clocks : longer runs of TMS must be split.
+ */
+static void test_jtag_pio(void)
+{
+	const u8 conn[]  = { 0x02, 0x02 };
+	const u8 disc[]  = { 0x03 };
+	const u8 conf1[] = { 0x15, 1, 4 };
+	u8   conf[] = { 0x04, 0, 16, 0x00, 0x00, 0x00 };
+	uint clocks[3], idle[3] = { 1, 33, 255 }, i;
+	u32  v;
+
+	printf(" - JTAG-DP transfers with the PIO engine (idle cycles)\n");
+	sim_jtag_pio = 1;
+	sim_st.jtag_pio_lost = 0;
+	dap(disc, sizeof(disc));
+	dap(conn, sizeof(conn));
+	dap(conf1, sizeof(conf1));
+	/* First transfer loads DPACC/APACC into IR */
+	transfer(DP | RD | A(0x0), &v);
+	for (i = 0; i < 3; i++)
+	{
+		conf[1] = idle[i];
+		dap(conf, sizeof(conf));
+		clocks[i] = sim_jtag.clocks;
+		v = 0;
+		check((transfer(DP | RD | A(0x0), &v) == 1) && (v == SIM_DPIDR),
+		      "DPIDR read with the PIO engine");
+		clocks[i] = sim_jtag.clocks - clocks[i];
+		check(sim_jtag.state == (int)jtag_tap(), "TAP state lost after idle cycles");
+	}
+	/* Read request and RDBUFF : two DR scans, each followed by idle cycles */
+	check((clocks[1] == clocks[0] + 2 * 32) && (clocks[2] == clocks[0] + 2 * 254),
+	      "idle cycles not sent");
+	check(sim_st.jtag_pio_lost == 0, "PIO shift longer than 32 bits");
+
+	conf[1] = 0;
+	dap(conf, sizeof(conf));
+	dap(disc, sizeof(disc));
+	sim_jtag_pio = 0;
+	swd_setup();
+}
+
+/**
+ * @brief Check DAP_JTAG_IDCODE and the scan chain detection vendor command
+ *
+ */
+static void test_jtag_chain(void)
+{
+	const u8  conn[]   = { 0x02, 0x02 };
+	const u8  disc[]   = { 0x03 };
+	const u8  detect[] = { 0x87, 0x00 };
+	const u8  rescan[] = { 0x87, 0x01 };
+	const u8  reset[]  = { 0x12, 5, 0x1F };
+	const u8  config[] = { 0x15, 3, 5, 4, 3 };
+	const u8  ir_len[3] = { 5, 4, 3 };
+	const u32 idcode[3] = { 0x0362D093, SIM_JTAG_IDCODE, 0 };
+	u8   pkt[2] = { 0x16, 0x00 };
+	u32  v = 0;
+	uint clocks, resets, i;
+	unsigned long n;
+
+	printf(" - JTAG scan chain detection and IDCODE\n");
+	sim_jtag_chain(&sim_jtag, 3, ir_len, idcode, 1);
+	dap(detect, sizeof(detect));
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "detection needs JTAG mode");
+	dap(conn, sizeof(conn));
+	dap(config, sizeof(config));
+	jtag_goto(JTAG_IDLE);
+
+	/* IDCODE instruction, without TAP reset : only the JTAG-DP has it */
+	resets = sim_jtag.resets;
+	for (i = 0; i < 3; i++)
+	{
+		pkt[1] = i;
+		dap(pkt, sizeof(pkt));
+		check((rsp_len == 6) && (rsp[1] == ((i == 1) ? 0x00 : 0xFF)) &&
+		      (get32(rsp + 2) == ((i == 1) ? idcode[i] : 0)),
+		      "DAP_JTAG_IDCODE");
+		if (i == 1)
+			check(sim_jtag.dev[1].ir == JTAG_IR_IDCODE, "IDCODE not loaded");
+	}
+	check(sim_jtag.resets == resets, "TAPs reset by DAP_JTAG_IDCODE");
+	clocks = sim_jtag.clocks;
+	pkt[1] = 1;
+	dap(pkt, sizeof(pkt));
+	check((rsp[1] == 0) && (get32(rsp + 2) == SIM_JTAG_IDCODE) &&
+	      (sim_jtag.clocks == clocks), "IDCODE not answered by the probe");
+	pkt[1] = 3;
+	dap(pkt, sizeof(pkt));
+	check(rsp[1] == 0xFF, "IDCODE of a device out of the chain");
+
+	/* Detection configures the chain, transfers can be used directly */
+	dap(detect, sizeof(detect));
+	check((rsp_len == 3 + 3 + 12) && (rsp[1] == 0x00) && (rsp[2] == 3),
+	      "detection of 3 devices");
+	check((rsp[3] == 5) && (rsp[4] == 4) && (rsp[5] == 3), "IR lengths");
+	for (i = 0; i < 3; i++)
+		check(get32(rsp + 6 + (i * 4)) == idcode[i], "IDCODE of detection");
+	xfer_index = 1;
+	check((transfer(DP | RD | A(0x0), &v) == 1) && (v == SIM_DPIDR),
+	      "DPIDR read after detection");
+	xfer_index = 0;
+
+	/* Result is kept until disconnect, unless a new scan is requested */
+	clocks = sim_jtag.clocks;
+	dap(detect, sizeof(detect));
+	check((rsp[1] == 0x00) && (rsp[2] == 3) && (sim_jtag.clocks == clocks),
+	      "detection result not kept");
+	dap(rescan, sizeof(rescan));
+	check((rsp[1] == 0x00) && (rsp[2] == 3) && (sim_jtag.clocks != clocks),
+	      "new scan not done");
+	n = sim_st.jtag_pio_init;
+	dap(disc, sizeof(disc));
+	dap(conn, sizeof(conn));
+	check(sim_st.jtag_pio_init == n + 1, "PIO engine not tried again on connect");
+	clocks = sim_jtag.clocks;
+	dap(detect, sizeof(detect));
+	check((rsp[2] == 3) && (sim_jtag.clocks != clocks),
+	      "detection result kept after disconnect");
+
+	/* Single JTAG-DP */
+	sim_jtag_reset(&sim_jtag);
+	dap(reset, sizeof(reset));
+	dap(rescan, sizeof(rescan));
+	check((rsp_len == 8) && (rsp[1] == 0x00) && (rsp[2] == 1) &&
+	      (rsp[3] == 4) && (get32(rsp + 4) == SIM_JTAG_IDCODE),
+	      "detection of a single JTAG-DP");
+
+	/* No device : TDO is connected to TDI */
+	sim_jtag_chain(&sim_jtag, 0, ir_len, idcode, 0);
+	dap(reset, sizeof(reset));
+	dap(rescan, sizeof(rescan));
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "empty chain detected");
+
+	sim_jtag_reset(&sim_jtag);
+	dap(disc, sizeof(disc));
+	swd_setup();
+}
+
+/**
+ * @brief Play a SVF file with the SVF vendor command
+ *
+ * @param text  Content of the file
+ * @param len   Length of the file
+ * @param chunk Number of bytes sent into each packet
+ * @return integer Status of the player, -1 for an invalid response
+ */
+static int svf_play(const char *text, uint len, uint chunk)
+{
+	u8   pkt[DAP_PACKET_SIZE] = { 0x88 };
+	uint pos = 0, n;
+
+	do
+	{
+		n = ((len - pos) > chunk) ? chunk : (len - pos);
+		pkt[1] = ((pos == 0) ? 0x01 : 0x00) | (((pos + n) == len) ? 0x02 : 0x00);
+		pkt[2] = (n >> 0) & 0xFF;
+		pkt[3] = (n >> 8) & 0xFF;
+		memcpy(pkt + 4, text + pos, n);
+		pos += n;
+		if ((dap(pkt, n + 4) < 2) || (rsp[0] != 0x88))
+			return(-1);
+		/* Port not in JTAG mode */
+		if (rsp_len != 10)
+			return(rsp[1]);
+	} while (pos < len);
+	return(rsp[1]);
+}
+
+/**
+ * @brief Play a SVF string, check status, mismatches and line
+ *
+ */
+static void svf_check(const char *text, int status, u32 mismatch, u32 line, const char *msg)
+{
+	check((svf_play(text, strlen(text), DAP_PACKET_SIZE - 4) == status) &&
+	      (get32(rsp + 2) == mismatch) && (get32(rsp + 6) == line), msg);
+}
+
+static void test_svf(void)
+{
+	const u8  conn[]   = { 0x02, 0x02 };
+	const u8  disc[]   = { 0x03 };
+	const u8  reset[]  = { 0x12, 5, 0x1F };
+	const u8  config[] = { 0x15, 3, 5, 4, 3 };
+	const u8  ir_len[3] = { 5, 4, 3 };
+	const u32 idcode[3] = { 0x0362D093, SIM_JTAG_IDCODE, 0 };
+	const char *idc =
+		"// Read IDCODE of the JTAG-DP\n"
+		"TRST OFF;\n"
+		"ENDIR IDLE;\n"
+		"ENDDR IDLE;\n"
+		"STATE RESET;\n"
+		"STATE IDLE;\n"
+		"sir 4 tdi (e) tdo (1) ! Capture-IR is 0001\n"
+		"  mask (3);\n"
+		"SDR 32 TDI (00000000)\n"
+		"       TDO (4BA00477) MASK (0FFFFFFF);\n"
+		"RUNTEST 100 TCK ENDSTATE IDLE;\n";
+	const char *bad =
+		"SIR 4 TDI (E);\n"
+		"SDR 32 TDI (0) TDO (4BA00478);\n"
+		"SDR 32 TDI (0) TDO (4BA00477);\n"
+		"SDR 32 TDI (0) TDO (FFFFFFFF) MASK (0);\n"
+		"SDR 32 TDI (0) TDO (00000077) MASK (FF);\n"
+		"SDR 32 TDI (0) TDO (FFFFFFFF) MASK (8);\n";
+	const char *chain =
+		"HIR 5 TDI (1F);\n"
+		"TIR 3;\n"
+		"HDR 1 TDI (0);\n"
+		"TDR 1 TDI (0);\n"
+		"SIR 4 TDI (E);\n"
+		"SDR 32 TDI (0) TDO (4BA00477);\n"
+		"HIR 0;\n"
+		"TIR 0;\n"
+		"HDR 0;\n"
+		"TDR 0;\n"
+		"SIR 12 TDI (FFF) TDO (221) MASK (FFF);\n";
+	const char *freq_svf =
+		"FREQUENCY 1E5 HZ;\n"
+		"RUNTEST 10 TCK;\n"
+		"FREQUENCY;\n";
+	const u8 clk[] = { 0x11, 0x80, 0x84, 0x1E, 0x00 };
+	const u8 svf_cmd[] = { 0x88, 0x03, 11, 0, 'S', 'T', 'A', 'T', 'E', ' ',
+	                       'I', 'D', 'L', 'E', ';' };
+	u8   pkt[2];
+	u32  freq;
+	uint clocks, i;
+	int  ok;
+
+	printf(" - SVF player (IDCODE, TDO compare, RUNTEST and STATE)\n");
+	sim_jtag_reset(&sim_jtag);
+	check(svf_play(idc, strlen(idc), 64) == 0xFF, "SVF needs JTAG mode");
+	dap(conn, sizeof(conn));
+	dap(reset, sizeof(reset));
+	svf_check(idc, 0, 0, 0, "IDCODE read with TDO compare");
+	check((jtag_tap() == JTAG_IDLE) && (sim_jtag.state == JTAG_IDLE),
+	      "TAP not into Run-Test/Idle");
+	/* Last bit of the scan is captured while leaving Shift-DR */
+	svf_check("SIR 4 TDI (F);\nSDR 9 TDI (1FF) TDO (1FE);", 0, 0, 0, "BYPASS register");
+
+	/* Statements split between packets */
+	for (i = 1, ok = 1; i < 12; i += 5)
+		if ((svf_play(idc, strlen(idc), i) != 0) || (get32(rsp + 2) != 0))
+			ok = 0;
+	check(ok, "statements split between packets");
+
+	/* Only mismatches are reported, the player continues */
+	svf_check(bad, 1, 2, 2, "TDO mismatch with MASK");
+	check(svf_play(bad, strlen(bad), 16) == 1, "mismatch not kept");
+
+	/* RUNTEST : clocks into the run state, minimum time, end state */
+	svf_check("RUNTEST 10 TCK;", 0, 0, 0, "RUNTEST");
+	clocks = sim_jtag.clocks;
+	svf_check("RUNTEST 25 TCK;", 0, 0, 0, "RUNTEST");
+	check(sim_jtag.clocks == (clocks + 25), "RUNTEST clocks");
+	sim_wait_us = 0;
+	svf_check("RUNTEST IDLE 1.5E-3 SEC MAXIMUM 1 SEC;\n"
+	          "RUNTEST 3 TCK 2.5e-6 SEC ENDSTATE DRPAUSE;", 0, 0, 0, "RUNTEST time");
+	check((sim_wait_us == 1503) && (sim_jtag.state == JTAG_DRPAUSE),
+	      "RUNTEST min time and end state");
+	svf_check("ENDDR DRPAUSE;\nSIR 4 TDI (E);\nSDR 32 TDI (0) TDO (4BA00477);\n"
+	          "SDR 32 TDI (0) TDO (4BA00477);", 1, 1, 4, "scan from DRPAUSE");
+	check((sim_jtag.state == JTAG_DRPAUSE) && (jtag_tap() == JTAG_DRPAUSE),
+	      "ENDDR not used");
+	svf_check("STATE DRPAUSE DREXIT2 DRUPDATE IDLE;\n", 0, 0, 0, "STATE path");
+	check(sim_jtag.state == JTAG_IDLE, "STATE path not followed");
+
+	/* FREQUENCY only applies to the file, the debugger clock is restored */
+	dap(clk, sizeof(clk));
+	freq = swj_clk.freq;
+	check(svf_play(freq_svf, strlen(freq_svf), 8) == 0, "FREQUENCY");
+	check((freq == 2000000) && (swj_clk.freq == freq), "clock not restored");
+	svf_check("FREQUENCY 1E5 HZ;\nFOO;", 2, 0, 2, "FREQUENCY then error");
+	check(swj_clk.freq == freq, "clock not restored after an error");
+
+	/* Length field : the command can be followed by others */
+	check(dap_exec(svf_cmd, sizeof(svf_cmd)) == 10, "SVF into a command list");
+	check((rsp[2] == 0x88) && (rsp[3] == 0), "SVF response");
+
+	/* Errors stop the player */
+	svf_check("ENDIR IDLE;\nSDR 8 TDI (0) FOO (1);\nSDR 8 TDI (0);", 2, 0, 2, "syntax error");
+	svf_check("SDR 8 TDO (1);", 2, 0, 1, "SDR without TDI");
+	svf_check("\n\nSDR 8 TDI (0)", 2, 0, 3, "missing semicolon");
+	svf_check("SDR 8 TDI (0G);", 2, 0, 1, "invalid vector");
+	svf_check("SDR 5000 TDI (0);", 3, 0, 1, "scan too long");
+	svf_check("STATE DRSHIFT;", 4, 0, 1, "unstable end state");
+	svf_check("ENDDR DRSHIFT;", 4, 0, 1, "unstable ENDDR");
+	svf_check("PIO (HL);", 5, 0, 1, "PIO not supported");
+	svf_check("SDR 8 TDI (0) TDO (1);\nSDR 8 TDI (0) TDO (2) ;\nFOO;",
+	          2, 2, 3, "error after mismatches");
+
+	printf(" - SVF player with headers and trailers (3 devices)\n");
+	sim_jtag_chain(&sim_jtag, 3, ir_len, idcode, 1);
+	dap(reset, sizeof(reset));
+	svf_check(chain, 0, 0, 0, "IDCODE of the middle device");
+
+	/* The IDCODE of the JTAG-DP is read with bypass of the others */
+	dap(config, sizeof(config));
+	pkt[0] = 0x16;
+	pkt[1] = 0x01;
+	dap(pkt, sizeof(pkt));
+	check((rsp[1] == 0) && (get32(rsp + 2) == idcode[1]), "IDCODE after SVF");
+
+	sim_jtag_reset(&sim_jtag);
+	dap(disc, sizeof(disc));
+	swd_setup();
+}
+
+/**
+ * @brief Set pins with the boundary scan vendor command
+ *
+ * @param pins  List of {pin, state}
+ * @param count Number of pins to set
+ * @return integer Level of pins 0 to 7 (from the response), -1 for error
+ */
+static int bscan_set(const u8 *pins, uint count)
+{
+	u8 pkt[DAP_PACKET_SIZE] = { 0x89, 0x02 };
+
+	pkt[2] = count;
+	memcpy(pkt + 3, pins, count * 2);
+	if ((dap(pkt, 3 + (count * 2)) != 3) || (rsp[1] != 0x00))
+		return(-1);
+	return(rsp[2]);
+}
+
+static void test_bscan(void)
+{
+	const u8  conn[]    = { 0x02, 0x02 };
+	const u8  disc[]    = { 0x03 };
+	const u8  reset[]   = { 0x12, 5, 0x1F };
+	const u8  detect[]  = { 0x87, 0x00 };
+	const u8  release[] = { 0x89, 0x04 };
+	const u8  ir_len[3] = { 5, 4, 3 };
+	const u32 idcode[3] = { 0x0362D093, SIM_JTAG_IDCODE, 0 };
+	/* Device 0, 16 pins (48 cells), EXTEST 0x00, SAMPLE 0x02 */
+	const u8  setup[] = { 0x89, 0x00, 0, SIM_BSR_PINS * 3, 0,
+	                      SIM_TAP_EXTEST, 0, 0, 0, SIM_TAP_SAMPLE, 0, 0, 0 };
+	/* Pins 0-3 are pins 0-3 of the device, pin 4 is the input of pin 5 */
+	u8   map[4 + (5 * 7)] = { 0x89, 0x01, 0, 5 };
+	const u8  set[]     = { 0x89, 0x02, 1, 7, 1 };
+	const u8  shared[4 + (2 * 7)] = { 0x89, 0x01, 6, 2,
+	                                  18, 0, 19, 0, 20, 0, 0,
+	                                  21, 0, 22, 0, 20, 0, 0 };
+	u8   pins[6], sample[4] = { 0x89, 0x03 };
+	u8  *p;
+	sim_tap_dev *d = &sim_jtag.dev[0];
+	uint i, n, len, scans;
+	u32  v = 0;
+	int  ok;
+
+	printf(" - Boundary scan (cell map, set and sample pins)\n");
+	sim_jtag_chain(&sim_jtag, 3, ir_len, idcode, 1);
+	d->bsr_pins = SIM_BSR_PINS;
+	d->pins     = (1 << 1) | (1 << 5);
+	dap(setup, sizeof(setup));
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "boundary scan needs JTAG mode");
+	dap(conn, sizeof(conn));
+	dap(reset, sizeof(reset));
+	dap(detect, sizeof(detect));
+
+	for (i = 0; i < 5; i++)
+	{
+		n = (i < 4) ? i : 5;
+		p = map + 4 + (i * 7);
+		p[0] = (n * 3);     p[1] = 0;
+		p[2] = (n * 3) + 1; p[3] = 0;
+		p[4] = (n * 3) + 2; p[5] = 0;
+		p[6] = 0;
+	}
+	/* Pin 4 is input only */
+	map[4 + (4 * 7) + 2] = 0xFF; map[4 + (4 * 7) + 3] = 0xFF;
+	map[4 + (4 * 7) + 4] = 0xFF; map[4 + (4 * 7) + 5] = 0xFF;
+	dap(setup, sizeof(setup));
+	check((rsp_len == 2) && (rsp[1] == 0x00), "setup");
+	dap(map, sizeof(map));
+	check((rsp_len == 2) && (rsp[1] == 0x00), "cell map");
+
+	/* Not driven : SAMPLE/PRELOAD is used */
+	sample[2] = 1;
+	dap(sample, sizeof(sample));
+	check((rsp_len == 3) && (rsp[1] == 0x00) && (rsp[2] == 0x12), "sample pins");
+	check(d->ir == SIM_TAP_SAMPLE, "SAMPLE not loaded");
+
+	/* First set : register preloaded before EXTEST */
+	pins[0] = 0; pins[1] = 1;
+	pins[2] = 2; pins[3] = 0;
+	check(bscan_set(pins, 2) == 0x13, "set pins (levels)");
+	check(d->ir == SIM_TAP_EXTEST, "EXTEST not loaded");
+	check((((d->bsr_entry >> 1) & 3) == 3) && (((d->bsr_entry >> 7) & 3) == 2) &&
+	      (((d->bsr_entry >> 4) & 2) == 0), "register not preloaded");
+
+	/* Next sets do not load the instruction again */
+	scans = sim_jtag.ir_scans;
+	pins[0] = 2; pins[1] = 1;
+	check(bscan_set(pins, 1) == 0x17, "set pin 2 high");
+	pins[0] = 0; pins[1] = 2;
+	check(bscan_set(pins, 1) == 0x16, "set pin 0 to high impedance");
+	check(sim_jtag.ir_scans == scans, "instruction loaded again");
+
+	/* Continuous sampling, streamed response */
+	sample[2] = 1000 & 0xFF;
+	sample[3] = 1000 >> 8;
+	dap(sample, sizeof(sample));
+	memcpy(stream + stream_len, rsp, rsp_len);
+	len = stream_len + rsp_len;
+	check((len == 2 + 1000) && (stream_len > 0) && (stream[1] == 0x00), "streamed samples");
+	for (i = 0, ok = 1; i < 1000; i++)
+		if (stream[2 + i] != 0x16)
+			ok = 0;
+	check(ok, "content of samples");
+	check(d->bsr_updates > 1000, "one scan per sample");
+
+	/* A transfer with another device modifies the instructions : the
+	 * register is preloaded again before EXTEST */
+	xfer_index = 1;
+	check((transfer(DP | RD | A(0x0), &v) == 1) && (v == SIM_DPIDR), "DPIDR read");
+	xfer_index = 0;
+	check(d->ir != SIM_TAP_EXTEST, "device still into EXTEST");
+	pins[0] = 3; pins[1] = 1;
+	check(bscan_set(pins, 1) == 0x1E, "set pins after a transfer");
+	check((d->ir == SIM_TAP_EXTEST) && (((d->bsr_entry >> 7) & 3) == 3),
+	      "register not preloaded again");
+
+	/* Pins 6 and 7 share the control cell of pin 6 : it is enabled while
+	 * one of them is driven (pin 6 is pulled high by the board) */
+	d->pins |= (1 << 6);
+	dap(shared, sizeof(shared));
+	check(rsp[1] == 0x00, "map of a shared control cell");
+	pins[0] = 6; pins[1] = 0;
+	pins[2] = 7; pins[3] = 2;
+	check((bscan_set(pins, 2) >= 0) && (sim_jtag_pin(d, 6) == 0),
+	      "control cell disabled by a pin in high impedance");
+	pins[0] = 6; pins[1] = 2;
+	pins[2] = 7; pins[3] = 1;
+	check((bscan_set(pins, 2) >= 0) && ((d->bsr >> 20) & 1),
+	      "shared control cell not enabled");
+	pins[0] = 7; pins[1] = 2;
+	check((bscan_set(pins, 1) >= 0) && (((d->bsr >> 20) & 1) == 0) &&
+	      (sim_jtag_pin(d, 6) == 1), "shared control cell not disabled");
+
+	/* Errors */
+	pins[0] = 4; pins[1] = 1;
+	check(bscan_set(pins, 1) < 0, "set an input only pin");
+	pins[0] = 9; pins[1] = 1;
+	check(bscan_set(pins, 1) < 0, "set a pin out of the map");
+	map[4] = SIM_BSR_PINS * 3;
+	dap(map, sizeof(map));
+	check(rsp[1] == 0xFF, "cell out of the register");
+
+	/* Release : the device drives its pins again */
+	dap(release, sizeof(release));
+	check((rsp[1] == 0x00) && (d->ir == SIM_TAP_IDCODE) &&
+	      (sim_jtag_pin(d, 0) == 0) && (sim_jtag_pin(d, 1) == 1), "release");
+
+	/* Each request uses its own length, other commands can follow it */
+	check((dap_exec(setup, sizeof(setup)) == 2) && (rsp[3] == 0x00) &&
+	      (dap_exec(shared, sizeof(shared)) == 2) && (rsp[3] == 0x00),
+	      "setup and map into a command list");
+	check((dap_exec(set, sizeof(set)) == 3) && (rsp[3] == 0x00), "set into a command list");
+	sample[2] = 1; sample[3] = 0;
+	check((dap_exec(sample, sizeof(sample)) == 3) && (rsp[3] == 0x00),
+	      "sample into a command list");
+	check((dap_exec(release, sizeof(release)) == 2) && (rsp[3] == 0x00),
+	      "release into a command list");
+
+	sim_jtag_reset(&sim_jtag);
+	dap(disc, sizeof(disc));
+	swd_setup();
+}
+
+/**
+ * @brief Send a batch of DMI operations (0x8A, 0x01)
+ *
+ * @param ops   Operations {op, address(2), data(4) for a write}
+ * @param len   Length of ops
+ * @param count Number of operations
+ * @return integer Status of the batch, -1 for a bad response
+ */
+static int dmi_batch(const u8 *ops, uint len, uint count)
+{
+	u8 pkt[DAP_PACKET_SIZE] = { 0x8A, 0x01 };
+
+	pkt[2] = count;
+	memcpy(pkt + 3, ops, len);
+	if ((dap(pkt, 3 + len) < 2) || (rsp[0] != 0x8A))
+		return(-1);
+	return(rsp[1]);
+}
+
+/**
+ * @brief Access a register of the hart with an abstract command (0x8A, 0x02)
+ *
+ */
+static int dmi_reg(uint regno, u32 *value, int write)
+{
+	u8 pkt[9] = { 0x8A, 0x02 };
+
+	pkt[2] = write;
+	pkt[3] = regno & 0xFF;
+	pkt[4] = regno >> 8;
+	put32(pkt + 5, *value);
+	if ((dap(pkt, sizeof(pkt)) != 6) || (rsp[0] != 0x8A))
+		return(-1);
+	*value = get32(rsp + 2);
+	return(rsp[1]);
+}
+
+/**
+ * @brief Read words through the system bus (0x8A, 0x03)
+ *
+ * @param addr  Address of the first word
+ * @param count Number of words
+ * @param done  Pointer where the number of words read is stored
+ * @return integer Status of the read (data into stream), -1 for a bad response
+ */
+static int dmi_mem_read(u32 addr, uint count, uint *done)
+{
+	u8  pkt[8] = { 0x8A, 0x03 };
+	int len;
+
+	put32(pkt + 2, addr);
+	pkt[6] = count & 0xFF;
+	pkt[7] = count >> 8;
+	dap(pkt, sizeof(pkt));
+	memcpy(stream + stream_len, rsp, rsp_len);
+	len = stream_len + rsp_len;
+	if ((len != (int)(4 + count * 4)) || (stream[0] != 0x8A))
+		return(-1);
+	*done = stream[len - 2] | (stream[len - 1] << 8);
+	return(stream[len - 3]);
+}
+
+static void test_dmi(void)
+{
+	const u8  conn[]    = { 0x02, 0x02 };
+	const u8  disc[]    = { 0x03 };
+	const u8  reset[]   = { 0x12, 5, 0x1F };
+	const u8  detect[]  = { 0x87, 0x00 };
+	const u8  ir_len[3] = { 5, 4, 3 };
+	const u32 idcode[3] = { 0x20000913, SIM_JTAG_IDCODE, 0 };
+	u8   setup[3] = { 0x8A, 0x00, 0 };
+	/* Write dmcontrol and data0, read dmstatus, dmcontrol and data0 */
+	const u8  ops[] = { 2, DM_DMCONTROL, 0, 0x01, 0, 0, 0,
+	                    1, DM_DMSTATUS,  0,
+	                    1, DM_DMCONTROL, 0,
+	                    2, DM_DATA0,     0, 0x78, 0x56, 0x34, 0x12,
+	                    1, DM_DATA0,     0 };
+	/* Read dmstatus, a register that fails, then data0 */
+	const u8  bad[] = { 1, DM_DMSTATUS, 0, 1, 0x50, 0, 1, DM_DATA0, 0 };
+	u8   pkt[DAP_PACKET_SIZE] = { 0x8A, 0x04 };
+	uint i, done, scans, ops_count;
+	u32  v;
+	int  ok;
+
+	printf(" - RISC-V DMI (batches, busy retry, abstract commands, system bus)\n");
+	sim_jtag_chain(&sim_jtag, 3, ir_len, idcode, 1);
+	sim_jtag.dev[0].dtm = 1;
+	sim_dm_reset(&sim_rv);
+	dap(setup, sizeof(setup));
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "DMI needs JTAG mode");
+	dap(conn, sizeof(conn));
+	dap(reset, sizeof(reset));
+	dap(detect, sizeof(detect));
+
+	/* The JTAG-DP has no DTM */
+	setup[2] = 1;
+	dap(setup, sizeof(setup));
+	check((rsp_len == 6) && (rsp[1] == DMI_NODTM), "DTM found on the JTAG-DP");
+	setup[2] = 0;
+	dap(setup, sizeof(setup));
+	check((rsp_len == 6) && (rsp[1] == DMI_OK) &&
+	      (((get32(rsp + 2) >> 4) & 0x3F) == SIM_DTM_ABITS), "setup");
+	check((dap_exec(setup, sizeof(setup)) == 6) && (rsp[3] == DMI_OK),
+	      "setup into a command list");
+
+	/* Pipelined : one scan per operation, plus the last NOP */
+	scans = sim_jtag.dr_scans;
+	ops_count = sim_rv.dmi_ops;
+	check((dmi_batch(ops, sizeof(ops), 5) == DMI_OK) && (rsp_len == 3 + 12) &&
+	      (rsp[2] == 5), "batch of operations");
+	check((get32(rsp + 3) == 0x382) && (get32(rsp + 7) == 1) &&
+	      (get32(rsp + 11) == 0x12345678), "results of the batch");
+	check((sim_jtag.dr_scans - scans == 6) && (sim_rv.dmi_ops - ops_count == 5),
+	      "operations not pipelined");
+
+	/* Busy : operations are sent again after dmireset */
+	sim_rv.busy    = 2;
+	sim_rv.busy_at = 2;
+	sim_rv.data0   = 0;
+	check((dmi_batch(ops, sizeof(ops), 5) == DMI_OK) && (rsp[2] == 5) &&
+	      (get32(rsp + 3) == 0x382) && (get32(rsp + 7) == 1) &&
+	      (get32(rsp + 11) == 0x12345678), "batch with busy");
+	check((sim_rv.dmi_busy == 2) && (sim_rv.dmi_resets == 2), "busy not retried");
+	sim_rv.busy = 1000;
+	check(dmi_batch(ops, sizeof(ops), 5) == DMI_BUSY, "busy forever");
+	sim_rv.busy = 0;
+	check(sim_rv.dmi_status == 0, "busy not cleared");
+
+	/* Failed operation : the batch stops */
+	check((dmi_batch(bad, sizeof(bad), 3) == DMI_FAILED) && (rsp[2] == 1) &&
+	      (get32(rsp + 3) == 0x382) && (sim_rv.dmi_status == 0), "failed operation");
+	check(dmi_batch(bad, sizeof(bad) - 1, 3) == 0xFF, "truncated batch");
+
+	/* Abstract commands */
+	v = 0xCAFEF00D;
+	check((dmi_reg(0x1005, &v, 1) == DMI_OK) && (sim_rv.gpr[5] == 0xCAFEF00D), "write x5");
+	sim_rv.gpr[6] = 0x600DF00D;
+	sim_rv.cmd_delay = 3;
+	v = 0;
+	check((dmi_reg(0x1006, &v, 0) == DMI_OK) && (v == 0x600DF00D), "read x6 (polled)");
+	v = 0;
+	check((dmi_reg(0x0300, &v, 0) == DMI_CMDERR) && (v == 3) && (sim_rv.cmderr == 0),
+	      "command error");
+	/* Command sent twice : the second one gets cmderr busy */
+	sim_rv.busy    = 1;
+	sim_rv.busy_at = 1;
+	sim_rv.gpr[7]  = 0x12344321;
+	v = 0;
+	check((dmi_reg(0x1007, &v, 0) == DMI_OK) && (v == 0x12344321) &&
+	      (sim_rv.cmderr == 0), "command with busy");
+	sim_rv.cmd_delay = 0;
+
+	/* System bus write, two blocks */
+	put32(pkt + 2, SIM_DM_RAM_BASE + 0x100);
+	pkt[6] = 62;
+	pkt[7] = 0;
+	for (i = 0; i < 62; i++)
+		put32(pkt + 8 + (i * 4), 0xA5000000 | i);
+	dap(pkt, 8 + (62 * 4));
+	check((rsp_len == 4) && (rsp[1] == DMI_OK) && (rsp[2] == 62), "system bus write");
+	for (i = 0, ok = 1; i < 62; i++)
+		if (sim_rv.ram[(0x100 / 4) + i] != (0xA5000000 | i))
+			ok = 0;
+	check(ok, "content of memory");
+	/* Count larger than the data of the request */
+	pkt[6] = 63;
+	dap(pkt, 8 + (62 * 4));
+	check((rsp_len == 2) && (rsp[1] == 0xFF), "system bus write truncated");
+	/* Into a command list, only count words are used */
+	pkt[6] = 1;
+	put32(pkt + 8, 0x5A5A5A5A);
+	check((dap_exec(pkt, 8 + 4) == 4) && (rsp[3] == DMI_OK) && (rsp[4] == 1) &&
+	      (sim_rv.ram[0x100 / 4] == 0x5A5A5A5A) &&
+	      (sim_rv.ram[(0x100 / 4) + 1] == (0xA5000000 | 1)),
+	      "system bus write into a command list");
+
+	/* System bus read, streamed */
+	for (i = 0; i < (SIM_DM_RAM_SIZE / 4); i++)
+		sim_rv.ram[i] = i * 0x01010101;
+	v = sim_rv.sb_reads;
+	check((dmi_mem_read(SIM_DM_RAM_BASE, 200, &done) == DMI_OK) && (done == 200) &&
+	      (stream_len > 0), "system bus read");
+	for (i = 0, ok = 1; i < 200; i++)
+		if (get32(stream + 1 + (i * 4)) != i * 0x01010101)
+			ok = 0;
+	check(ok, "content of read");
+	check(sim_rv.sb_reads - v == 200, "reads out of the block");
+
+	/* Busy during a block : the block is read again */
+	sim_rv.busy    = 1;
+	sim_rv.busy_at = 20;
+	check((dmi_mem_read(SIM_DM_RAM_BASE + 0x40, 50, &done) == DMI_OK) && (done == 50),
+	      "read with busy");
+	for (i = 0, ok = 1; i < 50; i++)
+		if (get32(stream + 1 + (i * 4)) != (i + 0x10) * 0x01010101)
+			ok = 0;
+	check(ok && (sim_rv.dmi_busy > 2), "content of read with busy");
+
+	/* Bus error */
+	check((dmi_mem_read(SIM_DM_RAM_BASE + SIM_DM_RAM_SIZE - 8, 4, &done) == DMI_SBERR) &&
+	      (done == 0) && (sim_rv.sberror == 0), "bus error");
+
+	sim_jtag_reset(&sim_jtag);
+	dap(disc, sizeof(disc));
+	swd_setup();
+}
+
+static void test_bench(void)
+{
+	const u8 dpidr[]    = { 0x05, 0x00, 0x01, DP | RD | A(0x0) };
+	const u8 ap_rd[]    = { 0x05, 0x00, 0x01, AP | RD | A(0x0) };
+	const u8 ap_wr[]    = { 0x05, 0x00, 0x01, AP | WR | A(0x4), 0, 0, 0, 0x20 };
+	const u8 blk_rd[]   = { 0x06, 0x00, 63, 0x00, AP | RD | A(0xC) };
+	u8 blk_wr[5 + (62 * 4)] = { 0x06, 0x00, 62, 0x00, AP | WR | A(0xC) };
+	const u8 seq[]      = { 0x12, 51, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	const u8 orun_on[]  = { 0x80, 0x01, 0x01 };
+	const u8 orun_off[] = { 0x80, 0x01, 0x00 };
+	const u8 cache_on[] = { 0x80, 0x02, 0x01 };
+	const u8 cache_off[]= { 0x80, 0x02, 0x00 };
+	const u8 mem_rd[]   = { 0x82, 0x02, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x04, 0, 0 };
+	const u8 crc_rd[]   = { 0x84, 0x02, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x04, 0, 0 };
+	u8 tr_rd[3 + 60] = { 0x05, 0x00, 60 };
+	u8 sg_rd[2 + (16 * 6)] = { 0x83, 16 };
+	u8 tr_sg[3 + (16 * 6)] = { 0x05, 0x00, 32 };
+	u8 jseq[2 + (16 * 9)] = { 0x14, 16 };
+	const u8 jconn[]    = { 0x02, 0x02 };
+	const u8 disc[]     = { 0x03 };
+	double ns;
+	u8 *p;
+	uint i;
+
+	printf(" - Benchmark (per command)\n");
+	printf("   %-24s %7s %8s %8s %6s %9s\n", "command",
+	       "clocks", "toggles", "io_acc", "dir", "host_ns");
+	wr(AP | WR | A(0x4), 0x20000000);
+	bench("Transfer DPIDR",      dpidr,  sizeof(dpidr));
+	bench("Transfer AP read",    ap_rd,  sizeof(ap_rd));
+	dap(cache_off, sizeof(cache_off));
+	bench("Transfer AP write",   ap_wr,  sizeof(ap_wr));
+	dap(cache_on, sizeof(cache_on));
+	wr(DP | WR | A(0x8), 0x00000000);
+	bench("Transfer AP write cached", ap_wr, sizeof(ap_wr));
+	wr(AP | WR | A(0x4), 0x20000000);
+	bench("TransferBlock rd 63", blk_rd, sizeof(blk_rd));
+	wr(AP | WR | A(0x4), 0x20000000);
+	bench("TransferBlock wr 62", blk_wr, sizeof(blk_wr));
+	bench("Memory read 1KB",     mem_rd, sizeof(mem_rd));
+	bench("CRC32 1KB",           crc_rd, sizeof(crc_rd));
+	/* Watch window : 4 fields of 4 structures */
+	for (i = 0, p = tr_sg + 3; i < 16; i++)
+	{
+		*p++ = AP | WR | A(0x4);
+		p = put32(p, 0x20000000 + ((i / 4) * 0x124) + ((i % 4) * 4));
+		*p++ = AP | RD | A(0xC);
+	}
+	for (i = 0, p = sg_rd + 2; i < 16; i++)
+	{
+		*p++ = 0x00;
+		*p++ = 0x02;
+		p = put32(p, 0x20000000 + ((i / 4) * 0x124) + ((i % 4) * 4));
+	}
+	bench("Transfer scatter rd 16", tr_sg, sizeof(tr_sg));
+	bench("Scatter read 16",      sg_rd,  sizeof(sg_rd));
+	memset(tr_rd + 3, AP | RD | A(0x0), 60);
+	wr(DP | WR | A(0x8), 0x00000000);
+	bench("Transfer AP rd 60",   tr_rd,  sizeof(tr_rd));
+	dap(orun_on, sizeof(orun_on));
+	bench("Transfer AP rd 60 orun", tr_rd, sizeof(tr_rd));
+	dap(orun_off, sizeof(orun_off));
+	bench("SWJ_Sequence 51",     seq,    sizeof(seq));
+
+	/* 16 sequences of 64 bits with capture */
+	for (i = 0, p = jseq + 2; i < 16; i++)
+	{
+		*p++ = 0x80;
+		memset(p, 0x5A, 8);
+		p += 8;
+	}
+	dap(jconn, sizeof(jconn));
+	ns = bench("JTAG_Sequence 1024",  jseq,   sizeof(jseq));
+	printf("   %-24s %7.2f Mbit/s\n", "", 1024 * 1e3 / ns);
+	dap(disc, sizeof(disc));
+	swd_setup();
+	line_reset();
+	transfer(DP | RD | A(0x0), 0);
+}
+
+/**
+ * @brief Serve the simulated probe on a local socket
+ *
+ * Each message received is a DAP request, the response is sent back as one
+ * message (SOCK_SEQPACKET keeps packet boundaries, like USB bulk transfers).
+ * The server stops when the client disconnects.
+ *
+ * @param path Path of the socket
+ * @return integer Zero on success, -1 for error
+ */
+static int server(const char *path)
+{
+	struct sockaddr_un addr;
+	u8  req[DAP_PACKET_SIZE];
+	int s, c, len;
+	unsigned long count = 0;
+
+	s = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (s < 0)
+	{
+		perror("socket");
+		return(-1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	if ((bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(s, 1) < 0))
+	{
+		perror("bind");
+		close(s);
+		return(-1);
+	}
+	printf(" - Simulated probe listening on %s\n", path);
+	fflush(stdout);
+
+	c = accept(s, 0, 0);
+	stream_sock = c;
+	while (c >= 0)
+	{
+		len = recv(c, req, sizeof(req), 0);
+		if (len <= 0)
+			break;
+		count++;
+		if (dap(req, len) > 0)
+			send(c, rsp, rsp_len, 0);
+	}
+	if (c >= 0)
+		close(c);
+	close(s);
+	unlink(path);
+
+	printf(" - %lu packets, %u SWD requests, %u WAIT, %u FAULT, %u protocol errors\n",
+	       count, sim_tgt.requests, sim_tgt.ack_wait, sim_tgt.ack_fault,
+	       sim_tgt.proto_err);
+	return(0);
+}
+
+/**
+ * @brief Play a SVF file against the simulated TAP
+ *
+ * The file is sent with the SVF vendor command, like a host tool does.
+ *
+ * @param path Path of the SVF file
+ * @return integer Zero if the file is played without error or mismatch
+ */
+static int play(const char *path)
+{
+	static char text[1024 * 1024];
+	const u8 conn[] = { 0x02, 0x02 };
+	FILE  *f;
+	size_t len;
+	int    status;
+
+	f = fopen(path, "rb");
+	if (f == 0)
+	{
+		perror(path);
+		return(-1);
+	}
+	len = fread(text, 1, sizeof(text), f);
+	fclose(f);
+	if (len == sizeof(text))
+	{
+		printf("%s: file too large\n", path);
+		return(-1);
+	}
+
+	dap(conn, sizeof(conn));
+	status = svf_play(text, len, DAP_PACKET_SIZE - 4);
+	printf(" - %s : status %d, %u mismatches, line %u (%u TCK)\n", path,
+	       status, get32(rsp + 2), get32(rsp + 6), sim_jtag.clocks);
+	return(status ? -1 : 0);
+}
+
+/**
+ * @brief Entry point of the program
+ *
+ * @return integer Zero if all tests pass
+ */
+int main(int argc, char **argv)
+{
+	const char *path = 0;
+	const char *svf  = 0;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-v") == 0)
+			sim_verbose = 1;
+		else if ((strcmp(argv[i], "-s") == 0) && ((i + 1) < argc))
+			path = argv[++i];
+		else if ((strcmp(argv[i], "-f") == 0) && ((i + 1) < argc))
+			svf = argv[++i];
+		else
+		{
+			printf("Usage: %s [-v] [-s socket] [-f file.svf]\n", argv[0]);
+			return(1);
+		}
+	}
+
+	sim_target_reset(&sim_tgt);
+	sim_jtag_reset(&sim_jtag);
+	ios_init();
+	dap_init();
+
+	if (path)
+		return(server(path) ? 1 : 0);
+	if (svf)
+		return(play(svf) ? 1 : 0);
+
+	test_info();
+	test_connect();
+	test_ap();
+	test_memory();
+	test_wait();
+	test_fault();
+	test_match();
+	test_swd_config();
+	test_pipe();
+	test_cache();
+	test_mem_cmd();
+	test_scatter();
+	test_crc();
+	test_diff();
+	test_flash();
+	test_jtag_tap();
+	test_jtag_seq();
+	test_jtag_dp();
+	test_jtag_pio();
+	test_jtag_chain();
+	test_svf();
+	test_bscan();
+	test_dmi();
+	test_bench();
+
+	contention += sim_st.contention;
+	check(contention == 0, "line driven by probe and target");
+	check(sim_tgt.parity_err == 0, "parity error on write data");
+
+	printf("\n Test complete ");
+	if (err == 0)
+		printf("\x1b[1;92m0 error\x1b[0m\n");
+	else
+		printf("\x1b[1;91m%d errors\x1b[0m\n", err);
+
+	return(err ? 1 : 0);
+}
+/* EOF */
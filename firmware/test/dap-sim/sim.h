@@ -0,0 +1,227 @@
+/**
+ * @file  sim.h
+ * @brief Headers and definitions for the simulated debug port and target
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef SIM_H
+#define SIM_H
+#include "types.h"
+
+/* Frequency of the simulated system clock */
+#define SIM_SYS_CLOCK 125000000
+
+/* Identifiers returned by the target model */
+#define SIM_DPIDR  0x0BC11477
+#define SIM_AP_IDR 0x04770031
+#define SIM_JTAG_IDCODE 0x4BA00477
+
+/* Max number of devices into the simulated scan chain */
+#define SIM_TAP_MAX 4
+/* Instruction that selects IDCODE, for devices other than the JTAG-DP */
+#define SIM_TAP_IDCODE 0x01
+/* Boundary scan (devices other than the JTAG-DP, when bsr_pins is set) :
+ * pin n has its input cell at 3n, output at 3n+1 and control at 3n+2 (the
+ * output is enabled when the control cell is high) */
+#define SIM_TAP_EXTEST 0x00
+#define SIM_TAP_SAMPLE 0x02
+#define SIM_BSR_PINS   16
+/* RISC-V DTM (device with dtm set) : IR of 5 bits, DM model of sim_riscv.c */
+#define SIM_DTM_ABITS   7
+#define SIM_DM_RAM_BASE 0x80000000
+#define SIM_DM_RAM_SIZE 4096
+/* Memory of the target (RAM) */
+#define SIM_RAM_BASE 0x20000000
+#define SIM_RAM_SIZE (64 * 1024)
+
+/* Flash of the target (written by the flash algorithm only) */
+#define SIM_FLASH_BASE   0x00000000
+#define SIM_FLASH_SIZE   (64 * 1024)
+#define SIM_FLASH_SECTOR 4096
+
+/* Core debug registers (Cortex-M) */
+#define SIM_DHCSR 0xE000EDF0
+#define SIM_DCRSR 0xE000EDF4
+#define SIM_DCRDR 0xE000EDF8
+
+/* Instructions of the fake CPU : the word at PC selects the function of the
+ * flash algorithm to execute (arguments into R0-R2, result into R0), then
+ * the core returns to LR and halts (like on a breakpoint) */
+#define SIM_OP(n)         (0xF1A50000 | (n))
+#define SIM_OP_INIT        1
+#define SIM_OP_UNINIT      2
+#define SIM_OP_ERASE       3
+#define SIM_OP_PROGRAM     4
+
+/* Bits of the DP CTRL/STAT register */
+#define SIM_ORUNDETECT  (1 <<  0)
+#define SIM_STICKYORUN  (1 <<  1)
+#define SIM_STICKYCMP   (1 <<  4)
+#define SIM_STICKYERR   (1 <<  5)
+#define SIM_WDATAERR    (1 <<  7)
+#define SIM_STICKY      (SIM_STICKYORUN | SIM_STICKYCMP | SIM_STICKYERR | SIM_WDATAERR)
+
+typedef struct sim_target_s
+{
+	/* State of the SWD bus decoder */
+	int  state;
+	int  n;
+	int  ones;
+	u32  hdr;
+	u32  data;
+	int  ack;
+	/* Signal driven by the target */
+	int  drive, drive_val;
+	/* After a line reset, DPIDR must be read first */
+	int  locked;
+	/* Turnaround period (DLCR), in clock cycles */
+	int  trn;
+	/* DP registers */
+	u32  ctrl_stat;
+	u32  select;
+	u32  rdbuff;
+	u32  resend;
+	/* MEM-AP registers */
+	u32  csw;
+	u32  tar;
+	/* Memory */
+	u8   ram[SIM_RAM_SIZE];
+	u8   flash[SIM_FLASH_SIZE];
+	/* Core : registers R0-R15 and xPSR, debug registers */
+	u32  core_r[17];
+	u32  dhcsr;      /* C_DEBUGEN, C_HALT, C_STEP, C_MASKINTS */
+	u32  dcrdr;
+	int  running;
+	uint run_polls;  /* Reads of DHCSR before the running core halts */
+	uint run_delay;  /* Value of run_polls when the core is resumed */
+	/* Error injection */
+	uint wait;       /* Number of WAIT to respond to next AP/RDBUFF requests */
+	uint wait_at;    /* WAITs start on the nth next AP/RDBUFF request (0: now) */
+	uint fault_at;   /* Bus error on the nth next memory access (0: never) */
+	uint bad_parity; /* Number of read responses sent with a bad parity */
+	uint busy;       /* Number of reads of the first RAM word with bit 0 set */
+	/* Statistics */
+	uint resets;
+	uint requests;
+	uint ack_wait;
+	uint ack_fault;
+	uint mem_access;
+	uint parity_err;
+	uint proto_err;
+	uint core_runs;  /* Functions executed by the core */
+	uint run_writes; /* Memory writes while the core is running */
+	/* JTAG-DP */
+	u32  jtag_data;   /* Result of the last read */
+	int  jtag_busy;   /* An AP transaction is in progress (WAIT can be sent) */
+	int  jtag_ignore; /* WAIT has been captured, next update is ignored */
+} sim_target;
+
+typedef struct sim_tap_dev_s
+{
+	uint ir_len;
+	u32  idcode;  /* Value of IDCODE register, 0 if the device has none */
+	int  dp;      /* Device is the JTAG-DP of the target model */
+	int  dtm;     /* Device is the RISC-V DTM of the DM model */
+	u32  ir;      /* Current instruction */
+	unsigned long long sr; /* Shift register (IR or DR) */
+	uint sr_len;
+	/* Boundary scan */
+	uint bsr_pins;    /* Number of pins (0 : no boundary-scan register) */
+	unsigned long long bsr;       /* Update register */
+	unsigned long long bsr_entry; /* Update register when EXTEST is loaded */
+	u32  pins;        /* Levels applied on the pins by the board */
+	uint bsr_updates;
+} sim_tap_dev;
+
+typedef struct sim_tap_s
+{
+	int  state;   /* State of the TAP controller (JTAG_RESET ...) */
+	int  tdo;
+	uint count;   /* Devices into the chain, device 0 is connected to TDO */
+	sim_tap_dev dev[SIM_TAP_MAX];
+	uint clocks;  /* Rising edges of TCK */
+	uint resets;  /* Entries into Test-Logic-Reset */
+	uint ir_scans;
+	uint dr_scans;
+} sim_tap;
+
+typedef struct sim_dm_s
+{
+	/* DTM */
+	u32  dmi_data;    /* Result of the last operation */
+	uint dmi_status;  /* Sticky status of the DMI : 0, 2 (failed), 3 (busy) */
+	uint dmi_addr;
+	/* Debug Module */
+	u32  data0;
+	u32  dmcontrol;
+	u32  cmderr;
+	uint abs_busy;    /* Reads of abstractcs before the command completes */
+	u32  gpr[32];     /* Registers of the hart */
+	u32  sbcs;        /* sbreadonaddr, sbaccess, sbautoincrement, sbreadondata */
+	u32  sberror;
+	u32  sbbusyerror;
+	u32  sbaddress;
+	u32  sbdata;
+	u32  ram[SIM_DM_RAM_SIZE / 4];
+	/* Error injection */
+	uint busy;        /* Next DMI scans that find an operation in progress */
+	uint busy_at;     /* Busy starts on the nth next DMI scan (0: now) */
+	uint cmd_delay;   /* Value of abs_busy when a command is started */
+	/* Statistics */
+	uint dmi_ops;     /* Operations executed */
+	uint dmi_busy;    /* Busy captured */
+	uint dmi_resets;  /* Writes of dtmcs.dmireset */
+	uint commands;
+	uint sb_reads;
+	uint sb_writes;
+} sim_dm;
+
+typedef struct sim_stats_s
+{
+	unsigned long pin_set;  /* Number of calls to ios_pin_set() */
+	unsigned long pin_get;  /* Number of calls to ios_pin() */
+	unsigned long toggles;  /* Number of real level changes of outputs */
+	unsigned long dir;      /* Number of direction changes */
+	unsigned long clocks;   /* Number of rising edges of SWCLK/TCK */
+	unsigned long contention;
+	unsigned long swd_pio_init;  /* Number of calls to swd_pio_init() */
+	unsigned long jtag_pio_init; /* Number of calls to jtag_pio_init() */
+	unsigned long jtag_pio_lost; /* JTAG PIO shifts dropped (bad length) */
+} sim_stats;
+
+extern sim_target sim_tgt;
+extern sim_stats  sim_st;
+extern sim_tap    sim_jtag;
+extern sim_dm     sim_rv;
+extern int        sim_verbose;
+extern unsigned long long sim_wait_us; /* Total of busy waits (us) */
+extern int sim_jtag_pio; /* True : JTAG PIO engine available (on the TAP model) */
+
+/* Simulated IOs (sim_ios.c) */
+void sim_ios_reset(void);
+/* Target model (sim_target.c) */
+void sim_target_reset(sim_target *t);
+void sim_target_edge (sim_target *t, int host, int line);
+unsigned long long sim_target_jtag_capture(sim_target *t);
+void sim_target_jtag_update(sim_target *t, u32 ir, unsigned long long dr);
+/* JTAG TAP model (sim_jtag.c) */
+void sim_jtag_reset(sim_tap *t);
+void sim_jtag_chain(sim_tap *t, uint count, const u8 *ir_len, const u32 *idcode, uint dp);
+int  sim_jtag_next (int state, int tms);
+void sim_jtag_edge (sim_tap *t, int tms, int tdi);
+int  sim_jtag_pin  (const sim_tap_dev *d, uint pin);
+/* RISC-V Debug Module model (sim_riscv.c) */
+void sim_dm_reset(sim_dm *m);
+unsigned long long sim_dm_capture(sim_dm *m, u32 ir);
+void sim_dm_update(sim_dm *m, u32 ir, unsigned long long dr);
+
+#endif
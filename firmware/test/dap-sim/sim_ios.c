@@ -0,0 +1,174 @@
+/**
+ * @file  sim_ios.c
+ * @brief Simulated IOs of the debug port (replace ios.c for host build)
+ *
+ * The functions of the ios module are implemented on top of the target
+ * model : SWCLK (D2) clocks the target and SWDIO (D1) is resolved from the
+ * direction of the probe and the signal driven by the target. In JTAG mode,
+ * TCK (D2) clocks the TAP model with TMS (D1) and TDI (D3). All accesses
+ * are counted to measure the cost of each DAP command.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "ios.h"
+#include "sim.h"
+
+#define PIN_SWDIO PORT_D1_PIN
+#define PIN_SWCLK PORT_D2_PIN
+#define PIN_TMS   PORT_D1_PIN
+#define PIN_TDI   PORT_D3_PIN
+
+sim_stats sim_st;
+
+static int pin_level[32];
+static int pin_dir[32];
+static int port_mode;
+
+/**
+ * @brief Reset IOs to their power-on state (all inputs)
+ *
+ */
+void sim_ios_reset(void)
+{
+	memset(pin_level, 0, sizeof(pin_level));
+	memset(pin_dir,   0, sizeof(pin_dir));
+	port_mode = PORT_MODE_HIZ;
+}
+
+/**
+ * @brief Level of SWDIO, seen by both probe and target
+ *
+ */
+static int swdio_line(void)
+{
+	if (pin_dir[PIN_SWDIO])
+		return(pin_level[PIN_SWDIO]);
+	if (sim_tgt.drive)
+		return(sim_tgt.drive_val);
+	/* Pull-up */
+	return(1);
+}
+
+/**
+ * @brief Initialize GPIOs
+ *
+ */
+void ios_init(void)
+{
+	sim_ios_reset();
+}
+
+/**
+ * @brief Configure the IOs of debug port for a specified mode
+ *
+ * @param mode New mode to set for the debug port
+ */
+void ios_mode(int mode)
+{
+	port_mode = mode;
+	if (mode == PORT_MODE_HIZ)
+	{
+		ios_pin_mode(PORT_D0_PIN, IO_DIR_IN);
+		ios_pin_mode(PORT_D1_PIN, IO_DIR_IN);
+		ios_pin_mode(PORT_D2_PIN, IO_DIR_IN);
+		ios_pin_mode(PORT_D3_PIN, IO_DIR_IN);
+	}
+	else if (mode == PORT_MODE_JTAG)
+	{
+		ios_pin_mode(PORT_D0_PIN, IO_DIR_IN);
+		ios_pin_mode(PORT_D1_PIN, IO_DIR_OUT);
+		ios_pin_set (PORT_D1_PIN, 0);
+		ios_pin_mode(PORT_D2_PIN, IO_DIR_OUT);
+		ios_pin_set (PORT_D2_PIN, 0);
+		ios_pin_mode(PORT_D3_PIN, IO_DIR_OUT);
+		ios_pin_set (PORT_D3_PIN, 0);
+	}
+	else if (mode == PORT_MODE_SWD)
+	{
+		ios_pin_mode(PORT_D1_PIN, IO_DIR_OUT);
+		ios_pin_set (PORT_D1_PIN, 1);
+		ios_pin_mode(PORT_D2_PIN, IO_DIR_OUT);
+		ios_pin_set (PORT_D2_PIN, 1);
+		ios_pin_mode(PORT_D3_PIN, IO_DIR_OUT);
+		ios_pin_set (PORT_D3_PIN, 1);
+	}
+}
+
+/**
+ * @brief Read the current state of an IO
+ *
+ * @param pin Identifier of the pin to read
+ * @return Current value of the pin
+ */
+int ios_pin(int pin)
+{
+	sim_st.pin_get++;
+
+	if ((pin == PORT_D0_PIN) && (port_mode == PORT_MODE_JTAG))
+		return(sim_jtag.tdo);
+	if (pin == PIN_SWDIO)
+		return(swdio_line());
+	return(pin_level[pin & 31]);
+}
+
+/**
+ * @brief Configure one specific pin (in or out)
+ *
+ * @param pin  Identifier of the pin to configure
+ * @param mode New mode to set for the specified pin
+ */
+void ios_pin_mode(int pin, int mode)
+{
+	pin &= 31;
+	if (pin_dir[pin] != mode)
+		sim_st.dir++;
+	pin_dir[pin] = mode;
+}
+
+/**
+ * @brief Set the output level of one pin
+ *
+ * A rising edge of SWCLK clocks the target model.
+ *
+ * @param pin   Identifier of the pin to set
+ * @param state New level of the pin
+ */
+void ios_pin_set(int pin, int state)
+{
+	int prev;
+
+	pin  &= 31;
+	state = state ? 1 : 0;
+	sim_st.pin_set++;
+
+	prev = pin_level[pin];
+	pin_level[pin] = state;
+	if (prev == state)
+		return;
+	sim_st.toggles++;
+
+	if ((pin == PIN_SWCLK) && state)
+	{
+		sim_st.clocks++;
+		if (port_mode == PORT_MODE_JTAG)
+		{
+			sim_jtag_edge(&sim_jtag, pin_level[PIN_TMS], pin_level[PIN_TDI]);
+			return;
+		}
+		/* Probe and target must never drive the line at the same time */
+		if (pin_dir[PIN_SWDIO] && sim_tgt.drive)
+			sim_st.contention++;
+		sim_target_edge(&sim_tgt, pin_dir[PIN_SWDIO], swdio_line());
+	}
+}
+/* EOF */
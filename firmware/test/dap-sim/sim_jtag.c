@@ -0,0 +1,302 @@
+/**
+ * @file  sim_jtag.c
+ * @brief Model of a JTAG TAP controller used by the host build
+ *
+ * The TAP is clocked by the rising edges of TCK when the debug port is in
+ * JTAG mode. Transitions are decoded here from the IEEE 1149.1 state
+ * diagram, independently of the tables of the firmware (jtag.c).
+ *
+ * The scan chain has up to SIM_TAP_MAX devices sharing TMS and TCK. One of
+ * them can be an ARM JTAG-DP connected to the target model, and another one
+ * a RISC-V DTM connected to the DM model (sim_riscv.c). Others only have
+ * IDCODE, BYPASS and optionally boundary-scan registers.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "jtag.h"
+#include "jtag_dmi.h"
+#include "sim.h"
+
+sim_tap sim_jtag;
+
+static void tap_reset(sim_tap *t);
+
+/**
+ * @brief Reset the TAP model (power-on)
+ *
+ * @param t Pointer to the TAP model
+ */
+void sim_jtag_reset(sim_tap *t)
+{
+	const u8  ir_len = 4;
+	const u32 idcode = SIM_JTAG_IDCODE;
+
+	memset(t, 0, sizeof(sim_tap));
+	sim_jtag_chain(t, 1, &ir_len, &idcode, 0);
+}
+
+/**
+ * @brief Set the devices of the scan chain (and reset their TAP)
+ *
+ * @param t      Pointer to the TAP model
+ * @param count  Number of devices (device 0 is connected to TDO)
+ * @param ir_len Length of the IR of each device
+ * @param idcode Value of IDCODE of each device (0 for none)
+ * @param dp     Index of the device that is the JTAG-DP
+ */
+void sim_jtag_chain(sim_tap *t, uint count, const u8 *ir_len, const u32 *idcode, uint dp)
+{
+	uint i;
+
+	memset(t->dev, 0, sizeof(t->dev));
+	t->count = count;
+	for (i = 0; i < count; i++)
+	{
+		t->dev[i].ir_len = ir_len[i];
+		t->dev[i].idcode = idcode[i];
+		t->dev[i].dp     = (i == dp);
+	}
+	t->state = JTAG_RESET;
+	tap_reset(t);
+}
+
+/**
+ * @brief Test-Logic-Reset : IDCODE (or BYPASS) is selected
+ *
+ * @param t Pointer to the TAP model
+ */
+static void tap_reset(sim_tap *t)
+{
+	sim_tap_dev *d;
+	uint i;
+
+	for (i = 0; i < t->count; i++)
+	{
+		d = &t->dev[i];
+		if (d->dp)
+			d->ir = JTAG_IR_IDCODE;
+		else if (d->idcode)
+			d->ir = SIM_TAP_IDCODE;
+		else
+			d->ir = (1u << d->ir_len) - 1;
+	}
+}
+
+/**
+ * @brief Capture-DR : load the register selected by the instruction
+ *
+ * @param d Pointer to the device
+ */
+static void tap_capture(sim_tap_dev *d)
+{
+	uint i;
+
+	/* Registers of the JTAG-DP */
+	if (d->dp && ((d->ir == JTAG_IR_DPACC) || (d->ir == JTAG_IR_APACC)))
+	{
+		d->sr     = sim_target_jtag_capture(&sim_tgt);
+		d->sr_len = 35;
+	}
+	else if (d->dp && (d->ir == JTAG_IR_ABORT))
+	{
+		d->sr     = 0;
+		d->sr_len = 35;
+	}
+	/* Registers of the RISC-V DTM */
+	else if (d->dtm && ((d->ir == DMI_IR_DTMCS) || (d->ir == DMI_IR_DMI)))
+	{
+		d->sr     = sim_dm_capture(&sim_rv, d->ir);
+		d->sr_len = (d->ir == DMI_IR_DTMCS) ? 32 : (SIM_DTM_ABITS + 34);
+	}
+	/* Boundary scan : pins are captured by input cells */
+	else if (d->bsr_pins && ! d->dp &&
+	         ((d->ir == SIM_TAP_EXTEST) || (d->ir == SIM_TAP_SAMPLE)))
+	{
+		d->sr = d->bsr;
+		for (i = 0; i < d->bsr_pins; i++)
+		{
+			d->sr &= ~(1ULL << (i * 3));
+			d->sr |= ((unsigned long long)sim_jtag_pin(d, i) << (i * 3));
+		}
+		d->sr_len = d->bsr_pins * 3;
+	}
+	/* IDCODE */
+	else if (d->idcode &&
+	         (d->ir == (d->dp ? JTAG_IR_IDCODE : SIM_TAP_IDCODE)))
+	{
+		d->sr     = d->idcode;
+		d->sr_len = 32;
+	}
+	/* BYPASS, and all unknown instructions */
+	else
+	{
+		d->sr     = 0;
+		d->sr_len = 1;
+	}
+}
+
+/**
+ * @brief Shift all registers of the chain by one bit
+ *
+ * @param t   Pointer to the TAP model
+ * @param tdi Level of TDI
+ */
+static void tap_shift(sim_tap *t, int tdi)
+{
+	unsigned long long in = tdi, out;
+	sim_tap_dev *d;
+	int i;
+
+	/* TDI is connected to the last device */
+	for (i = t->count - 1; i >= 0; i--)
+	{
+		d = &t->dev[i];
+		out   = (d->sr & 1);
+		d->sr = (d->sr >> 1) | (in << (d->sr_len - 1));
+		in    = out;
+	}
+}
+
+/**
+ * @brief Next state of a TAP controller
+ *
+ * @param state Current state
+ * @param tms   Level of TMS on the rising edge of TCK
+ * @return integer New state
+ */
+int sim_jtag_next(int state, int tms)
+{
+	switch (state)
+	{
+		case JTAG_RESET:
+			return(tms ? JTAG_RESET : JTAG_IDLE);
+		case JTAG_IDLE:
+		case JTAG_DRUPDATE:
+		case JTAG_IRUPDATE:
+			return(tms ? JTAG_DRSELECT : JTAG_IDLE);
+		case JTAG_DRSELECT:
+			return(tms ? JTAG_IRSELECT : JTAG_DRCAPTURE);
+		case JTAG_DRCAPTURE:
+		case JTAG_DRSHIFT:
+			return(tms ? JTAG_DREXIT1 : JTAG_DRSHIFT);
+		case JTAG_DREXIT1:
+			return(tms ? JTAG_DRUPDATE : JTAG_DRPAUSE);
+		case JTAG_DRPAUSE:
+			return(tms ? JTAG_DREXIT2 : JTAG_DRPAUSE);
+		case JTAG_DREXIT2:
+			return(tms ? JTAG_DRUPDATE : JTAG_DRSHIFT);
+		case JTAG_IRSELECT:
+			return(tms ? JTAG_RESET : JTAG_IRCAPTURE);
+		case JTAG_IRCAPTURE:
+		case JTAG_IRSHIFT:
+			return(tms ? JTAG_IREXIT1 : JTAG_IRSHIFT);
+		case JTAG_IREXIT1:
+			return(tms ? JTAG_IRUPDATE : JTAG_IRPAUSE);
+		case JTAG_IRPAUSE:
+			return(tms ? JTAG_IREXIT2 : JTAG_IRPAUSE);
+		case JTAG_IREXIT2:
+			return(tms ? JTAG_IRUPDATE : JTAG_IRSHIFT);
+	}
+	return(JTAG_RESET);
+}
+
+/**
+ * @brief Level of a pin of a device with a boundary-scan register
+ *
+ * @param d   Pointer to the device
+ * @param pin Number of the pin
+ * @return integer Level driven by EXTEST, or applied by the board
+ */
+int sim_jtag_pin(const sim_tap_dev *d, uint pin)
+{
+	if ((d->ir == SIM_TAP_EXTEST) && ((d->bsr >> (pin * 3 + 2)) & 1))
+		return((int)((d->bsr >> (pin * 3 + 1)) & 1));
+	return((int)((d->pins >> pin) & 1));
+}
+
+/**
+ * @brief Rising edge of TCK
+ *
+ * @param t   Pointer to the TAP model
+ * @param tms Level of TMS
+ * @param tdi Level of TDI
+ */
+void sim_jtag_edge(sim_tap *t, int tms, int tdi)
+{
+	sim_tap_dev *d;
+	uint i;
+	int  next;
+
+	t->clocks++;
+	switch (t->state)
+	{
+		case JTAG_DRCAPTURE:
+			for (i = 0; i < t->count; i++)
+				tap_capture(&t->dev[i]);
+			break;
+		/* IR capture value ends with 01 */
+		case JTAG_IRCAPTURE:
+			for (i = 0; i < t->count; i++)
+			{
+				t->dev[i].sr     = 1;
+				t->dev[i].sr_len = t->dev[i].ir_len;
+			}
+			break;
+		case JTAG_DRSHIFT:
+		case JTAG_IRSHIFT:
+			tap_shift(t, tdi);
+			break;
+	}
+
+	next = sim_jtag_next(t->state, tms);
+	if ((next == JTAG_RESET) && (t->state != JTAG_RESET))
+		t->resets++;
+	t->state = next;
+
+	switch (next)
+	{
+		case JTAG_RESET:
+			tap_reset(t);
+			break;
+		case JTAG_DRUPDATE:
+			t->dr_scans++;
+			for (i = 0; i < t->count; i++)
+			{
+				d = &t->dev[i];
+				if (d->dp && (d->sr_len == 35))
+					sim_target_jtag_update(&sim_tgt, d->ir, d->sr);
+				if (d->dtm && ((d->ir == DMI_IR_DTMCS) || (d->ir == DMI_IR_DMI)))
+					sim_dm_update(&sim_rv, d->ir, d->sr);
+				if (d->bsr_pins && ! d->dp &&
+				    ((d->ir == SIM_TAP_EXTEST) || (d->ir == SIM_TAP_SAMPLE)))
+				{
+					d->bsr = d->sr;
+					d->bsr_updates++;
+				}
+			}
+			break;
+		case JTAG_IRUPDATE:
+			t->ir_scans++;
+			for (i = 0; i < t->count; i++)
+			{
+				d = &t->dev[i];
+				d->ir = (u32)d->sr & ((1u << d->ir_len) - 1);
+				if (d->ir == SIM_TAP_EXTEST)
+					d->bsr_entry = d->bsr;
+			}
+			break;
+	}
+	/* TDO is the output of device 0 (driven after the falling edge) */
+	t->tdo = t->count ? (int)(t->dev[0].sr & 1) : tdi;
+}
+/* EOF */
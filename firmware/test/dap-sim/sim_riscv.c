@@ -0,0 +1,277 @@
+/**
+ * @file  sim_riscv.c
+ * @brief Model of a RISC-V JTAG DTM and Debug Module used by the host build
+ *
+ * The DTM has the registers dtmcs and dmi of the RISC-V Debug Specification
+ * 0.13. Operations are executed by the Update-DR of the scan that sends
+ * them, their result is captured by the next scan. Error injection makes
+ * some scans capture "busy" : the operation of that scan is ignored, and
+ * next ones too until the error is cleared by dtmcs.dmireset.
+ *
+ * The DM has one halted hart (abstract commands on GPRs only) and a system
+ * bus with SIM_DM_RAM_SIZE bytes of RAM (32 bits accesses only).
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "jtag_dmi.h"
+#include "sim.h"
+
+sim_dm sim_rv;
+
+static u32  dm_read(sim_dm *m, uint addr);
+static void dm_write(sim_dm *m, uint addr, u32 value);
+static void dm_command(sim_dm *m, u32 cmd);
+static void dm_sb_access(sim_dm *m, int write);
+
+/**
+ * @brief Reset the DTM and DM model (power-on)
+ *
+ * @param m Pointer to the model
+ */
+void sim_dm_reset(sim_dm *m)
+{
+	memset(m, 0, sizeof(sim_dm));
+}
+
+/**
+ * @brief Capture-DR of the DTM
+ *
+ * @param m  Pointer to the model
+ * @param ir Current instruction of the DTM
+ * @return integer Value of the register (dtmcs or dmi)
+ */
+unsigned long long sim_dm_capture(sim_dm *m, u32 ir)
+{
+	if (ir == DMI_IR_DTMCS)
+		/* version 1 (0.13), abits, dmistat, idle hint 1 */
+		return(1 | (SIM_DTM_ABITS << 4) | (m->dmi_status << 10) | (1 << 12));
+
+	if (m->busy_at)
+		m->busy_at--;
+	else if (m->busy)
+	{
+		m->busy--;
+		m->dmi_busy++;
+		m->dmi_status = 3;
+	}
+	return(((unsigned long long)m->dmi_addr << 34) |
+	       ((unsigned long long)m->dmi_data << 2) | m->dmi_status);
+}
+
+/**
+ * @brief Update-DR of the DTM
+ *
+ * @param m  Pointer to the model
+ * @param ir Current instruction of the DTM
+ * @param dr Value shifted into the register
+ */
+void sim_dm_update(sim_dm *m, u32 ir, unsigned long long dr)
+{
+	uint op   = (uint)(dr & 3);
+	u32  data = (u32)(dr >> 2);
+	uint addr = (uint)(dr >> 34) & ((1 << SIM_DTM_ABITS) - 1);
+
+	if (ir == DMI_IR_DTMCS)
+	{
+		/* dmireset */
+		if (dr & (1 << 16))
+		{
+			m->dmi_status = 0;
+			m->dmi_resets++;
+		}
+		return;
+	}
+	/* Sticky error : operations are ignored */
+	if (m->dmi_status || (op == 0) || (op == 3))
+		return;
+
+	m->dmi_ops++;
+	m->dmi_addr = addr;
+	/* Registers over 0x40 are not implemented by the model : op fails */
+	if (addr >= 0x40)
+	{
+		m->dmi_status = 2;
+		return;
+	}
+	if (op == 1)
+		m->dmi_data = dm_read(m, addr);
+	else
+		dm_write(m, addr, data);
+}
+
+/**
+ * @brief Read a register of the DM
+ *
+ */
+static u32 dm_read(sim_dm *m, uint addr)
+{
+	u32 value;
+
+	switch (addr)
+	{
+		case DM_DATA0:
+			return(m->data0);
+		case DM_DMCONTROL:
+			return(m->dmcontrol);
+		/* version 2 (0.13), authenticated, anyhalted, allhalted */
+		case DM_DMSTATUS:
+			return(0x382);
+		/* datacount 1, cmderr, busy */
+		case DM_ABSTRACTCS:
+			value = 1 | (m->cmderr << 8);
+			if (m->abs_busy)
+			{
+				value |= DM_ABS_BUSY;
+				m->abs_busy--;
+			}
+			return(value);
+		/* sbversion 1, sbasize 32, sbaccess32 */
+		case DM_SBCS:
+			return((1 << 29) | (m->sbbusyerror << 22) | m->sbcs |
+			       (m->sberror << 12) | (32 << 5) | (1 << 2));
+		case DM_SBADDRESS0:
+			return(m->sbaddress);
+		case DM_SBDATA0:
+			value = m->sbdata;
+			if (m->sbcs & DM_SB_READONDATA)
+				dm_sb_access(m, 0);
+			return(value);
+	}
+	return(0);
+}
+
+/**
+ * @brief Write a register of the DM
+ *
+ */
+static void dm_write(sim_dm *m, uint addr, u32 value)
+{
+	switch (addr)
+	{
+		case DM_DATA0:
+			if (m->abs_busy && (m->cmderr == 0))
+				m->cmderr = 1;
+			else if ( ! m->abs_busy)
+				m->data0 = value;
+			break;
+		case DM_DMCONTROL:
+			m->dmcontrol = value;
+			break;
+		/* cmderr is cleared by writing ones */
+		case DM_ABSTRACTCS:
+			m->cmderr &= ~((value >> 8) & 7);
+			break;
+		case DM_COMMAND:
+			dm_command(m, value);
+			break;
+		case DM_SBCS:
+			m->sbcs = value & (DM_SB_READONADDR | (7 << 17) |
+			                   DM_SB_AUTOINC | DM_SB_READONDATA);
+			if (value & DM_SB_BUSYERROR)
+				m->sbbusyerror = 0;
+			m->sberror &= ~((value >> 12) & 7);
+			break;
+		case DM_SBADDRESS0:
+			m->sbaddress = value;
+			if (m->sbcs & DM_SB_READONADDR)
+				dm_sb_access(m, 0);
+			break;
+		case DM_SBDATA0:
+			m->sbdata = value;
+			dm_sb_access(m, 1);
+			break;
+	}
+}
+
+/**
+ * @brief Execute an abstract command (access register only)
+ *
+ */
+static void dm_command(sim_dm *m, u32 cmd)
+{
+	uint regno = cmd & 0xFFFF;
+
+	/* Command written while the previous one is running */
+	if (m->abs_busy)
+	{
+		if (m->cmderr == 0)
+			m->cmderr = 1;
+		return;
+	}
+	if (m->cmderr)
+		return;
+	m->commands++;
+	m->abs_busy = m->cmd_delay;
+
+	/* cmdtype 0 and aarsize 2 only : "not supported" */
+	if (((cmd >> 24) != 0) || (((cmd >> 20) & 7) != 2))
+	{
+		m->cmderr = 2;
+		return;
+	}
+	if ((cmd & (1 << 17)) == 0)
+		return;
+	/* GPRs only : "exception" for other registers */
+	if ((regno < 0x1000) || (regno > 0x101F))
+	{
+		m->cmderr = 3;
+		return;
+	}
+	regno -= 0x1000;
+	if ((cmd & (1 << 16)) == 0)
+		m->data0 = m->gpr[regno];
+	else if (regno != 0)
+		m->gpr[regno] = m->data0;
+}
+
+/**
+ * @brief Access to the system bus (sbdata0 from/to sbaddress0)
+ *
+ */
+static void dm_sb_access(sim_dm *m, int write)
+{
+	u32 offset = m->sbaddress - SIM_DM_RAM_BASE;
+
+	/* No access while an error is pending */
+	if (m->sberror || m->sbbusyerror)
+		return;
+	/* 32 bits accesses only : "unsupported size" */
+	if (((m->sbcs >> 17) & 7) != 2)
+	{
+		m->sberror = 4;
+		return;
+	}
+	if ((m->sbaddress < SIM_DM_RAM_BASE) || (offset >= SIM_DM_RAM_SIZE))
+	{
+		m->sberror = 2;
+		return;
+	}
+	if (m->sbaddress & 3)
+	{
+		m->sberror = 3;
+		return;
+	}
+	if (write)
+	{
+		m->ram[offset / 4] = m->sbdata;
+		m->sb_writes++;
+	}
+	else
+	{
+		m->sbdata = m->ram[offset / 4];
+		m->sb_reads++;
+	}
+	if (m->sbcs & DM_SB_AUTOINC)
+		m->sbaddress += 4;
+}
+/* EOF */
@@ -0,0 +1,223 @@
+/**
+ * @file  sim_stubs.c
+ * @brief Host replacement of the firmware modules that need real hardware
+ *
+ * Logs are written to stderr (when verbose), the PIO SWD engine is reported
+ * as unavailable so the SWD module falls back to the GPIO engine (the PIO
+ * program has its own emulator, see test/pio-swd). The CRC32 of the DMA
+ * sniffer is computed by software.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "crc.h"
+#include "log.h"
+#include "sim.h"
+#include "jtag_pio.h"
+#include "swd_pio.h"
+
+int sim_verbose = 0;
+unsigned long long sim_wait_us = 0;
+int sim_jtag_pio = 0;
+systick_hw_t sim_systick;
+
+/* -------------------------------------------------------------------------- */
+/* --                                 SDK                                  -- */
+/* -------------------------------------------------------------------------- */
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+	(void)clk_index;
+	return(SIM_SYS_CLOCK);
+}
+
+void busy_wait_us_32(uint32_t delay_us)
+{
+	/* Time is not simulated, only the total of delays is kept */
+	sim_wait_us += delay_us;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                                 Logs                                 -- */
+/* -------------------------------------------------------------------------- */
+
+void log_init(void)
+{
+}
+
+void log_putdec(const uint32_t v)
+{
+	if (sim_verbose)
+		fprintf(stderr, "%u", (unsigned int)v);
+}
+
+void log_puthex(const uint32_t c, const uint8_t len)
+{
+	if (sim_verbose)
+		fprintf(stderr, "%0*X", len / 4, (unsigned int)c);
+}
+
+void log_puts(char *s)
+{
+	if (sim_verbose)
+		fputs(s, stderr);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                         CRC32 (DMA sniffer)                          -- */
+/* -------------------------------------------------------------------------- */
+
+static u32 sim_crc;
+
+int crc_init(void)
+{
+	return(0);
+}
+
+int crc_start(void)
+{
+	sim_crc = 0xFFFFFFFF;
+	return(0);
+}
+
+void crc_update(const u8 *data, uint len)
+{
+	int i;
+
+	for ( ; len; len--)
+	{
+		sim_crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			sim_crc = (sim_crc >> 1) ^ (0xEDB88320 & -(sim_crc & 1));
+	}
+}
+
+u32 crc_result(void)
+{
+	return(~sim_crc);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                           JTAG PIO engine                            -- */
+/* -------------------------------------------------------------------------- */
+
+void jtag_pio_clock(void)
+{
+}
+
+/*
+ * When sim_jtag_pio is set, shifts are executed at once on the TAP model,
+ * with the limits of the real engine : up to 32 bits per shift, longer
+ * shifts are dropped (and counted).
+ */
+int jtag_pio_init(void)
+{
+	sim_st.jtag_pio_init++;
+	/* Not available by default, use GPIO engine */
+	return(sim_jtag_pio ? 0 : -1);
+}
+
+void jtag_pio_release(void)
+{
+}
+
+u32 jtag_pio_shift(u32 tdi, uint len, uint tms)
+{
+	u32  tdo = 0;
+	uint i;
+
+	if (len > 32)
+	{
+		sim_st.jtag_pio_lost++;
+		return(0);
+	}
+	for (i = 0; i < len; i++)
+	{
+		tdo |= ((u32)sim_jtag.tdo << i);
+		sim_st.clocks++;
+		sim_jtag_edge(&sim_jtag, tms, (tdi >> i) & 1);
+	}
+	return(tdo);
+}
+
+void jtag_pio_queue(u32 tdi, uint len, uint tms, u8 *tdo)
+{
+	u32  value;
+	uint i;
+
+	value = jtag_pio_shift(tdi, len, tms);
+	if (tdo == 0)
+		return;
+	for (i = 0; i < len; i += 8)
+	{
+		*tdo++ = (u8)value;
+		value >>= 8;
+	}
+}
+
+void jtag_pio_flush(void)
+{
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                           SWD PIO engine                             -- */
+/* -------------------------------------------------------------------------- */
+
+void swd_pio_clock(void)
+{
+}
+
+int swd_pio_init(void)
+{
+	sim_st.swd_pio_init++;
+	/* Not available, use GPIO engine */
+	return(-1);
+}
+
+void swd_pio_release(void)
+{
+}
+
+int swd_pio_get(u32 *value)
+{
+	(void)value;
+	return(0);
+}
+
+void swd_pio_put(u8 req, u32 value)
+{
+	(void)req;
+	(void)value;
+}
+
+u32 swd_pio_rd(uint len)
+{
+	(void)len;
+	return(0);
+}
+
+int swd_pio_transfer(u8 req, u32 *value)
+{
+	(void)req;
+	(void)value;
+	return(0);
+}
+
+void swd_pio_wr(u32 value, uint len)
+{
+	(void)value;
+	(void)len;
+}
+/* EOF */
@@ -0,0 +1,678 @@
+/**
+ * @file  sim_target.c
+ * @brief Bit-level model of a SWD target (DP, MEM-AP and RAM)
+ *
+ * The model is clocked by the rising edges of SWCLK, like a real target. It
+ * decodes requests, drives ACK and read data, and implements the subset of
+ * ADIv5 used by debuggers : DPIDR, ABORT, CTRL/STAT with sticky flags,
+ * DLCR (turnaround period), SELECT, RDBUFF, overrun detection (data phase
+ * after WAIT and FAULT), posted AP reads and a MEM-AP with auto-increment (wrapped
+ * on 1KB boundaries) connected to a RAM. WAIT responses, bus faults and
+ * parity errors can be injected, and the first word of RAM can act as a busy
+ * status register.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "jtag.h"
+#include "sim.h"
+
+/* States of the bus decoder */
+enum { T_IDLE, T_RESET, T_HDR, T_TRN, T_ACK, T_RDATA, T_TRN_W, T_WDATA, T_TRN_END };
+
+#define REQ_APnDP(h) (((h) >> 1) & 1)
+#define REQ_RnW(h)   (((h) >> 2) & 1)
+#define REQ_A(h)     (((h) >> 1) & 0x0C)
+
+sim_target sim_tgt;
+
+static int parity(u32 v)
+{
+	return(__builtin_popcount(v) & 1);
+}
+
+/**
+ * @brief Initialize the target (power-on reset)
+ *
+ * @param t Pointer to the target model
+ */
+void sim_target_reset(sim_target *t)
+{
+	memset(t, 0, sizeof(sim_target));
+	t->state  = T_RESET;
+	t->locked = 1;
+	t->trn    = 1;
+	t->csw    = 0x03000002;
+	t->run_delay = 3;
+	/* Flash is erased, the core is halted */
+	memset(t->flash, 0xFF, SIM_FLASH_SIZE);
+	t->dhcsr  = (1 << 0) | (1 << 1);
+}
+
+/**
+ * @brief Execute the function of the fake flash algorithm at PC
+ *
+ * Called when the core halts, so that the probe can not modify the buffer
+ * of a running ProgramPage without being detected.
+ *
+ * @param t Pointer to the target model
+ */
+static void core_exec(sim_target *t)
+{
+	u32 *r = t->core_r;
+	u32  op = 0, pc, i;
+
+	pc = r[15] & ~1;
+	if ((pc >= SIM_RAM_BASE) && (pc < (SIM_RAM_BASE + SIM_RAM_SIZE - 3)))
+		memcpy(&op, t->ram + (pc - SIM_RAM_BASE), 4);
+
+	switch (op)
+	{
+		case SIM_OP(SIM_OP_INIT):
+		case SIM_OP(SIM_OP_UNINIT):
+			r[0] = 0;
+			break;
+		/* EraseSector(adr) */
+		case SIM_OP(SIM_OP_ERASE):
+			if ((r[0] % SIM_FLASH_SECTOR) || (r[0] >= SIM_FLASH_SIZE))
+			{
+				r[0] = 1;
+				break;
+			}
+			memset(t->flash + r[0], 0xFF, SIM_FLASH_SECTOR);
+			r[0] = 0;
+			break;
+		/* ProgramPage(adr, sz, buf), bits can only be cleared */
+		case SIM_OP(SIM_OP_PROGRAM):
+			if ((r[0] >= SIM_FLASH_SIZE) || (r[1] > (SIM_FLASH_SIZE - r[0])) ||
+			    (r[2] < SIM_RAM_BASE) || ((r[2] + r[1]) > (SIM_RAM_BASE + SIM_RAM_SIZE)))
+			{
+				r[0] = 1;
+				break;
+			}
+			for (i = 0; i < r[1]; i++)
+				t->flash[r[0] + i] &= t->ram[r[2] - SIM_RAM_BASE + i];
+			r[0] = 0;
+			break;
+		/* Not an instruction : fault */
+		default:
+			r[0] = 0xFFFFFFFF;
+			break;
+	}
+	/* Return to the breakpoint */
+	r[15] = r[14] & ~1;
+	t->core_runs++;
+}
+
+/**
+ * @brief Access the debug registers of the core (DHCSR, DCRSR, DCRDR)
+ *
+ * @param t     Pointer to the target model
+ * @param addr  Address of the register
+ * @param write True for a write access
+ * @param data  Data to write, or pointer where read data is stored
+ */
+static void core_access(sim_target *t, u32 addr, int write, u32 *data)
+{
+	switch (addr)
+	{
+		case SIM_DHCSR:
+			if ( ! write)
+			{
+				/* The running core halts after some polls */
+				if (t->running && (t->run_polls-- == 0))
+				{
+					core_exec(t);
+					t->running = 0;
+				}
+				/* S_HALT, S_REGRDY */
+				*data = t->dhcsr | (t->running ? 0 : (1 << 17)) | (1 << 16);
+				break;
+			}
+			if ((*data >> 16) != 0xA05F)
+				break;
+			t->dhcsr = (*data & 0x0F);
+			/* Resume : halt bit cleared with debug enabled */
+			if ( ! t->running && ! (t->dhcsr & (1 << 1)) && (t->dhcsr & (1 << 0)))
+			{
+				t->running   = 1;
+				t->run_polls = t->run_delay;
+			}
+			if (t->dhcsr & (1 << 1))
+				t->running = 0;
+			break;
+		case SIM_DCRSR:
+			/* Core registers can only be accessed when halted */
+			if ( ! write || t->running || ((*data & 0x1F) > 16))
+				break;
+			if (*data & (1 << 16))
+				t->core_r[*data & 0x1F] = t->dcrdr;
+			else
+				t->dcrdr = t->core_r[*data & 0x1F];
+			break;
+		case SIM_DCRDR:
+			if (write)
+				t->dcrdr = *data;
+			else
+				*data = t->dcrdr;
+			break;
+		default:
+			if ( ! write)
+				*data = 0;
+			break;
+	}
+}
+
+/**
+ * @brief Access the memory connected to the MEM-AP
+ *
+ * @param t     Pointer to the target model
+ * @param addr  Address to access
+ * @param size  Size of the access (0:byte 1:halfword 2:word)
+ * @param write True for a write access
+ * @param data  Data to write, or pointer where read data is stored
+ * @return integer Zero on success, -1 for a bus error
+ */
+static int mem_access(sim_target *t, u32 addr, uint size, int write, u32 *data)
+{
+	u32 word, mask, offset;
+
+	t->mem_access++;
+	if (t->fault_at)
+	{
+		t->fault_at--;
+		if (t->fault_at == 0)
+			return(-1);
+	}
+	if ((size > 2) || (addr & ((1 << size) - 1)))
+		return(-1);
+	if (write && t->running)
+		t->run_writes++;
+	/* Debug registers of the core (words only) */
+	if ((addr & ~0xF) == SIM_DHCSR)
+	{
+		if (size != 2)
+			return(-1);
+		core_access(t, addr, write, data);
+		return(0);
+	}
+	/* Flash : read only on the bus */
+	if ((addr - SIM_FLASH_BASE) < SIM_FLASH_SIZE)
+	{
+		if (write)
+			return(-1);
+		memcpy(&word, t->flash + ((addr - SIM_FLASH_BASE) & ~3), 4);
+		*data = word;
+		return(0);
+	}
+	if ((addr < SIM_RAM_BASE) || (addr >= (SIM_RAM_BASE + SIM_RAM_SIZE)))
+		return(-1);
+
+	/* Data uses the byte lanes of the address (like AHB) */
+	offset = (addr - SIM_RAM_BASE) & ~3;
+	memcpy(&word, t->ram + offset, 4);
+	if (write)
+	{
+		mask = (size == 2) ? 0xFFFFFFFF : (((1u << (8 << size)) - 1) << ((addr & 3) * 8));
+		word = (word & ~mask) | (*data & mask);
+		memcpy(t->ram + offset, &word, 4);
+	}
+	else
+	{
+		/* Simulated status register : busy during some reads */
+		if ((offset == 0) && t->busy)
+		{
+			t->busy--;
+			word |= 1;
+		}
+		*data = word;
+	}
+	return(0);
+}
+
+/**
+ * @brief Execute an AP register access
+ *
+ * @param t     Pointer to the target model
+ * @param a     Address of the register (A[3:2] from request)
+ * @param write True for a write access
+ * @param data  Data to write, or pointer where read data is stored
+ */
+static void ap_access(sim_target *t, uint a, int write, u32 *data)
+{
+	uint reg = (t->select & 0xF0) | a;
+	uint size;
+	u32  rd = 0;
+	int  err = 0;
+
+	/* Only one AP (MEM-AP) at APSEL 0 */
+	if ((t->select >> 24) != 0)
+	{
+		if ( ! write)
+			*data = 0;
+		return;
+	}
+
+	switch (reg)
+	{
+		/* CSW */
+		case 0x00:
+			if (write)
+				t->csw = (*data & ~(1 << 7)) | (1 << 6);
+			else
+				rd = t->csw | (1 << 6);
+			break;
+		/* TAR */
+		case 0x04:
+			if (write)
+				t->tar = *data;
+			else
+				rd = t->tar;
+			break;
+		/* DRW */
+		case 0x0C:
+			size = (t->csw & 7);
+			if (write)
+				err = mem_access(t, t->tar, size, 1, data);
+			else
+				err = mem_access(t, t->tar, size, 0, &rd);
+			/* Auto-increment (single or packed), wrapped on 1KB */
+			if ((err == 0) && (t->csw & (3 << 4)))
+				t->tar = (t->tar & ~0x3FF) | ((t->tar + (1 << size)) & 0x3FF);
+			break;
+		/* BD0 to BD3 */
+		case 0x10: case 0x14: case 0x18: case 0x1C:
+			err = mem_access(t, (t->tar & ~0xF) | (reg & 0xC), 2, write,
+			                 write ? data : &rd);
+			break;
+		/* CFG, BASE (no ROM table) and IDR */
+		case 0xF4: rd = 0;           break;
+		case 0xF8: rd = 0xFFFFFFFF;  break;
+		case 0xFC: rd = SIM_AP_IDR;  break;
+	}
+	if (err)
+		t->ctrl_stat |= SIM_STICKYERR;
+	if ( ! write)
+		*data = rd;
+}
+
+/**
+ * @brief Execute a DP register write
+ *
+ * @param t Pointer to the target model
+ * @param a Address of the register (A[3:2] from request)
+ * @param v Value to write
+ */
+static void dp_write(sim_target *t, uint a, u32 v)
+{
+	switch (a)
+	{
+		/* ABORT */
+		case 0x0:
+			if (v & (1 << 1)) t->ctrl_stat &= ~SIM_STICKYCMP;
+			if (v & (1 << 2)) t->ctrl_stat &= ~SIM_STICKYERR;
+			if (v & (1 << 3)) t->ctrl_stat &= ~SIM_WDATAERR;
+			if (v & (1 << 4)) t->ctrl_stat &= ~SIM_STICKYORUN;
+			break;
+		/* CTRL/STAT : power requests, MASKLANE, TRNMODE, ORUNDETECT */
+		case 0x4:
+			/* DLCR when DPBANKSEL is 1 : turnaround period */
+			if ((t->select & 0x0F) == 1)
+				t->trn = ((v >> 8) & 3) + 1;
+			else
+				t->ctrl_stat = (t->ctrl_stat & SIM_STICKY) | (v & 0x54000F0D);
+			break;
+		/* SELECT */
+		case 0x8:
+			t->select = v;
+			break;
+		/* TARGETSEL (not used, single target) */
+		case 0xC:
+			break;
+	}
+}
+
+/**
+ * @brief Execute a DP register read
+ *
+ * @param t Pointer to the target model
+ * @param a Address of the register (A[3:2] from request)
+ * @return integer Value of the register
+ */
+static u32 dp_read(sim_target *t, uint a)
+{
+	u32 v = 0;
+
+	switch (a)
+	{
+		case 0x0:
+			v = SIM_DPIDR;
+			break;
+		/* CTRL/STAT : power acknowledges follow requests */
+		case 0x4:
+			if ((t->select & 0x0F) == 1)
+			{
+				v = ((t->trn - 1) << 8);
+				break;
+			}
+			v = t->ctrl_stat;
+			if (v & (1 << 30)) v |= (1u << 31);
+			if (v & (1 << 28)) v |= (1u << 29);
+			break;
+		/* RESEND */
+		case 0x8:
+			v = t->resend;
+			break;
+		/* RDBUFF */
+		case 0xC:
+			v = t->rdbuff;
+			break;
+	}
+	return(v);
+}
+
+/**
+ * @brief Decode a request and select the ACK to send
+ *
+ * @param t Pointer to the target model
+ * @return integer Value of ACK, 0 if target must not respond
+ */
+static int request(sim_target *t)
+{
+	uint a   = REQ_A(t->hdr);
+	int  ap  = REQ_APnDP(t->hdr);
+	int  rd  = REQ_RnW(t->hdr);
+	int  allowed;
+
+	/* After a line reset, only a DPIDR read is accepted */
+	if (t->locked)
+	{
+		if (ap || ! rd || (a != 0))
+			return(0);
+		t->locked = 0;
+	}
+
+	/* With a sticky flag set, only DPIDR, CTRL/STAT and ABORT are allowed */
+	allowed = ! ap && ((rd && (a <= 0x4)) || ( ! rd && (a == 0x0)));
+	if ((t->ctrl_stat & SIM_STICKY) && ! allowed)
+	{
+		t->ack_fault++;
+		if (t->ctrl_stat & SIM_ORUNDETECT)
+			t->ctrl_stat |= SIM_STICKYORUN;
+		return(4);
+	}
+
+	/* AP accesses and RDBUFF wait for the end of the AP transaction */
+	if (ap || (rd && (a == 0xC)))
+	{
+		if (t->wait_at)
+			t->wait_at--;
+		if (t->wait && (t->wait_at == 0))
+		{
+			t->wait--;
+			t->ack_wait++;
+			/* With overrun detection, next requests are ignored */
+			if (t->ctrl_stat & SIM_ORUNDETECT)
+				t->ctrl_stat |= SIM_STICKYORUN;
+			return(2);
+		}
+	}
+
+	if (rd)
+	{
+		if (ap)
+		{
+			/* Posted read : return the result of the previous one */
+			t->data = t->rdbuff;
+			ap_access(t, a, 0, &t->rdbuff);
+		}
+		else
+			t->data = dp_read(t, a);
+		t->resend = t->data;
+	}
+	return(1);
+}
+
+/**
+ * @brief Capture-DR of the JTAG-DP with DPACC or APACC instruction
+ *
+ * While an AP transaction is in progress, WAIT is captured and the next
+ * request will be ignored (injected like SWD WAITs, see sim_target.wait).
+ *
+ * @param t Pointer to the target model
+ * @return Captured value : ACK into bits [2:0], result of last read above
+ */
+unsigned long long sim_target_jtag_capture(sim_target *t)
+{
+	t->jtag_ignore = 0;
+	if (t->jtag_busy)
+	{
+		if (t->wait_at)
+			t->wait_at--;
+		if (t->wait && (t->wait_at == 0))
+		{
+			t->wait--;
+			t->ack_wait++;
+			t->jtag_ignore = 1;
+			return(1); /* WAIT */
+		}
+		t->jtag_busy = 0;
+	}
+	return(((unsigned long long)t->jtag_data << 3) | 2); /* OK/FAULT */
+}
+
+/**
+ * @brief Update-DR of the JTAG-DP : execute the request
+ *
+ * @param t  Pointer to the target model
+ * @param ir Current instruction (ABORT, DPACC or APACC)
+ * @param dr Content of the DR : RnW, A[3:2] and data
+ */
+void sim_target_jtag_update(sim_target *t, u32 ir, unsigned long long dr)
+{
+	uint a  = (uint)(dr << 1) & 0x0C;
+	int  rd = (dr & 1);
+	u32  v  = (u32)(dr >> 3);
+
+	if (ir == JTAG_IR_ABORT)
+	{
+		dp_write(t, 0x0, v);
+		return;
+	}
+	if (t->jtag_ignore)
+		return;
+	t->requests++;
+
+	if (ir == JTAG_IR_APACC)
+	{
+		t->jtag_busy = 1;
+		if (rd)
+			ap_access(t, a, 0, &t->jtag_data);
+		else
+			ap_access(t, a, 1, &v);
+	}
+	/* RDBUFF reads as zero, DP register 0 is not writable with DPACC */
+	else if (rd)
+		t->jtag_data = (a == 0xC) ? 0 : dp_read(t, a);
+	else if (a != 0x0)
+		dp_write(t, a, v);
+}
+
+/**
+ * @brief SWD target model, called on each rising edge of SWCLK
+ *
+ * @param t    Pointer to the target model
+ * @param host True when the probe drives SWDIO
+ * @param line Level of SWDIO
+ */
+void sim_target_edge(sim_target *t, int host, int line)
+{
+	/* Detect line reset (at least 50 cycles high) */
+	if (host)
+	{
+		if (line)
+			t->ones++;
+		else
+			t->ones = 0;
+		if (t->ones == 50)
+		{
+			t->resets++;
+			t->locked = 1;
+			t->state  = T_RESET;
+			t->drive  = 0;
+			return;
+		}
+	}
+
+	switch (t->state)
+	{
+		case T_RESET:
+			if (host && (line == 0))
+				t->state = T_IDLE;
+			break;
+
+		case T_IDLE:
+			if (host && line)
+			{
+				t->hdr   = 1;
+				t->n     = 1;
+				t->state = T_HDR;
+			}
+			break;
+
+		case T_HDR:
+			t->hdr |= (line << t->n);
+			t->n++;
+			if (t->n == 8)
+			{
+				t->n     = t->trn;
+				t->state = T_TRN;
+			}
+			break;
+
+		/* Turnaround after request, then drive first ACK bit */
+		case T_TRN:
+			if (--t->n)
+				break;
+			t->state = T_IDLE;
+			/* Bad parity, stop or park bit : no response */
+			if ((((t->hdr >> 5) & 1) != (u32)parity((t->hdr >> 1) & 0x0F)) ||
+			    ((t->hdr & 0xC0) != 0x80))
+			{
+				t->proto_err++;
+				break;
+			}
+			/* Probe must release the line during turnaround */
+			if (host)
+			{
+				t->proto_err++;
+				break;
+			}
+			t->requests++;
+			t->ack = request(t);
+			if (t->ack == 0)
+			{
+				t->proto_err++;
+				break;
+			}
+			t->drive     = 1;
+			t->drive_val = t->ack & 1;
+			t->n         = 1;
+			t->state     = T_ACK;
+			break;
+
+		case T_ACK:
+			if (t->n < 3)
+			{
+				t->drive_val = (t->ack >> t->n) & 1;
+				t->n++;
+			}
+			else if ((t->ack == 1) && REQ_RnW(t->hdr))
+			{
+				t->drive_val = t->data & 1;
+				t->n     = 1;
+				t->state = T_RDATA;
+			}
+			else if (t->ack == 1)
+			{
+				t->drive = 0;
+				t->n     = t->trn;
+				t->state = T_TRN_W;
+			}
+			else
+			{
+				/* WAIT or FAULT : with overrun detection, the data
+				 * phase (33 cycles) is skipped like a transfer */
+				t->drive = 0;
+				t->n     = t->trn;
+				if (t->ctrl_stat & 1)
+					t->n += 33;
+				t->state = T_TRN_END;
+			}
+			break;
+
+		case T_RDATA:
+			if (t->n < 32)
+				t->drive_val = (t->data >> t->n) & 1;
+			else if (t->n == 32)
+			{
+				t->drive_val = parity(t->data);
+				if (t->bad_parity)
+				{
+					t->bad_parity--;
+					t->drive_val ^= 1;
+				}
+			}
+			else
+			{
+				t->drive = 0;
+				t->n     = t->trn;
+				t->state = T_TRN_END;
+				break;
+			}
+			t->n++;
+			break;
+
+		case T_TRN_W:
+			if (--t->n)
+				break;
+			t->data  = 0;
+			t->n     = 0;
+			t->state = T_WDATA;
+			break;
+
+		case T_WDATA:
+			if (t->n < 32)
+				t->data |= ((u32)line << t->n);
+			else
+			{
+				if (line != parity(t->data))
+				{
+					t->parity_err++;
+					t->ctrl_stat |= SIM_WDATAERR;
+				}
+				else if (REQ_APnDP(t->hdr))
+					ap_access(t, REQ_A(t->hdr), 1, &t->data);
+				else
+					dp_write(t, REQ_A(t->hdr), t->data);
+				t->state = T_IDLE;
+			}
+			t->n++;
+			break;
+
+		case T_TRN_END:
+			if (--t->n == 0)
+				t->state = T_IDLE;
+			break;
+	}
+}
+/* EOF */
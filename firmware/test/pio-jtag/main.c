@@ -0,0 +1,324 @@
+/**
+ * @file  main.c
+ * @brief Unit-test of the JTAG PIO program using an instruction emulator
+ *
+ * The PIO program of the firmware (jtag_pio.h) is executed by an emulated
+ * state machine (see test/pio-swd). Pins are connected to a model of target
+ * that records TMS and TDI on rising edges of TCK and drives TDO with a
+ * pseudo-random sequence updated on falling edges.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "ios.h"
+#include "jtag_pio.h"
+#include "pio_emu.h"
+
+#define PIN_TCK PORT_D2_PIN
+#define PIN_TDI PORT_D3_PIN
+#define PIN_TMS PORT_D1_PIN
+#define PIN_TDO PORT_D0_PIN
+
+#define MAX_CYCLES 100000
+#define MAX_BITS   4096
+
+typedef struct board_s
+{
+	pio_emu  pio;
+	int      tck, tms, tdi;
+	/* Target : TDO changes on falling edge of TCK */
+	uint32_t lfsr;
+	int      tdo;
+	/* Levels seen by the target on each rising edge */
+	uint8_t  tms_bits[MAX_BITS];
+	uint8_t  tdi_bits[MAX_BITS];
+	uint8_t  tdo_bits[MAX_BITS];
+	unsigned int  edges;
+	/* Clock waveform */
+	unsigned long rise, fall;
+	unsigned long period_min;
+	unsigned long high_min, high_max, low_min;
+	int      glitches;
+} board;
+
+static board brd;
+static int   err;
+
+static void check(int cond, const char *msg);
+
+/**
+ * @brief Input callback of the emulated PIO (state of GPIOs)
+ *
+ */
+static uint32_t board_input(void *ctx)
+{
+	board *b = (board *)ctx;
+
+	return((b->pio.pins & ~(1u << PIN_TDO)) | ((uint32_t)b->tdo << PIN_TDO));
+}
+
+/**
+ * @brief Execute one PIO cycle and update board model
+ *
+ */
+static void board_step(board *b)
+{
+	unsigned long t;
+	int tck, tms, tdi;
+
+	pio_emu_step(&b->pio);
+	t   = b->pio.cycles;
+	tck = (b->pio.pins >> PIN_TCK) & 1;
+	tms = (b->pio.pins >> PIN_TMS) & 1;
+	tdi = (b->pio.pins >> PIN_TDI) & 1;
+
+	/* TMS and TDI must not be modified while TCK is high */
+	if (b->tck && tck && ((tms != b->tms) || (tdi != b->tdi)))
+		b->glitches++;
+
+	/* Rising edge : target samples TMS and TDI */
+	if (tck && ! b->tck)
+	{
+		if (b->edges && ((t - b->rise) < b->period_min))
+			b->period_min = t - b->rise;
+		if (b->edges && ((t - b->fall) < b->low_min))
+			b->low_min = t - b->fall;
+		if (b->edges < MAX_BITS)
+		{
+			b->tms_bits[b->edges] = tms;
+			b->tdi_bits[b->edges] = tdi;
+			b->tdo_bits[b->edges] = b->tdo;
+		}
+		b->edges++;
+		b->rise = t;
+	}
+	/* Falling edge : target updates TDO */
+	if ( ! tck && b->tck)
+	{
+		if ((t - b->rise) < b->high_min)
+			b->high_min = t - b->rise;
+		if ((t - b->rise) > b->high_max)
+			b->high_max = t - b->rise;
+		b->lfsr = (b->lfsr >> 1) ^ (0xB4BCD35C & -(b->lfsr & 1));
+		b->tdo  = b->lfsr & 1;
+		b->fall = t;
+	}
+	b->tck = tck;
+	b->tms = tms;
+	b->tdi = tdi;
+}
+
+/**
+ * @brief Push a word into TX fifo (run PIO while fifo is full)
+ *
+ */
+static void put(uint32_t v)
+{
+	int i;
+
+	for (i = 0; i < MAX_CYCLES; i++)
+	{
+		if (pio_emu_put(&brd.pio, v) == 0)
+			return;
+		board_step(&brd);
+	}
+	check(0, "TX fifo blocked");
+}
+
+/**
+ * @brief Get a word from RX fifo (run PIO until available)
+ *
+ */
+static uint32_t get(void)
+{
+	uint32_t v = 0;
+	int i;
+
+	for (i = 0; i < MAX_CYCLES; i++)
+	{
+		if (pio_emu_get(&brd.pio, &v) == 0)
+			return(v);
+		board_step(&brd);
+	}
+	check(0, "RX fifo timeout");
+	return(0);
+}
+
+/**
+ * @brief Run PIO until all commands are processed
+ *
+ */
+static void flush(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CYCLES; i++)
+	{
+		if ((brd.pio.tx_n == 0) && brd.pio.stalled &&
+		    (brd.pio.pc == JTAG_PIO_WRAP_TARGET))
+			return;
+		board_step(&brd);
+	}
+	check(0, "PIO never returns to idle");
+}
+
+/**
+ * @brief Same sequence of commands as jtag_pio_shift() in firmware
+ *
+ */
+static uint32_t shift(uint32_t tdi, unsigned int len, int tms)
+{
+	put(JTAG_PIO_CMD(0, tms, len));
+	put(tdi);
+	return(get() >> (32 - len));
+}
+
+/**
+ * @brief Compare the bits seen by the target with a shift
+ *
+ * @param first Index of the first rising edge of the shift
+ * @param tdi   Bits sent
+ * @param tdo   Bits captured
+ * @param len   Number of bits
+ * @param tms   Expected level of TMS
+ * @return integer Zero if all bits match
+ */
+static int compare(unsigned int first, uint32_t tdi, uint32_t tdo, unsigned int len, int tms)
+{
+	unsigned int i;
+
+	if ((brd.edges - first) != len)
+		return(-1);
+	for (i = 0; i < len; i++)
+	{
+		if ((brd.tms_bits[first + i] != tms) ||
+		    (brd.tdi_bits[first + i] != ((tdi >> i) & 1)) ||
+		    (brd.tdo_bits[first + i] != ((tdo >> i) & 1)))
+			return(-1);
+	}
+	return(0);
+}
+
+static void check(int cond, const char *msg)
+{
+	if (cond)
+		return;
+	printf("    \x1b[1;91mFailed\x1b[0m %s\n", msg);
+	err++;
+}
+
+/**
+ * @brief Entry point of the program
+ *
+ * @param argc Number of argument into command line
+ * @param argv Array of string with command line arguments
+ * @return integer Zero if all tests pass
+ */
+int main(int argc, char **argv)
+{
+	uint32_t tdi[32], tdo[32];
+	unsigned long cycles;
+	unsigned int first, bad, i;
+	(void)argc;
+	(void)argv;
+
+	memset(&brd, 0, sizeof(board));
+	/* Configure emulated state machine like jtag_pio_init() */
+	pio_emu_init(&brd.pio, jtag_pio_program, JTAG_PIO_LENGTH);
+	brd.pio.wrap_target = JTAG_PIO_WRAP_TARGET;
+	brd.pio.wrap        = JTAG_PIO_WRAP;
+	brd.pio.side_bits   = JTAG_PIO_SIDE_BITS;
+	brd.pio.side_opt    = 1;
+	brd.pio.side_base   = PIN_TCK;
+	brd.pio.out_base    = PIN_TDI; brd.pio.out_count = 1;
+	brd.pio.set_base    = PIN_TMS; brd.pio.set_count = 1;
+	brd.pio.in_base     = PIN_TDO;
+	brd.pio.pins    = (1u << PIN_TDI);
+	brd.pio.pindirs = (1u << PIN_TCK) | (1u << PIN_TDI) | (1u << PIN_TMS);
+	brd.pio.pc      = JTAG_PIO_WRAP_TARGET;
+	brd.pio.input   = board_input;
+	brd.pio.ctx     = &brd;
+	brd.tdi  = 1;
+	brd.lfsr = 0x12345678;
+	brd.period_min = brd.high_min = brd.low_min = ~0UL;
+
+	printf(" - Program size (%d instructions)\n", (int)JTAG_PIO_LENGTH);
+	check(JTAG_PIO_LENGTH <= 32, "program does not fit into PIO memory");
+
+	printf(" - Shift 8 bits with TMS low\n");
+	first = brd.edges;
+	tdo[0] = shift(0xA5, 8, 0);
+	flush();
+	check(compare(first, 0xA5, tdo[0], 8, 0) == 0, "bad TMS, TDI or TDO bits");
+
+	printf(" - Shift 32 bits with TMS high\n");
+	first = brd.edges;
+	tdo[0] = shift(0x8001F00F, 32, 1);
+	flush();
+	check(compare(first, 0x8001F00F, tdo[0], 32, 1) == 0, "bad TMS, TDI or TDO bits");
+
+	printf(" - Single bit shifts\n");
+	for (i = 0, bad = 0; i < 4; i++)
+	{
+		first = brd.edges;
+		tdo[0] = shift(i & 1, 1, (i >> 1) & 1);
+		flush();
+		if (compare(first, i & 1, tdo[0], 1, (i >> 1) & 1) != 0)
+			bad++;
+	}
+	check(bad == 0, "bad single bit shift");
+
+	/* Same order as the CPU mode of jtag_pio_flush(), two shifts into
+	 * the TX fifo while the result of the previous one is read */
+	printf(" - Queued shifts (32 x 32 bits)\n");
+	for (i = 0; i < 32; i++)
+		tdi[i] = 0x9E3779B9 * (i + 1);
+	first  = brd.edges;
+	cycles = brd.pio.cycles;
+	for (i = 0; i < 32; i++)
+	{
+		put(JTAG_PIO_CMD(0, 0, 32));
+		put(tdi[i]);
+		if (i > 0)
+			tdo[i - 1] = get();
+	}
+	tdo[31] = get();
+	cycles = brd.pio.cycles - cycles;
+	flush();
+	check((brd.edges - first) == 1024, "bad number of clocks");
+	for (i = 0, bad = 0; i < 1024; i++)
+		if ((brd.tms_bits[first + i] != 0) ||
+		    (brd.tdi_bits[first + i] != ((tdi[i / 32] >> (i % 32)) & 1)) ||
+		    (brd.tdo_bits[first + i] != ((tdo[i / 32] >> (i % 32)) & 1)))
+			bad++;
+	check(bad == 0, "bad bits into queued shifts");
+	printf("   1024 bits in %lu cycles : %.1f Mbit/s at 125 MHz (divider 1)\n",
+	       cycles, 1024 * 125.0 / cycles);
+	check(cycles < (1024 * JTAG_PIO_CYCLES) + (32 * 8),
+	      "too many cycles between shifts");
+
+	printf(" - Clock waveform\n");
+	check(brd.period_min == JTAG_PIO_CYCLES, "bad TCK period");
+	check((brd.high_min == 2) && (brd.high_max == 2), "bad TCK high time");
+	check(brd.low_min >= 2, "bad TCK low time");
+	check(((brd.pio.pins >> PIN_TCK) & 1) == 0, "TCK must be low when idle");
+	check(brd.glitches == 0, "TMS or TDI modified while TCK high");
+
+	printf("\n Test complete ");
+	if (err == 0)
+		printf("\x1b[1;92m0 error\x1b[0m\n");
+	else
+		printf("\x1b[1;91m%d errors\x1b[0m\n", err);
+	return(err ? 1 : 0);
+}
+/* EOF */
@@ -0,0 +1,75 @@
+/**
+ * @file  pio.h
+ * @brief Host replacement of the pico-sdk "hardware/pio.h" header
+ *
+ * The state machine is the PIO emulator of this unit-test : the SDK
+ * functions used by swd_pio.c are implemented on top of it (see main.c).
+ * The configuration only holds the fields supported by the emulator.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef HARDWARE_PIO_H
+#define HARDWARE_PIO_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "types.h"
+
+typedef struct pio_hw_s *PIO;
+#define pio0 ((PIO)0)
+
+struct pio_program
+{
+	const uint16_t *instructions;
+	uint8_t length;
+	int8_t  origin;
+};
+
+typedef struct
+{
+	uint wrap_target, wrap;
+	uint side_bits, side_opt, side_base;
+	uint out_base, out_count;
+	uint set_base, set_count;
+	uint in_base;
+	u32  clkdiv;
+} pio_sm_config;
+
+bool pio_can_add_program(PIO pio, const struct pio_program *program);
+uint pio_add_program(PIO pio, const struct pio_program *program);
+void pio_remove_program(PIO pio, const struct pio_program *program, uint offset);
+int  pio_claim_unused_sm(PIO pio, bool required);
+void pio_sm_unclaim(PIO pio, uint sm);
+void pio_gpio_init(PIO pio, uint pin);
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint base);
+void sm_config_set_out_pins(pio_sm_config *c, uint base, uint count);
+void sm_config_set_set_pins(pio_sm_config *c, uint base, uint count);
+void sm_config_set_in_pins(pio_sm_config *c, uint base);
+void sm_config_set_out_shift(pio_sm_config *c, bool right, bool autopull, uint threshold);
+void sm_config_set_in_shift(pio_sm_config *c, bool right, bool autopush, uint threshold);
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac);
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t values, uint32_t mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t dirs, uint32_t mask);
+
+void     pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+bool     pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+uint8_t  pio_sm_get_pc(PIO pio, uint sm);
+
+#endif
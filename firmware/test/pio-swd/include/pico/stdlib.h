@@ -0,0 +1,34 @@
+/**
+ * @file  stdlib.h
+ * @brief Host replacement of the pico-sdk "pico/stdlib.h" header
+ *
+ * Only the types and functions used by the PIO SWD engine are declared
+ * here, they are implemented by the unit-test (see main.c).
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef PICO_STDLIB_H
+#define PICO_STDLIB_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+enum gpio_function
+{
+	GPIO_FUNC_SIO  = 5,
+	GPIO_FUNC_PIO0 = 6,
+};
+
+void gpio_set_function(uint gpio, enum gpio_function fn);
+
+#endif
@@ -0,0 +1,1032 @@
+/**
+ * @file  main.c
+ * @brief Unit-test of the SWD PIO program using an instruction emulator
+ *
+ * The PIO engine of the firmware (swd_pio.c) is compiled for host, the SDK
+ * functions it uses are implemented below on top of an emulated state
+ * machine that executes the PIO program (swd_pio.h). Pins are connected to
+ * a model of the board (SWDIO level shifter) and to a minimal SWD target
+ * that decodes requests on SWCLK edges.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "ios.h"
+#include "swd.h"
+#include "swd_pio.h"
+#include "swj_clock.h"
+#include "pio_emu.h"
+
+#define PIN_SWCLK PORT_D2_PIN
+#define PIN_SWDIR PORT_D1_DIR
+#define PIN_SWDIO PORT_D1_PIN
+
+#define MAX_CYCLES 100000
+
+/* States of the SWD target model */
+enum { T_IDLE, T_RESET, T_HDR, T_TRN, T_ACK, T_RDATA, T_SKIP, T_TRN_W, T_WDATA, T_TRN_END };
+
+typedef struct target_s
+{
+	int state;
+	int n;
+	int ones;
+	uint32_t hdr;
+	uint32_t data;
+	int ack;
+	/* Signal driven by the target */
+	int drive, drive_val;
+	/* Registers (DP and AP bank 0) */
+	uint32_t dp[4];
+	uint32_t ap[4];
+	/* Configuration : turnaround period, data phase on WAIT/FAULT */
+	int trn;
+	int orun;
+	/* Error injection */
+	int wait_count;
+	int fault;
+	int bad_parity;
+	/* Statistics */
+	int resets;
+	int edges;
+	int idles;
+	int parity_err;
+} target;
+
+typedef struct board_s
+{
+	pio_emu  pio;
+	target   tgt;
+	int      clk;
+	int      line;
+	int      contention;
+	int      glitches;
+	/* PIO cycles used by the CPU between two fifo accesses */
+	int      cpu_latency;
+	FILE    *vcd;
+} board;
+
+swd_param swd_config;
+swj_clock swj_clk;
+
+static board brd;
+static int   err;
+
+static void check(int cond, const char *msg);
+static void fatal(const char *msg);
+
+/**
+ * @brief Compute the parity of a 32 bits word
+ *
+ */
+static int parity(uint32_t v)
+{
+	return(__builtin_popcount(v) & 1);
+}
+
+/**
+ * @brief Value of SWDIO on the target side of the level shifter
+ *
+ */
+static int board_line(board *b)
+{
+	int dir = (b->pio.pins >> PIN_SWDIR) & 1;
+
+	if (dir)
+	{
+		/* MCU pin as input with buffer as output : floating (pull-up) */
+		if ((b->pio.pindirs & (1u << PIN_SWDIO)) == 0)
+			return(1);
+		return((b->pio.pins >> PIN_SWDIO) & 1);
+	}
+	if (b->tgt.drive)
+		return(b->tgt.drive_val);
+	return(1);
+}
+
+/**
+ * @brief Input callback of the emulated PIO (state of GPIOs)
+ *
+ */
+static uint32_t board_input(void *ctx)
+{
+	board *b = (board *)ctx;
+	uint32_t v = b->pio.pins;
+
+	/* When MCU pin is an input and buffer direction is in, read target */
+	if ((b->pio.pindirs & (1u << PIN_SWDIO)) == 0)
+	{
+		v &= ~(1u << PIN_SWDIO);
+		if ((((b->pio.pins >> PIN_SWDIR) & 1) == 0) && b->tgt.drive)
+			v |= (b->tgt.drive_val << PIN_SWDIO);
+		else if (((b->pio.pins >> PIN_SWDIR) & 1) == 0)
+			v |= (1u << PIN_SWDIO);
+	}
+	return(v);
+}
+
+/**
+ * @brief SWD target model, called on each rising edge of SWCLK
+ *
+ */
+static void target_edge(target *t, int host, int line)
+{
+	t->edges++;
+
+	/* Detect line reset (at least 50 cycles high) */
+	if (host)
+	{
+		if (line)
+			t->ones++;
+		else
+			t->ones = 0;
+		if (t->ones == 50)
+		{
+			t->resets++;
+			t->state = T_RESET;
+			t->drive = 0;
+			return;
+		}
+	}
+
+	switch (t->state)
+	{
+		case T_RESET:
+			if (host && (line == 0))
+				t->state = T_IDLE;
+			break;
+
+		case T_IDLE:
+			if (host && line)
+			{
+				t->hdr   = 1;
+				t->n     = 1;
+				t->state = T_HDR;
+			}
+			else if (host)
+				t->idles++;
+			break;
+
+		case T_HDR:
+			t->hdr |= (line << t->n);
+			t->n++;
+			if (t->n == 8)
+			{
+				t->n     = 0;
+				t->state = T_TRN;
+			}
+			break;
+
+		/* Turnaround after request, then drive first ACK bit */
+		case T_TRN:
+		{
+			int a = (t->hdr >> 1) & 0x0F;
+			if (++t->n < t->trn)
+				break;
+			if ((((t->hdr >> 5) & 1) != (uint32_t)parity(a)) || ((t->hdr & 0xC0) != 0x80))
+			{
+				/* Bad request, no response */
+				t->state = T_IDLE;
+				break;
+			}
+			if (t->wait_count)
+			{
+				t->wait_count--;
+				t->ack = 2;
+			}
+			else if (t->fault)
+				t->ack = 4;
+			else
+				t->ack = 1;
+			/* Data for a read request */
+			if ((t->ack == 1) && (a & 2))
+			{
+				if (a & 1)
+					t->data = t->ap[(a >> 2) & 3];
+				else
+					t->data = t->dp[(a >> 2) & 3];
+			}
+			t->drive     = 1;
+			t->drive_val = t->ack & 1;
+			t->n         = 1;
+			t->state     = T_ACK;
+			break;
+		}
+
+		case T_ACK:
+			if (t->n < 3)
+			{
+				t->drive_val = (t->ack >> t->n) & 1;
+				t->n++;
+			}
+			else if ((t->ack == 1) && (t->hdr & 4))
+			{
+				t->drive_val = t->data & 1;
+				t->n     = 1;
+				t->state = T_RDATA;
+			}
+			/* Write, or WAIT/FAULT of a write with a data phase */
+			else if ((t->ack == 1) || (t->orun && ! (t->hdr & 4)))
+			{
+				t->drive = 0;
+				t->n     = 0;
+				t->state = T_TRN_W;
+			}
+			/* WAIT/FAULT of a read with a data phase : line released */
+			else if (t->orun)
+			{
+				t->drive = 0;
+				t->n     = 0;
+				t->state = T_SKIP;
+			}
+			else
+			{
+				t->drive = 0;
+				t->n     = 0;
+				t->state = T_TRN_END;
+			}
+			break;
+
+		case T_RDATA:
+			if (t->n < 32)
+				t->drive_val = (t->data >> t->n) & 1;
+			else if (t->n == 32)
+			{
+				t->drive_val = parity(t->data);
+				if (t->bad_parity)
+				{
+					t->bad_parity = 0;
+					t->drive_val ^= 1;
+				}
+			}
+			else
+			{
+				t->drive = 0;
+				t->n     = 0;
+				t->state = T_TRN_END;
+				break;
+			}
+			t->n++;
+			break;
+
+		/* Data and parity of a read are not driven */
+		case T_SKIP:
+			if (++t->n == 33)
+			{
+				t->n     = 0;
+				t->state = T_TRN_END;
+			}
+			break;
+
+		case T_TRN_W:
+			if (++t->n < t->trn)
+				break;
+			t->data  = 0;
+			t->n     = 0;
+			t->state = T_WDATA;
+			break;
+
+		case T_WDATA:
+			if (t->n < 32)
+				t->data |= ((uint32_t)line << t->n);
+			else
+			{
+				int a = (t->hdr >> 1) & 0x0F;
+				if (line != parity(t->data))
+					t->parity_err++;
+				/* Data phase after WAIT/FAULT is ignored */
+				else if (t->ack != 1)
+					;
+				else if (a & 1)
+					t->ap[(a >> 2) & 3] = t->data;
+				else if (((a >> 2) & 3) != 0)
+					t->dp[(a >> 2) & 3] = t->data;
+				t->state = T_IDLE;
+			}
+			t->n++;
+			break;
+
+		case T_TRN_END:
+			if (++t->n < t->trn)
+				break;
+			t->state = T_IDLE;
+			break;
+	}
+}
+
+/**
+ * @brief Execute one PIO cycle and update board model
+ *
+ */
+static void board_step(board *b)
+{
+	int clk, dir, line;
+
+	pio_emu_step(&b->pio);
+
+	clk  = (b->pio.pins >> PIN_SWCLK) & 1;
+	dir  = (b->pio.pins >> PIN_SWDIR) & 1;
+	line = board_line(b);
+
+	/* Host and target must never drive the line at the same time */
+	if (dir && b->tgt.drive)
+		b->contention++;
+	/* Host must not modify SWDIO while SWCLK is high */
+	if (dir && b->clk && clk && (line != b->line))
+		b->glitches++;
+
+	if (b->vcd && ((clk != b->clk) || (line != b->line)))
+		fprintf(b->vcd, "#%lu\n%dc\n%dd\n%dl\n", b->pio.cycles, clk, dir, line);
+
+	/* On rising edge of SWCLK, target samples the line */
+	if (clk && ! b->clk)
+	{
+		target_edge(&b->tgt, dir, line);
+		line = board_line(b);
+	}
+	b->clk  = clk;
+	b->line = line;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                   SDK functions on the emulated PIO                  -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Let the CPU time between two fifo accesses elapse
+ *
+ */
+static void cpu_wait(void)
+{
+	int i;
+
+	for (i = 0; i < brd.cpu_latency; i++)
+		board_step(&brd);
+}
+
+bool pio_can_add_program(PIO pio, const struct pio_program *program)
+{
+	(void)pio;
+	return(program->length <= 32);
+}
+
+uint pio_add_program(PIO pio, const struct pio_program *program)
+{
+	(void)pio;
+	/* Program is always loaded at offset 0 */
+	pio_emu_init(&brd.pio, program->instructions, program->length);
+	brd.pio.input = board_input;
+	brd.pio.ctx   = &brd;
+	return(0);
+}
+
+void pio_remove_program(PIO pio, const struct pio_program *program, uint offset)
+{
+	(void)pio;
+	(void)program;
+	(void)offset;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+	(void)pio;
+	(void)required;
+	return(0);
+}
+
+void pio_sm_unclaim(PIO pio, uint sm)
+{
+	(void)pio;
+	(void)sm;
+}
+
+void pio_gpio_init(PIO pio, uint pin)
+{
+	(void)pio;
+	(void)pin;
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+	(void)gpio;
+	(void)fn;
+}
+
+pio_sm_config pio_get_default_sm_config(void)
+{
+	pio_sm_config c;
+
+	memset(&c, 0, sizeof(c));
+	c.wrap = 31;
+	return(c);
+}
+
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap)
+{
+	c->wrap_target = wrap_target;
+	c->wrap        = wrap;
+}
+
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs)
+{
+	c->side_bits = bit_count;
+	c->side_opt  = optional;
+	check( ! pindirs, "side-set of pindirs not emulated");
+}
+
+void sm_config_set_sideset_pins(pio_sm_config *c, uint base)
+{
+	c->side_base = base;
+}
+
+void sm_config_set_out_pins(pio_sm_config *c, uint base, uint count)
+{
+	c->out_base  = base;
+	c->out_count = count;
+}
+
+void sm_config_set_set_pins(pio_sm_config *c, uint base, uint count)
+{
+	c->set_base  = base;
+	c->set_count = count;
+}
+
+void sm_config_set_in_pins(pio_sm_config *c, uint base)
+{
+	c->in_base = base;
+}
+
+void sm_config_set_out_shift(pio_sm_config *c, bool right, bool autopull, uint threshold)
+{
+	(void)c;
+	(void)threshold;
+	check(right && ! autopull, "only right shift without autopull is emulated");
+}
+
+void sm_config_set_in_shift(pio_sm_config *c, bool right, bool autopush, uint threshold)
+{
+	(void)c;
+	(void)threshold;
+	check(right && ! autopush, "only right shift without autopush is emulated");
+}
+
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac)
+{
+	c->clkdiv = ((u32)div_int << 8) | div_frac;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+	(void)pio;
+	(void)sm;
+	brd.pio.wrap_target = config->wrap_target;
+	brd.pio.wrap        = config->wrap;
+	brd.pio.side_bits   = config->side_bits;
+	brd.pio.side_opt    = config->side_opt;
+	brd.pio.side_base   = config->side_base;
+	brd.pio.out_base    = config->out_base;
+	brd.pio.out_count   = config->out_count;
+	brd.pio.set_base    = config->set_base;
+	brd.pio.set_count   = config->set_count;
+	brd.pio.in_base     = config->in_base;
+	brd.pio.pc          = initial_pc;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+	(void)pio;
+	(void)sm;
+	(void)enabled;
+}
+
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac)
+{
+	(void)pio;
+	(void)sm;
+	(void)div_int;
+	(void)div_frac;
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t values, uint32_t mask)
+{
+	(void)pio;
+	(void)sm;
+	brd.pio.pins = (brd.pio.pins & ~mask) | (values & mask);
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t dirs, uint32_t mask)
+{
+	(void)pio;
+	(void)sm;
+	brd.pio.pindirs = (brd.pio.pindirs & ~mask) | (dirs & mask);
+}
+
+/**
+ * @brief Push a word into TX fifo (run PIO while fifo is full)
+ *
+ * The firmware would wait forever for a fifo that never moves, so the test
+ * is stopped.
+ */
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data)
+{
+	int i;
+
+	(void)pio;
+	(void)sm;
+	cpu_wait();
+	for (i = 0; i < MAX_CYCLES; i++)
+	{
+		if (pio_emu_put(&brd.pio, data) == 0)
+			return;
+		board_step(&brd);
+	}
+	fatal("TX fifo blocked (deadlock)");
+}
+
+/**
+ * @brief Get a word from RX fifo (run PIO until available)
+ *
+ */
+uint32_t pio_sm_get_blocking(PIO pio, uint sm)
+{
+	uint32_t v = 0;
+	int i;
+
+	(void)pio;
+	(void)sm;
+	cpu_wait();
+	for (i = 0; i < MAX_CYCLES; i++)
+	{
+		if (pio_emu_get(&brd.pio, &v) == 0)
+			return(v);
+		board_step(&brd);
+	}
+	fatal("RX fifo timeout (deadlock)");
+	return(0);
+}
+
+/**
+ * @brief Test if TX fifo is empty (PIO runs while CPU polls)
+ *
+ */
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm)
+{
+	(void)pio;
+	(void)sm;
+	board_step(&brd);
+	return(brd.pio.tx_n == 0);
+}
+
+/**
+ * @brief Get the program counter (PIO runs while CPU polls)
+ *
+ */
+uint8_t pio_sm_get_pc(PIO pio, uint sm)
+{
+	(void)pio;
+	(void)sm;
+	board_step(&brd);
+	return(brd.pio.pc);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                                 Logs                                 -- */
+/* -------------------------------------------------------------------------- */
+
+void log_puts(char *s)
+{
+	(void)s;
+}
+
+void log_puthex(const uint32_t c, const uint8_t len)
+{
+	(void)c;
+	(void)len;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                                 Tests                                -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Run PIO until all commands are processed
+ *
+ */
+static void flush(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CYCLES; i++)
+	{
+		if ((brd.pio.tx_n == 0) && brd.pio.stalled &&
+		    (brd.pio.pc == SWD_PIO_WRAP_TARGET))
+			return;
+		board_step(&brd);
+	}
+	check(0, "PIO never returns to idle");
+}
+
+/**
+ * @brief Process one transfer and count its clock cycles
+ *
+ * @param req   Identifier of the SWD request
+ * @param value Value to read or write
+ * @param ack   Expected ACK
+ * @param edges Expected number of clock cycles
+ * @param msg   Name of the transfer for error messages
+ */
+static void xfer(u8 req, u32 *value, int ack, int edges, const char *msg)
+{
+	char text[96];
+	int  n, result;
+
+	n = brd.tgt.edges;
+	result = swd_pio_transfer(req, value);
+	flush();
+	n = brd.tgt.edges - n;
+
+	snprintf(text, sizeof(text), "%s : bad ACK (%d)", msg, result);
+	check(result == ack, text);
+	snprintf(text, sizeof(text), "%s : %d clock cycles instead of %d", msg, n, edges);
+	check(n == edges, text);
+	snprintf(text, sizeof(text), "%s : target not idle", msg);
+	check(brd.tgt.state == T_IDLE, text);
+}
+
+/**
+ * @brief Transfers with a turnaround period of several cycles
+ *
+ */
+static void test_turnaround(void)
+{
+	uint trn;
+	u32  v;
+
+	printf(" - Turnaround period of 2 to 4 cycles\n");
+	for (trn = 2; trn <= 4; trn++)
+	{
+		swd_config.turnaround = trn;
+		brd.tgt.trn = trn;
+
+		v = 0;
+		xfer(0x02, &v, 1, 44 + (2 * trn), "read");
+		check(v == 0x0BC11477, "bad DPIDR value");
+		v = 0x12345678 + trn;
+		xfer(0x05, &v, 1, 44 + (2 * trn), "write");
+		check(brd.tgt.ap[1] == (0x12345678 + trn), "value not received by target");
+		v = 0;
+		xfer(0x07, &v, 1, 44 + (2 * trn), "read back");
+		check(v == (0x12345678 + trn), "bad value read back");
+
+		brd.tgt.wait_count = 1;
+		xfer(0x02, &v, 2, 11 + (2 * trn), "WAIT");
+	}
+	swd_config.turnaround = 1;
+	brd.tgt.trn = 1;
+}
+
+/**
+ * @brief Data phase on WAIT and FAULT (sticky overrun detection)
+ *
+ */
+static void test_data_phase(void)
+{
+	u32 v;
+
+	printf(" - Data phase on WAIT and FAULT\n");
+	swd_config.data_phase = 1;
+	brd.tgt.orun = 1;
+
+	brd.tgt.wait_count = 1;
+	xfer(0x06, &v, 2, 46, "read WAIT");
+	brd.tgt.wait_count = 1;
+	v = 0xDEADBEEF;
+	xfer(0x05, &v, 2, 46, "write WAIT");
+	check(brd.tgt.ap[1] != 0xDEADBEEF, "write accepted after WAIT");
+	brd.tgt.fault = 1;
+	xfer(0x07, &v, 4, 46, "read FAULT");
+	v = 0xDEADBEEF;
+	xfer(0x05, &v, 4, 46, "write FAULT");
+	check(brd.tgt.ap[1] != 0xDEADBEEF, "write accepted after FAULT");
+	brd.tgt.fault = 0;
+
+	/* Longer turnaround with a data phase */
+	swd_config.turnaround = 3;
+	brd.tgt.trn = 3;
+	brd.tgt.wait_count = 1;
+	xfer(0x06, &v, 2, 50, "read WAIT (trn 3)");
+	brd.tgt.wait_count = 1;
+	xfer(0x05, &v, 2, 50, "write WAIT (trn 3)");
+	swd_config.turnaround = 1;
+	brd.tgt.trn = 1;
+
+	/* Without data phase, WAIT is still short */
+	swd_config.data_phase = 0;
+	brd.tgt.orun = 0;
+	brd.tgt.wait_count = 1;
+	xfer(0x06, &v, 2, 13, "read WAIT (no data phase)");
+	v = 0;
+	xfer(0x02, &v, 1, 46, "read after WAIT");
+	check(v == 0x0BC11477, "bad DPIDR value");
+}
+
+/**
+ * @brief Idle cycles after each transfer
+ *
+ */
+static void test_idle(void)
+{
+	static const uint idle[] = { 1, 8, 32, 40, 70 };
+	uint i, n;
+	u32  v;
+
+	printf(" - Idle cycles after transfers\n");
+	for (i = 0; i < sizeof(idle) / sizeof(idle[0]); i++)
+	{
+		swd_config.idle_cycles = idle[i];
+		n = brd.tgt.idles;
+		v = 0;
+		xfer(0x02, &v, 1, 46 + idle[i], "read with idle cycles");
+		check(v == 0x0BC11477, "bad DPIDR value");
+		v = 0x55AA0000 + i;
+		xfer(0x05, &v, 1, 46 + idle[i], "write with idle cycles");
+		check(brd.tgt.ap[1] == (0x55AA0000 + i), "value not received by target");
+		check((brd.tgt.idles - n) == (2 * idle[i]), "idle cycles not driven low");
+		/* No idle cycles when the transfer is not accepted */
+		brd.tgt.wait_count = 1;
+		xfer(0x02, &v, 2, 13, "WAIT with idle cycles");
+	}
+	swd_config.idle_cycles = 0;
+}
+
+/**
+ * @brief Run transfers like the pipelined DAP_Transfer (swd_pio_put/get)
+ *
+ * Up to SWD_PIPE_DEPTH transfers are pending : the result of a transfer is
+ * read after the next one has been queued.
+ *
+ * @param req   Requests of the transfers
+ * @param data  Values to write, replaced by the values read
+ * @param ack   Array where the ACK of each transfer is stored
+ * @param count Number of transfers
+ */
+static void pipe_run(const u8 *req, u32 *data, int *ack, uint count)
+{
+	uint i;
+
+	for (i = 0; i < count; i++)
+	{
+		swd_pio_put(req[i], data[i]);
+		if (i >= (SWD_PIPE_DEPTH - 1))
+		{
+			uint n = i - (SWD_PIPE_DEPTH - 1);
+			ack[n] = swd_pio_get(&data[n]);
+		}
+	}
+	for (i = (count >= SWD_PIPE_DEPTH) ? (count - SWD_PIPE_DEPTH + 1) : 0; i < count; i++)
+		ack[i] = swd_pio_get(&data[i]);
+	flush();
+}
+
+/**
+ * @brief Pipelined transfers, with idle cycles and WAIT
+ *
+ */
+static void test_pipe(void)
+{
+	static const uint idle[] = { 0, 8, SWD_PIPE_IDLE_MAX };
+	/* Reads back to back fill the RX fifo (worst case) */
+	static const u8 req[8] = { 0x05, 0x07, 0x07, 0x02, 0x01, 0x07, 0x06, 0x07 };
+	u32  data[8];
+	int  ack[8];
+	uint i, j, n;
+	char text[64];
+
+	printf(" - Pipelined transfers (swd_pio_put/get)\n");
+	brd.tgt.orun = 1;
+	for (i = 0; i < sizeof(idle) / sizeof(idle[0]); i++)
+	{
+		swd_config.idle_cycles = idle[i];
+		memset(data, 0, sizeof(data));
+		data[0] = 0xCAFE0000 + i;
+		data[4] = 0xCAFE1000 + i;
+		n = brd.tgt.edges;
+		pipe_run(req, data, ack, 8);
+		n = brd.tgt.edges - n;
+
+		snprintf(text, sizeof(text), "%d idle cycles : bad ACK", idle[i]);
+		for (j = 0; j < 8; j++)
+			check(ack[j] == 1, text);
+		snprintf(text, sizeof(text), "%d idle cycles : bad value", idle[i]);
+		check(data[1] == (0xCAFE0000 + i), text);
+		check(data[2] == (0xCAFE0000 + i), text);
+		check(data[3] == 0x0BC11477, text);
+		check(data[5] == (0xCAFE0000 + i), text);
+		check(data[7] == (0xCAFE0000 + i), text);
+		check(brd.tgt.ap[0] == (0xCAFE1000 + i), text);
+		snprintf(text, sizeof(text), "%d idle cycles : bad clock cycles", idle[i]);
+		check(n == (8 * (46 + idle[i])), text);
+		check(brd.tgt.state == T_IDLE, "target not idle");
+	}
+
+	/* WAIT : the data phase is still generated, next transfers go on */
+	swd_config.idle_cycles = 8;
+	brd.tgt.wait_count = 1;
+	memset(data, 0, sizeof(data));
+	n = brd.tgt.edges;
+	pipe_run(req + 1, data, ack, 3);
+	n = brd.tgt.edges - n;
+	check(ack[0] == 2, "WAIT not reported");
+	check((ack[1] == 1) && (ack[2] == 1), "bad ACK after WAIT");
+	check(data[2] == 0x0BC11477, "bad value after WAIT");
+	check(n == (3 * (46 + 8)), "bad clock cycles with WAIT");
+
+	swd_config.idle_cycles = 0;
+	brd.tgt.orun = 0;
+}
+
+/**
+ * @brief Compare the duration of pipelined and non-pipelined transfers
+ *
+ * The CPU needs some time for each fifo access : without pipeline the state
+ * machine waits for it between the ACK and the data phase, and between two
+ * transfers.
+ */
+static void test_pipe_bench(void)
+{
+	u8   req[32];
+	u32  data[32];
+	int  ack[32];
+	unsigned long t_xfer, t_pipe;
+	uint i;
+
+	printf(" - Pipelined versus single transfers (PIO cycles)\n");
+	for (i = 0; i < 32; i++)
+		req[i] = 0x07;
+	brd.cpu_latency = 8;
+	brd.tgt.orun    = 1;
+
+	t_xfer = brd.pio.cycles;
+	for (i = 0; i < 32; i++)
+		check(swd_pio_transfer(req[i], &data[i]) == 1, "bad ACK");
+	flush();
+	t_xfer = brd.pio.cycles - t_xfer;
+
+	t_pipe = brd.pio.cycles;
+	pipe_run(req, data, ack, 32);
+	t_pipe = brd.pio.cycles - t_pipe;
+
+	printf("   32 reads : %lu (single) %lu (pipelined)\n", t_xfer, t_pipe);
+	check(t_pipe < t_xfer, "pipelined transfers are not faster");
+
+	brd.cpu_latency = 0;
+	brd.tgt.orun    = 0;
+}
+
+static void check(int cond, const char *msg)
+{
+	if (cond)
+		return;
+	printf("    \x1b[1;91mFailed\x1b[0m %s\n", msg);
+	err++;
+}
+
+/**
+ * @brief Stop the test when the firmware would be blocked
+ *
+ */
+static void fatal(const char *msg)
+{
+	check(0, msg);
+	printf("\n Test aborted\n");
+	exit(1);
+}
+
+/**
+ * @brief Entry point of the program
+ *
+ * @param argc Number of argument into command line
+ * @param argv Array of string with command line arguments
+ * @return integer Zero if all tests pass
+ */
+int main(int argc, char **argv)
+{
+	u32 v;
+	int edges;
+
+	memset(&brd, 0, sizeof(board));
+	if ((argc > 2) && (strcmp(argv[1], "-vcd") == 0))
+	{
+		brd.vcd = fopen(argv[2], "w");
+		if (brd.vcd)
+			fprintf(brd.vcd, "$timescale 1ns $end\n"
+			    "$var wire 1 c swclk $end\n"
+			    "$var wire 1 d swdir $end\n"
+			    "$var wire 1 l swdio $end\n"
+			    "$enddefinitions $end\n");
+	}
+	brd.clk  = 1;
+	brd.line = 1;
+	brd.tgt.dp[0] = 0x0BC11477;
+	brd.tgt.trn   = 1;
+
+	swd_config.retry_count = 16;
+	swd_config.turnaround  = 1;
+	swd_config.data_phase  = 0;
+	swd_config.idle_cycles = 0;
+	swj_clk.pio_div = SWJ_PIO_DIV_MIN;
+
+	printf(" - Program size (%d instructions)\n", (int)SWD_PIO_LENGTH);
+	check(SWD_PIO_LENGTH <= 32, "program does not fit into PIO memory");
+
+	printf(" - Load and start the state machine\n");
+	check(swd_pio_init() == 0, "swd_pio_init failed");
+	check(brd.pio.pc == SWD_PIO_WRAP_TARGET, "state machine not at start");
+	check(brd.pio.side_bits == SWD_PIO_SIDE_BITS, "bad side-set configuration");
+
+	printf(" - Line reset and idle cycles\n");
+	swd_pio_wr(0xFFFFFFFF, 32);
+	swd_pio_wr(0xFFFFF, 20);
+	swd_pio_wr(0x00, 8);
+	flush();
+	check(brd.tgt.resets == 1, "line reset not detected");
+	check(brd.tgt.edges == 60, "bad number of clock cycles");
+	check(brd.tgt.state == T_IDLE, "target not idle");
+
+	printf(" - Read DPIDR\n");
+	v = 0;
+	xfer(0x02, &v, 1, 46, "read");
+	check(v == 0x0BC11477, "bad DPIDR value");
+
+	printf(" - Write then read AP register\n");
+	v = 0x20000000;
+	xfer(0x05, &v, 1, 46, "write");
+	check(brd.tgt.ap[1] == 0x20000000, "value not received by target");
+	check(brd.tgt.parity_err == 0, "parity error on write");
+	v = 0;
+	xfer(0x07, &v, 1, 46, "read back");
+	check(v == 0x20000000, "bad value read back");
+
+	printf(" - WAIT response then retry\n");
+	brd.tgt.wait_count = 1;
+	xfer(0x02, &v, 2, 13, "WAIT");
+	v = 0;
+	xfer(0x02, &v, 1, 46, "retry");
+	check(v == 0x0BC11477, "retry failed");
+
+	printf(" - FAULT response\n");
+	brd.tgt.fault = 1;
+	xfer(0x06, &v, 4, 13, "FAULT");
+	brd.tgt.fault = 0;
+
+	printf(" - Parity error on read data\n");
+	brd.tgt.bad_parity = 1;
+	v = 0x12345678;
+	xfer(0x02, &v, 1, 46, "parity error");
+	check(v == 0x12345678, "value with parity error accepted");
+
+	test_turnaround();
+	test_data_phase();
+	test_idle();
+	test_pipe();
+	test_pipe_bench();
+
+	printf(" - Raw read (SWD sequence input)\n");
+	edges = brd.tgt.edges;
+	v = swd_pio_rd(8);
+	flush();
+	check(v == 0xFF, "bad value for floating line");
+	check((brd.tgt.edges - edges) == 8, "read is not 8 clock cycles");
+	check(((brd.pio.pins >> PIN_SWDIR) & 1) == 0, "buffer not input");
+
+	printf(" - Bus checks\n");
+	check(brd.contention == 0, "bus contention detected");
+	check(brd.glitches   == 0, "SWDIO modified while SWCLK high");
+	check(brd.tgt.parity_err == 0, "parity error on write");
+
+	swd_pio_release();
+	if (brd.vcd)
+		fclose(brd.vcd);
+
+	printf("\n Test complete ");
+	if (err == 0)
+		printf("\x1b[1;92m0 error\x1b[0m\n");
+	else
+		printf("\x1b[1;91m%d errors\x1b[0m\n", err);
+
+	return(err ? 1 : 0);
+}
+/* EOF */
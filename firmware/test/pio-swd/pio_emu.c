@@ -0,0 +1,340 @@
+/**
+ * @file  pio_emu.c
+ * @brief Instruction level emulator of one RP2040 PIO state machine
+ *
+ * This emulator is used to validate the PIO programs of the firmware on a
+ * Linux host. Only the features used by the firmware are implemented : right
+ * shift without autopush/autopull, blocking push/pull and (optional) side-set.
+ * Input synchronizers are not emulated, pins are sampled directly.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <string.h>
+#include "pio_emu.h"
+
+static void     _pins_write(pio_emu *pio, uint32_t *reg, unsigned int base, unsigned int count, uint32_t value);
+static uint32_t _source(pio_emu *pio, unsigned int src);
+
+/**
+ * @brief Initialize an emulated state machine and load a program
+ *
+ * The program is loaded at offset 0, the caller must configure pin mapping
+ * and wrap before the first call to pio_emu_step().
+ *
+ * @param pio  Pointer to the state machine structure
+ * @param prog Pointer to the instructions of the program
+ * @param len  Number of instructions
+ */
+void pio_emu_init(pio_emu *pio, const uint16_t *prog, unsigned int len)
+{
+	memset(pio, 0, sizeof(pio_emu));
+	if (len > 32)
+		len = 32;
+	memcpy(pio->imem, prog, len * sizeof(uint16_t));
+	pio->wrap = 31;
+}
+
+/**
+ * @brief Execute one PIO clock cycle
+ *
+ * @param pio Pointer to the state machine structure
+ * @return integer 1 if an instruction has been executed, 0 if stalled
+ */
+int pio_emu_step(pio_emu *pio)
+{
+	unsigned int ds_bits, delay_max;
+	unsigned int op, arg1, arg2, next;
+	uint16_t instr;
+	uint32_t v;
+	int cond;
+
+	pio->cycles++;
+
+	/* If a delay is pending, nothing else to do */
+	if (pio->delay)
+	{
+		pio->delay--;
+		return(1);
+	}
+
+	instr = pio->imem[pio->pc & 0x1F];
+
+	/* Decode side-set and delay field (bits 12:8) */
+	ds_bits   = (instr >> 8) & 0x1F;
+	delay_max = (1u << (5 - pio->side_bits)) - 1;
+	if (pio->side_bits)
+	{
+		unsigned int sbits = pio->side_bits;
+		unsigned int side  = ds_bits >> (5 - sbits);
+		int enable = 1;
+
+		if (pio->side_opt)
+		{
+			enable = (side >> (sbits - 1)) & 1;
+			sbits--;
+			side &= (1u << sbits) - 1;
+		}
+		/* Side-set is applied even if the instruction stalls */
+		if (enable)
+			_pins_write(pio, &pio->pins, pio->side_base, sbits, side);
+	}
+
+	op   = (instr >> 13) & 0x07;
+	arg1 = (instr >>  5) & 0x07;
+	arg2 = (instr >>  0) & 0x1F;
+	next = (pio->pc == pio->wrap) ? pio->wrap_target : ((pio->pc + 1) & 0x1F);
+	pio->stalled = 0;
+
+	switch (op)
+	{
+		/* JMP */
+		case 0:
+			switch (arg1)
+			{
+				case 0: cond = 1;                           break;
+				case 1: cond = (pio->x == 0);               break;
+				case 2: cond = (pio->x != 0); pio->x--;     break;
+				case 3: cond = (pio->y == 0);               break;
+				case 4: cond = (pio->y != 0); pio->y--;     break;
+				case 5: cond = (pio->x != pio->y);          break;
+				case 6: cond = (pio->input(pio->ctx) >> pio->jmp_pin) & 1; break;
+				default: cond = (pio->osr_count < 32);      break;
+			}
+			if (cond)
+				next = arg2;
+			break;
+
+		/* WAIT (not used by firmware) */
+		case 1:
+			break;
+
+		/* IN */
+		case 2:
+		{
+			unsigned int n = arg2 ? arg2 : 32;
+			switch (arg1)
+			{
+				case 0: v = pio->input(pio->ctx);
+				        v = (v >> pio->in_base) | (v << ((32 - pio->in_base) & 31));
+				        break;
+				case 1: v = pio->x;   break;
+				case 2: v = pio->y;   break;
+				case 6: v = pio->isr; break;
+				case 7: v = pio->osr; break;
+				default: v = 0;       break;
+			}
+			if (n < 32)
+			{
+				v &= (1u << n) - 1;
+				pio->isr = (pio->isr >> n) | (v << (32 - n));
+			}
+			else
+				pio->isr = v;
+			pio->isr_count += n;
+			if (pio->isr_count > 32)
+				pio->isr_count = 32;
+			break;
+		}
+
+		/* OUT */
+		case 3:
+		{
+			unsigned int n = arg2 ? arg2 : 32;
+			v = (n < 32) ? (pio->osr & ((1u << n) - 1)) : pio->osr;
+			pio->osr = (n < 32) ? (pio->osr >> n) : 0;
+			pio->osr_count += n;
+			if (pio->osr_count > 32)
+				pio->osr_count = 32;
+			switch (arg1)
+			{
+				case 0: _pins_write(pio, &pio->pins, pio->out_base, pio->out_count, v); break;
+				case 1: pio->x = v; break;
+				case 2: pio->y = v; break;
+				case 4: _pins_write(pio, &pio->pindirs, pio->out_base, pio->out_count, v); break;
+				case 5: next = v & 0x1F; break;
+				case 6: pio->isr = v; pio->isr_count = n; break;
+				default: break;
+			}
+			break;
+		}
+
+		/* PUSH / PULL */
+		case 4:
+			/* PULL */
+			if (instr & 0x80)
+			{
+				if (pio->tx_n == 0)
+				{
+					/* Blocking pull stalls, non-blocking copies X */
+					if (instr & 0x20)
+					{
+						pio->stalled = 1;
+						return(0);
+					}
+					pio->osr = pio->x;
+				}
+				else
+				{
+					pio->osr  = pio->tx[pio->tx_r];
+					pio->tx_r = (pio->tx_r + 1) % PIO_EMU_FIFO_DEPTH;
+					pio->tx_n--;
+				}
+				pio->osr_count = 0;
+			}
+			/* PUSH */
+			else
+			{
+				if (pio->rx_n == PIO_EMU_FIFO_DEPTH)
+				{
+					if (instr & 0x20)
+					{
+						pio->stalled = 1;
+						return(0);
+					}
+				}
+				else
+				{
+					unsigned int w = (pio->rx_r + pio->rx_n) % PIO_EMU_FIFO_DEPTH;
+					pio->rx[w] = pio->isr;
+					pio->rx_n++;
+				}
+				pio->isr = 0;
+				pio->isr_count = 0;
+			}
+			break;
+
+		/* MOV */
+		case 5:
+		{
+			unsigned int mop = (arg2 >> 3) & 0x03;
+			unsigned int i;
+			uint32_t r;
+
+			v = _source(pio, arg2 & 0x07);
+			if (mop == 1)
+				v = ~v;
+			else if (mop == 2)
+			{
+				for (r = 0, i = 0; i < 32; i++)
+					if (v & (1u << i))
+						r |= (1u << (31 - i));
+				v = r;
+			}
+			switch (arg1)
+			{
+				case 0: _pins_write(pio, &pio->pins, pio->out_base, pio->out_count, v); break;
+				case 1: pio->x = v; break;
+				case 2: pio->y = v; break;
+				case 5: next = v & 0x1F; break;
+				case 6: pio->isr = v; pio->isr_count = 0; break;
+				case 7: pio->osr = v; pio->osr_count = 0; break;
+				default: break;
+			}
+			break;
+		}
+
+		/* IRQ (not used by firmware) */
+		case 6:
+			break;
+
+		/* SET */
+		case 7:
+			switch (arg1)
+			{
+				case 0: _pins_write(pio, &pio->pins,    pio->set_base, pio->set_count, arg2); break;
+				case 1: pio->x = arg2; break;
+				case 2: pio->y = arg2; break;
+				case 4: _pins_write(pio, &pio->pindirs, pio->set_base, pio->set_count, arg2); break;
+				default: break;
+			}
+			break;
+	}
+
+	pio->pc    = next;
+	pio->delay = ds_bits & delay_max;
+	return(1);
+}
+
+/**
+ * @brief Write one word into the TX fifo
+ *
+ * @param pio   Pointer to the state machine structure
+ * @param value Word to insert into fifo
+ * @return integer Zero on success, -1 if the fifo is full
+ */
+int pio_emu_put(pio_emu *pio, uint32_t value)
+{
+	if (pio->tx_n == PIO_EMU_FIFO_DEPTH)
+		return(-1);
+	pio->tx[(pio->tx_r + pio->tx_n) % PIO_EMU_FIFO_DEPTH] = value;
+	pio->tx_n++;
+	return(0);
+}
+
+/**
+ * @brief Read one word from the RX fifo
+ *
+ * @param pio   Pointer to the state machine structure
+ * @param value Pointer to a word where received value is stored
+ * @return integer Zero on success, -1 if the fifo is empty
+ */
+int pio_emu_get(pio_emu *pio, uint32_t *value)
+{
+	if (pio->rx_n == 0)
+		return(-1);
+	*value = pio->rx[pio->rx_r];
+	pio->rx_r = (pio->rx_r + 1) % PIO_EMU_FIFO_DEPTH;
+	pio->rx_n--;
+	return(0);
+}
+
+/**
+ * @brief Update a group of consecutive pins (value or direction)
+ *
+ */
+static void _pins_write(pio_emu *pio, uint32_t *reg, unsigned int base, unsigned int count, uint32_t value)
+{
+	unsigned int i;
+	(void)pio;
+
+	for (i = 0; i < count; i++)
+	{
+		unsigned int pin = (base + i) & 31;
+		if (value & (1u << i))
+			*reg |=  (1u << pin);
+		else
+			*reg &= ~(1u << pin);
+	}
+}
+
+/**
+ * @brief Get the value of a MOV source
+ *
+ */
+static uint32_t _source(pio_emu *pio, unsigned int src)
+{
+	uint32_t v;
+
+	switch (src)
+	{
+		case 0:
+			v = pio->input(pio->ctx);
+			return( (v >> pio->in_base) | (v << ((32 - pio->in_base) & 31)) );
+		case 1: return(pio->x);
+		case 2: return(pio->y);
+		case 5: return(0);
+		case 6: return(pio->isr);
+		case 7: return(pio->osr);
+	}
+	return(0);
+}
+/* EOF */
@@ -0,0 +1,62 @@
+/**
+ * @file  pio_emu.h
+ * @brief Headers and definitions for the RP2040 PIO instruction emulator
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef PIO_EMU_H
+#define PIO_EMU_H
+#include <stdint.h>
+
+#define PIO_EMU_FIFO_DEPTH 4
+
+typedef struct pio_emu_s
+{
+	/* Instruction memory and program counter */
+	uint16_t imem[32];
+	unsigned int pc;
+	unsigned int wrap_target;
+	unsigned int wrap;
+	/* Pin mapping */
+	unsigned int side_bits;   /* Number of side-set bits (with enable) */
+	int          side_opt;
+	unsigned int side_base;
+	unsigned int out_base, out_count;
+	unsigned int set_base, set_count;
+	unsigned int in_base;
+	unsigned int jmp_pin;
+	/* Shift registers (right shift only) */
+	uint32_t x, y;
+	uint32_t osr, isr;
+	unsigned int osr_count, isr_count;
+	/* FIFOs */
+	uint32_t tx[PIO_EMU_FIFO_DEPTH];
+	uint32_t rx[PIO_EMU_FIFO_DEPTH];
+	unsigned int tx_r, tx_n;
+	unsigned int rx_r, rx_n;
+	/* State */
+	unsigned int delay;
+	int stalled;
+	unsigned long cycles;
+	/* Outputs of the state machine and input callback */
+	uint32_t pins;
+	uint32_t pindirs;
+	uint32_t (*input)(void *ctx);
+	void *ctx;
+} pio_emu;
+
+void pio_emu_init(pio_emu *pio, const uint16_t *prog, unsigned int len);
+int  pio_emu_step(pio_emu *pio);
+int  pio_emu_put(pio_emu *pio, uint32_t value);
+int  pio_emu_get(pio_emu *pio, uint32_t *value);
+
+#endif
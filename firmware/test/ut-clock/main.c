@@ -0,0 +1,176 @@
+/**
+ * @file  main.c
+ * @brief Unit-test of the conversion from SWJ clock frequency to settings
+ *
+ * The functions used by the firmware (swj_clock.h) to compute PIO divider
+ * and GPIO delay loops are executed for the full range of frequencies that
+ * a debugger can request (1kHz to 25MHz) and for some system clocks.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include "swj_clock.h"
+
+#define FREQ_MIN     1000
+#define FREQ_MAX 25000000
+
+static int err = 0;
+
+static void check(int cond, const char *msg, u32 sys, u32 freq)
+{
+	if (cond)
+		return;
+	printf("    \x1b[1;91mFailed\x1b[0m %s (sys=%lu freq=%lu)\n",
+	       msg, (unsigned long)sys, (unsigned long)freq);
+	err++;
+}
+
+/**
+ * @brief Check the PIO divider for one system clock
+ *
+ * @param sys Frequency of the system clock (Hz)
+ */
+static void test_pio(u32 sys)
+{
+	u32 freq, prev_freq, prev_act;
+	u32 act, div;
+	double e, emax = 0;
+
+	prev_freq = 0;
+	prev_act  = 0;
+	for (freq = FREQ_MIN; freq <= FREQ_MAX; freq += (freq / 200) + 1)
+	{
+		act = swj_clock_pio(sys, freq, &div);
+
+		check((div >= SWJ_PIO_DIV_MIN) && (div <= SWJ_PIO_DIV_MAX),
+		      "divider out of range", sys, freq);
+		check(act == (u32)(((unsigned long long)sys << 8) / (2ULL * div)),
+		      "reported frequency does not match divider", sys, freq);
+		check(act >= prev_act, "not monotonic", sys, freq);
+
+		/* Request above sys/2, divider saturated */
+		if (div == SWJ_PIO_DIV_MIN)
+			check(act == (sys / 2), "bad maximum speed", sys, freq);
+		/* Request below the slowest PIO clock */
+		else if (div == SWJ_PIO_DIV_MAX)
+			check(act >= freq, "bad minimum speed", sys, freq);
+		else
+		{
+			check(act <= freq, "faster than requested", sys, freq);
+			e = (double)(freq - act) / freq;
+			if (e > emax)
+				emax = e;
+			check(e < 0.005, "error is above 0.5%", sys, freq);
+		}
+		prev_freq = freq;
+		prev_act  = act;
+	}
+	printf("     sys=%3luMHz  up to %lu Hz, max error %.3f%%\n",
+	       (unsigned long)sys / 1000000, (unsigned long)prev_freq, emax * 100);
+
+	/* Null frequency must not crash and gives the slowest clock */
+	act = swj_clock_pio(sys, 0, &div);
+	check(div == SWJ_PIO_DIV_MAX, "bad divider for 0Hz", sys, 0);
+	check(act > 0, "bad frequency for 0Hz", sys, 0);
+	/* Divider pointer is optional */
+	check(swj_clock_pio(sys, 1000000, 0) == 1000000, "1MHz not exact", sys, 1000000);
+}
+
+/**
+ * @brief Check the GPIO delay loops for one system clock
+ *
+ * @param sys  Frequency of the system clock (Hz)
+ * @param loop Cost of one delay loop (8.8 fixed point)
+ */
+static void test_gpio(u32 sys, u32 loop)
+{
+	unsigned long long ovh = (SWJ_GPIO_OVERHEAD << 8);
+	u32 freq, prev_act, gmax;
+	u32 act;
+	int faster;
+	uint delay;
+
+	gmax = (u32)(((unsigned long long)sys << 8) / (2ULL * ovh));
+
+	prev_act  = 0;
+	for (freq = FREQ_MIN; freq <= FREQ_MAX; freq += (freq / 200) + 1)
+	{
+		act = swj_clock_gpio(sys, freq, loop, &delay);
+
+		check(act >= prev_act, "not monotonic", sys, freq);
+		check(act == (u32)(((unsigned long long)sys << 8) /
+		                   (2ULL * (ovh + (unsigned long long)delay * loop))),
+		      "reported frequency does not match delay", sys, freq);
+		if (delay == 0)
+		{
+			/* Request above maximum GPIO speed */
+			check(act == gmax, "bad maximum speed", sys, freq);
+			check(freq + (freq / 100) >= gmax, "delay too small", sys, freq);
+		}
+		else
+		{
+			check(act <= freq, "faster than requested", sys, freq);
+			/* One loop less must be faster than requested */
+			faster = (2ULL * freq * (ovh + (unsigned long long)(delay - 1) * loop))
+			         < ((unsigned long long)sys << 8);
+			check(faster, "delay is not minimal", sys, freq);
+		}
+		prev_act = act;
+	}
+	printf("     sys=%3luMHz loop=%lu.%02lu cycles, max speed %lu Hz\n",
+	       (unsigned long)sys / 1000000, (unsigned long)loop >> 8,
+	       (unsigned long)((loop & 0xFF) * 100) >> 8, (unsigned long)gmax);
+
+	/* Null frequency must not crash and gives the slowest clock */
+	act = swj_clock_gpio(sys, 0, loop, &delay);
+	check(act <= 1, "bad frequency for 0Hz", sys, 0);
+	check(delay > 0, "bad delay for 0Hz", sys, 0);
+}
+
+/**
+ * @brief Entry point of the program
+ *
+ * @return integer Zero if all tests pass
+ */
+int main(void)
+{
+	uint delay;
+
+	printf(" - PIO divider\n");
+	test_pio(125000000);
+	test_pio(133000000);
+	test_pio( 48000000);
+	check(swj_clock_pio(125000000, FREQ_MAX, 0) == FREQ_MAX,
+	      "25MHz not exact", 125000000, FREQ_MAX);
+
+	printf(" - GPIO delay loops\n");
+	test_gpio(125000000, SWJ_GPIO_LOOP);
+	test_gpio(133000000, SWJ_GPIO_LOOP);
+	test_gpio( 48000000, SWJ_GPIO_LOOP);
+	/* Calibrated loop cost with a fractional part */
+	test_gpio(125000000, (3 << 8) | 0x80);
+	test_gpio(125000000, (1 << 8));
+
+	printf(" - Uncalibrated loop\n");
+	check(swj_clock_gpio(125000000, 100000, 0, &delay) ==
+	      swj_clock_gpio(125000000, 100000, SWJ_GPIO_LOOP, 0),
+	      "default loop cost not used", 125000000, 100000);
+
+	printf("\n Test complete ");
+	if (err == 0)
+		printf("\x1b[1;92m0 error\x1b[0m\n");
+	else
+		printf("\x1b[1;91m%d errors\x1b[0m\n", err);
+
+	return(err ? 1 : 0);
+}
+/* EOF */
@@ -0,0 +1,781 @@
+/**
+ * @file  bench.c
+ * @brief Throughput and latency benchmark of the CMSIS-DAP interface
+ *
+ * Packets are sent with asynchronous libusb transfers so that many packets
+ * can be in flight (up to the packet count of the probe), like a debugger
+ * does. The same tests can be run against a simulated probe (test/dap-sim
+ * in server mode) through a local socket, without hardware.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <libusb-1.0/libusb.h>
+#include "bench.h"
+
+#define BENCH_SLOTS  16
+#define BENCH_PKT  1024
+#define EP_OUT     0x07
+#define EP_IN      0x88
+#define TIMEOUT    1000
+
+/* DAP_Transfer requests */
+#define RD_DPIDR   0x02
+#define WR_ABORT   0x00
+#define WR_CTRL    0x04
+#define RD_CTRL    0x06
+#define WR_SELECT  0x08
+#define WR_CSW     0x01
+#define WR_TAR     0x05
+#define RD_DRW     0x0F
+#define WR_DRW     0x0D
+
+typedef struct bench_slot_s
+{
+	struct libusb_transfer *out;
+	struct libusb_transfer *in;
+	int    out_done;
+	int    in_done;
+	int    busy;
+	unsigned char tx[BENCH_PKT];
+	int    tx_len;
+	unsigned char rx[BENCH_PKT];
+	int    rx_len;
+	double t_submit;
+} bench_slot;
+
+typedef struct bench_s
+{
+	cmsis_env *env;
+	int        sock;
+	int        pkt_size;
+	int        pkt_count;
+	unsigned long addr;
+	int        mem_left;
+	bench_slot slot[BENCH_SLOTS];
+	double    *lat;
+} bench;
+
+typedef struct bench_result_s
+{
+	double time;  /* Duration of the test (s) */
+	long   bytes; /* Number of data bytes transfered */
+	long   words; /* Number of words transfered */
+} bench_result;
+
+typedef int  (*bench_fill) (bench *b, bench_slot *s, int n);
+typedef int  (*bench_check)(bench *b, bench_slot *s, int n, bench_result *r);
+
+/**
+ * @brief Get current time (in seconds)
+ *
+ */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + (ts.tv_nsec * 1e-9));
+}
+
+static unsigned long get32(const unsigned char *p)
+{
+	return((unsigned long)p[0]         | ((unsigned long)p[1] << 8) |
+	      ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24));
+}
+
+static unsigned char *put32(unsigned char *p, unsigned long v)
+{
+	*p++ = (v >>  0) & 0xFF;
+	*p++ = (v >>  8) & 0xFF;
+	*p++ = (v >> 16) & 0xFF;
+	*p++ = (v >> 24) & 0xFF;
+	return(p);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                          Transport (link)                            -- */
+/* -------------------------------------------------------------------------- */
+
+static void LIBUSB_CALL usb_done(struct libusb_transfer *xfer)
+{
+	*(int *)xfer->user_data = 1;
+}
+
+/**
+ * @brief Open the link to the probe (USB or socket)
+ *
+ * @param b    Pointer to the benchmark context
+ * @param path Path of the socket of a simulated probe (0 for USB)
+ * @return integer Zero on success, -1 for error
+ */
+static int link_open(bench *b, const char *path)
+{
+	struct sockaddr_un addr;
+	struct timeval tv = { TIMEOUT / 1000, 0 };
+	int i;
+
+	b->sock = -1;
+	if (path == 0)
+	{
+		for (i = 0; i < BENCH_SLOTS; i++)
+		{
+			b->slot[i].out = libusb_alloc_transfer(0);
+			b->slot[i].in  = libusb_alloc_transfer(0);
+			if ((b->slot[i].out == 0) || (b->slot[i].in == 0))
+				return(-1);
+		}
+		return(0);
+	}
+
+	b->sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (b->sock < 0)
+		return(-1);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(b->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		perror("Bench: connect to simulated probe");
+		return(-1);
+	}
+	setsockopt(b->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return(0);
+}
+
+/**
+ * @brief Close the link, pending transfers are cancelled
+ *
+ * @param b Pointer to the benchmark context
+ */
+static void link_close(bench *b)
+{
+	bench_slot *s;
+	int i;
+
+	if (b->sock >= 0)
+	{
+		close(b->sock);
+		b->sock = -1;
+		return;
+	}
+	for (i = 0; i < BENCH_SLOTS; i++)
+	{
+		s = &b->slot[i];
+		if (s->busy)
+		{
+			if ( ! s->out_done) libusb_cancel_transfer(s->out);
+			if ( ! s->in_done)  libusb_cancel_transfer(s->in);
+			while ( ! s->out_done || ! s->in_done)
+				libusb_handle_events_completed(0, s->out_done ? &s->in_done : &s->out_done);
+		}
+		if (s->out) libusb_free_transfer(s->out);
+		if (s->in)  libusb_free_transfer(s->in);
+		s->out = 0;
+		s->in  = 0;
+	}
+}
+
+/**
+ * @brief Send the request of a slot (without waiting the response)
+ *
+ * @param b Pointer to the benchmark context
+ * @param s Pointer to the slot
+ * @return integer Zero on success, -1 for error
+ */
+static int link_submit(bench *b, bench_slot *s)
+{
+	s->t_submit = now();
+	s->busy     = 1;
+
+	if (b->sock >= 0)
+	{
+		if (send(b->sock, s->tx, s->tx_len, 0) != s->tx_len)
+			return(-1);
+		return(0);
+	}
+
+	s->out_done = 0;
+	s->in_done  = 0;
+	libusb_fill_bulk_transfer(s->out, b->env->dev, EP_OUT, s->tx, s->tx_len,
+	                          usb_done, &s->out_done, TIMEOUT);
+	libusb_fill_bulk_transfer(s->in,  b->env->dev, EP_IN,  s->rx, BENCH_PKT,
+	                          usb_done, &s->in_done,  TIMEOUT);
+	if (libusb_submit_transfer(s->out) < 0)
+	{
+		s->out_done = 1;
+		s->in_done  = 1;
+		return(-1);
+	}
+	/* Responses come back in order, IN transfers can be queued now */
+	if (libusb_submit_transfer(s->in) < 0)
+	{
+		s->in_done = 1;
+		return(-1);
+	}
+	return(0);
+}
+
+/**
+ * @brief Wait the response of a slot
+ *
+ * @param b Pointer to the benchmark context
+ * @param s Pointer to the slot
+ * @return integer Zero on success, -1 for error
+ */
+static int link_wait(bench *b, bench_slot *s)
+{
+	int len;
+
+	if (b->sock >= 0)
+	{
+		s->busy = 0;
+		len = recv(b->sock, s->rx, BENCH_PKT, 0);
+		if (len <= 0)
+			return(-1);
+		s->rx_len = len;
+		return(0);
+	}
+
+	while ( ! s->out_done)
+		if (libusb_handle_events_completed(0, &s->out_done) < 0)
+			return(-1);
+	while ( ! s->in_done)
+		if (libusb_handle_events_completed(0, &s->in_done) < 0)
+			return(-1);
+	s->busy = 0;
+	if ((s->out->status != LIBUSB_TRANSFER_COMPLETED) ||
+	    (s->in->status  != LIBUSB_TRANSFER_COMPLETED))
+		return(-1);
+	s->rx_len = s->in->actual_length;
+	return(0);
+}
+
+/**
+ * @brief Receive the next part of a long response
+ *
+ * @param b   Pointer to the benchmark context
+ * @param buf Buffer where received data is stored
+ * @param max Size of the buffer
+ * @return integer Number of bytes received, -1 for error
+ */
+static int link_recv(bench *b, unsigned char *buf, int max)
+{
+	int len;
+
+	if (b->sock >= 0)
+	{
+		len = recv(b->sock, buf, max, 0);
+		return((len > 0) ? len : -1);
+	}
+	if (libusb_bulk_transfer(b->env->dev, EP_IN, buf, max, &len, TIMEOUT) < 0)
+		return(-1);
+	return(len);
+}
+
+/**
+ * @brief Send one request and wait its response (nothing else in flight)
+ *
+ * @param b   Pointer to the benchmark context
+ * @param req Request to send
+ * @param len Length of the request
+ * @return integer Pointer to the slot with response, 0 for error
+ */
+static bench_slot *link_txrx(bench *b, const unsigned char *req, int len)
+{
+	bench_slot *s = &b->slot[0];
+
+	memcpy(s->tx, req, len);
+	s->tx_len = len;
+	if ((link_submit(b, s) < 0) || (link_wait(b, s) < 0) ||
+	    (s->rx_len < 2) || (s->rx[0] != req[0]))
+		return(0);
+	return(s);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                             Test runner                              -- */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * @brief Send packets with a number of them in flight
+ *
+ * @param b        Pointer to the benchmark context
+ * @param count    Number of packets to send
+ * @param inflight Max number of packets in flight
+ * @param fill     Function called to make each request
+ * @param check    Function called to check each response
+ * @param r        Pointer to a structure where results are stored
+ * @return integer Zero on success, -1 for error
+ */
+static int run(bench *b, int count, int inflight, bench_fill fill,
+               bench_check check, bench_result *r)
+{
+	bench_slot *s;
+	int sent = 0, done = 0;
+	double t0;
+
+	memset(r, 0, sizeof(bench_result));
+	b->mem_left = 0;
+	t0 = now();
+	while (done < count)
+	{
+		/* Fill the pipe */
+		while (((sent - done) < inflight) && (sent < count))
+		{
+			s = &b->slot[sent % inflight];
+			fill(b, s, sent);
+			if (link_submit(b, s) < 0)
+				return(-1);
+			sent++;
+		}
+		/* Wait the oldest response */
+		s = &b->slot[done % inflight];
+		if (link_wait(b, s) < 0)
+			return(-1);
+		b->lat[done] = (now() - s->t_submit) * 1e6;
+		if (check(b, s, done, r) < 0)
+			return(-1);
+		done++;
+	}
+	r->time = now() - t0;
+	return(0);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return((x > y) - (x < y));
+}
+
+/**
+ * @brief Display percentiles of the latencies of the last run
+ *
+ */
+static void show_latency(bench *b, int count, bench_result *r)
+{
+	qsort(b->lat, count, sizeof(double), cmp_double);
+	printf("     p50 %7.1f us  p90 %7.1f us  p99 %7.1f us  max %7.1f us"
+	       "  (%.0f packets/s)\n",
+	       b->lat[count / 2], b->lat[(count * 90) / 100],
+	       b->lat[(count * 99) / 100], b->lat[count - 1], count / r->time);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                                Tests                                 -- */
+/* -------------------------------------------------------------------------- */
+
+static int fill_dpidr(bench *b, bench_slot *s, int n)
+{
+	(void)b; (void)n;
+	s->tx[0] = 0x05; /* DAP_Transfer */
+	s->tx[1] = 0x00;
+	s->tx[2] = 1;
+	s->tx[3] = RD_DPIDR;
+	s->tx_len = 4;
+	return(0);
+}
+
+/**
+ * @brief Check a DAP_Transfer response (all transfers done, ACK OK)
+ *
+ */
+static int check_transfer(bench *b, bench_slot *s, int n, bench_result *r)
+{
+	(void)b; (void)n;
+	if ((s->rx_len < 3) || (s->rx[0] != 0x05) ||
+	    (s->rx[1] != s->tx[2]) || (s->rx[2] != 0x01))
+	{
+		color(31); printf("Failed"); color(0);
+		printf(" DAP_Transfer error: %.2X %.2X\n", s->rx[1], s->rx[2]);
+		return(-1);
+	}
+	r->words += s->tx[2];
+	r->bytes += s->tx[2] * 4;
+	return(0);
+}
+
+/* Word read : DAP_Transfer with as many DRW reads as the response allows */
+static int fill_word_read(bench *b, bench_slot *s, int n)
+{
+	int count = (b->pkt_size - 3) / 4;
+
+	(void)n;
+	s->tx[0] = 0x05;
+	s->tx[1] = 0x00;
+	s->tx[2] = count;
+	memset(s->tx + 3, RD_DRW, count);
+	s->tx_len = 3 + count;
+	return(0);
+}
+
+/* Word write : DAP_Transfer with as many DRW writes as the request allows */
+static int fill_word_write(bench *b, bench_slot *s, int n)
+{
+	unsigned char *p = s->tx + 3;
+	int count = (b->pkt_size - 3) / 5;
+	int i;
+
+	s->tx[0] = 0x05;
+	s->tx[1] = 0x00;
+	s->tx[2] = count;
+	for (i = 0; i < count; i++)
+	{
+		*p++ = WR_DRW;
+		p = put32(p, (n << 8) | i);
+	}
+	s->tx_len = (p - s->tx);
+	return(0);
+}
+
+/**
+ * @brief Memory read : TransferBlock on DRW, TAR is written on each 1KB
+ *
+ * Auto-increment of TAR is only guaranteed into a 1KB block, a small
+ * DAP_Transfer is sent to load TAR before the first block of each 1KB.
+ */
+static int fill_mem_read(bench *b, bench_slot *s, int n)
+{
+	int count = (b->pkt_size - 4) / 4;
+
+	(void)n;
+	if (b->mem_left == 0)
+	{
+		s->tx[0] = 0x05;
+		s->tx[1] = 0x00;
+		s->tx[2] = 1;
+		s->tx[3] = WR_TAR;
+		put32(s->tx + 4, b->addr & ~0x3FF);
+		s->tx_len = 8;
+		b->mem_left = 256;
+		return(0);
+	}
+	if (count > b->mem_left)
+		count = b->mem_left;
+	b->mem_left -= count;
+
+	s->tx[0] = 0x06; /* DAP_TransferBlock */
+	s->tx[1] = 0x00;
+	s->tx[2] = (count >> 0) & 0xFF;
+	s->tx[3] = (count >> 8) & 0xFF;
+	s->tx[4] = RD_DRW;
+	s->tx_len = 5;
+	return(0);
+}
+
+static int check_mem_read(bench *b, bench_slot *s, int n, bench_result *r)
+{
+	int count;
+
+	/* TAR update */
+	if (s->tx[0] == 0x05)
+	{
+		if (check_transfer(b, s, n, r) < 0)
+			return(-1);
+		r->words -= 1;
+		r->bytes -= 4;
+		return(0);
+	}
+	count = s->tx[2] | (s->tx[3] << 8);
+	if ((s->rx_len < (4 + (count * 4))) || (s->rx[0] != 0x06) ||
+	    ((s->rx[1] | (s->rx[2] << 8)) != count) || (s->rx[3] != 0x01))
+	{
+		color(31); printf("Failed"); color(0);
+		printf(" DAP_TransferBlock error: count=%d ack=%.2X\n",
+		       s->rx[1] | (s->rx[2] << 8), s->rx[3]);
+		return(-1);
+	}
+	r->words += count;
+	r->bytes += count * 4;
+	return(0);
+}
+
+/**
+ * @brief Memory read with the vendor command (0x82), 1KB per command
+ *
+ * The response of each command is longer than a packet, so it is received
+ * in several parts. Only one command is in flight.
+ *
+ * @param b     Pointer to the benchmark context
+ * @param count Number of commands to send
+ * @param r     Pointer to a structure where results are stored
+ * @return integer Zero on success, 1 if not supported, -1 for error
+ */
+static int mem_vendor(bench *b, int count, bench_result *r)
+{
+	const int len = 1024;
+	unsigned char req[11] = { 0x82, 0x02, 0x00 };
+	bench_slot *s = &b->slot[0];
+	int total, n, i;
+	double t0;
+
+	put32(req + 3, b->addr & ~0x3FF);
+	put32(req + 7, len);
+	memset(r, 0, sizeof(bench_result));
+	t0 = now();
+	for (i = 0; i < count; i++)
+	{
+		memcpy(s->tx, req, sizeof(req));
+		s->tx_len = sizeof(req);
+		if ((link_submit(b, s) < 0) || (link_wait(b, s) < 0))
+			return(-1);
+		/* Command rejected (old firmware) */
+		if ((s->rx_len == 2) && (s->rx[0] == 0x82) && (s->rx[1] == 0xFF))
+			return(1);
+		/* Receive next parts, the last one ends with status and count */
+		for (total = s->rx_len, n = s->rx_len; total < (1 + len + 5); total += n)
+		{
+			n = link_recv(b, s->rx, BENCH_PKT);
+			if (n < 0)
+				return(-1);
+		}
+		if ((n < 5) || (s->rx[n - 5] != 0x01))
+		{
+			color(31); printf("Failed"); color(0);
+			printf(" memory read vendor command\n");
+			return(-1);
+		}
+		r->bytes += len;
+	}
+	r->time = now() - t0;
+	return(0);
+}
+
+/**
+ * @brief Memory CRC32 with the vendor command (0x84), 4KB per command
+ *
+ * @param b     Pointer to the benchmark context
+ * @param count Number of commands to send
+ * @param r     Pointer to a structure where results are stored
+ * @return integer Zero on success, 1 if not supported, -1 for error
+ */
+static int mem_crc(bench *b, int count, bench_result *r)
+{
+	const int len = 4096;
+	unsigned char req[11] = { 0x84, 0x02, 0x00 };
+	bench_slot *s = &b->slot[0];
+	double t0;
+	int i;
+
+	put32(req + 3, b->addr & ~0x3FF);
+	put32(req + 7, len);
+	memset(r, 0, sizeof(bench_result));
+	t0 = now();
+	for (i = 0; i < count; i++)
+	{
+		memcpy(s->tx, req, sizeof(req));
+		s->tx_len = sizeof(req);
+		if ((link_submit(b, s) < 0) || (link_wait(b, s) < 0))
+			return(-1);
+		/* Command unknown or rejected (old firmware) */
+		if ((s->rx[0] != 0x84) || ((s->rx_len == 2) && (s->rx[1] == 0xFF)))
+			return(1);
+		if ((s->rx_len < 10) || (s->rx[1] != 0x01) || (get32(s->rx + 2) != (unsigned long)len))
+		{
+			color(31); printf("Failed"); color(0);
+			printf(" memory CRC32 vendor command\n");
+			return(-1);
+		}
+		r->bytes += len;
+	}
+	r->time = now() - t0;
+	return(0);
+}
+
+/**
+ * @brief Connect to the target and prepare the MEM-AP
+ *
+ * @param b    Pointer to the benchmark context
+ * @param csw  Value of CSW register (size and auto-increment)
+ * @return integer Zero on success, -1 for error
+ */
+static int setup_ap(bench *b, unsigned long csw)
+{
+	unsigned char req[32], *p = req;
+	bench_slot *s;
+
+	*p++ = 0x05; *p++ = 0x00; *p++ = 2;
+	*p++ = WR_CSW; p = put32(p, csw);
+	*p++ = WR_TAR; p = put32(p, b->addr);
+	s = link_txrx(b, req, p - req);
+	if ((s == 0) || (s->rx[1] != 2) || (s->rx[2] != 1))
+		return(-1);
+	return(0);
+}
+
+/**
+ * @brief Get probe parameters, then connect and power-up the target
+ *
+ * @param b   Pointer to the benchmark context
+ * @param cfg Pointer to the benchmark configuration
+ * @return integer Zero on success, -1 for error
+ */
+static int setup(bench *b, bench_cfg *cfg)
+{
+	const unsigned char orun[]       = { 0x80, 0x01, 0x01 };
+	const unsigned char info_count[] = { 0x00, 0xFE };
+	const unsigned char info_size[]  = { 0x00, 0xFF };
+	const unsigned char connect[]    = { 0x02, 0x01 };
+	const unsigned char config[]     = { 0x04, 0x00, 0x40, 0x00, 0x00, 0x00 };
+	const unsigned char j2s[] = { 0x12, 136,
+	                              0xff,0xff,0xff,0xff,0xff,0xff,0xff, 0x9e, 0xe7,
+	                              0xff,0xff,0xff,0xff,0xff,0xff,0xff, 0x00 };
+	unsigned char req[32], *p = req;
+	bench_slot *s;
+
+	s = link_txrx(b, info_count, sizeof(info_count));
+	if ((s == 0) || (s->rx[1] != 1))
+		return(-1);
+	b->pkt_count = s->rx[2];
+	s = link_txrx(b, info_size, sizeof(info_size));
+	if ((s == 0) || (s->rx[1] != 2))
+		return(-1);
+	b->pkt_size = s->rx[2] | (s->rx[3] << 8);
+	if (b->pkt_size > BENCH_PKT)
+		b->pkt_size = BENCH_PKT;
+
+	/* Vendor command : pipelined DAP_Transfer with sticky overrun */
+	if (cfg->orun)
+	{
+		s = link_txrx(b, orun, sizeof(orun));
+		if ((s == 0) || (s->rx[1] != 0))
+			return(-1);
+	}
+	if ( ! link_txrx(b, connect, sizeof(connect)) ||
+	     ! link_txrx(b, config,  sizeof(config))  ||
+	     ! link_txrx(b, j2s,     sizeof(j2s)))
+		return(-1);
+
+	/* Read DPIDR, clear errors, power-up debug, select MEM-AP 0 */
+	*p++ = 0x05; *p++ = 0x00; *p++ = 5;
+	*p++ = RD_DPIDR;
+	*p++ = WR_ABORT;  p = put32(p, 0x1E);
+	*p++ = WR_SELECT; p = put32(p, 0);
+	*p++ = WR_CTRL;   p = put32(p, 0x50000000);
+	*p++ = RD_CTRL;
+	s = link_txrx(b, req, p - req);
+	if ((s == 0) || (s->rx[1] != 5) || (s->rx[2] != 1))
+		return(-1);
+	printf(" - Probe: packet size %d, packet count %d, DPIDR 0x%.2X%.2X%.2X%.2X\n",
+	       b->pkt_size, b->pkt_count, s->rx[6], s->rx[5], s->rx[4], s->rx[3]);
+	return(0);
+}
+
+/**
+ * @brief Run all benchmarks
+ *
+ * @param env Pointer to a structure with probe environment
+ * @param cfg Pointer to the benchmark configuration
+ * @return integer Zero on success, negative value for error
+ */
+int bench_run(cmsis_env *env, bench_cfg *cfg)
+{
+	const unsigned char disconnect[] = { 0x03 };
+	const unsigned char stats[]      = { 0x81, 0x00 };
+	bench_result r;
+	bench_slot *s;
+	bench *b;
+	int inflight;
+	int result = -1;
+
+	b = (bench *)calloc(1, sizeof(bench));
+	if (b == 0)
+		return(-1);
+	b->env  = env;
+	b->addr = cfg->addr;
+	b->lat  = (double *)calloc(cfg->count, sizeof(double));
+	if ((b->lat == 0) || (link_open(b, cfg->socket) < 0) || (setup(b, cfg) < 0))
+	{
+		err_request();
+		goto end;
+	}
+	inflight = cfg->inflight ? cfg->inflight : b->pkt_count;
+	if (inflight > BENCH_SLOTS)
+		inflight = BENCH_SLOTS;
+	if (inflight < 1)
+		inflight = 1;
+
+	printf(" - Round-trip latency, DAP_Transfer (1 read), 1 packet in flight\n");
+	if (run(b, cfg->count, 1, fill_dpidr, check_transfer, &r) < 0)
+		goto err;
+	show_latency(b, cfg->count, &r);
+
+	printf(" - Round-trip latency, DAP_Transfer (1 read), %d packets in flight\n",
+	       inflight);
+	if (run(b, cfg->count, inflight, fill_dpidr, check_transfer, &r) < 0)
+		goto err;
+	show_latency(b, cfg->count, &r);
+
+	/* Word tests use the same address (no auto-increment) */
+	if (setup_ap(b, 0x23000002) < 0)
+		goto err;
+	printf(" - Word read,  DAP_Transfer (%d reads/packet)  ", (b->pkt_size - 3) / 4);
+	if (run(b, cfg->count, inflight, fill_word_read, check_transfer, &r) < 0)
+		goto err;
+	printf(": %9.0f words/s\n", r.words / r.time);
+
+	printf(" - Word write, DAP_Transfer (%d writes/packet) ", (b->pkt_size - 3) / 5);
+	if (run(b, cfg->count, inflight, fill_word_write, check_transfer, &r) < 0)
+		goto err;
+	printf(": %9.0f words/s\n", r.words / r.time);
+
+	if (setup_ap(b, 0x23000012) < 0)
+		goto err;
+	printf(" - Memory read, DAP_TransferBlock (%d words/packet)", (b->pkt_size - 4) / 4);
+	if (run(b, cfg->count, inflight, fill_mem_read, check_mem_read, &r) < 0)
+		goto err;
+	printf(": %7.1f KB/s\n", (r.bytes / 1024.0) / r.time);
+
+	printf(" - Memory read, vendor command (1KB/command)     ");
+	result = mem_vendor(b, (cfg->count / 4) + 1, &r);
+	if (result < 0)
+		goto err;
+	if (result == 0)
+		printf(": %7.1f KB/s\n", (r.bytes / 1024.0) / r.time);
+	else
+		printf(": not supported by probe\n");
+	printf(" - Memory CRC32, vendor command (4KB/command)    ");
+	result = mem_crc(b, (cfg->count / 16) + 1, &r);
+	if (result < 0)
+		goto err;
+	if (result == 0)
+		printf(": %7.1f KB/s\n", (r.bytes / 1024.0) / r.time);
+	else
+		printf(": not supported by probe\n");
+	result = -1;
+
+	/* Vendor command : counters of the register cache (if supported) */
+	s = link_txrx(b, stats, sizeof(stats));
+	if (s && (s->rx_len >= 10) && (s->rx[1] == 0))
+		printf(" - Register cache (SELECT, CSW, TAR) : %lu writes skipped, %lu sent\n",
+		       get32(s->rx + 2), get32(s->rx + 6));
+
+	link_txrx(b, disconnect, sizeof(disconnect));
+	result = 0;
+	goto end;
+err:
+	err_request();
+end:
+	link_close(b);
+	free(b->lat);
+	free(b);
+	return(result);
+}
+/* EOF */
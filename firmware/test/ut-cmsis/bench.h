@@ -0,0 +1,31 @@
+/**
+ * @file  bench.h
+ * @brief Headers and definitions for the CMSIS-DAP benchmark
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+#include "test.h"
+
+typedef struct bench_cfg_s
+{
+	const char   *socket;   /* Path of a simulated probe (0 to use USB) */
+	int           inflight; /* Max packets in flight (0: packet count of probe) */
+	int           count;    /* Number of packets sent by each test */
+	unsigned long addr;     /* Address of target RAM used by memory tests */
+	int           orun;     /* Enable pipelined transfers (sticky overrun) */
+} bench_cfg;
+
+int bench_run(cmsis_env *env, bench_cfg *cfg);
+
+#endif
@@ -0,0 +1,235 @@
+/**
+ * @file  diff.c
+ * @brief Find the flash sectors that differ from an image (differential
+ *        programming)
+ *
+ * The CRC32 of each sector of the image is sent to the probe, that computes
+ * the CRC of the same sectors into target (vendor command 0x85). Only the
+ * sectors reported as different have to be erased and programmed again.
+ * The last sector of the image is padded with 0xFF (erased flash).
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "diff.h"
+
+/* Max number of sectors per command */
+#define DIFF_SECTORS 31
+
+static unsigned long crc32(const unsigned char *data, unsigned long len);
+static unsigned char *put32(unsigned char *p, unsigned long v);
+static int setup(cmsis_env *env);
+
+/**
+ * @brief Compare an image with the content of target
+ *
+ * @param env Pointer to a structure with probe environment
+ * @param cfg Pointer to the configuration (image, address, sector size)
+ * @return integer Zero on success, negative value for error
+ */
+int diff_run(cmsis_env *env, diff_cfg *cfg)
+{
+	struct sockaddr_un sa;
+	struct timespec t0, t1;
+	unsigned char *img = 0;
+	unsigned long len, bitmap, i, n;
+	unsigned char *p;
+	int count, differ, k;
+	int result = -1;
+	FILE *f;
+
+	if ((cfg->sector == 0) || (cfg->sector & 3))
+	{
+		printf("Diff: bad sector size %lu\n", cfg->sector);
+		return(-1);
+	}
+
+	/* Load the image, padded to a whole number of sectors */
+	f = fopen(cfg->file, "rb");
+	if (f == 0)
+	{
+		perror("Diff: open image");
+		return(-1);
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	count = (len + cfg->sector - 1) / cfg->sector;
+	img = (unsigned char *)malloc(count * cfg->sector + 1);
+	if ((img == 0) || (fread(img, 1, len, f) != len))
+	{
+		fclose(f);
+		goto end;
+	}
+	fclose(f);
+	memset(img + len, 0xFF, (count * cfg->sector) - len);
+
+	/* Simulated probe */
+	if (cfg->socket)
+	{
+		env->sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, cfg->socket, sizeof(sa.sun_path) - 1);
+		if ((env->sock < 0) || (connect(env->sock, (struct sockaddr *)&sa, sizeof(sa)) < 0))
+		{
+			perror("Diff: connect to simulated probe");
+			goto end;
+		}
+	}
+	if (setup(env) < 0)
+	{
+		err_request();
+		goto end;
+	}
+
+	printf(" - Image %s : %lu bytes, %d sectors of %lu bytes at 0x%.8lX\n",
+	       cfg->file, len, count, cfg->sector, cfg->addr);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	differ = 0;
+	for (i = 0; i < (unsigned long)count; i += n)
+	{
+		n = count - i;
+		if (n > DIFF_SECTORS)
+			n = DIFF_SECTORS;
+		p = env->tx;
+		*p++ = 0x85;
+		*p++ = 0x02; /* Word accesses */
+		*p++ = 0x00; /* AP 0 */
+		p = put32(p, cfg->sector);
+		*p++ = n;
+		for (k = 0; k < (int)n; k++)
+		{
+			p = put32(p, cfg->addr + (i + k) * cfg->sector);
+			p = put32(p, crc32(img + (i + k) * cfg->sector, cfg->sector));
+		}
+		env->tx_len = p - env->tx;
+		if (cmsis_txrx(env) < 0)
+		{
+			err_request();
+			goto end;
+		}
+		if ((env->rx_len < 7) || (env->rx[0] != 0x85))
+		{
+			err_header(env, 2);
+			goto end;
+		}
+		if ((env->rx[1] != 0x01) || (env->rx[2] != n))
+		{
+			color(31); printf("Failed"); color(0);
+			printf(" at sector %lu (ACK %d)\n", i + env->rx[2], env->rx[1]);
+			goto end;
+		}
+		bitmap = env->rx[3] | (env->rx[4] << 8) | (env->rx[5] << 16) |
+		         ((unsigned long)env->rx[6] << 24);
+		for (k = 0; k < (int)n; k++)
+		{
+			if ( ! (bitmap & (1ul << k)))
+				continue;
+			printf("   0x%.8lX differs\n", cfg->addr + (i + k) * cfg->sector);
+			differ++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf(" - %d/%d sectors differ : %lu KB to program, %lu KB skipped (%.1f ms)\n",
+	       differ, count, (differ * cfg->sector) / 1024,
+	       ((count - differ) * cfg->sector) / 1024,
+	       ((t1.tv_sec - t0.tv_sec) * 1e3) + ((t1.tv_nsec - t0.tv_nsec) / 1e6));
+	result = 0;
+end:
+	if (env->sock >= 0)
+	{
+		close(env->sock);
+		env->sock = -1;
+	}
+	free(img);
+	return(result);
+}
+
+/**
+ * @brief Compute the CRC32 of a buffer (IEEE 802.3, like the probe)
+ *
+ * @param data Pointer to the data
+ * @param len  Number of bytes
+ * @return integer Value of the CRC
+ */
+static unsigned long crc32(const unsigned char *data, unsigned long len)
+{
+	unsigned long crc = 0xFFFFFFFF;
+	int i;
+
+	while (len--)
+	{
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+	}
+	return(~crc & 0xFFFFFFFF);
+}
+
+/**
+ * @brief Store a 32 bits value (little endian)
+ *
+ * @param p Pointer where value is stored
+ * @param v Value to store
+ * @return integer Pointer to the next byte
+ */
+static unsigned char *put32(unsigned char *p, unsigned long v)
+{
+	*p++ = (v >>  0) & 0xFF;
+	*p++ = (v >>  8) & 0xFF;
+	*p++ = (v >> 16) & 0xFF;
+	*p++ = (v >> 24) & 0xFF;
+	return(p);
+}
+
+/**
+ * @brief Connect to the target and power-up the debug port
+ *
+ * @param env Pointer to a structure with probe environment
+ * @return integer Zero on success, -1 for error
+ */
+static int setup(cmsis_env *env)
+{
+	const unsigned char connect[] = { 0x02, 0x01 };
+	const unsigned char j2s[] = { 0x12, 136,
+	                              0xff,0xff,0xff,0xff,0xff,0xff,0xff, 0x9e, 0xe7,
+	                              0xff,0xff,0xff,0xff,0xff,0xff,0xff, 0x00 };
+	/* Read DPIDR, clear errors, select AP 0 and power-up debug */
+	const unsigned char init[] = { 0x05, 0x00, 4,
+	                               0x02,
+	                               0x00, 0x1E, 0x00, 0x00, 0x00,
+	                               0x08, 0x00, 0x00, 0x00, 0x00,
+	                               0x04, 0x00, 0x00, 0x00, 0x50 };
+
+	memcpy(env->tx, connect, sizeof(connect));
+	env->tx_len = sizeof(connect);
+	if ((cmsis_txrx(env) < 0) || (env->rx[1] != 0x01))
+		return(-1);
+	memcpy(env->tx, j2s, sizeof(j2s));
+	env->tx_len = sizeof(j2s);
+	if (cmsis_txrx(env) < 0)
+		return(-1);
+	memcpy(env->tx, init, sizeof(init));
+	env->tx_len = sizeof(init);
+	if ((cmsis_txrx(env) < 0) || (env->rx[1] != 4) || (env->rx[2] != 1))
+		return(-1);
+	return(0);
+}
+/* EOF */
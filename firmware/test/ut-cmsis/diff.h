@@ -0,0 +1,30 @@
+/**
+ * @file  diff.h
+ * @brief Headers and definitions for the differential programming helper
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This firmware is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef DIFF_H
+#define DIFF_H
+#include "test.h"
+
+typedef struct diff_cfg_s
+{
+	const char   *socket; /* Path of a simulated probe (0 to use USB) */
+	const char   *file;   /* Image to compare with target */
+	unsigned long addr;   /* Address of the image into target */
+	unsigned long sector; /* Size of a flash sector */
+} diff_cfg;
+
+int diff_run(cmsis_env *env, diff_cfg *cfg);
+
+#endif
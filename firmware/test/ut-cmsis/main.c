@@ -14,10 +14,14 @@
  * This program is distributed WITHOUT ANY WARRANTY.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <libusb-1.0/libusb.h>
+#include "bench.h"
 #include "dap_general.h"
 #include "dap_info.h"
+#include "diff.h"
 #include "swd.h"
 #include "test.h"
 
@@ -33,12 +37,19 @@ int find_probe(libusb_device_handle **probe);
 int main(int argc, char **argv)
 {
 	cmsis_env env;
+	bench_cfg bench;
+	diff_cfg  diff;
 	int test = 0;
 	int ret = 0;
 	int err = 0;
+	int i;
+
+	memset((void *)&bench, 0, sizeof(bench_cfg));
+	bench.count = 1000;
+	bench.addr  = 0x20000000;
+	memset((void *)&diff, 0, sizeof(diff_cfg));
+	diff.sector = 4096;
 
-	(void)argc;
-	(void)argv;
 	if (argc > 1)
 	{
 		/* Execute all tests (default) */
@@ -50,14 +61,57 @@ int main(int argc, char **argv)
 		/* Execute only SWD tests */
 		else if (strcmp(argv[1], "swd") == 0)
 			test = 2;
+		/* Measure throughput and latency */
+		else if (strcmp(argv[1], "bench") == 0)
+			test = 3;
+		/* Find the flash sectors that differ from an image */
+		else if (strcmp(argv[1], "diff") == 0)
+			test = 4;
 		else
 		{
 			printf("Unknown argument %s\n\n", argv[1]);
-			printf("Usage: %s [all|dap|swd]\n", argv[0]);
-			return(0);
+			goto usage;
+		}
+	}
+	for (i = 2; (test == 3) && (i < argc); i++)
+	{
+		if (strcmp(argv[i], "-o") == 0)
+		{
+			bench.orun = 1;
+			continue;
+		}
+		if ((argv[i][0] != '-') || (strlen(argv[i]) != 2) || ((i + 1) == argc))
+			goto usage;
+		switch (argv[i][1])
+		{
+			case 's': bench.socket   = argv[++i]; break;
+			case 'n': bench.inflight = atoi(argv[++i]); break;
+			case 'c': bench.count    = atoi(argv[++i]); break;
+			case 'a': bench.addr     = strtoul(argv[++i], 0, 0); break;
+			default:  goto usage;
+		}
+	}
+	for (i = 2; (test == 4) && (i < argc); i++)
+	{
+		if ((argv[i][0] != '-') && (diff.file == 0))
+		{
+			diff.file = argv[i];
+			continue;
+		}
+		if ((argv[i][0] != '-') || (strlen(argv[i]) != 2) || ((i + 1) == argc))
+			goto usage;
+		switch (argv[i][1])
+		{
+			case 's': diff.socket = argv[++i]; break;
+			case 'a': diff.addr   = strtoul(argv[++i], 0, 0); break;
+			case 'z': diff.sector = strtoul(argv[++i], 0, 0); break;
+			default:  goto usage;
 		}
 	}
+	if ((bench.count < 1) || ((test == 4) && (diff.file == 0)))
+		goto usage;
 	memset((void *)&env, 0, sizeof(cmsis_env));
+	env.sock = -1;
 
 	if (libusb_init(0) < 0)
 	{
@@ -65,8 +119,8 @@ int main(int argc, char **argv)
 		return(-1);
 	}
 
-	/* Search cowprobe USB device */
-	if (find_probe(&env.dev) < 0)
+	/* Search cowprobe USB device (not needed for a simulated probe) */
+	if ((bench.socket == 0) && (diff.socket == 0) && (find_probe(&env.dev) < 0))
 	{
 		fprintf(stderr, "Cowprobe: USB device not found\n");
 		ret = -1;
@@ -103,7 +157,16 @@ int main(int argc, char **argv)
 		//err += swd_reset(&env) ? 1 : 0;
 		err += swd_j2s(&env)   ? 1 : 0;
 		err += swd_dpidr(&env) ? 1 : 0;
+		err += swd_block(&env) ? 1 : 0;
+		err += swd_queue(&env) ? 1 : 0;
+		err += swd_execute(&env) ? 1 : 0;
 	}
+	/* Benchmark */
+	if (test == 3)
+		err += bench_run(&env, &bench) ? 1 : 0;
+	/* Differential programming */
+	if (test == 4)
+		err += diff_run(&env, &diff) ? 1 : 0;
 
 	printf("\n Test complete ");
 	if (err == 0)
@@ -129,6 +192,12 @@ finish:
 	libusb_exit(0);
 
 	return(ret);
+
+usage:
+	printf("Usage: %s [all|dap|swd]\n", argv[0]);
+	printf("       %s bench [-s socket] [-n inflight] [-c count] [-a addr] [-o]\n", argv[0]);
+	printf("       %s diff  [-s socket] [-a addr] [-z sector] image.bin\n", argv[0]);
+	return(0);
 }
 
 void color(int x)
@@ -180,6 +249,16 @@ int cmsis_txrx(cmsis_env *env)
 {
 	int r, tr;
 
+	/* Simulated probe : one message per packet */
+	if (env->sock >= 0)
+	{
+		if (send(env->sock, env->tx, env->tx_len, 0) != env->tx_len)
+			return(-1);
+		r = recv(env->sock, env->rx, sizeof(env->rx), 0);
+		env->rx_len = (r > 0) ? r : 0;
+		return((r > 0) ? 0 : -1);
+	}
+
 	r = libusb_bulk_transfer(env->dev, 0x07, env->tx, env->tx_len, &tr, 5000);
 
 	if ((r != 0) || (tr != env->tx_len))
@@ -98,6 +98,173 @@ int swd_dpidr(cmsis_env *env)
 	return(result);
 }
 
+/**
+ * @brief Use DAP_TransferBlock to read IDCODE many times
+ *
+ * The response of this test is larger than one USB packet (64 bytes).
+ *
+ * @param env Pointer to a structure with probe environment
+ * @return integer On success 0 is returned, negative value for error
+ */
+int swd_block(cmsis_env *env)
+{
+	unsigned long data, first;
+	int count = 20;
+	int result = 0;
+	int i;
+
+	printf(" - SWD TransferBlock DPIDR x%d ... ", count);
+
+	env->tx[0] = 0x06;  /* DAP_TransferBlock */
+	env->tx[1] = 0x00;  /* Index of the DAP */
+	env->tx[2] = count; /* Transfer count (LSB) */
+	env->tx[3] = 0x00;  /* Transfer count (MSB) */
+	env->tx[4] = 0x02;  /* SWD request value */
+	env->tx_len = 5;
+
+	if (cmsis_txrx(env) < 0)
+		return( err_request() );
+
+	/* Check header of received response */
+	if ((env->rx_len < (4 + (4 * count))) || (env->rx[0] != 0x06))
+		return( err_header(env, 4) );
+
+	if ((env->rx[1] != count) || (env->rx[2] != 0) || (env->rx[3] != 0x01))
+	{
+		color(31); printf("Failed"); color(0);
+		printf(" error reported: %.2X%.2X %.2X\n",
+		       env->rx[2], env->rx[1], env->rx[3]);
+		return(-3);
+	}
+
+	first = 0;
+	for (i = 0; i < count; i++)
+	{
+		data  = (env->rx[4 + (i * 4) + 3] << 24);
+		data |= (env->rx[4 + (i * 4) + 2] << 16);
+		data |= (env->rx[4 + (i * 4) + 1] <<  8);
+		data |= (env->rx[4 + (i * 4) + 0] <<  0);
+		if (i == 0)
+			first = data;
+		else if (data != first)
+			result = -3;
+	}
+	if (result == 0)
+	{
+		color(32); printf("Success"); color(0);
+		printf(" 0x%.8X\n", (unsigned int)first);
+	}
+	else
+	{
+		color(31); printf("Failed"); color(0);
+		printf(" values differ\n");
+	}
+	return(result);
+}
+
+/**
+ * @brief Send many DAP_Transfer packets before reading responses
+ *
+ * The number of packets sent is the Packet Count reported by DAP_Info, the
+ * probe must queue all of them.
+ *
+ * @param env Pointer to a structure with probe environment
+ * @return integer On success 0 is returned, negative value for error
+ */
+int swd_queue(cmsis_env *env)
+{
+	unsigned char req[4] = { 0x05, 0x00, 0x01, 0x02 };
+	int count, tr, r;
+	int i;
+
+	printf(" - SWD queued packets ... ");
+
+	/* Get Packet Count */
+	env->tx[0]  = 0x00;
+	env->tx[1]  = 0xFE;
+	env->tx_len = 2;
+	if (cmsis_txrx(env) < 0)
+		return( err_request() );
+	if ((env->rx_len != 3) || (env->rx[0] != 0x00))
+		return( err_header(env, 2) );
+	count = env->rx[2];
+
+	/* Send all packets (DAP_Transfer, read DPIDR) */
+	for (i = 0; i < count; i++)
+	{
+		r = libusb_bulk_transfer(env->dev, 0x07, req, 4, &tr, 5000);
+		if ((r != 0) || (tr != 4))
+			return( err_request() );
+	}
+	/* Then get all responses */
+	for (i = 0; i < count; i++)
+	{
+		r = libusb_bulk_transfer(env->dev, 0x88, env->rx, 1024, &tr, 200);
+		if (r != 0)
+			return( err_request() );
+		env->rx_len = tr;
+		if ((env->rx_len != 7) || (env->rx[0] != 0x05) || (env->rx[1] != 1))
+			return( err_header(env, 3) );
+	}
+	color(32); printf("Success"); color(0);
+	printf(" (%d packets)\n", count);
+	return(0);
+}
+
+/**
+ * @brief Use DAP_QueueCommands and DAP_ExecuteCommands
+ *
+ * A first packet (queued) holds DAP_Transfer to read DPIDR and DAP_Info, the
+ * second one (executed) holds the same commands. Both responses must hold the
+ * concatenated responses of the commands.
+ *
+ * @param env Pointer to a structure with probe environment
+ * @return integer On success 0 is returned, negative value for error
+ */
+int swd_execute(cmsis_env *env)
+{
+	unsigned char cmds[] = { 0x02,
+	                         0x05, 0x00, 0x01, 0x02, /* DAP_Transfer(DPIDR) */
+	                         0x00, 0xFE };           /* DAP_Info(PacketCount) */
+	int tr, r;
+	int i;
+
+	printf(" - SWD Queue/Execute commands ... ");
+
+	/* Send a queued packet, then an executed one */
+	for (i = 0; i < 2; i++)
+	{
+		env->tx[0] = (i == 0) ? 0x7E : 0x7F;
+		memcpy(env->tx + 1, cmds, sizeof(cmds));
+		env->tx_len = 1 + sizeof(cmds);
+		r = libusb_bulk_transfer(env->dev, 0x07, env->tx, env->tx_len, &tr, 5000);
+		if ((r != 0) || (tr != env->tx_len))
+			return( err_request() );
+	}
+	/* Then get both responses */
+	for (i = 0; i < 2; i++)
+	{
+		r = libusb_bulk_transfer(env->dev, 0x88, env->rx, 1024, &tr, 200);
+		if (r != 0)
+			return( err_request() );
+		env->rx_len = tr;
+		/* Header, then DAP_Transfer (7 bytes) and DAP_Info (3 bytes) */
+		if ((env->rx_len != 12) || (env->rx[0] != ((i == 0) ? 0x7E : 0x7F)))
+			return( err_header(env, 2) );
+		if ((env->rx[1] != 2) ||
+		    (env->rx[2] != 0x05) || (env->rx[3] != 1) || (env->rx[4] != 1) ||
+		    (env->rx[9] != 0x00) || (env->rx[10] != 1))
+		{
+			color(31); printf("Failed"); color(0);
+			printf(" bad response\n");
+			return(-3);
+		}
+	}
+	color(32); printf("Success"); color(0);
+	printf("\n");
+	return(0);
+}
+
 /**
  * @brief Test the SWD line reset cycle (50 cycles)
  *
@@ -16,9 +16,12 @@
 #ifndef SWD_H
 #define SWD_H
 
+int swd_block(cmsis_env *env);
 int swd_connect(cmsis_env *env);
 int swd_dpidr(cmsis_env *env);
+int swd_execute(cmsis_env *env);
 int swd_j2s(cmsis_env *env);
+int swd_queue(cmsis_env *env);
 int swd_reset(cmsis_env *env);
 
 #endif
@@ -20,6 +20,7 @@
 typedef struct cmsis_env_s
 {
 	libusb_device_handle *dev;
+	int sock;                /* Socket of a simulated probe (-1 for USB) */
 	unsigned char tx[1024];
 	int tx_len;
 	unsigned char rx[1024];
@@ -0,0 +1,30 @@
+/**
+ * @file  irq.h
+ * @brief Host replacement of the pico-sdk "hardware/irq.h" header
+ *
+ * The handler of the UART interrupt is kept by the unit-test, which calls
+ * it when the TX interrupt is enabled and the UART FIFO has space.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef HARDWARE_IRQ_H
+#define HARDWARE_IRQ_H
+#include "pico/stdlib.h"
+
+#define UART0_IRQ 20
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+
+#endif
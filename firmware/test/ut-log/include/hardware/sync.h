@@ -0,0 +1,30 @@
+/**
+ * @file  sync.h
+ * @brief Host replacement of the pico-sdk "hardware/sync.h" header
+ *
+ * The unit-test has one thread : spin locks only count the calls, to check
+ * that each lock is released.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef HARDWARE_SYNC_H
+#define HARDWARE_SYNC_H
+#include "pico/stdlib.h"
+
+typedef volatile uint32_t spin_lock_t;
+
+int          spin_lock_claim_unused(bool required);
+spin_lock_t *spin_lock_init(uint lock_num);
+uint32_t     spin_lock_blocking(spin_lock_t *lock);
+void         spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file  uart.h
+ * @brief Host replacement of the pico-sdk "hardware/uart.h" header
+ *
+ * The UART is a TX FIFO of UART_FIFO_SIZE bytes, emptied by the unit-test.
+ * A write of the data register is taken by the next test of the FIFO
+ * level (see main.c).
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#ifndef HARDWARE_UART_H
+#define HARDWARE_UART_H
+#include "pico/stdlib.h"
+
+#define UART_FIFO_SIZE 32
+
+typedef enum
+{
+	UART_PARITY_NONE,
+	UART_PARITY_EVEN,
+	UART_PARITY_ODD
+} uart_parity_t;
+
+typedef struct uart_hw_s
+{
+	uint32_t dr;
+} uart_hw_t;
+
+typedef struct uart_inst_s uart_inst_t;
+extern uart_inst_t *uart0;
+
+uint       uart_init(uart_inst_t *uart, uint baudrate);
+void       uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+void       uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits,
+                           uart_parity_t parity);
+void       uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+void       uart_set_irq_enables(uart_inst_t *uart, bool rx, bool tx);
+bool       uart_is_writable(uart_inst_t *uart);
+uart_hw_t *uart_get_hw(uart_inst_t *uart);
+
+#endif
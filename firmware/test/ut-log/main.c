@@ -0,0 +1,399 @@
+/**
+ * @file  main.c
+ * @brief Unit-test of the ring buffer of log messages
+ *
+ * The ring used by the firmware (log_ring.h) is filled and drained like the
+ * UART interrupt does : messages are never cut, they are dropped and counted
+ * when the ring is full. The compile-time filter of log.h is also checked.
+ *
+ * Then log.c itself is compiled with a simulated UART (see include/) : the
+ * line about lost messages and the formatting of numbers are checked on
+ * the bytes sent by the UART.
+ *
+ * @author Saint-Genest Gwenael <gwen@cowlab.fr>
+ * @copyright Cowlab (c) 2022
+ *
+ * @page License
+ * This software is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation. You should have received a copy of the
+ * GNU General Public License along with this program, see LICENSE.md file
+ * for more details.
+ * This program is distributed WITHOUT ANY WARRANTY.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "log_ring.h"
+
+/* This module only compiles warnings and errors */
+#define LOG_LEVEL LOG_WARN
+#include "log.h"
+
+/* Data register of the UART, after the FIFO has taken the byte */
+#define UART_DR_EMPTY 0xFFFFFFFF
+
+uart_inst_t *uart0;
+
+static log_ring ring;
+static int err = 0;
+
+static uart_hw_t     uart_reg = { UART_DR_EMPTY };
+static irq_handler_t uart_irq;
+static uint uart_fifo;       /* Bytes into the TX FIFO */
+static uint uart_txie;       /* TX interrupt enabled */
+static char uart_out[8192];  /* Bytes written to the FIFO */
+static uint uart_len;
+static int  locks;           /* Spin locks taken and not released */
+
+static void check(int cond, const char *msg)
+{
+	if (cond)
+		return;
+	printf("    \x1b[1;91mFailed\x1b[0m %s\n", msg);
+	err++;
+}
+
+/**
+ * @brief Read bytes from the ring, like the UART interrupt
+ *
+ * @param dst Buffer where bytes are stored
+ * @param max Max number of bytes to read
+ * @return integer Number of bytes read
+ */
+static uint drain(char *dst, uint max)
+{
+	uint n;
+	int  c;
+
+	for (n = 0; n < max; n++)
+	{
+		c = log_ring_get(&ring);
+		if (c < 0)
+			break;
+		dst[n] = c;
+	}
+	return(n);
+}
+
+static void test_order(void)
+{
+	const char *msg = "SWD: Parity error\r\n";
+	char buf[LOG_RING_SIZE];
+	uint i, k, n, pos;
+	int  ok;
+
+	printf(" - Messages in order, across the end of the ring\n");
+	log_ring_init(&ring);
+	check((log_ring_get(&ring) < 0) && (log_ring_count(&ring) == 0), "empty ring");
+	/* The ring is drained slower than it is filled, then emptied */
+	for (i = 0, pos = 0, ok = 1; i < 1000; i++)
+	{
+		if (log_ring_put(&ring, msg, 19) != 0)
+			ok = 0;
+		n = drain(buf, ((i % 200) < 150) ? 12 : LOG_RING_SIZE);
+		for (k = 0; k < n; k++, pos++)
+			if (buf[k] != msg[pos % 19])
+				ok = 0;
+	}
+	n = drain(buf, sizeof(buf));
+	for (k = 0; k < n; k++, pos++)
+		if (buf[k] != msg[pos % 19])
+			ok = 0;
+	n = drain(buf, sizeof(buf));
+	check(ok && (ring.lost == 0), "messages dropped");
+	check(ring.tail == ring.head, "ring not empty");
+	check(ring.head == 1000 * 19, "bad count of bytes");
+
+	/* Content, with counters around the wrap of the integer */
+	ring.head = ring.tail = 0u - 10;
+	check(log_ring_put(&ring, "0123456789ABCDEF", 16) == 0, "put across the wrap");
+	check(log_ring_count(&ring) == 16, "count across the wrap");
+	n = drain(buf, sizeof(buf));
+	check((n == 16) && (memcmp(buf, "0123456789ABCDEF", 16) == 0), "content across the wrap");
+}
+
+static void test_full(void)
+{
+	char buf[LOG_RING_SIZE];
+	uint i, n;
+
+	printf(" - Full ring : messages dropped and counted\n");
+	log_ring_init(&ring);
+	memset(buf, 'x', sizeof(buf));
+	/* Error storm, nothing sent */
+	for (i = 0; i < 200; i++)
+		log_ring_put(&ring, "SWD: Transfer failed ! ACK=04\r\n", 31);
+	check(log_ring_count(&ring) == (LOG_RING_SIZE / 31) * 31, "ring not filled");
+	check(ring.lost == 200 - (LOG_RING_SIZE / 31), "lost messages not counted");
+
+	/* A message is never cut */
+	n = LOG_RING_SIZE - log_ring_count(&ring);
+	check(log_ring_put(&ring, buf, n + 1) < 0, "message longer than free space");
+	check(log_ring_put(&ring, buf, n) == 0, "message that fits");
+	check(log_ring_count(&ring) == LOG_RING_SIZE, "ring not full");
+	check(log_ring_put(&ring, "", 0) == 0, "empty message");
+
+	/* Space again after the drain */
+	drain(buf, 100);
+	check(log_ring_put(&ring, "ok\r\n", 4) == 0, "put after drain");
+	n = drain(buf, sizeof(buf));
+	check((n == LOG_RING_SIZE - 100 + 4) && (memcmp(buf + n - 4, "ok\r\n", 4) == 0),
+	      "content after drain");
+}
+
+static void test_level(void)
+{
+	int level = 0;
+
+	printf(" - Compile-time level of messages\n");
+#if LOG_ON(LOG_ERROR)
+	level |= 1;
+#endif
+#if LOG_ON(LOG_WARN)
+	level |= 2;
+#endif
+#if LOG_ON(LOG_INFO)
+	level |= 4;
+#endif
+#if LOG_ON(LOG_DEBUG)
+	level |= 8;
+#endif
+	check(level == 3, "messages above LOG_WARN compiled");
+}
+
+/**
+ * @brief Send bytes of the FIFO on the line, then run the interrupt
+ *
+ * @param n Max number of bytes to send
+ */
+static void uart_tx(uint n)
+{
+	uart_fifo -= (n < uart_fifo) ? n : uart_fifo;
+	if (uart_txie && uart_irq)
+		uart_irq();
+}
+
+/**
+ * @brief Send everything (FIFO and ring), and check the bytes sent
+ *
+ * @param text Expected bytes since the last call
+ * @return integer True if the bytes match
+ */
+static int uart_sent(const char *text)
+{
+	uint i, len;
+	int  ok;
+
+	for (i = 0; (i < 1000) && (uart_fifo || uart_txie); i++)
+		uart_tx(UART_FIFO_SIZE);
+	len = strlen(text);
+	ok  = (uart_len == len) && (memcmp(uart_out, text, len) == 0) &&
+	      (uart_txie == 0) && (locks == 0);
+	uart_len = 0;
+	return(ok);
+}
+
+static void test_lost(void)
+{
+	const char *msg = "SWD: Transfer failed ! ACK=04\r\n";
+	char expect[LOG_RING_SIZE + 64];
+	uint i, n;
+
+	printf(" - Line of lost messages, queued by the UART interrupt\n");
+	log_init();
+	uart_len = 0;
+	/* The line is busy : the FIFO is full, then the ring */
+	uart_fifo = UART_FIFO_SIZE;
+	for (i = 0; i < 200; i++)
+		log_puts((char *)msg);
+	n = LOG_RING_SIZE / 31;
+	check((uart_len == 0) && uart_txie, "ring not waiting for the UART");
+	/* No more message : the line is queued by the interrupt */
+	for (i = 0, expect[0] = 0; i < n; i++)
+		strcat(expect, msg);
+	sprintf(expect + strlen(expect), "\r\nLOG: %u messages lost\r\n", 200 - n);
+	check(uart_sent(expect), "lost messages not reported by the interrupt");
+
+	/* Only the messages lost since the last line are counted */
+	uart_fifo = UART_FIFO_SIZE;
+	for (i = 0; i < n + 7; i++)
+		log_puts((char *)msg);
+	for (i = 0, expect[0] = 0; i < n; i++)
+		strcat(expect, msg);
+	strcat(expect, "\r\nLOG: 7 messages lost\r\n");
+	check(uart_sent(expect), "count of lost messages");
+
+	/* Nothing lost : no line */
+	log_puts("ok\r\n");
+	check(uart_sent("ok\r\n"), "line without lost messages");
+}
+
+static void test_format(void)
+{
+	printf(" - Format of numbers and filter of log.h\n");
+	log_puthex(0x0000F000, 16);
+	check(uart_sent("F000"), "hex bits 12-15");
+	log_puthex(0x12345678, 32);
+	check(uart_sent("12345678"), "hex 32 bits");
+	log_puthex(0xFABCDE, 20);
+	check(uart_sent("ABCDE"), "hex 20 bits");
+	log_puthex(0xA5, 8);
+	log_puthex(0x7, 4);
+	log_puthex(0x7, 0);
+	check(uart_sent("A57"), "hex 8, 4 and 0 bits");
+
+	log_putdec(0);
+	check(uart_sent("0"), "decimal zero");
+	log_putdec(10);
+	check(uart_sent("10"), "decimal 10");
+	log_putdec(1000000000);
+	check(uart_sent("1000000000"), "decimal 10 digits");
+	log_putdec(4294967295u);
+	check(uart_sent("4294967295"), "decimal max");
+
+	/* Only warnings and errors are compiled into this module */
+	LOG_ERROR_PUTS("E");
+	LOG_WARN_PUTS("W");
+	LOG_INFO_PUTS("I");
+	LOG_DEBUG_PUTS("D");
+	LOG_WARN_PUTHEX(0xC, 4);
+	LOG_INFO_PUTHEX(0xD, 4);
+	check(uart_sent("EWC"), "messages filtered by level");
+}
+
+/**
+ * @brief Entry point of the program
+ *
+ * @return integer Zero if all tests pass
+ */
+int main(void)
+{
+	test_order();
+	test_full();
+	test_level();
+	test_lost();
+	test_format();
+
+	printf("\n Test complete ");
+	if (err == 0)
+		printf("\x1b[1;92m0 error\x1b[0m\n");
+	else
+		printf("\x1b[1;91m%d errors\x1b[0m\n", err);
+
+	return(err ? 1 : 0);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --                  Simulated SDK functions (UART)                      -- */
+/* -------------------------------------------------------------------------- */
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+	(void)gpio;
+	(void)fn;
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+	if (num == UART0_IRQ)
+		uart_irq = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+	(void)num;
+	(void)enabled;
+}
+
+int spin_lock_claim_unused(bool required)
+{
+	(void)required;
+	return(0);
+}
+
+spin_lock_t *spin_lock_init(uint lock_num)
+{
+	static spin_lock_t lock;
+
+	(void)lock_num;
+	return(&lock);
+}
+
+uint32_t spin_lock_blocking(spin_lock_t *lock)
+{
+	(void)lock;
+	locks++;
+	return(0);
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq)
+{
+	(void)lock;
+	(void)saved_irq;
+	locks--;
+}
+
+uint uart_init(uart_inst_t *uart, uint baudrate)
+{
+	(void)uart;
+	uart_fifo = 0;
+	uart_txie = 0;
+	uart_reg.dr = UART_DR_EMPTY;
+	return(baudrate);
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts)
+{
+	(void)uart;
+	(void)cts;
+	(void)rts;
+}
+
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits,
+                     uart_parity_t parity)
+{
+	(void)uart;
+	(void)data_bits;
+	(void)stop_bits;
+	(void)parity;
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled)
+{
+	(void)uart;
+	(void)enabled;
+}
+
+void uart_set_irq_enables(uart_inst_t *uart, bool rx, bool tx)
+{
+	(void)uart;
+	(void)rx;
+	uart_txie = tx;
+}
+
+/**
+ * @brief Level of the TX FIFO (takes the byte written into DR first)
+ *
+ */
+bool uart_is_writable(uart_inst_t *uart)
+{
+	(void)uart;
+	if (uart_reg.dr != UART_DR_EMPTY)
+	{
+		if (uart_len < sizeof(uart_out))
+			uart_out[uart_len++] = (char)uart_reg.dr;
+		uart_fifo++;
+		uart_reg.dr = UART_DR_EMPTY;
+	}
+	return(uart_fifo < UART_FIFO_SIZE);
+}
+
+uart_hw_t *uart_get_hw(uart_inst_t *uart)
+{
+	(void)uart;
+	return(&uart_reg);
+}
+/* EOF */